@@ -0,0 +1,447 @@
+#include <stdio.h> // for printf().
+#include <stdlib.h> // for qsort().
+#include <string.h> // for strcmp() and strstr().
+#include <math.h> // for sqrt() and lgamma().
+#include <unistd.h> // for usleep().
+#include <pthread.h> // for pthread_create().
+#include <sys/stat.h> // for mkdir().
+#include <sys/socket.h> // for socket().
+#include <arpa/inet.h> // for htons().
+#include "timing.h"
+#include "bench.h"
+
+typedef struct benchStage {
+	int stage;
+	unsigned short metricsPort;
+	int sent; // Senders are measured by the Bytes they send, everybody else by the Bytes received.
+	int sampleAmount;
+	unsigned long long int ns[BENCHMAXSAMPLES];
+	double bytes[BENCHMAXSAMPLES];
+	double cpu[BENCHMAXSAMPLES];
+	double throughput[BENCHMAXREPEATS]; // Mb/s of every measured run.
+	double cpuPerGb[BENCHMAXREPEATS]; // CPU seconds per Gb.
+	int runs;
+} BenchStage;
+
+typedef struct benchSampler {
+	int stop;
+	int stageAmount;
+	BenchStage* stages;
+} BenchSampler;
+
+static const char* benchMetricNames[] = {"throughput", "cpupergb"};
+static const char* benchMetricUnits[] = {"Mb/s", "CPU s/Gb"};
+
+// [ Stats
+static int benchCompare(const void* a, const void* b) {
+	double x = *((const double*) a);
+	double y = *((const double*) b);
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// 97.5% quantile of Student's t with "df" degrees of freedom.
+static double benchT975(double df) {
+	static const double table[30] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131,
+			2.120, 2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+	if (df < 1) {
+		return 0;
+	}
+	if (df <= 30) {
+		return table[(int) df - 1];
+	}
+	return 1.96 + 2.5 / df; // Within 0.002 of the exact value above 30.
+}
+
+void benchStats(const double* values, int n, BenchStats* bs) {
+	double sorted[BENCHMAXREPEATS];
+	double sum = 0;
+	double sq = 0;
+	int i;
+
+	memset(bs, 0, sizeof(BenchStats));
+	bs->n = n;
+	if (n <= 0) {
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		sum += values[i];
+		sorted[i] = values[i];
+	}
+	bs->mean = sum / n;
+	for (i = 0; i < n; i++) {
+		sq += (values[i] - bs->mean) * (values[i] - bs->mean);
+	}
+	qsort(sorted, n, sizeof(double), benchCompare);
+	bs->median = n % 2 == 1 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+	if (n > 1) {
+		bs->stddev = sqrt(sq / (n - 1));
+		bs->ci = benchT975(n - 1) * bs->stddev / sqrt(n);
+	}
+}
+
+// Continued fraction of the incomplete beta function, modified Lentz's method.
+static double benchBetaCf(double a, double b, double x) {
+	double c = 1;
+	double d = 1 - (a + b) * x / (a + 1);
+	double h;
+	int m;
+
+	d = fabs(d) < 1e-300 ? 1e-300 : d;
+	d = 1 / d;
+	h = d;
+	for (m = 1; m <= 300; m++) {
+		double aa = m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+		d = 1 + aa * d;
+		d = fabs(d) < 1e-300 ? 1e-300 : d;
+		c = 1 + aa / c;
+		c = fabs(c) < 1e-300 ? 1e-300 : c;
+		d = 1 / d;
+		h *= d * c;
+		aa = -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1));
+		d = 1 + aa * d;
+		d = fabs(d) < 1e-300 ? 1e-300 : d;
+		c = 1 + aa / c;
+		c = fabs(c) < 1e-300 ? 1e-300 : c;
+		d = 1 / d;
+		double del = d * c;
+		h *= del;
+		if (fabs(del - 1) < 1e-12) {
+			break;
+		}
+	}
+	return h;
+}
+
+// Regularized incomplete beta function I_x(a, b).
+static double benchBetaI(double a, double b, double x) {
+	if (x <= 0) {
+		return 0;
+	}
+	if (x >= 1) {
+		return 1;
+	}
+	double bt = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1 - x));
+	if (x < (a + 1) / (a + b + 2)) {
+		return bt * benchBetaCf(a, b, x) / a;
+	}
+	return 1 - bt * benchBetaCf(b, a, 1 - x) / b;
+}
+
+double benchWelch(const BenchStats* a, const BenchStats* b) {
+	if (a->n < 2 || b->n < 2) {
+		return 1;
+	}
+	double va = a->stddev * a->stddev / a->n;
+	double vb = b->stddev * b->stddev / b->n;
+	if (va + vb <= 0) {
+		return a->mean == b->mean ? 1 : 0;
+	}
+	double t = (a->mean - b->mean) / sqrt(va + vb);
+	double df = (va + vb) * (va + vb) / (va * va / (a->n - 1) + vb * vb / (b->n - 1));
+	return benchBetaI(df / 2, 0.5, df / (df + t * t));
+}
+// ]
+
+// [ Sampler
+// Received or sent Bytes and process CPU seconds from the metrics of a local stage, -1 if it does not answer.
+static int benchScrape(unsigned short port, int sent, double* bytes, double* cpu) {
+	static const char request[] = "GET /metrics HTTP/1.0\r\n\r\n";
+	const char* bytesName = sent ? "\nidaq_sent_bytes_total " : "\nidaq_received_bytes_total ";
+	const char* cpuName = "\nidaq_process_cpu_seconds_total ";
+	char buf[16384];
+	struct sockaddr_in addr;
+	struct timeval timeout;
+	size_t len = 0;
+	int sock;
+
+	if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		return -1;
+	}
+	timeout.tv_sec = 1;
+	timeout.tv_usec = 0;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if (connect(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0 || send(sock, request, sizeof(request) - 1, MSG_NOSIGNAL) < 0) {
+		close(sock);
+		return -1;
+	}
+	// The totals come first, the per connection series after them are not needed.
+	while (len < sizeof(buf) - 1) {
+		ssize_t ret = recv(sock, buf + len, sizeof(buf) - 1 - len, 0);
+		if (ret <= 0) {
+			break;
+		}
+		len += ret;
+		buf[len] = '\0';
+		if (strstr(buf, bytesName) != NULL && strstr(buf, cpuName) != NULL && strstr(strstr(buf, cpuName) + 1, "\n") != NULL) {
+			break;
+		}
+	}
+	close(sock);
+	buf[len] = '\0';
+	char* b = strstr(buf, bytesName);
+	char* c = strstr(buf, cpuName);
+	if (b == NULL || c == NULL) {
+		return -1;
+	}
+	*bytes = atof(b + strlen(bytesName));
+	*cpu = atof(c + strlen(cpuName));
+	return 0;
+}
+
+static void* threadBenchSampler(void* arg) {
+	BenchSampler* bsp = (BenchSampler*) arg;
+	int i;
+
+	while (!__atomic_load_n(&bsp->stop, __ATOMIC_RELAXED)) {
+		for (i = 0; i < bsp->stageAmount; i++) {
+			BenchStage* st = &bsp->stages[i];
+			double bytes;
+			double cpu;
+			if (st->sampleAmount < BENCHMAXSAMPLES && benchScrape(st->metricsPort, st->sent, &bytes, &cpu) == 0) {
+				st->ns[st->sampleAmount] = timingNowNs();
+				st->bytes[st->sampleAmount] = bytes;
+				st->cpu[st->sampleAmount] = cpu;
+				st->sampleAmount++;
+			}
+		}
+		usleep(BENCHSAMPLEMS * 1000);
+	}
+	return ((void*) 0);
+}
+
+// Throughput and CPU per Gb of one run from its samples, -1 if its byte counter never grew, -2 if the traffic was too short
+// for the warm-up.
+static int benchMeasure(BenchStage* st, double warmup, double* throughput, double* cpuPerGb, double* window) {
+	int first = -1;
+	int last = -1;
+	int start = -1;
+	int i;
+
+	for (i = 1; i < st->sampleAmount; i++) {
+		if (st->bytes[i] > st->bytes[i - 1]) {
+			if (first < 0) {
+				first = i - 1;
+			}
+			last = i;
+		}
+	}
+	if (first < 0) {
+		return -1;
+	}
+	for (i = first; i < st->sampleAmount; i++) {
+		if (st->ns[i] >= st->ns[first] + (unsigned long long int) (warmup * 1e9)) {
+			start = i;
+			break;
+		}
+	}
+	int end = last - 1; // The traffic stopped within the last interval that grew, it is only partly used.
+	if (start < 0 || end <= start || st->bytes[end] <= st->bytes[start]) {
+		return -2;
+	}
+	double bits = (st->bytes[end] - st->bytes[start]) * 8;
+	*window = (st->ns[end] - st->ns[start]) * 1e-9;
+	*throughput = bits / (*window * 1e6);
+	*cpuPerGb = (st->cpu[end] - st->cpu[start]) / (bits * 1e-9);
+	return 0;
+}
+// ]
+
+// [ Baseline
+static void benchSave(Topology* topo, BenchStage* stages, int stageAmount, int repeats, double warmup, const char* path) {
+	FILE* fp;
+	int i;
+	int r;
+
+	if ((fp = fopen(path, "w")) == NULL) {
+		printf("bench: cannot write baseline %s\n", path);
+		return;
+	}
+	fprintf(fp, "# idaq bench of %s, %d runs, warm-up %.1lf s. stage metric value of every run\n", topo->path, repeats, warmup);
+	for (i = 0; i < stageAmount; i++) {
+		BenchStage* st = &stages[i];
+		fprintf(fp, "%s %s", topo->stage[st->stage].name, benchMetricNames[0]);
+		for (r = 0; r < st->runs; r++) {
+			fprintf(fp, " %.6lf", st->throughput[r]);
+		}
+		fprintf(fp, "\n%s %s", topo->stage[st->stage].name, benchMetricNames[1]);
+		for (r = 0; r < st->runs; r++) {
+			fprintf(fp, " %.6lf", st->cpuPerGb[r]);
+		}
+		fprintf(fp, "\n");
+	}
+	fclose(fp);
+	printf("bench: baseline saved to %s\n", path);
+}
+
+// Values of "stage" "metric" in the baseline file, -1 if it has none.
+static int benchLoad(const char* path, const char* stage, const char* metric, double* values) {
+	char line[16384];
+	FILE* fp;
+	int n = -1;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		return -1;
+	}
+	while (n < 0 && fgets(line, sizeof(line), fp) != NULL) {
+		char* save = NULL;
+		char* name = strtok_r(line, " \t\r\n", &save);
+		char* m = strtok_r(NULL, " \t\r\n", &save);
+		char* v;
+		if (name == NULL || name[0] == '#' || m == NULL || strcmp(name, stage) != 0 || strcmp(m, metric) != 0) {
+			continue;
+		}
+		n = 0;
+		while ((v = strtok_r(NULL, " \t\r\n", &save)) != NULL && n < BENCHMAXREPEATS) {
+			values[n++] = atof(v);
+		}
+	}
+	fclose(fp);
+	return n;
+}
+// ]
+
+static void benchPrintStats(const char* prefix, const BenchStats* bs, const char* unit) {
+	printf("%s%.3lf %s mean, median %.3lf, stddev %.3lf (%.2lf%%), 95%% CI +-%.3lf, n %d\n", prefix, bs->mean, unit, bs->median, bs->stddev,
+			bs->mean != 0 ? bs->stddev * 100 / bs->mean : 0.0, bs->ci, bs->n);
+}
+
+int benchRun(Topology* topo, int repeats, double warmup, const char* baselinePath, const char* savePath) {
+	BenchStage* stages;
+	BenchSampler sampler;
+	char logDir[sizeof(topo->logDir) - 16]; // Room for "/run<r>".
+	int stageAmount = 0;
+	int regressions = 0;
+	int measured = 0;
+	int s;
+	int i;
+	int r;
+
+	if (repeats > BENCHMAXREPEATS) {
+		repeats = BENCHMAXREPEATS;
+	}
+	if ((stages = (BenchStage*) calloc(BENCHMAXSTAGES, sizeof(BenchStage))) == NULL) {
+		return -1;
+	}
+	// [Local stages with a metrics port are measured.
+	for (s = 0; s < topo->stageAmount && stageAmount < BENCHMAXSTAGES; s++) {
+		TopologyStage* ts = &topo->stage[s];
+		for (i = 0; ts->local && i + 1 < ts->optAmount; i++) {
+			if (strcmp(ts->opts[i], "-m") == 0) {
+				if (ts->role == TopologySender && ts->mode == 6) {
+					printf("bench: stage %s is a connection storm (-c 6), it has no throughput to measure, drop its -m\n", ts->name);
+					free(stages);
+					return -1;
+				}
+				stages[stageAmount].stage = s;
+				stages[stageAmount].metricsPort = atoi(ts->opts[i + 1]);
+				stages[stageAmount].sent = ts->role == TopologySender;
+				stageAmount++;
+				break;
+			}
+		}
+	}
+	if (stageAmount == 0) {
+		printf("bench: no local stage has a metrics port, add \"-m port\" to the options of the stages to measure\n");
+		free(stages);
+		return -1;
+	}
+	// ]
+
+	snprintf(logDir, sizeof(logDir), "%.*s", (int) sizeof(logDir) - 1, topo->logDir);
+	mkdir(logDir, 0755);
+	for (r = 0; r < repeats && !topologyInterrupted(); r++) {
+		snprintf(topo->logDir, sizeof(topo->logDir), "%s/run%d", logDir, r + 1);
+		printf("\nbench: run %d of %d\n", r + 1, repeats);
+		for (i = 0; i < stageAmount; i++) {
+			stages[i].sampleAmount = 0;
+		}
+		sampler.stop = 0;
+		sampler.stageAmount = stageAmount;
+		sampler.stages = stages;
+		pthread_t ntid;
+		if (pthread_create(&ntid, NULL, threadBenchSampler, &sampler) != 0) {
+			break;
+		}
+		int failed = topologyRun(topo);
+		__atomic_store_n(&sampler.stop, 1, __ATOMIC_RELAXED);
+		pthread_join(ntid, NULL);
+		if (failed > 0 || topologyInterrupted()) {
+			printf("bench: run %d failed, not counted\n", r + 1);
+			continue;
+		}
+		for (i = 0; i < stageAmount; i++) {
+			BenchStage* st = &stages[i];
+			double throughput;
+			double cpuPerGb;
+			double window;
+			int ret = benchMeasure(st, warmup, &throughput, &cpuPerGb, &window);
+			if (ret == -1) {
+				printf("bench: run %d of %s moved no Bytes its metrics port counted, not counted\n", r + 1, topo->stage[st->stage].name);
+				continue;
+			}
+			if (ret < 0) {
+				printf("bench: run %d of %s is shorter than the warm-up, not counted\n", r + 1, topo->stage[st->stage].name);
+				continue;
+			}
+			st->throughput[st->runs] = throughput;
+			st->cpuPerGb[st->runs] = cpuPerGb;
+			st->runs++;
+			measured++;
+			printf("bench: run %d of %s: %.3lf Mb/s, %.4lf CPU s/Gb over %.2lf s\n", r + 1, topo->stage[st->stage].name, throughput, cpuPerGb, window);
+		}
+		sleep(1); // Let TIME_WAIT sockets and the page cache settle between runs.
+	}
+	snprintf(topo->logDir, sizeof(topo->logDir), "%s", logDir);
+
+	// [Statistics of every measured stage and the comparison with the baseline.
+	printf("\nbench: %s, %d runs, warm-up %.1lf s\n", topo->path, repeats, warmup);
+	for (i = 0; i < stageAmount; i++) {
+		BenchStage* st = &stages[i];
+		const char* name = topo->stage[st->stage].name;
+		int metric;
+		for (metric = 0; metric < 2; metric++) {
+			double base[BENCHMAXREPEATS];
+			char prefix[128];
+			BenchStats now;
+			BenchStats was;
+			benchStats(metric == 0 ? st->throughput : st->cpuPerGb, st->runs, &now);
+			snprintf(prefix, sizeof(prefix), "%s %s: ", name, benchMetricNames[metric]);
+			benchPrintStats(prefix, &now, benchMetricUnits[metric]);
+			if (baselinePath == NULL) {
+				continue;
+			}
+			int n = benchLoad(baselinePath, name, benchMetricNames[metric], base);
+			if (n < 0) {
+				printf("    not in baseline %s\n", baselinePath);
+				continue;
+			}
+			benchStats(base, n, &was);
+			double p = benchWelch(&now, &was);
+			double change = was.mean != 0 ? (now.mean - was.mean) * 100 / was.mean : 0.0;
+			// Less throughput or more CPU per Gb is worse.
+			int worse = metric == 0 ? now.mean < was.mean : now.mean > was.mean;
+			const char* verdict = p >= 0.05 ? "no significant change" : (worse ? "REGRESSION" : "improvement");
+			printf("    baseline %.3lf (n %d), change %+.2lf%%, Welch p %.4lf: %s\n", was.mean, was.n, change, p, verdict);
+			if (p < 0.05 && worse) {
+				regressions++;
+			}
+		}
+	}
+	// ]
+
+	if (savePath != NULL && measured > 0) {
+		benchSave(topo, stages, stageAmount, repeats, warmup, savePath);
+	}
+	free(stages);
+	if (measured == 0) {
+		return -1;
+	}
+	if (baselinePath != NULL) {
+		printf("bench: %d regressions\n", regressions);
+	}
+	return regressions;
+}
@@ -0,0 +1,36 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "topology.h"
+
+#define BENCHMAXREPEATS 100
+#define BENCHMAXSTAGES 8
+#define BENCHSAMPLEMS 200
+#define BENCHMAXSAMPLES 9000 // 30 minutes of samples per run.
+
+// [ Bench
+// Runs a topology "repeats" times and measures every local stage that has a metrics port ("-m n" in its options). A
+// sampler thread scrapes the metrics of those stages every BENCHSAMPLEMS. The window of a run starts "warmup" seconds
+// after the first Byte and ends at the last full sample before the traffic stops, so neither start-up nor the tail of
+// the run count. Per stage it reports the mean, median, stddev and 95% confidence interval of the throughput and of the
+// CPU seconds per Gb.
+//
+// "savePath" keeps the samples of every run as a baseline. With "baselinePath" every metric is compared against the
+// baseline with Welch's t-test, and a change for the worse with p < 0.05 is a regression. Returns the number of
+// regressions, or -1 if no run could be measured.
+int benchRun(Topology* topo, int repeats, double warmup, const char* baselinePath, const char* savePath);
+
+typedef struct benchStats {
+	int n;
+	double mean;
+	double median;
+	double stddev; // Sample standard deviation.
+	double ci; // Half width of the 95% confidence interval of the mean.
+} BenchStats;
+
+void benchStats(const double* values, int n, BenchStats* bs);
+// Two-sided p value of Welch's t-test for different means, 1 if either side has fewer than 2 values.
+double benchWelch(const BenchStats* a, const BenchStats* b);
+// ]
+
+#endif
@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include "blockQueue.h"
+
+BlockQueue* blockQueueAlloc(int cap) {
+	BlockQueue* bq;
+	if ((bq = (BlockQueue*) calloc(1, sizeof(BlockQueue))) != NULL) {
+		bq->blocks = (char**) malloc(cap * sizeof(char*));
+		bq->sizes = (size_t*) malloc(cap * sizeof(size_t));
+		if (bq->blocks == NULL || bq->sizes == NULL) {
+			free(bq->blocks);
+			free(bq->sizes);
+			free(bq);
+			return NULL;
+		}
+		bq->cap = cap;
+		pthread_mutex_init(&bq->lock, NULL);
+		pthread_cond_init(&bq->notEmpty, NULL);
+		pthread_cond_init(&bq->notFull, NULL);
+	}
+
+	return bq;
+}
+
+void blockQueueRelease(BlockQueue* bq) {
+	pthread_mutex_destroy(&bq->lock);
+	pthread_cond_destroy(&bq->notEmpty);
+	pthread_cond_destroy(&bq->notFull);
+	free(bq->blocks);
+	free(bq->sizes);
+	free(bq);
+}
+
+void blockQueuePush(BlockQueue* bq, char* block, size_t size) {
+	pthread_mutex_lock(&bq->lock);
+	while (bq->count == bq->cap) {
+		pthread_cond_wait(&bq->notFull, &bq->lock);
+	}
+	int tail = (bq->head + bq->count) % bq->cap;
+	bq->blocks[tail] = block;
+	bq->sizes[tail] = size;
+	bq->count++;
+	if (bq->count > bq->peak) {
+		bq->peak = bq->count;
+	}
+	pthread_cond_signal(&bq->notEmpty);
+	pthread_mutex_unlock(&bq->lock);
+}
+
+int blockQueuePop(BlockQueue* bq, char** blocks, size_t* sizes, int max) {
+	int n, i;
+
+	pthread_mutex_lock(&bq->lock);
+	while (bq->count == 0 && !bq->closed) {
+		pthread_cond_wait(&bq->notEmpty, &bq->lock);
+	}
+	n = bq->count < max ? bq->count : max;
+	for (i = 0; i < n; i++) {
+		int j = (bq->head + i) % bq->cap;
+		blocks[i] = bq->blocks[j];
+		sizes[i] = bq->sizes[j];
+	}
+	bq->head = (bq->head + n) % bq->cap;
+	bq->count -= n;
+	if (n > 0) {
+		pthread_cond_broadcast(&bq->notFull);
+	}
+	pthread_mutex_unlock(&bq->lock);
+
+	return n;
+}
+
+void blockQueueClose(BlockQueue* bq) {
+	pthread_mutex_lock(&bq->lock);
+	bq->closed = 1;
+	pthread_cond_broadcast(&bq->notEmpty);
+	pthread_mutex_unlock(&bq->lock);
+}
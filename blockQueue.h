@@ -0,0 +1,30 @@
+#ifndef BLOCKQUEUE_H
+#define BLOCKQUEUE_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+// [ BlockQueue
+// Bounded FIFO of buffers (pointer and size) handed from producer threads to one consumer thread. The buffers themselves are not copied.
+typedef struct blockQueue {
+	char** blocks;
+	size_t* sizes;
+	int cap;
+	int head;
+	int count;
+	int peak; // Largest "count" seen.
+	int closed;
+	pthread_mutex_t lock;
+	pthread_cond_t notEmpty;
+	pthread_cond_t notFull;
+} BlockQueue;
+
+BlockQueue* blockQueueAlloc(int cap);
+void blockQueueRelease(BlockQueue* bq);
+void blockQueuePush(BlockQueue* bq, char* block, size_t size); // Block while the queue is full.
+// Block while empty, then take up to "max" buffers. Return how many were taken, 0 once closed and drained.
+int blockQueuePop(BlockQueue* bq, char** blocks, size_t* sizes, int max);
+void blockQueueClose(BlockQueue* bq);
+// ]
+
+#endif // BLOCKQUEUE_H
@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h> // for MPOL_PREFERRED.
+#include "bufPool.h"
+#include "dieWithError.h"
+
+char* hugeRegionAlloc(size_t size, int node, const char** backing) {
+	char* region;
+
+	size = (size + BUFPOOLHUGEPAGE - 1) / BUFPOOLHUGEPAGE * BUFPOOLHUGEPAGE;
+	region = (char*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (region != MAP_FAILED) {
+		*backing = "hugetlb";
+	}
+	else {
+		region = (char*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (region == MAP_FAILED) {
+			return NULL;
+		}
+		*backing = madvise(region, size, MADV_HUGEPAGE) == 0 ? "thp" : "4k";
+	}
+
+	// Nothing is faulted in yet, so the policy decides where every page lands. Failing is harmless (no NUMA support).
+	if (node >= 0 && node < BUFPOOLMAXNODES) {
+		unsigned long nodeMask = 1UL << node;
+		syscall(SYS_mbind, region, size, MPOL_PREFERRED, &nodeMask, BUFPOOLMAXNODES + 1, 0);
+	}
+
+	return region;
+}
+
+void hugeRegionRelease(char* region, size_t size) {
+	size = (size + BUFPOOLHUGEPAGE - 1) / BUFPOOLHUGEPAGE * BUFPOOLHUGEPAGE;
+	munmap(region, size);
+}
+
+int currentNumaNode() {
+	unsigned int cpu, node;
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0 || node >= BUFPOOLMAXNODES) {
+		return 0;
+	}
+	return (int) node;
+}
+
+BufPool* bufPoolAllocOnNode(size_t blockSize, int blockAmount, int node) {
+	BufPool* bp;
+	int i;
+
+	if ((bp = (BufPool*) calloc(1, sizeof(BufPool))) == NULL) {
+		return NULL;
+	}
+	bp->blockSize = blockSize;
+	bp->blockAmount = blockAmount;
+	bp->regionSize = blockSize * blockAmount;
+	bp->node = node;
+	bp->region = hugeRegionAlloc(bp->regionSize, node, &bp->backing);
+	bp->freeList = (char**) malloc(blockAmount * sizeof(char*));
+	if (bp->region == NULL || bp->freeList == NULL) {
+		if (bp->region != NULL) {
+			hugeRegionRelease(bp->region, bp->regionSize);
+		}
+		free(bp->freeList);
+		free(bp);
+		return NULL;
+	}
+	for (i = 0; i < blockAmount; i++) {
+		bp->freeList[i] = bp->region + (size_t) i * blockSize;
+	}
+	bp->freeTop = blockAmount;
+	pthread_mutex_init(&bp->lock, NULL);
+	pthread_cond_init(&bp->notEmpty, NULL);
+
+	return bp;
+}
+
+BufPool* bufPoolAlloc(size_t blockSize, int blockAmount) {
+	return bufPoolAllocOnNode(blockSize, blockAmount, -1);
+}
+
+void bufPoolRelease(BufPool* bp) {
+	pthread_mutex_destroy(&bp->lock);
+	pthread_cond_destroy(&bp->notEmpty);
+	hugeRegionRelease(bp->region, bp->regionSize);
+	free(bp->freeList);
+	free(bp);
+}
+
+char* bufPoolGet(BufPool* bp) {
+	char* block;
+
+	pthread_mutex_lock(&bp->lock);
+	if (bp->freeTop == 0) {
+		bp->waits++;
+		while (bp->freeTop == 0) {
+			pthread_cond_wait(&bp->notEmpty, &bp->lock);
+		}
+	}
+	block = bp->freeList[--bp->freeTop];
+	pthread_mutex_unlock(&bp->lock);
+
+	return block;
+}
+
+char* bufPoolTryGet(BufPool* bp) {
+	char* block = NULL;
+
+	pthread_mutex_lock(&bp->lock);
+	if (bp->freeTop > 0) {
+		block = bp->freeList[--bp->freeTop];
+	}
+	pthread_mutex_unlock(&bp->lock);
+
+	return block;
+}
+
+void bufPoolPut(BufPool* bp, char* block) {
+	pthread_mutex_lock(&bp->lock);
+	bp->freeList[bp->freeTop++] = block;
+	pthread_cond_signal(&bp->notEmpty);
+	pthread_mutex_unlock(&bp->lock);
+}
+
+// [ Thread caches
+typedef struct bufPoolCache {
+	BufPool* pool;
+	int count;
+	char* blocks[BUFPOOLCACHESIZE];
+} BufPoolCache;
+
+static __thread BufPoolCache bufPoolCaches[BUFPOOLMAXCACHES];
+static pthread_key_t bufPoolCacheKey;
+static pthread_once_t bufPoolCacheOnce = PTHREAD_ONCE_INIT;
+
+// Thread exit: hand the cached blocks back.
+static void bufPoolCacheFlush(void* arg) {
+	BufPoolCache* caches = (BufPoolCache*) arg;
+	int i;
+
+	for (i = 0; i < BUFPOOLMAXCACHES; i++) {
+		while (caches[i].count > 0) {
+			bufPoolPut(caches[i].pool, caches[i].blocks[--caches[i].count]);
+		}
+		caches[i].pool = NULL;
+	}
+}
+
+static void bufPoolCacheKeyInit() {
+	pthread_key_create(&bufPoolCacheKey, bufPoolCacheFlush);
+}
+
+// Cache of "bp" for the calling thread, NULL when all cache slots serve other pools.
+static BufPoolCache* bufPoolCacheOf(BufPool* bp) {
+	int i;
+
+	pthread_once(&bufPoolCacheOnce, bufPoolCacheKeyInit);
+	for (i = 0; i < BUFPOOLMAXCACHES; i++) {
+		if (bufPoolCaches[i].pool == bp) {
+			return &bufPoolCaches[i];
+		}
+	}
+	for (i = 0; i < BUFPOOLMAXCACHES; i++) {
+		if (bufPoolCaches[i].pool == NULL) {
+			bufPoolCaches[i].pool = bp;
+			bufPoolCaches[i].count = 0;
+			pthread_setspecific(bufPoolCacheKey, bufPoolCaches);
+			return &bufPoolCaches[i];
+		}
+	}
+	return NULL;
+}
+
+char* bufPoolGetCached(BufPool* bp) {
+	BufPoolCache* cache = bufPoolCacheOf(bp);
+	if (cache != NULL && cache->count > 0) {
+		return cache->blocks[--cache->count];
+	}
+	return bufPoolGet(bp);
+}
+
+static char* bufPoolTryGetCached(BufPool* bp) {
+	BufPoolCache* cache = bufPoolCacheOf(bp);
+	if (cache != NULL && cache->count > 0) {
+		return cache->blocks[--cache->count];
+	}
+	return bufPoolTryGet(bp);
+}
+
+void bufPoolPutCached(BufPool* bp, char* block) {
+	BufPoolCache* cache = bufPoolCacheOf(bp);
+	if (cache != NULL && cache->count < BUFPOOLCACHESIZE) {
+		cache->blocks[cache->count++] = block;
+		return;
+	}
+	bufPoolPut(bp, block);
+}
+// ]
+
+// [ Node pools
+static BufPool* bufPoolNodes[BUFPOOLMAXNODES];
+static size_t bufPoolNodeBlockSize;
+static int bufPoolNodeBlockAmount;
+static pthread_mutex_t bufPoolNodeLock = PTHREAD_MUTEX_INITIALIZER;
+static int bufPoolNodeOverflow = 0; // A node pool ran empty and buffers came from malloc().
+
+void bufPoolNodeInit(size_t blockSize, int blockAmount) {
+	bufPoolNodeBlockSize = blockSize;
+	bufPoolNodeBlockAmount = blockAmount;
+}
+
+char* bufPoolNodeGet() {
+	int node = currentNumaNode();
+	BufPool* bp;
+
+	if ((bp = __atomic_load_n(&bufPoolNodes[node], __ATOMIC_ACQUIRE)) == NULL) {
+		pthread_mutex_lock(&bufPoolNodeLock);
+		if ((bp = bufPoolNodes[node]) == NULL) {
+			if ((bp = bufPoolAllocOnNode(bufPoolNodeBlockSize, bufPoolNodeBlockAmount, node)) == NULL) {
+				dieWithError("bufPoolNodeGet bufPoolAllocOnNode() failed");
+			}
+			__atomic_store_n(&bufPoolNodes[node], bp, __ATOMIC_RELEASE);
+			printf("buffer pool node %d: %d x %zu Bytes, %s\n", node, bp->blockAmount, bp->blockSize, bp->backing);
+		}
+		pthread_mutex_unlock(&bufPoolNodeLock);
+	}
+
+	char* block = bufPoolTryGetCached(bp);
+	if (block == NULL) {
+		if ((block = (char*) malloc(bufPoolNodeBlockSize)) == NULL) {
+			dieWithError("bufPoolNodeGet malloc() failed");
+		}
+		if (!__atomic_exchange_n(&bufPoolNodeOverflow, 1, __ATOMIC_RELAXED)) {
+			printf("buffer pool node %d empty, more receive buffers come from malloc()\n", node);
+		}
+	}
+	return block;
+}
+
+void bufPoolNodePut(char* block) {
+	int i;
+
+	// The thread may have moved to another node since it got the block, find the owner.
+	for (i = 0; i < BUFPOOLMAXNODES; i++) {
+		BufPool* bp = __atomic_load_n(&bufPoolNodes[i], __ATOMIC_ACQUIRE);
+		if (bp != NULL && block >= bp->region && block < bp->region + bp->regionSize) {
+			bufPoolPutCached(bp, block);
+			return;
+		}
+	}
+	free(block); // From malloc() when the pool was empty.
+}
+// ]
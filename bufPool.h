@@ -0,0 +1,58 @@
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define BUFPOOLHUGEPAGE (2*1024*1024) // Regions are rounded up to whole huge pages.
+#define BUFPOOLMAXNODES 8 // NUMA nodes with their own node pool.
+#define BUFPOOLCACHESIZE 4 // Blocks a thread keeps in its cache of one pool.
+#define BUFPOOLMAXCACHES 4 // Pools a thread keeps a cache for.
+
+// [ Huge regions
+// Memory for pools and rings: MAP_HUGETLB pages when the system has them reserved, otherwise normal pages with
+// MADV_HUGEPAGE so transparent huge pages can back them. With node >= 0 the pages prefer that NUMA node.
+char* hugeRegionAlloc(size_t size, int node, const char** backing); // backing: "hugetlb", "thp" or "4k".
+void hugeRegionRelease(char* region, size_t size);
+int currentNumaNode(); // Node of the CPU the calling thread runs on, 0 if unknown.
+// ]
+
+// [ BufPool
+// Fixed-size buffers carved out of one region. Buffers move between threads (a receive thread fills one, a send thread returns it),
+// so the pool never allocates on the data path.
+typedef struct bufPool {
+	char* region;
+	size_t regionSize;
+	size_t blockSize;
+	int blockAmount;
+	char** freeList;
+	int freeTop;
+	int node; // NUMA node of the region, -1 for no binding.
+	const char* backing;
+	unsigned long long int waits; // bufPoolGet() calls that found the pool empty.
+	pthread_mutex_t lock;
+	pthread_cond_t notEmpty;
+} BufPool;
+
+BufPool* bufPoolAlloc(size_t blockSize, int blockAmount);
+BufPool* bufPoolAllocOnNode(size_t blockSize, int blockAmount, int node);
+void bufPoolRelease(BufPool* bp);
+char* bufPoolGet(BufPool* bp); // Block while every buffer is in use.
+char* bufPoolTryGet(BufPool* bp); // NULL while every buffer is in use.
+void bufPoolPut(BufPool* bp, char* block);
+
+// Per-thread cache in front of the pool, for buffers the calling thread gets and puts itself: a thread that serves one connection
+// after another reuses the same warm buffers without taking the lock. Cached buffers go back to the pool when the thread exits.
+char* bufPoolGetCached(BufPool* bp);
+void bufPoolPutCached(BufPool* bp, char* block);
+// ]
+
+// [ Node pools
+// Central pools of receive buffers, one per NUMA node, created on first use by a thread running on that node.
+// A connection never waits for a buffer: when the node pool is empty the buffer comes from malloc() instead.
+void bufPoolNodeInit(size_t blockSize, int blockAmount);
+char* bufPoolNodeGet(); // Cached, from the pool of the calling thread's node.
+void bufPoolNodePut(char* block); // Back to the pool that owns it, free() if none does.
+// ]
+
+#endif // BUFPOOL_H
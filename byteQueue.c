@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <string.h>
+#include "timing.h"
+#include "byteQueue.h"
+
+ByteQueue* byteQueueAlloc(size_t cap) {
+	ByteQueue* bq;
+	if ((bq = (ByteQueue*) calloc(1, sizeof(ByteQueue))) != NULL) {
+		if ((bq->data = (char*) malloc(cap)) == NULL) {
+			free(bq);
+			return NULL;
+		}
+		bq->cap = cap;
+		pthread_mutex_init(&bq->lock, NULL);
+		pthread_mutex_init(&bq->pushLock, NULL);
+		pthread_cond_init(&bq->notEmpty, NULL);
+		pthread_cond_init(&bq->notFull, NULL);
+	}
+
+	return bq;
+}
+
+void byteQueueRelease(ByteQueue* bq) {
+	pthread_mutex_destroy(&bq->lock);
+	pthread_mutex_destroy(&bq->pushLock);
+	pthread_cond_destroy(&bq->notEmpty);
+	pthread_cond_destroy(&bq->notFull);
+	free(bq->data);
+	free(bq);
+}
+
+void byteQueuePush(ByteQueue* bq, const char* data, size_t len) {
+	pthread_mutex_lock(&bq->pushLock);
+	pthread_mutex_lock(&bq->lock);
+	while (len > 0) {
+		if (bq->size == bq->cap) {
+			unsigned long long int t1 = timingNowNs();
+			while (bq->size == bq->cap) {
+				pthread_cond_wait(&bq->notFull, &bq->lock);
+			}
+			bq->pushWaitUs += (timingNowNs() - t1) / 1000;
+		}
+
+		// Copy up to the free space, in at most two pieces around the end of the ring.
+		size_t n = bq->cap - bq->size;
+		n = n < len ? n : len;
+		size_t tail = (bq->head + bq->size) % bq->cap;
+		size_t first = bq->cap - tail < n ? bq->cap - tail : n;
+		memcpy(bq->data + tail, data, first);
+		memcpy(bq->data, data + first, n - first);
+		__atomic_store_n(&bq->size, bq->size + n, __ATOMIC_RELAXED);
+		if (bq->size > bq->peak) {
+			bq->peak = bq->size;
+		}
+		data += n;
+		len -= n;
+		pthread_cond_signal(&bq->notEmpty);
+	}
+	pthread_mutex_unlock(&bq->lock);
+	pthread_mutex_unlock(&bq->pushLock);
+}
+
+size_t byteQueuePeek(ByteQueue* bq, char** data) {
+	size_t n;
+
+	pthread_mutex_lock(&bq->lock);
+	while (bq->size == 0 && !bq->closed) {
+		pthread_cond_wait(&bq->notEmpty, &bq->lock);
+	}
+	n = bq->cap - bq->head < bq->size ? bq->cap - bq->head : bq->size;
+	*data = bq->data + bq->head;
+	pthread_mutex_unlock(&bq->lock);
+
+	return n;
+}
+
+void byteQueuePop(ByteQueue* bq, size_t len) {
+	pthread_mutex_lock(&bq->lock);
+	bq->head = (bq->head + len) % bq->cap;
+	__atomic_store_n(&bq->size, bq->size - len, __ATOMIC_RELAXED);
+	pthread_cond_broadcast(&bq->notFull);
+	pthread_mutex_unlock(&bq->lock);
+}
+
+void byteQueueClose(ByteQueue* bq) {
+	pthread_mutex_lock(&bq->lock);
+	bq->closed = 1;
+	pthread_cond_broadcast(&bq->notEmpty);
+	pthread_mutex_unlock(&bq->lock);
+}
@@ -0,0 +1,36 @@
+#ifndef BYTEQUEUE_H
+#define BYTEQUEUE_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+// [ ByteQueue
+// Bounded byte ring between producer threads and one consumer thread.
+// The consumer sends straight out of the ring (byteQueuePeek() then byteQueuePop()), so bytes are copied only once.
+typedef struct byteQueue {
+	char* data;
+	size_t cap;
+	size_t head; // Read position.
+	size_t size; // Bytes queued.
+	size_t peak; // Largest "size" seen.
+	int closed;
+	unsigned long long int pushWaitUs; // Time producers waited for space.
+	pthread_mutex_t lock;
+	pthread_mutex_t pushLock; // Keeps the bytes of one push contiguous when it has to wait for space.
+	pthread_cond_t notEmpty;
+	pthread_cond_t notFull;
+} ByteQueue;
+
+ByteQueue* byteQueueAlloc(size_t cap);
+void byteQueueRelease(ByteQueue* bq);
+void byteQueuePush(ByteQueue* bq, const char* data, size_t len); // Block while the queue is full.
+size_t byteQueuePeek(ByteQueue* bq, char** data); // Block while empty. Return contiguous queued bytes, 0 once closed and drained.
+void byteQueuePop(ByteQueue* bq, size_t len);
+void byteQueueClose(ByteQueue* bq);
+
+static inline size_t byteQueueSize(ByteQueue* bq) {
+	return __atomic_load_n(&bq->size, __ATOMIC_RELAXED);
+}
+// ]
+
+#endif // BYTEQUEUE_H
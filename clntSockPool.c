@@ -0,0 +1,48 @@
+#include <stdlib.h>
+#include "clntSockPool.h"
+
+ClntSockPool* clntSockPoolAlloc() {
+	ClntSockPool* cspool;
+	if ((cspool = (ClntSockPool*) malloc(sizeof(ClntSockPool))) != NULL) {
+		cspool->poolTop = 0;
+		if (pthread_mutex_init(&cspool->poolLock, NULL) != 0) {
+			free(cspool);
+			return NULL;
+		}
+	}
+
+	return cspool;
+}
+
+void clntSockPoolRelease(ClntSockPool* cspool) {
+	pthread_mutex_lock(&cspool->poolLock);
+	if (cspool->poolTop == 0) {
+		pthread_mutex_unlock(&cspool->poolLock);
+		pthread_mutex_destroy(&cspool->poolLock);
+		free(cspool);
+	}
+	else {
+		pthread_mutex_unlock(&cspool->poolLock);
+	}
+}
+
+int clntSockPoolPush(ClntSockPool* cspool, int sock) {
+	int ret = -1;
+	pthread_mutex_lock(&cspool->poolLock);
+	if (cspool->poolTop < CLNTSOCKPOOLSIZE) {
+		cspool->pool[cspool->poolTop++] = sock;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&cspool->poolLock);
+	return ret;
+}
+
+int clntSockPoolPop(ClntSockPool* cspool) {
+	int sock = -1;
+	pthread_mutex_lock(&cspool->poolLock);
+	if (cspool->poolTop > 0) {
+		sock = cspool->pool[--cspool->poolTop];
+	}
+	pthread_mutex_unlock(&cspool->poolLock);
+	return sock;
+}
@@ -0,0 +1,23 @@
+#ifndef CLNTSOCKPOOL_H
+#define CLNTSOCKPOOL_H
+
+#include <pthread.h>
+
+#define CLNTSOCKPOOLSIZE 10 // As MAXPENDING, the accept backlog of the modes that used the pool.
+
+// [ ClntSockPool
+// Client socket pool, main thread accept client socket and put it in pool, receive thread of server or receive-send thread of L2 client get client socket from pool.
+// Used in the deprecated "threadReceive" and "threadReceiveAndSend", the multithread modes now hand every connection to a new thread.
+typedef struct clntSockPool {
+	int pool[CLNTSOCKPOOLSIZE];
+	int poolTop;
+	pthread_mutex_t poolLock;
+} ClntSockPool;
+
+ClntSockPool* clntSockPoolAlloc();
+void clntSockPoolRelease(ClntSockPool* cspool); // Only frees an empty pool.
+int clntSockPoolPush(ClntSockPool* cspool, int sock); // -1 if the pool is full.
+int clntSockPoolPop(ClntSockPool* cspool); // The last socket pushed, -1 if the pool is empty.
+// ]
+
+#endif // CLNTSOCKPOOL_H
@@ -0,0 +1,399 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h> // for SIOCINQ and SIOCOUTQ.
+#include "connStats.h"
+#include "cpuUsage.h"
+#include "dieWithError.h"
+
+int connStatsMax = 0;
+ConnStats* connStatsTable;
+int* connStatsFree; // Stack of free slot ids, so opening a connection does not scan the table.
+int connStatsFreeTop;
+ConnStats connStatsOverflow; // Shared by connections beyond connStatsMax.
+ConnStatsTotals connStatsClosed; // Counters of closed connections.
+pthread_mutex_t connStatsLock = PTHREAD_MUTEX_INITIALIZER;
+int connStatsSampleNext = 0; // Slot connStatsSampleQueues() goes on from.
+static void (*connStatsExtraTotals)(ConnStatsTotals* totals) = NULL;
+
+void connStatsInit(int maxConnections) {
+	int i;
+
+	connStatsTable = (ConnStats*) calloc(maxConnections, sizeof(ConnStats));
+	connStatsFree = (int*) malloc(maxConnections * sizeof(int));
+	if (connStatsTable == NULL || connStatsFree == NULL) {
+		dieWithError("connStatsInit malloc() failed");
+	}
+	for (i = 0; i < maxConnections; i++) {
+		connStatsFree[i] = maxConnections - 1 - i; // Lowest ids are taken first.
+	}
+	connStatsFreeTop = maxConnections;
+	connStatsMax = maxConnections;
+	connStatsOverflow.shared = 1;
+	connStatsOverflow.recvSock = -1;
+	connStatsOverflow.sendSock = -1;
+}
+
+ConnStats* connStatsOpen(const char* role, int recvSock, int sendSock, pid_t tid, struct sockaddr_in* peerAddress) {
+	ConnStats* cs = &connStatsOverflow;
+	TcpSeries* recvSeries = recvSock >= 0 ? tcpInfoSeriesAlloc() : NULL;
+	TcpSeries* sendSeries = sendSock >= 0 ? tcpInfoSeriesAlloc() : NULL;
+
+	pthread_mutex_lock(&connStatsLock);
+	if (connStatsFreeTop > 0) {
+		int id = connStatsFree[--connStatsFreeTop];
+		cs = &connStatsTable[id];
+		memset(cs, 0, sizeof(ConnStats));
+		cs->inUse = 1;
+		cs->id = id;
+		cs->role = role;
+		cs->recvSock = recvSock;
+		cs->sendSock = sendSock;
+		cs->tid = tid;
+		cs->openNs = timingNowNs();
+		if (peerAddress != NULL) {
+			cs->peerAddress = *peerAddress;
+		}
+		cs->recvTcp.series = recvSeries;
+		cs->sendTcp.series = sendSeries;
+	}
+	pthread_mutex_unlock(&connStatsLock);
+
+	if (cs == &connStatsOverflow) {
+		free(recvSeries);
+		free(sendSeries);
+	}
+
+	return cs;
+}
+
+void connStatsClose(ConnStats* cs) {
+	if (cs == &connStatsOverflow) {
+		return;
+	}
+
+	pthread_mutex_lock(&connStatsLock);
+	connStatsClosed.closedConnections++;
+	connStatsClosed.recvBytes += cs->recvBytes;
+	connStatsClosed.recvCalls += cs->recvCalls;
+	connStatsClosed.sendBytes += cs->sendBytes;
+	connStatsClosed.sendCalls += cs->sendCalls;
+	TcpSeries* recvSeries = cs->recvTcp.series;
+	TcpSeries* sendSeries = cs->sendTcp.series;
+	int id = cs->id;
+	const char* role = cs->role;
+	cs->recvTcp.series = NULL;
+	cs->sendTcp.series = NULL;
+	cs->inUse = 0;
+	connStatsFree[connStatsFreeTop++] = id;
+	pthread_mutex_unlock(&connStatsLock);
+
+	// The slot may already serve another connection, write the series outside the lock from the copies.
+	tcpInfoSeriesDump(recvSeries, id, role, "recv");
+	tcpInfoSeriesDump(sendSeries, id, role, "send");
+}
+
+void connStatsCloseSock(ConnStats* cs, int sock) {
+	pthread_mutex_lock(&connStatsLock);
+	if (cs->recvSock == sock) {
+		cs->closedSocks |= CONNSTATSRECVCLOSED;
+	}
+	if (cs->sendSock == sock) {
+		cs->closedSocks |= CONNSTATSSENDCLOSED;
+	}
+	pthread_mutex_unlock(&connStatsLock);
+	close(sock);
+}
+
+int connStatsSnapshot(ConnStats* snapshot, ConnStatsTotals* totals) {
+	int i;
+	int n = 0;
+	ConnStatsTotals t;
+
+	pthread_mutex_lock(&connStatsLock);
+	t = connStatsClosed;
+	t.activeConnections = 0;
+	for (i = 0; i < connStatsMax; i++) {
+		ConnStats* cs = &connStatsTable[i];
+		if (cs->inUse) {
+			t.activeConnections++;
+			t.recvBytes += cs->recvBytes;
+			t.recvCalls += cs->recvCalls;
+			t.sendBytes += cs->sendBytes;
+			t.sendCalls += cs->sendCalls;
+			if (snapshot != NULL) {
+				snapshot[n++] = *cs;
+			}
+		}
+	}
+	t.recvBytes += __atomic_load_n(&connStatsOverflow.recvBytes, __ATOMIC_RELAXED);
+	t.recvCalls += __atomic_load_n(&connStatsOverflow.recvCalls, __ATOMIC_RELAXED);
+	t.sendBytes += __atomic_load_n(&connStatsOverflow.sendBytes, __ATOMIC_RELAXED);
+	t.sendCalls += __atomic_load_n(&connStatsOverflow.sendCalls, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&connStatsLock);
+
+	if (connStatsExtraTotals != NULL) {
+		connStatsExtraTotals(&t);
+	}
+	if (totals != NULL) {
+		*totals = t;
+	}
+	return n;
+}
+
+void connStatsTotalsHook(void (*hook)(ConnStatsTotals* totals)) {
+	connStatsExtraTotals = hook;
+}
+
+int connStatsQueueDepth(int sock, int request) {
+	int depth = 0;
+	if (sock < 0 || ioctl(sock, request, &depth) < 0) {
+		return 0;
+	}
+	return depth;
+}
+
+// One slot of a connStatsSampleQueues() batch: what to read, copied under the lock, and what was read without it.
+typedef struct connStatsProbe {
+	int id;
+	unsigned long long int openNs; // With id, the connection the readings belong to.
+	int closedSocks;
+	int recvSock;
+	int sendSock;
+	pid_t tid;
+	int readBufs; // First sample of the slot.
+	int readCPU;
+
+	int rcvBuf;
+	int sndBuf;
+	int inq;
+	int outq;
+	int recvTcpOk;
+	int sendTcpOk;
+	TcpSample recvTcp;
+	TcpSample sendTcp;
+	int cpuOk;
+	unsigned long long int cpuTicks;
+	unsigned long long int cpuNs;
+} ConnStatsProbe;
+
+static ConnStatsProbe connStatsProbes[CONNSTATSSAMPLEBATCH]; // Only the report thread samples.
+
+// The syscalls and /proc reads of one probe, without the lock.
+static void connStatsProbeRead(ConnStatsProbe* p, pid_t pid, pid_t* cachedTid, unsigned long long int* cachedTicks, int* cached) {
+	ProcPidStat pps;
+	socklen_t optLen;
+	int j;
+
+	if (p->readBufs) {
+		optLen = sizeof(int);
+		if (p->recvSock >= 0) {
+			getsockopt(p->recvSock, SOL_SOCKET, SO_RCVBUF, &p->rcvBuf, &optLen);
+		}
+		optLen = sizeof(int);
+		if (p->sendSock >= 0) {
+			getsockopt(p->sendSock, SOL_SOCKET, SO_SNDBUF, &p->sndBuf, &optLen);
+		}
+	}
+	p->inq = connStatsQueueDepth(p->recvSock, SIOCINQ);
+	p->outq = connStatsQueueDepth(p->sendSock, SIOCOUTQ);
+	unsigned int ms = (unsigned int) ((timingNowNs() - p->openNs) / 1000000);
+	p->recvTcpOk = tcpInfoRead(p->recvSock, ms, &p->recvTcp) == 0;
+	p->sendTcpOk = tcpInfoRead(p->sendSock, ms, &p->sendTcp) == 0;
+
+	p->cpuOk = 0;
+	if (!p->readCPU) {
+		return;
+	}
+	for (j = 0; j < *cached && cachedTid[j] != p->tid; j++) {
+	}
+	if (j < *cached) {
+		p->cpuTicks = cachedTicks[j];
+	}
+	else if (tryGetThreadCPUStatus(&pps, pid, p->tid) == 0) {
+		p->cpuTicks = pps.utime + pps.stimev;
+		if (*cached < CONNSTATSTIDCACHE) {
+			cachedTid[*cached] = p->tid;
+			cachedTicks[(*cached)++] = p->cpuTicks;
+		}
+	}
+	else {
+		return;
+	}
+	p->cpuOk = 1;
+	p->cpuNs = timingNowNs();
+}
+
+void connStatsSampleQueues() {
+	double ticks = (double) sysconf(_SC_CLK_TCK);
+	pid_t pid = getpid();
+	pid_t cachedTid[CONNSTATSTIDCACHE];
+	unsigned long long int cachedTicks[CONNSTATSTIDCACHE];
+	int cached = 0;
+	int i;
+	int n = 0;
+	int scanned;
+
+	// What to read is copied under the lock, connStatsOpen() and connStatsClose() never wait for the syscalls.
+	pthread_mutex_lock(&connStatsLock);
+	for (scanned = 0; scanned < connStatsMax && n < CONNSTATSSAMPLEBATCH; scanned++) {
+		ConnStats* cs = &connStatsTable[connStatsSampleNext];
+		connStatsSampleNext = (connStatsSampleNext + 1) % connStatsMax;
+		if (!cs->inUse) {
+			continue;
+		}
+		ConnStatsProbe* p = &connStatsProbes[n++];
+		p->id = cs->id;
+		p->openNs = cs->openNs;
+		p->closedSocks = cs->closedSocks;
+		p->recvSock = cs->closedSocks & CONNSTATSRECVCLOSED ? -1 : cs->recvSock;
+		p->sendSock = cs->closedSocks & CONNSTATSSENDCLOSED ? -1 : cs->sendSock;
+		p->tid = cs->tid;
+		p->readBufs = cs->queueSamples == 0;
+		p->readCPU = cs->queueSamples % CONNSTATSCPUSAMPLE == 0; // Every CONNSTATSCPUSAMPLE-th sample of the slot, the first one included.
+		p->rcvBuf = cs->rcvBuf;
+		p->sndBuf = cs->sndBuf;
+	}
+	pthread_mutex_unlock(&connStatsLock);
+
+	for (i = 0; i < n; i++) {
+		connStatsProbeRead(&connStatsProbes[i], pid, cachedTid, cachedTicks, &cached);
+	}
+
+	pthread_mutex_lock(&connStatsLock);
+	for (i = 0; i < n; i++) {
+		ConnStatsProbe* p = &connStatsProbes[i];
+		ConnStats* cs = &connStatsTable[p->id];
+		// A slot reused, or a socket closed and its fd maybe reused, since the copy: the readings are not of this connection.
+		if (!cs->inUse || cs->openNs != p->openNs || cs->closedSocks != p->closedSocks) {
+			continue;
+		}
+		cs->rcvBuf = p->rcvBuf;
+		cs->sndBuf = p->sndBuf;
+		cs->inqSum += p->inq;
+		cs->outqSum += p->outq;
+		cs->inqMax = p->inq > cs->inqMax ? p->inq : cs->inqMax;
+		cs->outqMax = p->outq > cs->outqMax ? p->outq : cs->outqMax;
+		cs->inqLast = p->inq;
+		cs->outqLast = p->outq;
+		cs->queueSamples++;
+		if (p->recvTcpOk) {
+			tcpInfoAdd(&cs->recvTcp, &p->recvTcp);
+		}
+		if (p->sendTcpOk) {
+			tcpInfoAdd(&cs->sendTcp, &p->sendTcp);
+		}
+		if (!p->cpuOk) {
+			continue;
+		}
+		if (cs->cpuSampleNs != 0 && p->cpuNs > cs->cpuSampleNs) {
+			cs->busySum += (p->cpuTicks - cs->cpuTicksLast) / ticks / ((p->cpuNs - cs->cpuSampleNs) * 1e-9);
+			cs->busySamples++;
+		}
+		cs->cpuTicksLast = p->cpuTicks;
+		cs->cpuSampleNs = p->cpuNs;
+	}
+	pthread_mutex_unlock(&connStatsLock);
+}
+
+const char* connStatsBottleneck(ConnStats* cs, unsigned long long int elapsedNs) {
+	if (elapsedNs == 0) {
+		return "unknown";
+	}
+	double recvFrac = (double) cs->recvWaitNs / elapsedNs;
+	double sendFrac = (double) cs->sendBlockNs / elapsedNs;
+	double samples = cs->queueSamples > 0 ? (double) cs->queueSamples : 1.0;
+	double outqFill = cs->sndBuf > 0 ? (cs->outqSum / samples) / (cs->sndBuf / 2) : 0.0; // The kernel doubles SO_SNDBUF for its overhead.
+	double inqFill = cs->rcvBuf > 0 ? (cs->inqSum / samples) / (cs->rcvBuf / 2) : 0.0;
+	double busy = cs->busySamples > 0 ? cs->busySum / cs->busySamples : 0.0;
+
+	if (busy > 0.9) {
+		return "this stage"; // The handling thread is on CPU all the time.
+	}
+	if (cs->sendSock >= 0 && sendFrac >= recvFrac && (sendFrac > 0.3 || outqFill > 0.8)) {
+		return "downstream";
+	}
+	if (cs->recvSock >= 0 && recvFrac > 0.3 && inqFill < 0.8) {
+		return "upstream";
+	}
+	return "this stage";
+}
+
+void connStatsPrintStall(ConnStats* cs, const char* prefix) {
+	unsigned long long int elapsedNs = timingNowNs() - cs->openNs;
+	double elapsed = elapsedNs * 1e-9;
+	double samples = cs->queueSamples > 0 ? (double) cs->queueSamples : 1.0;
+
+	// Queues and thread CPU are there only when the report thread sampled them (-i, -m, -continuous or -tcpinfo).
+	if (cs->recvSock >= 0) {
+		printf("%srecv wait: %lf s (%.1f%%)", prefix, cs->recvWaitNs * 1e-9, elapsed > 0 ? cs->recvWaitNs * 1e-7 / elapsed : 0.0);
+		if (cs->queueSamples > 0) {
+			printf(", inq avg: %.0f max: %d of rcvbuf %d Bytes", cs->inqSum / samples, cs->inqMax, cs->rcvBuf);
+		}
+		printf("\n");
+	}
+	if (cs->sendSock >= 0) {
+		printf("%ssend blocked: %lf s (%.1f%%)", prefix, cs->sendBlockNs * 1e-9, elapsed > 0 ? cs->sendBlockNs * 1e-7 / elapsed : 0.0);
+		if (cs->queueSamples > 0) {
+			printf(", outq avg: %.0f max: %d of sndbuf %d Bytes", cs->outqSum / samples, cs->outqMax, cs->sndBuf);
+		}
+		printf("\n");
+	}
+	if (cs->busySamples > 0) {
+		printf("%sthread busy: %.1f%%, ", prefix, cs->busySum * 100.0 / cs->busySamples);
+	}
+	else {
+		printf("%s", prefix);
+	}
+	printf("bottleneck: %s\n", connStatsBottleneck(cs, elapsedNs));
+	connStatsPrintSizes(cs, prefix);
+	tcpInfoPrint(&cs->recvTcp, prefix, "recv");
+	tcpInfoPrint(&cs->sendTcp, prefix, "send");
+}
+
+// Lower bound of a histogram bin as "512", "64K" or "1M".
+static void connStatsBinName(int bin, char* name, size_t nameSize) {
+	unsigned long long int low = bin == 0 ? 0 : 1ULL << (bin - 1);
+
+	if (low >= (1ULL << 20)) {
+		snprintf(name, nameSize, "%lluM", low >> 20);
+	}
+	else if (low >= (1ULL << 10)) {
+		snprintf(name, nameSize, "%lluK", low >> 10);
+	}
+	else {
+		snprintf(name, nameSize, "%llu", low);
+	}
+}
+
+static void connStatsPrintHist(const char* prefix, const char* dir, unsigned long long int* hist, unsigned long long int calls, unsigned long long int bytes, unsigned long long int zero, double elapsed) {
+	char name[16];
+	int bin;
+
+	printf("%s%s calls: %llu (%.0f /s), %.0f Bytes/call, zero-progress: %llu\n", prefix, dir, calls, elapsed > 0 ? calls / elapsed : 0.0, calls > 0 ? (double) bytes / calls : 0.0, zero);
+	if (calls == 0) {
+		return;
+	}
+	printf("%s%s size:", prefix, dir);
+	for (bin = 0; bin < CONNSTATSHISTBINS; bin++) {
+		if (hist[bin] != 0) {
+			connStatsBinName(bin, name, sizeof(name));
+			printf(" %s+ %.1f%%", name, hist[bin] * 100.0 / calls);
+		}
+	}
+	printf("\n");
+}
+
+void connStatsPrintSizes(ConnStats* cs, const char* prefix) {
+	double elapsed = (timingNowNs() - cs->openNs) * 1e-9;
+
+	if (cs->recvSock >= 0) {
+		connStatsPrintHist(prefix, "recv", cs->recvHist, cs->recvCalls, cs->recvBytes, cs->recvZero, elapsed);
+	}
+	if (cs->sendSock >= 0) {
+		connStatsPrintHist(prefix, "send", cs->sendHist, cs->sendCalls, cs->sendBytes, cs->sendZero, elapsed);
+	}
+}
@@ -0,0 +1,199 @@
+#ifndef CONNSTATS_H
+#define CONNSTATS_H
+
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "timing.h"
+#include "tcpInfo.h"
+
+#define MAXCONNSTATS 1024 // Default of the maximum connections tracked at the same time, see connStatsInit().
+#define CONNSTATSMAXAUTO 65536 // Most slots sized from the fd limit of the event loop server.
+#define CONNSTATSSAMPLEBATCH 1024 // Connections sampled per connStatsSampleQueues(), the next call goes on from there.
+#define CONNSTATSRECVCLOSED 1
+#define CONNSTATSSENDCLOSED 2
+#define CONNSTATSHISTBINS 32 // Bin b counts calls returning [2^(b-1), 2^b) Bytes, bin 0 counts 0 Bytes.
+
+// [ ConnStats
+// Live counters of one connection, or one receive-send session of an L2 client.
+// Counters are written only by the thread owning the connection and read by observer threads (metrics, reports), so no lock is taken on the data path.
+// The shared overflow slot is the exception, its counters are written by several threads with atomic adds.
+typedef struct connStats {
+	int inUse;
+	int shared; // The overflow slot.
+	int id; // Slot index, stable while the connection is open.
+	const char* role; // "server", "l1client", "l2client", ...
+	int recvSock; // Socket whose receive queue is sampled, -1 if none.
+	int sendSock; // Socket whose send queue is sampled, -1 if none.
+	int closedSocks; // CONNSTATSRECVCLOSED and CONNSTATSSENDCLOSED, sockets closed by connStatsCloseSock().
+	pid_t tid; // Thread handling the connection.
+	struct sockaddr_in peerAddress;
+
+	unsigned long long int recvBytes;
+	unsigned long long int recvCalls;
+	unsigned long long int sendBytes;
+	unsigned long long int sendCalls;
+
+	// Bytes moved per recv() and send() call, log2 bins. A zero-progress call returned EAGAIN or EINTR
+	// after a wakeup, so it cost a syscall and moved nothing.
+	unsigned long long int recvHist[CONNSTATSHISTBINS];
+	unsigned long long int sendHist[CONNSTATSHISTBINS];
+	unsigned long long int recvZero;
+	unsigned long long int sendZero;
+
+	// Stall accounting, see connStatsBottleneck().
+	unsigned long long int openNs; // timingNowNs() when opened.
+	unsigned long long int recvWaitNs; // Time spent in recv(), waiting for the previous hop.
+	unsigned long long int sendBlockNs; // Time spent in send(), blocked by the next hop.
+
+	// Socket queues, sampled by connStatsSampleQueues() from the report thread.
+	unsigned long long int queueSamples;
+	unsigned long long int inqSum;
+	unsigned long long int outqSum;
+	int inqMax;
+	int outqMax;
+	int inqLast; // Latest sample, the metrics gauges.
+	int outqLast;
+	int rcvBuf; // SO_RCVBUF of recvSock.
+	int sndBuf; // SO_SNDBUF of sendSock.
+
+	// CPU use of the handling thread, sampled once a second. Time in recv() and send() includes copying,
+	// so a busy thread is the limit itself even when those times are high.
+	unsigned long long int cpuTicksLast;
+	unsigned long long int cpuSampleNs;
+	double busySum;
+	unsigned long long int busySamples;
+
+	// TCP_INFO of recvSock and sendSock, sampled with the queues.
+	TcpInfoStats recvTcp;
+	TcpInfoStats sendTcp;
+} ConnStats;
+
+// Totals of all connections, both open and closed.
+typedef struct connStatsTotals {
+	int activeConnections;
+	unsigned long long int closedConnections;
+	unsigned long long int recvBytes;
+	unsigned long long int recvCalls;
+	unsigned long long int sendBytes;
+	unsigned long long int sendCalls;
+	unsigned long long int cpuNs; // CPU time of other processes added by connStatsTotalsHook(), the fork workers.
+} ConnStatsTotals;
+
+extern int connStatsMax; // Slots in the table.
+
+// Allocate the table with "maxConnections" slots. Call once before any connection is opened or observed.
+void connStatsInit(int maxConnections);
+
+// Claim a slot for a new connection. Never returns NULL: when all slots are taken a shared overflow slot is returned, which is counted in the totals only.
+ConnStats* connStatsOpen(const char* role, int recvSock, int sendSock, pid_t tid, struct sockaddr_in* peerAddress);
+void connStatsClose(ConnStats* cs);
+// close() a socket of a connection that stays open. The report thread samples the sockets of open slots, so the socket
+// is marked closed under the lock first and a new connection reusing the fd number is never sampled in its place.
+void connStatsCloseSock(ConnStats* cs, int sock);
+
+// Copy the open slots into "snapshot" (connStatsMax entries), return how many were copied. "totals" may be NULL,
+// "snapshot" may be NULL to get the totals only.
+int connStatsSnapshot(ConnStats* snapshot, ConnStatsTotals* totals);
+// Connections counted outside the table, the fork server's workers. "hook" adds them to the totals of every
+// connStatsSnapshot(), so the metrics and the reports see them. Set it before those threads read.
+void connStatsTotalsHook(void (*hook)(ConnStatsTotals* totals));
+
+#define CONNSTATSCPUSAMPLE 10 // Thread CPU is sampled every 10th queue sample.
+#define CONNSTATSTIDCACHE 64 // Threads whose CPU time is read once per sample, however many connections they handle.
+
+// Sample socket queues, TCP_INFO and thread CPU of up to CONNSTATSSAMPLEBATCH open connections, round robin over the
+// table, so at tens of thousands of connections each is sampled less often instead of the lock being held for long.
+void connStatsSampleQueues();
+int connStatsQueueDepth(int sock, int request); // SIOCINQ or SIOCOUTQ, 0 on error.
+
+// Which hop limits this connection: "downstream" (the next hop does not take data fast enough), "upstream" (waiting for the previous hop)
+// or "this stage" (neither, so this process is the limit).
+const char* connStatsBottleneck(ConnStats* cs, unsigned long long int elapsedNs);
+void connStatsPrintStall(ConnStats* cs, const char* prefix);
+void connStatsPrintSizes(ConnStats* cs, const char* prefix); // Also called by connStatsPrintStall().
+
+static inline int connStatsHistBin(unsigned long long int size) {
+	int bin = size == 0 ? 0 : 64 - __builtin_clzll(size);
+	return bin < CONNSTATSHISTBINS ? bin : CONNSTATSHISTBINS - 1;
+}
+
+// Add to a counter of "cs", a plain store when one thread owns the slot.
+static inline void connStatsAdd(ConnStats* cs, unsigned long long int* counter, unsigned long long int n) {
+	if (cs->shared) {
+		__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+	}
+	else {
+		__atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+	}
+}
+
+static inline int connStatsNoProgress(ssize_t ret) {
+	return ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+}
+
+static inline void connStatsRecvZero(ConnStats* cs) {
+	connStatsAdd(cs, &cs->recvZero, 1);
+}
+
+static inline void connStatsSendZero(ConnStats* cs) {
+	connStatsAdd(cs, &cs->sendZero, 1);
+}
+
+static inline void connStatsRecvWait(ConnStats* cs, unsigned long long int ns) {
+	connStatsAdd(cs, &cs->recvWaitNs, ns);
+}
+
+static inline void connStatsSendBlock(ConnStats* cs, unsigned long long int ns) {
+	connStatsAdd(cs, &cs->sendBlockNs, ns);
+}
+
+// recv() and send() with the time spent inside them accounted to "cs".
+static inline ssize_t connStatsTimedRecv(ConnStats* cs, int sock, void* buf, size_t len, int flags) {
+	unsigned long long int t = timingNowNs();
+	ssize_t ret = recv(sock, buf, len, flags);
+	connStatsRecvWait(cs, timingNowNs() - t);
+	if (connStatsNoProgress(ret)) {
+		connStatsRecvZero(cs);
+	}
+	return ret;
+}
+
+static inline ssize_t connStatsTimedSend(ConnStats* cs, int sock, const void* buf, size_t len, int flags) {
+	unsigned long long int t = timingNowNs();
+	ssize_t ret = send(sock, buf, len, flags);
+	connStatsSendBlock(cs, timingNowNs() - t);
+	if (connStatsNoProgress(ret)) {
+		connStatsSendZero(cs);
+	}
+	return ret;
+}
+
+static inline void connStatsRecv(ConnStats* cs, int size) {
+	connStatsAdd(cs, &cs->recvBytes, size);
+	connStatsAdd(cs, &cs->recvCalls, 1);
+	int bin = connStatsHistBin(size);
+	connStatsAdd(cs, &cs->recvHist[bin], 1);
+}
+
+// Datagrams taken from a packet ring in one go, binned at their mean size.
+static inline void connStatsRecvBatch(ConnStats* cs, unsigned long long int bytes, unsigned long long int calls) {
+	if (calls == 0) {
+		return;
+	}
+	connStatsAdd(cs, &cs->recvBytes, bytes);
+	connStatsAdd(cs, &cs->recvCalls, calls);
+	int bin = connStatsHistBin(bytes / calls);
+	connStatsAdd(cs, &cs->recvHist[bin], calls);
+}
+
+static inline void connStatsSend(ConnStats* cs, int size) {
+	connStatsAdd(cs, &cs->sendBytes, size);
+	connStatsAdd(cs, &cs->sendCalls, 1);
+	int bin = connStatsHistBin(size);
+	connStatsAdd(cs, &cs->sendHist[bin], 1);
+}
+// ]
+
+#endif // CONNSTATS_H
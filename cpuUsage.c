@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <sys/resource.h> // for getrusage().
 #include <linux/limits.h>
 #include "cpuUsage.h"
 #include "dieWithError.h"
@@ -43,26 +44,50 @@ float calWholeCPUUse(ProcStat* ps1, ProcStat* ps2) {
 	return CPUUse;
 }
 
-void getProcessCPUStatus(ProcPidStat* pps, pid_t pid) {
-	//printf("\n======== getProcessCPUStatus() begin ========\n");
-
-	// Get "/proc/[pid]/stat" info.
+// Parse one "/proc/[pid]/stat" or "/proc/[pid]/task/[tid]/stat" file. Return 0 on success, -1 if the file can not be opened.
+static int readPidStat(const char* fileName, ProcPidStat* pps) {
 	FILE* inputFile = NULL;
-	char fileName[1024];
-	sprintf(fileName, "/proc/%d/stat", pid);
-	//printf(fileName);
 	inputFile = fopen(fileName, "r");
 	if (!inputFile) {
-		dieWithError("fopen() failed");
+		return -1;
 	}
 	
 	char buff[1024];
-	fgets(buff, sizeof(buff), inputFile);
+	if (!fgets(buff, sizeof(buff), inputFile)) {
+		fclose(inputFile);
+		return -1;
+	}
 	//printf(buff);
-	sscanf(buff, "%lld %s %c %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld ", &pps->pid, pps->tcomm, &pps->state, &pps->ppid, &pps->pgid, &pps->sid, &pps->tty_nr, &pps->tty_pgrp, &pps->flags, &pps->min_flt, &pps->cmin_flt, &pps->maj_flt, &pps->cmaj_flt, &pps->utime, &pps->stimev, &pps->cutime, &pps->cstime);
+	// "tcomm" is in parentheses and may hold spaces or ')', so every other field is read after the last ')'.
+	char* open = strchr(buff, '(');
+	char* close = strrchr(buff, ')');
+	if (!open || !close || close < open) {
+		fclose(inputFile);
+		return -1;
+	}
+	pps->pid = atoll(buff);
+	size_t commLen = close - open - 1;
+	memcpy(pps->tcomm, open + 1, commLen);
+	pps->tcomm[commLen] = '\0';
+	// nswap and cnswap, always 0, are read into zero1 and zero2.
+	sscanf(close + 1, " %c %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %llu %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld", &pps->state, &pps->ppid, &pps->pgid, &pps->sid, &pps->tty_nr, &pps->tty_pgrp, &pps->flags, &pps->min_flt, &pps->cmin_flt, &pps->maj_flt, &pps->cmaj_flt, &pps->utime, &pps->stimev, &pps->cutime, &pps->cstime, &pps->priority, &pps->nicev, &pps->num_threads, &pps->it_real_value, &pps->start_time, &pps->vsize, &pps->rss, &pps->rsslim, &pps->start_code, &pps->end_code, &pps->start_stack, &pps->esp, &pps->eip, &pps->pending, &pps->blocked, &pps->sigign, &pps->sigcatch, &pps->wchan, &pps->zero1, &pps->zero2, &pps->exit_signal, &pps->cpu, &pps->rt_priority, &pps->policy);
 	//printf("process: %s, utime: %lld, stimev: %lld, cutime: %lld, cstime: %lld\n", pps->tcomm, pps->utime, pps->stimev, pps->cutime, pps->cstime);
 	fclose(inputFile);
 
+	return 0;
+}
+
+void getProcessCPUStatus(ProcPidStat* pps, pid_t pid) {
+	//printf("\n======== getProcessCPUStatus() begin ========\n");
+
+	// Get "/proc/[pid]/stat" info.
+	char fileName[1024];
+	sprintf(fileName, "/proc/%d/stat", pid);
+	//printf(fileName);
+	if (readPidStat(fileName, pps) < 0) {
+		dieWithError("fopen() failed");
+	}
+
 	//printf("======== getProcessCPUStatus() end ========\n");
 
 }
@@ -80,31 +105,43 @@ float calProcessCPUUse(ProcStat* ps1, ProcPidStat* pps1, ProcStat* ps2, ProcPidS
 	return CPUUse;
 }
 
+void printMemoryStatus(const char* prefix, ProcPidStat* pps1, ProcPidStat* pps2, unsigned long long int bytes) {
+	struct rusage usage;
+	double pageMB = sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+	double peakMB = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss / 1024.0 : 0.0; // Linux keeps ru_maxrss in KB.
+	num minor = pps2->min_flt - pps1->min_flt;
+	num major = pps2->maj_flt - pps1->maj_flt;
+	double gb = bytes / 1e9;
+
+	printf("%smemory: rss %.1f MB, peak rss %.1f MB, vsize %.1f MB, threads %lld\n", prefix, pps2->rss * pageMB, peakMB, pps2->vsize / (1024.0 * 1024.0), pps2->num_threads);
+	if (gb > 0) {
+		printf("%spage faults: minor %lld, major %lld, per GB: minor %.1f, major %.1f\n", prefix, minor, major, minor / gb, major / gb);
+	}
+	else {
+		printf("%spage faults: minor %lld, major %lld\n", prefix, minor, major);
+	}
+}
+
 // Thread "/proc/<pid>/task/<tid>" has the same data structure as process.
 void getThreadCPUStatus(ProcPidStat* pps, pid_t pid, pid_t tid) { 
 	//printf("\n======== getThreadCPUStatus() begin ========\n");
 
-	// Get "/proc/[pid]/stat" info.
-	FILE* inputFile = NULL;
-	char fileName[1024];
-	sprintf(fileName, "/proc/%d/task/%d/stat", pid, tid);
-	//printf(fileName);
-	inputFile = fopen(fileName, "r");
-	if (!inputFile) {
+	if (tryGetThreadCPUStatus(pps, pid, tid) < 0) {
 		dieWithError("fopen() failed");
 	}
-	
-	char buff[1024];
-	fgets(buff, sizeof(buff), inputFile);
-	//printf(buff);
-	sscanf(buff, "%lld %s %c %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld ", &pps->pid, pps->tcomm, &pps->state, &pps->ppid, &pps->pgid, &pps->sid, &pps->tty_nr, &pps->tty_pgrp, &pps->flags, &pps->min_flt, &pps->cmin_flt, &pps->maj_flt, &pps->cmaj_flt, &pps->utime, &pps->stimev, &pps->cutime, &pps->cstime);
-	//printf("Thread: %s, utime: %lld, stimev: %lld, cutime: %lld, cstime: %lld\n", pps->tcomm, pps->utime, pps->stimev, pps->cutime, pps->cstime);
-	fclose(inputFile);
 
 	//printf("======== getThreadCPUStatus() end ========\n");
 
 }
 
+// Same as getThreadCPUStatus(), but return -1 instead of exiting when the thread is gone. Used by observers of other threads.
+int tryGetThreadCPUStatus(ProcPidStat* pps, pid_t pid, pid_t tid) {
+	char fileName[1024];
+	sprintf(fileName, "/proc/%d/task/%d/stat", pid, tid);
+	//printf(fileName);
+	return readPidStat(fileName, pps);
+}
+
 float calThreadCPUUse(ProcStat* ps1, ProcPidStat* pps1, ProcStat* ps2, ProcPidStat* pps2) {
 	//printf("\n======== calThreadCPUUse() begin ========\n");
 	float CPUUse = 0.0;
@@ -120,6 +157,12 @@ float calThreadCPUUse(ProcStat* ps1, ProcPidStat* pps1, ProcStat* ps2, ProcPidSt
 
 }
 
+unsigned long long int threadCPUNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (unsigned long long int) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 /*
 int main(int argc, char* argv[]) {
 
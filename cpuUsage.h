@@ -77,6 +77,13 @@ float calProcessCPUUse(ProcStat* ps1, ProcPidStat* pps1, ProcStat* ps2, ProcPidS
 
 // Thread "/proc/<pid>/task/<tid>" has the same data structure as process, ProcPidStat.
 void getThreadCPUStatus(ProcPidStat* pps, pid_t pid, pid_t tid); 
+int tryGetThreadCPUStatus(ProcPidStat* pps, pid_t pid, pid_t tid);
 float calThreadCPUUse(ProcStat* ps1, ProcPidStat* pps1, ProcStat* ps2, ProcPidStat* pps2);
 
+// Memory of the process at "pps2" (rss, peak rss, vsize, threads) and the page faults from "pps1" to "pps2", also per GB
+// of "bytes", the Bytes moved in between. One line each, both start with "prefix".
+void printMemoryStatus(const char* prefix, ProcPidStat* pps1, ProcPidStat* pps2, unsigned long long int bytes);
+
+unsigned long long int threadCPUNs(); // CPU time of the calling thread (ns), cheap enough to wrap single operations.
+
 #endif // CPUUSAGE_H
@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <nmmintrin.h> // for _mm_crc32_u64().
+#include "crc32c.h"
+#include "cpuUsage.h"
+
+#define CRC32CPOLY 0x82f63b78 // Reflected Castagnoli polynomial.
+#define CRC32CLANE 4096 // Bytes per lane of the interleaved kernel.
+
+static uint32_t crc32cTable[8][256];
+static uint32_t crc32cShift1; // x^(8*CRC32CLANE) mod P, shifts a CRC over one lane.
+static uint32_t crc32cShift2; // Over two lanes.
+static uint32_t (*crc32cImpl)(uint32_t crc, const unsigned char* p, size_t len);
+static pthread_once_t crc32cOnce = PTHREAD_ONCE_INIT;
+
+// a * b mod P, both reflected.
+static uint32_t crc32cMultiply(uint32_t a, uint32_t b) {
+	uint32_t m = 1u << 31;
+	uint32_t p = 0;
+
+	while (m != 0) {
+		if (a & m) {
+			p ^= b;
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ CRC32CPOLY : b >> 1;
+	}
+	return p;
+}
+
+static uint32_t crc32cSoft(uint32_t crc, const unsigned char* p, size_t len) {
+	while (len > 0 && ((uintptr_t) p & 7) != 0) {
+		crc = crc32cTable[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+	while (len >= 8) {
+		uint64_t v;
+		memcpy(&v, p, 8);
+		v ^= crc;
+		crc = crc32cTable[7][v & 0xff] ^ crc32cTable[6][(v >> 8) & 0xff] ^ crc32cTable[5][(v >> 16) & 0xff] ^ crc32cTable[4][(v >> 24) & 0xff]
+			^ crc32cTable[3][(v >> 32) & 0xff] ^ crc32cTable[2][(v >> 40) & 0xff] ^ crc32cTable[1][(v >> 48) & 0xff] ^ crc32cTable[0][v >> 56];
+		p += 8;
+		len -= 8;
+	}
+	while (len > 0) {
+		crc = crc32cTable[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+	return crc;
+}
+
+// The crc32 instruction has a latency of 3 cycles and a throughput of 1, so three independent lanes run at once
+// and are joined by shifting the earlier lanes' CRCs over the later lanes.
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHard(uint32_t crc, const unsigned char* p, size_t len) {
+	uint64_t c0 = crc;
+
+	while (len > 0 && ((uintptr_t) p & 7) != 0) {
+		c0 = _mm_crc32_u8((uint32_t) c0, *p++);
+		len--;
+	}
+	while (len >= 3 * CRC32CLANE) {
+		uint64_t c1 = 0;
+		uint64_t c2 = 0;
+		const unsigned char* end = p + CRC32CLANE;
+		while (p < end) {
+			uint64_t v0, v1, v2;
+			memcpy(&v0, p, 8);
+			memcpy(&v1, p + CRC32CLANE, 8);
+			memcpy(&v2, p + 2 * CRC32CLANE, 8);
+			c0 = _mm_crc32_u64(c0, v0);
+			c1 = _mm_crc32_u64(c1, v1);
+			c2 = _mm_crc32_u64(c2, v2);
+			p += 8;
+		}
+		c0 = crc32cMultiply(crc32cShift2, (uint32_t) c0) ^ crc32cMultiply(crc32cShift1, (uint32_t) c1) ^ c2;
+		p += 2 * CRC32CLANE;
+		len -= 3 * CRC32CLANE;
+	}
+	while (len >= 8) {
+		uint64_t v;
+		memcpy(&v, p, 8);
+		c0 = _mm_crc32_u64(c0, v);
+		p += 8;
+		len -= 8;
+	}
+	while (len > 0) {
+		c0 = _mm_crc32_u8((uint32_t) c0, *p++);
+		len--;
+	}
+	return (uint32_t) c0;
+}
+
+static void crc32cInit() {
+	uint32_t i, j;
+
+	for (i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for (j = 0; j < 8; j++) {
+			c = (c & 1) ? (c >> 1) ^ CRC32CPOLY : c >> 1;
+		}
+		crc32cTable[0][i] = c;
+	}
+	for (i = 0; i < 256; i++) {
+		for (j = 1; j < 8; j++) {
+			crc32cTable[j][i] = crc32cTable[0][crc32cTable[j-1][i] & 0xff] ^ (crc32cTable[j-1][i] >> 8);
+		}
+	}
+
+	uint32_t x8 = 1u << 23; // x^8.
+	crc32cShift1 = 1u << 31; // x^0.
+	for (i = 0; i < CRC32CLANE; i++) {
+		crc32cShift1 = crc32cMultiply(crc32cShift1, x8);
+	}
+	crc32cShift2 = crc32cMultiply(crc32cShift1, crc32cShift1);
+
+	__builtin_cpu_init();
+	crc32cImpl = __builtin_cpu_supports("sse4.2") ? crc32cHard : crc32cSoft;
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t len) {
+	pthread_once(&crc32cOnce, crc32cInit);
+	return ~crc32cImpl(~crc, (const unsigned char*) data, len);
+}
+
+const char* crc32cImplName() {
+	pthread_once(&crc32cOnce, crc32cInit);
+	return crc32cImpl == crc32cHard ? "sse4.2" : "table";
+}
+
+void crc32cFrameSeal(char* frame, size_t frameSize) {
+	uint32_t crc = htonl(crc32c(0, frame, frameSize - CRC32CSIZE));
+	memcpy(frame + frameSize - CRC32CSIZE, &crc, CRC32CSIZE);
+}
+
+static void crcCheckFrame(void* ctx, const char* frame, size_t frameSize, const FrameHeader* hdr) {
+	CrcChecker* cc = (CrcChecker*) ctx;
+	uint32_t crc;
+
+	cc->frames++;
+	if (!(hdr->flags & FRAMEFLAGCRC) || hdr->length < CRC32CSIZE) {
+		return;
+	}
+	cc->checked++;
+	cc->checkedBytes += frameSize;
+	memcpy(&crc, frame + frameSize - CRC32CSIZE, CRC32CSIZE);
+	if (crc32c(0, frame, frameSize - CRC32CSIZE) != ntohl(crc)) {
+		if (cc->failures == 0) {
+			cc->firstBadSrcId = hdr->srcId;
+			cc->firstBadSeq = hdr->seq;
+		}
+		cc->failures++;
+	}
+}
+
+CrcChecker* crcCheckerAlloc() {
+	CrcChecker* cc;
+	if ((cc = (CrcChecker*) calloc(1, sizeof(CrcChecker))) != NULL) {
+		if ((cc->fr = frameReaderAlloc()) == NULL) {
+			free(cc);
+			return NULL;
+		}
+		cc->firstBadSrcId = -1;
+		cc->firstBadSeq = -1;
+	}
+
+	return cc;
+}
+
+void crcCheckerRelease(CrcChecker* cc) {
+	frameReaderRelease(cc->fr);
+	free(cc);
+}
+
+void crcCheckerFeed(CrcChecker* cc, const char* buf, size_t len) {
+	unsigned long long int t = threadCPUNs();
+	frameReaderFeed(cc->fr, buf, len, crcCheckFrame, cc);
+	cc->verifyNs += threadCPUNs() - t;
+}
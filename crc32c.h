@@ -0,0 +1,36 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "frame.h"
+
+// [ CRC32C
+// Castagnoli CRC, the one the SSE4.2 crc32 instruction computes. Uses the instruction when the CPU has it, a slicing-by-8 table otherwise.
+#define CRC32CSIZE 4 // Trailer size on the wire.
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t len); // Start with crc 0, pass the result on to continue.
+const char* crc32cImplName(); // "sse4.2" or "table".
+// ]
+
+// [ Checked frames
+// Frames with FRAMEFLAGCRC end with CRC32C(header and payload before the trailer) in network byte order.
+void crc32cFrameSeal(char* frame, size_t frameSize); // Write the trailer into the last CRC32CSIZE bytes.
+
+typedef struct crcChecker {
+	FrameReader* fr;
+	unsigned long long int frames;
+	unsigned long long int checked; // Frames carrying a CRC.
+	unsigned long long int failures;
+	unsigned long long int checkedBytes;
+	unsigned long long int verifyNs; // Thread CPU time spent parsing and verifying.
+	int firstBadSrcId; // Source and sequence of the first failure, -1 if none.
+	long long int firstBadSeq;
+} CrcChecker;
+
+CrcChecker* crcCheckerAlloc();
+void crcCheckerRelease(CrcChecker* cc);
+void crcCheckerFeed(CrcChecker* cc, const char* buf, size_t len);
+// ]
+
+#endif // CRC32C_H
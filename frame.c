@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "frame.h"
+#include "dieWithError.h"
+
+void frameHeaderWrite(char* dst, uint16_t srcId, uint16_t flags, uint32_t seq, uint32_t length) {
+	FrameHeader hdr;
+	hdr.magic = htonl(FRAMEMAGIC);
+	hdr.srcId = htons(srcId);
+	hdr.flags = htons(flags);
+	hdr.seq = htonl(seq);
+	hdr.length = htonl(length);
+	memcpy(dst, &hdr, FRAMEHEADERSIZE);
+}
+
+void frameHeaderRead(const char* src, FrameHeader* hdr) {
+	memcpy(hdr, src, FRAMEHEADERSIZE);
+	hdr->magic = ntohl(hdr->magic);
+	hdr->srcId = ntohs(hdr->srcId);
+	hdr->flags = ntohs(hdr->flags);
+	hdr->seq = ntohl(hdr->seq);
+	hdr->length = ntohl(hdr->length);
+}
+
+FrameReader* frameReaderAlloc() {
+	return (FrameReader*) calloc(1, sizeof(FrameReader)); // "carry" comes with the first frame spanning two buffers.
+}
+
+void frameReaderRelease(FrameReader* fr) {
+	free(fr->carry);
+	free(fr);
+}
+
+// Make room for "size" Bytes in carry, keeping what it holds.
+static void frameReaderReserve(FrameReader* fr, size_t size) {
+	if (size <= fr->carryCap) {
+		return;
+	}
+	size_t cap = fr->carryCap > 0 ? fr->carryCap : 4096;
+	while (cap < size) {
+		cap *= 2;
+	}
+	cap = cap < FRAMEMAXSIZE ? cap : FRAMEMAXSIZE;
+	char* carry = (char*) realloc(fr->carry, cap);
+	if (carry == NULL) {
+		dieWithError("frameReaderReserve realloc() failed");
+	}
+	fr->carry = carry;
+	fr->carryCap = cap;
+}
+
+// Check a complete header, return the frame size or 0 if the header is bad.
+static size_t frameSizeOf(const char* header, FrameHeader* hdr) {
+	frameHeaderRead(header, hdr);
+	if (hdr->magic != FRAMEMAGIC || hdr->length > FRAMEMAXSIZE - FRAMEHEADERSIZE) {
+		return 0;
+	}
+	return FRAMEHEADERSIZE + hdr->length;
+}
+
+void frameReaderFeed(FrameReader* fr, const char* buf, size_t len, FrameHandler handler, void* ctx) {
+	FrameHeader hdr;
+	size_t n;
+
+	while (len > 0) {
+		// Finish the frame held in carry first.
+		if (fr->carrySize > 0) {
+			if (fr->carryNeed == 0) {
+				frameReaderReserve(fr, FRAMEHEADERSIZE);
+				n = FRAMEHEADERSIZE - fr->carrySize;
+				n = n < len ? n : len;
+				memcpy(fr->carry + fr->carrySize, buf, n);
+				fr->carrySize += n;
+				buf += n;
+				len -= n;
+				if (fr->carrySize < FRAMEHEADERSIZE) {
+					return;
+				}
+				if ((fr->carryNeed = frameSizeOf(fr->carry, &hdr)) == 0) {
+					// Bad header: drop one byte and look for a header again.
+					fr->skippedBytes++;
+					memmove(fr->carry, fr->carry + 1, FRAMEHEADERSIZE - 1);
+					fr->carrySize = FRAMEHEADERSIZE - 1;
+					continue;
+				}
+				frameReaderReserve(fr, fr->carryNeed);
+			}
+			n = fr->carryNeed - fr->carrySize;
+			n = n < len ? n : len;
+			memcpy(fr->carry + fr->carrySize, buf, n);
+			fr->carrySize += n;
+			buf += n;
+			len -= n;
+			if (fr->carrySize < fr->carryNeed) {
+				return;
+			}
+			frameHeaderRead(fr->carry, &hdr);
+			handler(ctx, fr->carry, fr->carryNeed, &hdr);
+			fr->frames++;
+			fr->carrySize = 0;
+			fr->carryNeed = 0;
+			continue;
+		}
+
+		// Frames inside buf are handed out in place.
+		if (len < FRAMEHEADERSIZE) {
+			frameReaderReserve(fr, FRAMEHEADERSIZE);
+			memcpy(fr->carry, buf, len);
+			fr->carrySize = len;
+			return;
+		}
+		size_t frameSize = frameSizeOf(buf, &hdr);
+		if (frameSize == 0) {
+			fr->skippedBytes++;
+			buf++;
+			len--;
+			continue;
+		}
+		if (frameSize > len) {
+			frameReaderReserve(fr, frameSize);
+			memcpy(fr->carry, buf, len);
+			fr->carrySize = len;
+			fr->carryNeed = frameSize;
+			return;
+		}
+		handler(ctx, buf, frameSize, &hdr);
+		fr->frames++;
+		buf += frameSize;
+		len -= frameSize;
+	}
+}
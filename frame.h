@@ -0,0 +1,49 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FRAMEMAGIC 0x49444151 // "IDAQ".
+#define FRAMEHEADERSIZE 16 // sizeof(FrameHeader).
+#define FRAMEMAXSIZE (16*1024*1024) // Largest frame (header included) a FrameReader accepts.
+
+// Frame flags.
+#define FRAMEFLAGLZ 0x1 // Payload is an LZ compressed block (lz.h).
+#define FRAMEFLAGSTORED 0x2 // Payload is a block that did not compress.
+#define FRAMEFLAGCRC 0x4 // Payload ends with the CRC32C of the frame before it (crc32c.h).
+
+// [ FrameHeader
+// Header in front of every event when the L1 client runs with "-frame". All fields are in network byte order on the wire.
+typedef struct frameHeader {
+	uint32_t magic;
+	uint16_t srcId; // Source (front-end) id.
+	uint16_t flags;
+	uint32_t seq; // Event sequence number of the source.
+	uint32_t length; // Payload length, header excluded.
+} FrameHeader;
+
+void frameHeaderWrite(char* dst, uint16_t srcId, uint16_t flags, uint32_t seq, uint32_t length);
+void frameHeaderRead(const char* src, FrameHeader* hdr); // Convert to host byte order.
+// ]
+
+// [ FrameReader
+// Cut a TCP byte stream back into frames. Frames lying completely inside the fed buffer are handed out in place,
+// only frames spanning two recv() calls are copied into "carry". "carry" grows to the largest such frame, not FRAMEMAXSIZE.
+typedef void (*FrameHandler)(void* ctx, const char* frame, size_t frameSize, const FrameHeader* hdr);
+
+typedef struct frameReader {
+	char* carry;
+	size_t carryCap; // Bytes allocated for carry.
+	size_t carrySize; // Bytes held in carry.
+	size_t carryNeed; // Size of the frame being assembled in carry, 0 while its header is incomplete.
+	unsigned long long int frames;
+	unsigned long long int skippedBytes; // Bytes skipped to resynchronise after a bad magic or an oversized length.
+} FrameReader;
+
+FrameReader* frameReaderAlloc();
+void frameReaderRelease(FrameReader* fr);
+void frameReaderFeed(FrameReader* fr, const char* buf, size_t len, FrameHandler handler, void* ctx);
+// ]
+
+#endif // FRAME_H
@@ -0,0 +1,188 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "timing.h"
+#include "gen.h"
+#include "bufPool.h"
+
+#define GENADCPULSERATE 2000 // One pulse per this many samples on average.
+#define GENADCTAU 20.0 // Pulse decay constant (samples).
+#define GENSPARSEOCCUPANCY 20 // Hits fill one in this many hit slots on average.
+
+static const char* genTypeNames[] = {"pattern", "random", "adc", "sparse", "seq"};
+
+typedef struct genRng {
+	uint64_t s;
+} GenRng;
+
+static inline uint64_t genRngNext(GenRng* r) { // xorshift64*.
+	r->s ^= r->s >> 12;
+	r->s ^= r->s << 25;
+	r->s ^= r->s >> 27;
+	return r->s * 2685821657736338717ULL;
+}
+
+static inline double genRngUniform(GenRng* r) { // [0, 1).
+	return (genRngNext(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void genRngSeed(GenRng* r, uint64_t seed) { // splitmix64, so small seeds still give well mixed states.
+	uint64_t z = seed + 0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	r->s = (z ^ (z >> 31)) | 1;
+}
+
+static void genPattern(char* package, size_t pkgSize) {
+	memset(package, 'd', pkgSize);
+	package[0] = 's';
+	if (pkgSize >= 3) { // Packages too small for both ends keep the 's'.
+		package[pkgSize-2] = 'e';
+		package[pkgSize-1] = 'e';
+	}
+}
+
+static void genRandom(GenRng* r, char* package, size_t pkgSize) {
+	size_t i;
+	for (i = 0; i + 8 <= pkgSize; i += 8) {
+		uint64_t v = genRngNext(r);
+		memcpy(package + i, &v, 8);
+	}
+	if (i < pkgSize) {
+		uint64_t v = genRngNext(r);
+		memcpy(package + i, &v, pkgSize - i);
+	}
+}
+
+// The waveform continues from one package to the next, "pulse" carries the decaying pulse across.
+static void genAdc(GenRng* r, char* package, size_t pkgSize, int adcBits, double* pulse) {
+	double maxValue = (double) ((1 << adcBits) - 1);
+	double baseline = maxValue * 0.1;
+	double noise = adcBits >= 14 ? 8.0 : 2.0;
+	double decay = exp(-1.0 / GENADCTAU);
+	size_t i;
+
+	for (i = 0; i + 2 <= pkgSize; i += 2) {
+		if (genRngNext(r) % GENADCPULSERATE == 0) {
+			*pulse += genRngUniform(r) * maxValue * 0.8;
+		}
+		// Sum of four uniforms, close enough to Gaussian noise.
+		double n = genRngUniform(r) + genRngUniform(r) + genRngUniform(r) + genRngUniform(r) - 2.0;
+		double v = baseline + *pulse + n * noise * 1.73;
+		*pulse *= decay;
+		uint16_t sample = (uint16_t) (v < 0.0 ? 0.0 : (v > maxValue ? maxValue : v));
+		memcpy(package + i, &sample, 2);
+	}
+	if (i < pkgSize) {
+		package[i] = 0;
+	}
+}
+
+static void genSparse(GenRng* r, char* package, size_t pkgSize, uint32_t* clock) {
+	uint32_t slots = pkgSize >= 4 ? (uint32_t) ((pkgSize - 4) / 8) : 0;
+	uint32_t mean = slots / GENSPARSEOCCUPANCY > 0 ? slots / GENSPARSEOCCUPANCY : 1;
+	uint32_t hits = (uint32_t) (genRngNext(r) % (2 * mean + 1));
+	uint32_t channel = 0;
+	uint32_t i;
+	char* p = package + 4;
+
+	if (hits > slots) {
+		hits = slots;
+	}
+	memset(package, 0, pkgSize);
+	if (pkgSize < 4) {
+		return;
+	}
+	memcpy(package, &hits, 4);
+	for (i = 0; i < hits; i++) {
+		channel += 1 + (uint32_t) (genRngNext(r) % 64); // Channels ascend, as a zero-suppressing front-end reads them out.
+		double a = 50.0 - log(1.0 - genRngUniform(r)) * 200.0; // Long tail of large amplitudes.
+		uint16_t ch = (uint16_t) channel;
+		uint16_t amplitude = (uint16_t) (a > 4095.0 ? 4095.0 : a);
+		uint32_t t = *clock + (uint32_t) (genRngNext(r) % 25);
+		memcpy(p, &ch, 2);
+		memcpy(p + 2, &amplitude, 2);
+		memcpy(p + 4, &t, 4);
+		p += 8;
+	}
+	*clock += 25;
+}
+
+static void genSeq(char* package, size_t pkgSize, uint32_t* counter) {
+	size_t i;
+	for (i = 0; i + 4 <= pkgSize; i += 4) {
+		uint32_t v = (*counter)++;
+		memcpy(package + i, &v, 4);
+	}
+	if (i < pkgSize) {
+		memset(package + i, 0, pkgSize - i);
+	}
+}
+
+GenRing* genRingAlloc(GenType type, size_t pkgSize, uint64_t seed, int adcBits) {
+	GenRing* gr;
+	GenRng rng;
+	double pulse = 0.0;
+	uint32_t clock = 0;
+	uint32_t counter = (uint32_t) seed;
+	int i;
+
+	if (pkgSize == 0 || (gr = (GenRing*) calloc(1, sizeof(GenRing))) == NULL) {
+		return NULL;
+	}
+	gr->type = type;
+	gr->pkgSize = pkgSize;
+	gr->amount = type == GenPattern ? 1 : (int) (GENRINGBYTES / pkgSize);
+	if (gr->amount < GENRINGMIN && type != GenPattern) {
+		gr->amount = GENRINGMIN;
+	}
+	if ((gr->region = hugeRegionAlloc(gr->amount * pkgSize, currentNumaNode(), &gr->backing)) == NULL) {
+		free(gr);
+		return NULL;
+	}
+
+	unsigned long long int t1 = timingNowNs();
+	genRngSeed(&rng, seed);
+	for (i = 0; i < gr->amount; i++) {
+		char* package = gr->region + (size_t) i * pkgSize;
+		switch (type) {
+		case GenRandom:
+			genRandom(&rng, package, pkgSize);
+			break;
+		case GenAdc:
+			genAdc(&rng, package, pkgSize, adcBits, &pulse);
+			break;
+		case GenSparse:
+			genSparse(&rng, package, pkgSize, &clock);
+			break;
+		case GenSeq:
+			genSeq(package, pkgSize, &counter);
+			break;
+		default:
+			genPattern(package, pkgSize);
+			break;
+		}
+	}
+	gr->genNs = timingNowNs() - t1;
+
+	return gr;
+}
+
+void genRingRelease(GenRing* gr) {
+	hugeRegionRelease(gr->region, gr->amount * gr->pkgSize);
+	free(gr);
+}
+
+int genTypeParse(const char* name) {
+	int i;
+	for (i = 0; i < (int) (sizeof(genTypeNames) / sizeof(genTypeNames[0])); i++) {
+		if (strcmp(name, genTypeNames[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+const char* genTypeName(GenType type) {
+	return genTypeNames[type];
+}
@@ -0,0 +1,45 @@
+#ifndef GEN_H
+#define GEN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define GENRINGBYTES (16*1024*1024) // Pre-generated data per stream, larger than the caches and the LZ window.
+#define GENRINGMIN 4 // Packages in a ring at least.
+
+// [ GenRing
+// Payload of the L1 client, generated into a ring of packages before sending starts so the send loop only picks the next one.
+// Every generator is driven by a seeded PRNG, the same seed replays the same data.
+typedef enum GENTYPE {
+	GenPattern = 0, // 's', 'd'..., 'e', 'e'. The original payload.
+	GenRandom = 1, // Uniform random bytes.
+	GenAdc = 2, // Waveform samples (uint16, host order): baseline, noise and exponential pulses, 12 or 14 bits.
+	GenSparse = 3, // Zero-suppressed hits: hit count (uint32), then (channel uint16, amplitude uint16, time uint32) per hit, zero padded.
+	GenSeq = 4 // Counting uint32 words starting at the seed.
+} GenType;
+
+typedef struct genRing {
+	GenType type;
+	char* region;
+	const char* backing; // Page size backing the region, see hugeRegionAlloc().
+	size_t pkgSize;
+	int amount;
+	int next;
+	unsigned long long int genNs; // Time spent generating.
+} GenRing;
+
+GenRing* genRingAlloc(GenType type, size_t pkgSize, uint64_t seed, int adcBits);
+void genRingRelease(GenRing* gr);
+int genTypeParse(const char* name); // Return -1 for an unknown name.
+const char* genTypeName(GenType type);
+
+static inline char* genRingNext(GenRing* gr) {
+	char* package = gr->region + (size_t) gr->next * gr->pkgSize;
+	if (++gr->next == gr->amount) {
+		gr->next = 0;
+	}
+	return package;
+}
+// ]
+
+#endif // GEN_H
@@ -9,9 +9,45 @@
 #include <sys/syscall.h> // for SYS_gettid.
 #include "dieWithError.h"
 #include "cpuUsage.h"
+#include "connStats.h"
+#include "metrics.h"
+#include "frame.h"
+#include "byteQueue.h"
+#include "bufPool.h"
+#include "blockQueue.h"
+#include "clntSockPool.h"
+#include "mux.h"
+#include "lz.h"
+#include "crc32c.h"
+#include "gen.h"
+#include "timing.h"
+#include "perfCount.h"
+#include "latency.h"
+#include "packetRing.h"
+#include "report.h"
+#include "shmStats.h"
+#include "linkEmu.h"
+#include "trigger.h"
+#include "monitor.h"
+#include "topology.h"
+#include "bench.h"
+#include <sys/uio.h> // for writev().
+#include <fcntl.h> // for fcntl().
+#include <errno.h> // for errno.
+#include <sys/epoll.h> // for epoll_create1().
+#include <netinet/tcp.h> // for TCP_DEFER_ACCEPT.
+#include <linux/if_packet.h> // for PACKET_FANOUT_HASH.
+#include <signal.h> // for sigemptyset().
+#include <limits.h> // for INT_MAX.
+#include <math.h> // for HUGE_VAL.
+#include <poll.h> // for poll().
+#include <sys/wait.h> // for WIFEXITED().
+#include <sys/resource.h> // for wait4(), rusage and getrlimit().
+#include <sys/prctl.h> // for PR_SET_PDEATHSIG.
 
 #define MAXPENDING 10 // Maximum outstanding conncetion requests.
 #define RCVBUFSIZE (1024*1024) // Size of receive buffer.
+#define RCVPOOLAMOUNT 128 // Receive buffers in the central pool of each NUMA node, taken only as connections need them.
 
 /* ######################## Method Declare ######################## */
 // ================= Out of this file. ================
@@ -33,13 +69,25 @@ typedef enum CLIENTTYPE {
 	L1Client = 1,
 	L2Client = 2,
 	MultiConnSingleThreadL2Client = 3,
-	MultiConnMultiThreadL2Client = 4
+	MultiConnMultiThreadL2Client = 4,
+	FanOutL2Client = 5,
+	StormClient = 6,
+	UdpClient = 7
 } ClientType;
 typedef enum SERVERTYPE {
 	DefaultServer = 1,
 	MultiConnSingleThreadServer = 2,
-	MultiConnMultiThreadServer = 3
+	MultiConnMultiThreadServer = 3,
+	EventLoopServer = 4,
+	UdpServer = 5,
+	PacketServer = 6,
+	ForkServer = 7
 } ServerType;
+typedef enum DISTTYPE {
+	DistRoundRobin = 1,
+	DistLeastQueued = 2,
+	DistHash = 3
+} DistType;
 
 struct PARAS {
 	// Server only paras.
@@ -51,64 +99,472 @@ struct PARAS {
 	
 	// L2 client only paras.
 	unsigned short prePort;	
+	char* fanOut; // Downstream list of the fan-out L2 client, "ip:port,ip:port,...".
+	char distType; // How the fan-out L2 client distributes data, DistType.
+	int aggregate; // Downstream connections of the aggregating multithread L2 client, 0 means one per upstream connection.
 
 	// Common paras.
 	char isServer;
 	unsigned short servPort; // Server port.
 	unsigned int pkgSize; // Package size (Byte).
 	unsigned int interval; // Testing time (Second). 
+	unsigned short metricsPort; // Port of the metrics HTTP listener, 0 means no listener.
+	unsigned int reportInterval; // Interval report period (Second), 0 means no interval report.
+	char demux; // Server splits an aggregated connection back into streams.
+	char framed; // Data is framed with FrameHeader: L1 client writes frames, L2 clients and servers parse them.
+	unsigned short srcId; // Source id written in frames by the L1 client.
+	int streams; // Connections of the L1 client.
+	char genTypes[64]; // Generator of each L1 client stream (GenType), the list repeats over the streams.
+	int genTypeAmount;
+	unsigned long long int seed; // Seed of the L1 client generators, stream i uses seed + i.
+	int adcBits; // Sample width of the "adc" generator, 12 or 14.
+	char perf; // Report perf_event_open() counters of every handler.
+	char* tcpInfoFile; // CSV file for the TCP_INFO series of every connection, NULL for none.
+	char continuous; // No idle timeout, rolling windows, SIGUSR1 reports and SIGTERM drains.
+	int workers; // Event loops of the event loop server, receive threads of the UDP and packet servers or processes of the fork server, 0 means one per core.
+	char sharedListen; // Fork server workers accept() on one inherited socket instead of a SO_REUSEPORT socket each.
+	char* iface; // Interface of the packet server rings.
+	int maxConns; // Connections tracked by ConnStats at the same time, 0 sizes the table from the mode.
+	int backlog; // listen() backlog of every receiving socket, 0 means the mode's default.
+	int deferAccept; // TCP_DEFER_ACCEPT seconds of every receiving socket, 0 means off.
+	char accept4; // The event loop server accepts with accept4(SOCK_NONBLOCK), no fcntl() per connection.
+	double stormRate; // Connections per second of the storm client.
+	size_t stormSize; // Bytes sent on every storm connection.
+	unsigned int monitor; // Receivers sample 1 in "monitor" events for the monitoring histograms, 0 means no monitoring.
+	char* monitorFile; // Histogram dump of the monitoring thread.
+	char trigger; // L2 clients forward only events a TriggerFilter accepts.
+	uint16_t triggerThreshold; // Samples above this are over threshold.
+	int triggerChannels; // Over-threshold samples an event needs.
+	unsigned int prescale; // Every prescale-th rejected event is forwarded anyway, 0 means none.
+	char linkEmu; // L2 clients forward through a LinkEmu.
+	double linkRate; // LinkEmu bandwidth cap (Mb/s), 0 means no cap.
+	double linkDelay; // LinkEmu one-way delay (ms).
+	double linkJitter; // LinkEmu jitter (ms), the delay varies by up to this much either way.
+	double linkLoss; // LinkEmu segment loss probability.
+	size_t linkBuffer; // LinkEmu buffer (Byte), queue plus bytes in flight.
+	char compress; // L2 clients forward LZ compressed frames.
+	char decompress; // Server decodes LZ compressed frames.
+	char crc; // L1 client appends a CRC32C to every frame, servers verify it.
+	char* topologyFile; // Launch the stages of this host from a topology file instead of running one role.
+	char* topologyHost; // Name of this host in the topology file, gethostname() by default.
+	int benchRepeats; // Runs of the topology for a benchmark, 0 means run it once without statistics.
+	double benchWarmup; // Seconds after the first Byte a benchmark run does not count.
+	char* benchBaseline; // Baseline file the benchmark compares with.
+	char* benchSave; // File the benchmark saves its runs to as a new baseline.
 } Paras;
 
-// [ ClntSockPool
-// Client socket pool, main thread accept client socket and put it in pool, receive thread of server or receive-send thread of L2 client get client socket from pool.
-// Used in "MultiConnMultiThreadServer", "MultiConnMultiThreadL2Client".
-typedef struct clntSockPool {
-	int pool[MAXPENDING];
-	int poolTop;
-	pthread_mutex_t poolLock;
-} ClntSockPool;
+// [ Connection 
+// Connection is a structure contains: socket fd, server address, client address.
+// Receive thread accept one Connection then deal with it.
+typedef struct connection {
+    int socketfd;
+    int id; // Accept order, used as source id of unframed streams.
+    struct sockaddr_in serverAddress;
+    struct sockaddr_in clientAddress;
+} Connection;
+// ]
+
+pid_t gettid() {
+	return syscall(SYS_gettid); // Return the tid same as "/proc/<pid>/task/<tid>"
+}
+
+void printUsage() {
+	printf("Usage: \n");                                                                                
+	printf("    idaq [-c clientType|-s serverType] [-a serverIP] [-p serverPort] [-P preClientPort] [-t testInterval] [-size packageSize] [-m metricsPort] [-i reportInterval]\n");
+	printf("         [-frame] [-id sourceId] [-fanout ip:port,ip:port,...] [-dist rr|lq|hash]\n");
+	printf("         [-agg downstreamConnections] [-demux] [-compress] [-decompress] [-crc] [-trigger threshold] [-trigchannels n] [-prescale n]\n");
+	printf("         [-linkrate Mb/s] [-linkdelay ms] [-linkjitter ms] [-linkloss probability] [-linkbuf bytes]\n");
+	printf("         [-streams n] [-gen pattern|random|adc|sparse|seq,...] [-seed n] [-adcbits 12|14] [-perf] [-tcpinfo file] [-continuous]\n");
+	printf("         [-monitor n] [-monitorfile file]\n");
+	printf("         [-workers n] [-iface name] [-sharedlisten] [-maxconns n] [-backlog n] [-deferaccept seconds] [-accept4] [-storm connectionsPerSecond] [-stormsize n]\n");
+	printf("    idaq -topology file [-host name] [-repeat n] [-warmup seconds] [-baseline file] [-savebaseline file]\n");
+}
+
+// Create a TCP socket connected to "ip:port".
+int connectToServer(const char* ip, unsigned short port, const char* errorMessage) {
+	int sock;
+	struct sockaddr_in addr;
+
+	if ((sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+		dieWithError(errorMessage);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(ip);
+	addr.sin_port = htons(port);
+
+	if (connect(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+		dieWithError(errorMessage);
+	}
+
+	return sock;
+}
+
+// listen() with "-backlog" and "-deferaccept" applied, "backlog" is the default of the mode.
+int listenSocket(int sock, int backlog) {
+	if (Paras.deferAccept > 0) {
+		// accept() returns only once data arrived, connections that never send stay in the kernel.
+		if (setsockopt(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &Paras.deferAccept, sizeof(int)) < 0) {
+			return -1;
+		}
+	}
+	return listen(sock, Paras.backlog > 0 ? Paras.backlog : backlog);
+}
+
+// Create a TCP socket listening on "port" of any interface, "backlog" is the default of the mode as in listenSocket().
+int listenOn(unsigned short port, int backlog, const char* errorMessage) {
+	int sock;
+	struct sockaddr_in addr;
+	int on = 1;
 
-ClntSockPool* clntSockPoolAlloc() {
-	ClntSockPool* cspool;
-	if ((cspool = (ClntSockPool*) malloc(sizeof(ClntSockPool))) != NULL) {
-		cspool->poolTop = 0;
-		if (pthread_mutex_init(&cspool->poolLock, NULL) != 0) {
-			free(cspool);
-			return NULL;
+	if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		dieWithError(errorMessage);
+	}
+
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int)) < 0) {
+		dieWithError(errorMessage);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	if (bind(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+		dieWithError(errorMessage);
+	}
+
+	if (listenSocket(sock, backlog) < 0) {
+		dieWithError(errorMessage);
+	}
+
+	return sock;
+}
+
+void setNonBlocking(int sock) {
+	int flags = fcntl(sock, F_GETFL, 0);
+	if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+		dieWithError("fcntl() O_NONBLOCK failed");
+	}
+}
+
+// [ Demux
+// Servers with "-demux" split an aggregated connection back into its streams.
+void demuxStreamEnd(void* ctx, MuxStream* stream) {
+	printf("stream %u end, records: %llu, bytes: %llu\n", stream->streamId, stream->records, stream->bytes);
+}
+
+void demuxReport(MuxReader* mr) {
+	printf("demux records: %llu, streams ended: %llu\n", mr->records, mr->streamsEnded);
+}
+// ]
+
+// [ Codec
+// L2 clients with "-compress" forward LZ compressed frames, servers with "-decompress" decode them.
+// The receive thread fills raw blocks of a BufPool and queues them, a codec thread compresses and sends them,
+// so receiving the next block overlaps with compressing the last one.
+#define CODECBLOCKAMOUNT 32 // Raw blocks of one connection in flight between the receive thread and the codec thread.
+
+typedef struct codecStage {
+	int sock; // Downstream socket.
+	ConnStats* cs;
+	uint16_t srcId;
+	BufPool* pool;
+	BlockQueue* queue;
+	unsigned long long int blocks;
+	unsigned long long int rawBytes;
+	unsigned long long int wireBytes;
+	unsigned long long int codecNs; // Thread CPU time spent compressing.
+	pthread_t ntid;
+} CodecStage;
+
+void* threadCompressAndSend(void* arg) {
+	CodecStage* stage = (CodecStage*) arg;
+	char* frame = (char*) malloc(LZFRAMEMAX);
+	char* blocks[CODECBLOCKAMOUNT];
+	size_t sizes[CODECBLOCKAMOUNT];
+	int n, i;
+
+	if (frame == NULL) {
+		dieWithError("threadCompressAndSend malloc() failed");
+	}
+	while ((n = blockQueuePop(stage->queue, blocks, sizes, CODECBLOCKAMOUNT)) > 0) {
+		for (i = 0; i < n; i++) {
+			unsigned long long int t = threadCPUNs();
+			size_t frameSize = lzEncodeFrame(blocks[i], sizes[i], frame, stage->srcId, (uint32_t) stage->blocks);
+			stage->codecNs += threadCPUNs() - t;
+			bufPoolPut(stage->pool, blocks[i]);
+
+			size_t sent = 0;
+			while (sent < frameSize) {
+				int ret = connStatsTimedSend(stage->cs, stage->sock, frame + sent, frameSize - sent, 0);
+				if (ret <= 0) {
+					dieWithError("threadCompressAndSend send() failed");
+				}
+				sent += ret;
+				connStatsSend(stage->cs, ret);
+			}
+			stage->blocks++;
+			stage->rawBytes += sizes[i];
+			stage->wireBytes += frameSize;
 		}
 	}
 
-	return cspool;
+	free(frame);
+	return ((void*) 0);
 }
 
-void clntSockPoolRelease(ClntSockPool* cspool) {
-	pthread_mutex_lock(&cspool->poolLock);
-	if (cspool->poolTop == 0) {
-		pthread_mutex_unlock(&cspool->poolLock);
-		pthread_mutex_destroy(&cspool->poolLock);
-		free(cspool);
+// Receive from preSock until it closes and forward compressed on nextSock. Return the raw bytes received.
+unsigned long long int compressForward(ConnStats* cs, int preSock, int nextSock, uint16_t srcId, CodecStage* stage) {
+	unsigned long long int totalRecvMsgSize = 0;
+
+	memset(stage, 0, sizeof(CodecStage));
+	stage->sock = nextSock;
+	stage->cs = cs;
+	stage->srcId = srcId;
+	if ((stage->pool = bufPoolAllocOnNode(LZBLOCKSIZE, CODECBLOCKAMOUNT, currentNumaNode())) == NULL) {
+		dieWithError("compressForward bufPoolAlloc() failed");
+	}
+	if ((stage->queue = blockQueueAlloc(CODECBLOCKAMOUNT)) == NULL) {
+		dieWithError("compressForward blockQueueAlloc() failed");
+	}
+	if (pthread_create(&stage->ntid, NULL, threadCompressAndSend, stage) != 0) {
+		dieWithError("compressForward pthread_create() failed");
+	}
+
+	// Fill each block completely, small blocks compress badly.
+	char* block = NULL;
+	size_t fill = 0;
+	while (1) {
+		if (block == NULL) {
+			unsigned long long int getNs = timingNowNs();
+			block = bufPoolGet(stage->pool);
+			connStatsSendBlock(cs, timingNowNs() - getNs); // An empty pool means the codec thread is behind.
+			fill = 0;
+		}
+		int recvMsgSize = connStatsTimedRecv(cs, preSock, block + fill, LZBLOCKSIZE - fill, 0);
+		if (recvMsgSize < 0) {
+			dieWithError("compressForward recv() failed");
+		}
+		else if (recvMsgSize == 0) {
+			break;
+		}
+		totalRecvMsgSize += recvMsgSize;
+		connStatsRecv(cs, recvMsgSize);
+		fill += recvMsgSize;
+		if (fill == LZBLOCKSIZE) {
+			blockQueuePush(stage->queue, block, fill);
+			block = NULL;
+		}
+	}
+	if (fill > 0) {
+		blockQueuePush(stage->queue, block, fill);
 	}
 	else {
-		pthread_mutex_unlock(&cspool->poolLock);
+		bufPoolPut(stage->pool, block);
 	}
+
+	blockQueueClose(stage->queue);
+	pthread_join(stage->ntid, NULL);
+	blockQueueRelease(stage->queue);
+	bufPoolRelease(stage->pool);
+
+	return totalRecvMsgSize;
+}
+
+void compressReport(CodecStage* stage, double timeSpan, const char* prefix) {
+	printf("%scompress blocks: %llu, raw: %llu Bytes, wire: %llu Bytes, ratio: %lf\n", prefix, stage->blocks, stage->rawBytes, stage->wireBytes, stage->wireBytes > 0 ? (double) stage->rawBytes / stage->wireBytes : 0.0);
+	printf("%scompress CPU: %lf s, %lf ns/Byte\n", prefix, stage->codecNs * 1e-9, stage->rawBytes > 0 ? (double) stage->codecNs / stage->rawBytes : 0.0);
+	printf("%seffective speed: %lf Mb/s, wire speed: %lf Mb/s\n", prefix, ((double) stage->rawBytes * 8) / (timeSpan * 1000 * 1000), ((double) stage->wireBytes * 8) / (timeSpan * 1000 * 1000));
 }
 
+void decompressReport(LzDecoder* ld, double timeSpan, const char* prefix) {
+	printf("%sdecompress blocks: %llu, stored: %llu, plain: %llu, bad: %llu, skipped: %llu Bytes\n", prefix, ld->blocks, ld->storedBlocks, ld->plainFrames, ld->badBlocks, ld->fr->skippedBytes);
+	printf("%sdecompress raw: %llu Bytes, wire: %llu Bytes, ratio: %lf\n", prefix, ld->rawBytes, ld->wireBytes, ld->wireBytes > 0 ? (double) ld->rawBytes / ld->wireBytes : 0.0);
+	printf("%sdecompress CPU: %lf s, %lf ns/Byte\n", prefix, ld->codecNs * 1e-9, ld->rawBytes > 0 ? (double) ld->codecNs / ld->rawBytes : 0.0);
+	printf("%seffective speed: %lf Mb/s, wire speed: %lf Mb/s\n", prefix, ((double) ld->rawBytes * 8) / (timeSpan * 1000 * 1000), ((double) ld->wireBytes * 8) / (timeSpan * 1000 * 1000));
+}
 // ]
 
-// [ Connection 
-// Connection is a structure contains: socket fd, server address, client address.
-// Receive thread accept one Connection then deal with it.
-typedef struct connection {
-    int socketfd;
-    struct sockaddr_in serverAddress;
-    struct sockaddr_in clientAddress;
-} Connection;
+// [ LinkForward
+// L2 clients with "-linkrate", "-linkdelay", "-linkjitter" or "-linkloss" forward through a LinkEmu, so loopback tests see the
+// bandwidth, RTT and loss of a real link. One thread both reads and sends without blocking, select() wakes it for the
+// upstream socket, the downstream socket or the next block due. The connections of the multithread L2 client share one
+// link, a LinkShare.
+
+// Receive from preSock until it closes and forward on nextSock through a new LinkEmu, which is returned for the report.
+// "ls" is the link shared with other connections, NULL for a link of this connection alone.
+LinkEmu* linkForward(ConnStats* cs, int preSock, int nextSock, unsigned long long int seed, LinkShare* ls) {
+	LinkEmu* le = linkEmuAlloc(Paras.linkRate, Paras.linkDelay, Paras.linkJitter, Paras.linkLoss, Paras.linkBuffer, seed);
+	if (le == NULL) {
+		dieWithError("linkForward linkEmuAlloc() failed");
+	}
+	if (ls != NULL) {
+		linkEmuShare(le, ls);
+	}
+	int maxsock = preSock > nextSock ? preSock : nextSock;
+	int eof = 0;
+
+	while (!eof || !linkEmuEmpty(le)) {
+		fd_set rfds, wfds;
+		struct timeval timeout;
+		struct timeval* tp = NULL;
+		size_t room = 0;
+		char* buffer = eof ? NULL : linkEmuRecvBuffer(le, &room);
+		long long int waitNs = linkEmuWaitNs(le, timingNowNs());
+		// Other connections free the shared buffer without waking this one.
+		if (le->heldByShare && (waitNs < 0 || waitNs > LINKEMUSHAREPOLLNS)) {
+			waitNs = LINKEMUSHAREPOLLNS;
+		}
+
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		if (buffer != NULL) {
+			FD_SET(preSock, &rfds);
+		}
+		if (waitNs == 0) {
+			FD_SET(nextSock, &wfds);
+		}
+		else if (waitNs > 0) {
+			timeout.tv_sec = waitNs / 1000000000LL;
+			timeout.tv_usec = (waitNs % 1000000000LL + 999) / 1000;
+			tp = &timeout;
+		}
+		if (select(maxsock + 1, &rfds, &wfds, NULL, tp) < 0) {
+			dieWithError("linkForward select() failed");
+		}
+
+		if (buffer != NULL && FD_ISSET(preSock, &rfds)) {
+			int recvMsgSize = recv(preSock, buffer, room, MSG_DONTWAIT);
+			if (recvMsgSize > 0) {
+				connStatsRecv(cs, recvMsgSize);
+				linkEmuPush(le, recvMsgSize, timingNowNs());
+			}
+			else if (recvMsgSize == 0) {
+				eof = 1;
+			}
+			else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				dieWithError("linkForward recv() failed");
+			}
+		}
+		if (linkEmuWaitNs(le, timingNowNs()) == 0) {
+			ssize_t sendMsgSize = linkEmuSend(le, nextSock);
+			if (sendMsgSize < 0) {
+				dieWithError("linkForward send() failed");
+			}
+			connStatsSend(cs, sendMsgSize);
+		}
+	}
+
+	return le;
+}
 // ]
 
-void printUsage() {
-	printf("Usage: \n");                                                                                
-	printf("    idaq [-c clientType|-s serverType] [-a serverIP] [-p serverPort] [-P preClientPort] [-t testInterval] [-size packageSize]\n");
+// [ FilterForward
+// L2 clients with "-trigger threshold" forward only the events a TriggerFilter accepts.
+
+// Receive from preSock until it closes, forward accepted events on nextSock. The filter is returned for the report.
+TriggerFilter* filterForward(ConnStats* cs, int preSock, int nextSock, char* buffer) {
+	TriggerFilter* tf = triggerFilterAlloc(nextSock, Paras.triggerThreshold, Paras.triggerChannels, Paras.prescale);
+	if (tf == NULL) {
+		dieWithError("filterForward triggerFilterAlloc() failed");
+	}
+	while (1) {
+		int recvMsgSize = connStatsTimedRecv(cs, preSock, buffer, RCVBUFSIZE, 0);
+		if (recvMsgSize < 0) {
+			dieWithError("filterForward recv() failed");
+		}
+		else if (recvMsgSize == 0) {
+			break;
+		}
+		connStatsRecv(cs, recvMsgSize);
+		unsigned long long int outBytes = tf->outBytes;
+		if (triggerFilterFeed(tf, buffer, recvMsgSize) < 0) {
+			dieWithError("filterForward writev() failed");
+		}
+		connStatsSend(cs, tf->outBytes - outBytes);
+	}
+
+	return tf;
+}
+// ]
+
+// [ RecvPath
+// Optional stages of a receiving connection: "-decompress", then the "-monitor" tap and "-demux" or "-crc". The tap sees the
+// stream as the L1 client sent it, a compressed frame has no samples to look at.
+// Streams of a demuxed connection are not CRC checked, their frames are interleaved.
+typedef struct recvPath {
+	LzDecoder* ld;
+	MuxReader* mr;
+	CrcChecker* cc;
+	MonitorTap* mt;
+} RecvPath;
+
+void recvPathRaw(void* ctx, const char* data, size_t len) {
+	RecvPath* rp = (RecvPath*) ctx;
+	if (rp->mt != NULL) {
+		monitorTapFeed(rp->mt, data, len);
+	}
+	if (rp->mr != NULL) {
+		muxReaderFeed(rp->mr, data, len);
+	}
+	else if (rp->cc != NULL) {
+		crcCheckerFeed(rp->cc, data, len);
+	}
+}
+
+void recvPathInit(RecvPath* rp) {
+	rp->mr = Paras.demux ? muxReaderAlloc(NULL, demuxStreamEnd, NULL) : NULL;
+	rp->cc = NULL;
+	rp->ld = NULL;
+	rp->mt = Paras.monitor > 0 ? monitorTapOpen(Paras.framed) : NULL;
+	if (Paras.crc && !Paras.demux && (rp->cc = crcCheckerAlloc()) == NULL) {
+		dieWithError("recvPathInit crcCheckerAlloc() failed");
+	}
+	if (Paras.decompress && (rp->ld = lzDecoderAlloc(recvPathRaw, rp)) == NULL) {
+		dieWithError("recvPathInit lzDecoderAlloc() failed");
+	}
+}
+
+void recvPathFeed(RecvPath* rp, const char* buf, size_t len) {
+	if (rp->ld != NULL) {
+		lzDecoderFeed(rp->ld, buf, len);
+	}
+	else {
+		recvPathRaw(rp, buf, len);
+	}
+}
+
+// Report and release the stages.
+void recvPathFinish(RecvPath* rp, double timeSpan, const char* prefix) {
+	if (rp->mt != NULL) {
+		monitorTapPrint(rp->mt, prefix, timeSpan);
+		monitorTapClose(rp->mt);
+		rp->mt = NULL;
+	}
+	if (rp->ld != NULL) {
+		decompressReport(rp->ld, timeSpan, prefix);
+		lzDecoderRelease(rp->ld);
+		rp->ld = NULL;
+	}
+	if (rp->cc != NULL) {
+		CrcChecker* cc = rp->cc;
+		printf("%scrc32c (%s) frames: %llu, checked: %llu, failures: %llu, skipped: %llu Bytes\n", prefix, crc32cImplName(), cc->frames, cc->checked, cc->failures, cc->fr->skippedBytes);
+		if (cc->failures > 0) {
+			printf("%scrc32c first failure: source %d, seq %lld\n", prefix, cc->firstBadSrcId, cc->firstBadSeq);
+		}
+		printf("%scrc32c verify CPU: %lf s, %lf ns/Byte, verify speed: %lf Mb/s\n", prefix, cc->verifyNs * 1e-9, cc->checkedBytes > 0 ? (double) cc->verifyNs / cc->checkedBytes : 0.0, cc->verifyNs > 0 ? ((double) cc->checkedBytes * 8 * 1000) / cc->verifyNs : 0.0);
+		crcCheckerRelease(cc);
+		rp->cc = NULL;
+	}
+	if (rp->mr != NULL) {
+		demuxReport(rp->mr);
+		muxReaderRelease(rp->mr);
+		rp->mr = NULL;
+	}
 }
+// ]
 
 void server() {
 	printf("server\n");
@@ -139,7 +595,7 @@ void server() {
 	}
 
 	// Mark the socket so it will listen for incoming connections.
-	if (listen(servSock, MAXPENDING) < 0) {
+	if (listenSocket(servSock, MAXPENDING) < 0) {
 		dieWithError("server listen() failed");
 	}
 
@@ -148,16 +604,19 @@ void server() {
 	struct timeval timeout;
 	clntLen = sizeof(clntAddr);
 
-	while (1) {
+	while (!reportStopping()) {
 		FD_ZERO(&fds);
 		FD_SET(servSock, &fds);
-		timeout.tv_sec = 30;
+		timeout.tv_sec = Paras.continuous ? 1 : 30; // No idle timeout in continuous mode, wake up to notice SIGTERM.
 		timeout.tv_usec = 0;
 		int ret = 0;
 		if ((ret = select(maxsock+1, &fds, NULL, NULL, &timeout)) < 0) {
 			dieWithError("server select() failed");
 		}
 		else if (ret == 0) {
+			if (Paras.continuous) {
+				continue;
+			}
 			printf("timeout\n");
 			break;
 		}
@@ -171,11 +630,13 @@ void server() {
 			maxsock = clntSock;
 		}
 		FD_SET(clntSock, &fds);
+		ConnStats* cs = connStatsOpen("server", clntSock, -1, gettid(), &clntAddr);
+		RecvPath rp;
+		recvPathInit(&rp);
 
 
 		// [When comes a connection, recieve the message and calculte the CPU and speed.
-		char buffer[RCVBUFSIZE];
-		bzero(buffer, RCVBUFSIZE);
+		char* buffer = bufPoolNodeGet(); // Receive buffer from the central pool, not the stack.
 
 		unsigned long long int totalRecvMsgSize = 0;
 		int recvMsgSize;
@@ -186,19 +647,22 @@ void server() {
 		pid_t pid = getpid();
 		getWholeCPUStatus(&ps1);
 		getProcessCPUStatus(&pps1, pid);
+		PerfCount perf;
+		perfCountStartInherit(&perf); // The process role, so threads started for the connection count too.
 
 		// Time calculating.
-		struct timeval t1, t2;
-		gettimeofday(&t1, NULL);
+		unsigned long long int t1 = timingNowNs();
 		double timeSpan = 0.0;
 
 		while (1) {
-			if ((recvMsgSize = recv(clntSock, buffer, RCVBUFSIZE, 0)) < 0) {
+			if ((recvMsgSize = connStatsTimedRecv(cs, clntSock, buffer, RCVBUFSIZE, 0)) < 0) {
 				dieWithError("server recv() failed");
 			}
 			else if (recvMsgSize > 0) {
 				//buffer[RCVBUFSIZE-1] = '\0';
 				totalRecvMsgSize += recvMsgSize;
+				connStatsRecv(cs, recvMsgSize);
+				recvPathFeed(&rp, buffer, recvMsgSize);
 				//printf("recvMsgSize: %d\n", recvMsgSize);
 				//printf("totalRecvMsgSize: %lld\n", totalRecvMsgSize);
 				//printf("%s\n", buffer);
@@ -206,18 +670,25 @@ void server() {
 			else { // recvMsgSize == 0
 				getWholeCPUStatus(&ps2);
 				getProcessCPUStatus(&pps2, pid);
+				perfCountStop(&perf);
 				float CPUUse = calWholeCPUUse(&ps1, &ps2);
 				float processCPUUse = calProcessCPUUse(&ps1, &pps1, &ps2, &pps2);
 				printf("CPUUse: %f, processCPUUse: %f\n", CPUUse, processCPUUse);
 
-				gettimeofday(&t2, NULL);
-				timeSpan = (double) (t2.tv_sec-t1.tv_sec) + (double) t2.tv_usec*1e-6 - (double) t1.tv_usec*1e-6;
+				timeSpan = timingSince(t1);
 				double recvSpeed = ((double) totalRecvMsgSize * 8) / (timeSpan * 1000 *1000);
 				printf("totalRecvMsgSize: %llu Bytes\n", totalRecvMsgSize);
 				printf("time span: %lf s\n", timeSpan);
-				printf("receive speed: %lf Mb/s\n\n", recvSpeed);
+				printf("receive speed: %lf Mb/s\n", recvSpeed);
+				connStatsPrintStall(cs, "");
+				printMemoryStatus("", &pps1, &pps2, totalRecvMsgSize);
+				perfCountPrint(&perf, "", totalRecvMsgSize, cs->recvCalls);
+				recvPathFinish(&rp, timeSpan, "");
+				printf("\n");
+				bufPoolNodePut(buffer);
 
 				FD_CLR(clntSock, &fds);
+				connStatsClose(cs);
 				close(clntSock);
 				// ]
 
@@ -227,6 +698,9 @@ void server() {
 	}
 	
 	close(servSock);
+	if (Paras.continuous) {
+		reportDrain(NULL);
+	}
 
 	exit(0);
 
@@ -244,7 +718,7 @@ void multiConnSingleThreadServer() {
 	struct sockaddr_in clntAddr; // connector's address info.
 	socklen_t sinSize; 
 	int on = 1;
-	char buffer[RCVBUFSIZE];
+	char* buffer = bufPoolNodeGet();
 	int ret;
 	int i;
 
@@ -266,7 +740,7 @@ void multiConnSingleThreadServer() {
 		dieWithError("multiConnSingleThreadServer bind() failed");
 	}
 
-	if (listen(servSock, MAXPENDING) < 0) {
+	if (listenSocket(servSock, MAXPENDING) < 0) {
 		dieWithError("multiConnSingleThreadServer listen() failed");
 	}
 	printf("servPort: %d\n", servPort);
@@ -289,16 +763,33 @@ void multiConnSingleThreadServer() {
 	ProcPidStat pps1[MAXPENDING], pps2[MAXPENDING];
 	pid_t pid = getpid();
 
-	struct timeval t1[MAXPENDING], t2[MAXPENDING];
+	// Counters count the thread, so all connections share one PerfCount and it is reported as a thread total.
+	PerfCount perf;
+	unsigned long long int perfBytes = 0;
+	unsigned long long int perfCalls = 0;
+	perfCountStart(&perf);
+
+	unsigned long long int t1[MAXPENDING];
+	ConnStats* cs[MAXPENDING];
+	RecvPath rp[MAXPENDING];
+	pid_t tid = gettid();
 
 
 	while (1) {
+		// After SIGTERM accept no more connections and end when the open ones are done.
+		int stopping = reportStopping();
+		if (stopping && connAmount == 0) {
+			break;
+		}
+
 		// Init file descriptor set.
 		FD_ZERO(&fds);
-		FD_SET(servSock, &fds);
+		if (!stopping) {
+			FD_SET(servSock, &fds);
+		}
 
 		// Timeout setting.
-		timeout.tv_sec = 10;
+		timeout.tv_sec = Paras.continuous ? 1 : 10;
 		timeout.tv_usec = 0;
 
 		// Add active connection to fd set.
@@ -308,11 +799,21 @@ void multiConnSingleThreadServer() {
 			}	
 		}
 
+		unsigned long long int selectNs = timingNowNs();
 		ret = select(maxsock+1, &fds, NULL, NULL, &timeout);
+		selectNs = timingNowNs() - selectNs;
+		for (i = 0; i < MAXPENDING; i++) {
+			if (fdArr[i] != 0) {
+				connStatsRecvWait(cs[i], selectNs); // Every connection waited for its L1 client.
+			}
+		}
 		if (ret < 0) {
 			dieWithError("multiConnSingleThreadServer select() failed");
 		}
 		else if (ret == 0) {
+			if (Paras.continuous) {
+				continue;
+			}
 			printf("timeout\n");
 			break; // When timeout, jump out the loop and end the server.
 			//continue; // When timeout, just continue to waiting for new connetions.
@@ -327,6 +828,8 @@ void multiConnSingleThreadServer() {
 				}
 				else if (ret > 0) {
 					totalRecvMsgSize[i] += ret;
+					connStatsRecv(cs[i], ret);
+					recvPathFeed(&rp[i], buffer, ret);
 					// Receive data.
 					//if (ret < RCVBUFSIZE) {
 					//	memset(&buffer[ret], '\0', 1);
@@ -336,20 +839,27 @@ void multiConnSingleThreadServer() {
 				else { // ret == 0
 					// Close client.
 					printf("close connection client[%d]\n", i);
-					close(fdArr[i]);
+					char prefix[32];
+					snprintf(prefix, sizeof(prefix), "client[%d] ", i);
+					connStatsPrintStall(cs[i], prefix);
+					connStatsCloseSock(cs[i], fdArr[i]);
 					connAmount--;
 					FD_CLR(fdArr[i], &fds);
 					fdArr[i] = 0;
 
 					// time and CPU.
-					gettimeofday(&t2[i], NULL);
 					getWholeCPUStatus(&ps2[i]);
 					getProcessCPUStatus(&pps2[i], pid);
 
-					timeSpan[i] = (double) (t2[i].tv_sec-t1[i].tv_sec) + (double) t2[i].tv_usec*1e-6 - (double) t1[i].tv_usec*1e-6;
+					timeSpan[i] = timingSince(t1[i]);
 					recvSpeed[i] = ((double) totalRecvMsgSize[i] * 8) / (timeSpan[i] * 1000 *1000);
 					CPUUse[i] = calWholeCPUUse(&ps1[i], &ps2[i]);
 					processCPUUse[i] = calProcessCPUUse(&ps1[i], &pps1[i], &ps2[i], &pps2[i]);
+					printMemoryStatus(prefix, &pps1[i], &pps2[i], totalRecvMsgSize[i]);
+					perfBytes += totalRecvMsgSize[i];
+					perfCalls += cs[i]->recvCalls;
+					connStatsClose(cs[i]);
+					recvPathFinish(&rp[i], timeSpan[i], prefix);
 
 				}
 			}
@@ -368,9 +878,11 @@ void multiConnSingleThreadServer() {
 					if (fdArr[i] == 0) {
 						fdArr[i] = clntSock;
 						connAmount++;
+						cs[i] = connStatsOpen("server", clntSock, -1, tid, &clntAddr);
+						recvPathInit(&rp[i]);
 						
 						// time and CPU.
-						gettimeofday(&t1[i], NULL);
+						t1[i] = timingNowNs();
 						getWholeCPUStatus(&ps1[i]);
 						getProcessCPUStatus(&pps1[i], pid);
 
@@ -407,6 +919,9 @@ void multiConnSingleThreadServer() {
 	// Close other connections.
 	for (i = 0; i < MAXPENDING; i++) {
 		if (fdArr[i] != 0) {
+			perfBytes += totalRecvMsgSize[i];
+			perfCalls += cs[i]->recvCalls;
+			connStatsClose(cs[i]);
 			close(fdArr[i]);
 			connAmount--;
 		}
@@ -415,14 +930,18 @@ void multiConnSingleThreadServer() {
 	for (i = 0; i < MAXPENDING; i++) {
 		printf("connection %d \nCPUUse: %f, processCPUUse: %f\ntotalRecvMsgSize: %llu Bytes\ntimeSpan: %lf\nrecvSpeed: %lf Mb/s\n\n", i, CPUUse[i], processCPUUse[i], totalRecvMsgSize[i], timeSpan[i], recvSpeed[i]);
 	}
+	perfCountStop(&perf);
+	perfCountPrint(&perf, "thread total ", perfBytes, perfCalls);
+
+	bufPoolNodePut(buffer);
+	if (Paras.continuous) {
+		reportDrain(NULL);
+	}
 
 	exit(0);
 }
 
 
-pid_t gettid() {
-	return syscall(SYS_gettid); // Return the tid same as "/proc/<pid>/task/<tid>"
-}
 unsigned long long int threadRTag = 0;
 pthread_mutex_t threadRTagLock;
 void* threadReceive(void* arg) {
@@ -445,8 +964,7 @@ void* threadReceive(void* arg) {
     pid_t tid = gettid();
 	printf("thread clntSock: %d, pid: %u, tid: %u\n\n", clntSock, (unsigned int) pid, (unsigned int) tid);
 
-	char buffer[RCVBUFSIZE];
-	bzero(buffer, RCVBUFSIZE);
+	char* buffer = bufPoolNodeGet();
 
 	int recvMsgSize;
 	unsigned long long int totalRecvMsgSize = 0;
@@ -458,8 +976,7 @@ void* threadReceive(void* arg) {
 	getThreadCPUStatus(&pps1, pid, tid); // accurate?
 
 	// Time calculating.
-	struct timeval t1, t2;
-	gettimeofday(&t1, NULL);
+	unsigned long long int t1 = timingNowNs();
 	double timeSpan = 0.0;
 
 	while (1) {
@@ -481,8 +998,7 @@ void* threadReceive(void* arg) {
 	float CPUUse = calWholeCPUUse(&ps1, &ps2);
 	float threadCPUUse = calProcessCPUUse(&ps1, &pps1, &ps2, &pps2);
 
-	gettimeofday(&t2, NULL);
-	timeSpan = (double) (t2.tv_sec-t1.tv_sec) + (double) t2.tv_usec*1e-6 - (double) t1.tv_usec*1e-6;
+	timeSpan = timingSince(t1);
 	double recvSpeed = ((double) totalRecvMsgSize * 8) / (timeSpan * 1000 *1000);
 
 	pthread_mutex_lock(&threadRTagLock);
@@ -494,6 +1010,7 @@ void* threadReceive(void* arg) {
 	printf("thread %d-%d time span: %lf\n", pid, tid, timeSpan);
 	printf("thread %d-%d receive speed: %lf Mb/s\n\n", pid, tid, recvSpeed);
 
+	bufPoolNodePut(buffer);
 	close(clntSock);
 	pthread_exit((void*) 0);
 
@@ -511,9 +1028,11 @@ void* threadReceiveConnection(void* arg) {
     //pthread_t tid = pthread_self(); // Get tid, different from "syscall(SYS_gettid)".
     pid_t tid = gettid();
     printf("thread connectionSock: %d, pid: %u, tid: %u\n\n", connectionSock, (unsigned int) pid, (unsigned int) tid);
+    ConnStats* cs = connStatsOpen("server", connectionSock, -1, tid, &conn->clientAddress);
+    RecvPath rp;
+    recvPathInit(&rp);
 
-    int buffer[RCVBUFSIZE];
-    bzero(buffer, RCVBUFSIZE);
+    char* buffer = bufPoolNodeGet();
 
     int recvMsgSize;
     unsigned long long int totalRecvMsgSize = 0;
@@ -523,18 +1042,21 @@ void* threadReceiveConnection(void* arg) {
     ProcPidStat pps1, pps2;
     getWholeCPUStatus(&ps1);
     getThreadCPUStatus(&pps1, pid, tid); // accurate?
+    PerfCount perf;
+    perfCountStart(&perf);
 
     // Time calculating.
-    struct timeval t1, t2;
-    gettimeofday(&t1, NULL);
+    unsigned long long int t1 = timingNowNs();
     double timeSpan = 0.0;
 
     while (1) {
-        if ((recvMsgSize = recv(connectionSock, buffer, RCVBUFSIZE*sizeof(int), 0)) < 0) {
+        if ((recvMsgSize = connStatsTimedRecv(cs, connectionSock, buffer, RCVBUFSIZE, 0)) < 0) {
             dieWithError("threadReceive recv() failed");
         }
         else if (recvMsgSize > 0) {
             totalRecvMsgSize += recvMsgSize;
+            connStatsRecv(cs, recvMsgSize);
+            recvPathFeed(&rp, buffer, recvMsgSize);
             //printf("thread %u recvMsgSize: %d\n", (unsigned int) tid, recvMsgSize);
             //printf("thread %u totalRecvMsgSize: %lld\n", (unsigned int) tid, totalRecvMsgSize);
             /*int i = 0;
@@ -550,11 +1072,11 @@ void* threadReceiveConnection(void* arg) {
 
     getWholeCPUStatus(&ps2);
     getThreadCPUStatus(&pps2, pid, tid);
+    perfCountStop(&perf);
     float CPUUse = calWholeCPUUse(&ps1, &ps2);
     float threadCPUUse = calProcessCPUUse(&ps1, &pps1, &ps2, &pps2);
 
-    gettimeofday(&t2, NULL);
-    timeSpan = (double) (t2.tv_sec-t1.tv_sec) + (double) t2.tv_usec*1e-6 - (double) t1.tv_usec*1e-6;
+    timeSpan = timingSince(t1);
     double recvSpeed = ((double) totalRecvMsgSize * 8) / (timeSpan * 1000 *1000);
 
     pthread_mutex_lock(&threadRTagLock);
@@ -564,8 +1086,17 @@ void* threadReceiveConnection(void* arg) {
     printf("thread %d-%d CPUUse: %f, threadCPUUse: %f\n", pid, tid, CPUUse, threadCPUUse);
     printf("thread %d-%d totalRecvMsgSize: %llu Bytes\n", pid, tid, totalRecvMsgSize);
     printf("thread %d-%d time span: %lf\n", pid, tid, timeSpan);
-    printf("thread %d-%d receive speed: %lf Mb/s\n\n", pid, tid, recvSpeed);
-
+    printf("thread %d-%d receive speed: %lf Mb/s\n", pid, tid, recvSpeed);
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "thread %d-%d ", pid, tid);
+    connStatsPrintStall(cs, prefix);
+    printMemoryStatus(prefix, &pps1, &pps2, totalRecvMsgSize);
+    perfCountPrint(&perf, prefix, totalRecvMsgSize, cs->recvCalls);
+    recvPathFinish(&rp, timeSpan, prefix);
+    printf("\n");
+
+    bufPoolNodePut(buffer);
+    connStatsClose(cs);
     close(connectionSock);
     free(conn);
     pthread_exit((void*) 0);
@@ -606,7 +1137,7 @@ void multiConnMultiThreadServer() {
 		dieWithError("multiConnMultiThreadServer bind() failed");
 	}
 
-	if (listen(servSock, MAXPENDING) < 0) {
+	if (listenSocket(servSock, MAXPENDING) < 0) {
 		dieWithError("multiConnMultiThreadServer listen() failed");
 	}
 	printf("servPort: %d\n", servPort);
@@ -618,16 +1149,19 @@ void multiConnMultiThreadServer() {
 	sinSize = sizeof(clntAddr);
 
 	
-	while (1) {
+	while (!reportStopping()) {
 		FD_ZERO(&fds);
 		FD_SET(servSock, &fds);
-		timeout.tv_sec = 30;
+		timeout.tv_sec = Paras.continuous ? 1 : 30;
 		timeout.tv_usec = 0;
 		int ret = 0;
 		if ((ret = select(maxsock+1, &fds, NULL, NULL, &timeout)) < 0) {
 			dieWithError("multiConnMultiThreadServer select() failed");
 		}
 		else if (ret == 0) {
+			if (Paras.continuous) {
+				continue;
+			}
 			printf("timeout\n");
 			break;
 		}
@@ -648,103 +1182,1301 @@ void multiConnMultiThreadServer() {
 		if (pthread_create(&ntid, NULL, threadReceiveConnection, conn) < 0) {
 			dieWithError("multiConnMultiThreadServer pthread_create() failed");
 		}
+		pthread_detach(ntid); // Nobody joins, a long run must not keep every finished thread.
 		//pthread_join(ntid, NULL);
 
 	}
 	
 	//clntSockPoolRelease(cspool);
 	close(servSock);
+	if (Paras.continuous) {
+		reportDrain(NULL);
+	}
 
 	exit(0);
 }
 
-void client() {
-	int sock; // Socket descriptor.
-	struct sockaddr_in servAddr; // Server address.
-	char* package;
+// Counter "name" of a "section" in /proc/net/netstat or /proc/net/snmp, such as TcpExt: ListenOverflows, 0 if not found.
+unsigned long long int procNetCounter(const char* path, const char* section, const char* name) {
+	char names[4096], values[4096];
+	unsigned long long int value = 0;
+	size_t sectionLen = strlen(section);
+	FILE* fd = fopen(path, "r");
+	if (fd == NULL) {
+		return 0;
+	}
+	// Pairs of lines: "TcpExt: name name ..." followed by "TcpExt: value value ...".
+	while (fgets(names, sizeof(names), fd) != NULL && fgets(values, sizeof(values), fd) != NULL) {
+		if (strncmp(names, section, sectionLen) != 0) {
+			continue;
+		}
+		char* nameSave;
+		char* valueSave;
+		char* n = strtok_r(names, " \n", &nameSave);
+		char* v = strtok_r(values, " \n", &valueSave);
+		while (n != NULL && v != NULL) {
+			if (strcmp(n, name) == 0) {
+				value = strtoull(v, NULL, 10);
+			}
+			n = strtok_r(NULL, " \n", &nameSave);
+			v = strtok_r(NULL, " \n", &valueSave);
+		}
+	}
+	fclose(fd);
+	return value;
+}
 
-	unsigned short servPort = Paras.servPort;
-	char* servIP = Paras.servIP;
-	unsigned int pkgSize = Paras.pkgSize;	
-	unsigned int interval = Paras.interval;
+// [ EventLoopServer
+// Every connection is a small state machine instead of a thread: one event loop per core owns an epoll instance and one
+// receive buffer, and handles each readiness event of its connections to completion. A connection costs an EventConn and
+// a ConnStats slot, so tens of thousands of low-rate front-ends fit where a thread each would not.
+#define EVENTLOOPMAXWORKERS 64
+#define EVENTLOOPMAXEVENTS 256 // Events taken by one epoll_wait().
+#define EVENTLOOPACCEPTBATCH 64 // Connections accepted per wakeup, so one loop does not take a whole burst.
+
+typedef struct eventConn {
+	int sock;
+	ConnStats* cs;
+	RecvPath rp;
+	unsigned long long int totalRecvMsgSize;
+	unsigned long long int recvCalls; // Own count, "cs" may be the shared overflow slot.
+	unsigned long long int t1; // Accepted.
+	struct sockaddr_in peerAddress; // Own copy too, the overflow slot holds the address of no connection in particular.
+} EventConn;
+
+typedef struct eventLoopWorker {
+	int id;
+	int epfd;
+	pthread_t ntid;
+	char* buffer; // Shared by the connections of the loop, no event leaves data in it.
+	int connections; // Open connections, read by the status loop.
+	unsigned long long int accepted;
+	unsigned long long int resets; // Connections ended by ECONNRESET.
+	Latency firstByte; // accept() to the first data of the connection.
+} EventLoopWorker;
+
+struct {
+	EventLoopWorker worker[EVENTLOOPMAXWORKERS];
+	int workerAmount;
+	int listenSock;
+	int connections; // Open connections of all loops.
+	int mostConnections; // Most open at once, exact even for connections shorter than a status second.
+} EventLoop;
+
+// Pin the calling thread to "cpu", a plain bit mask keeps this free of _GNU_SOURCE.
+void pinToCPU(int cpu) {
+	unsigned long mask[16];
+
+	memset(mask, 0, sizeof(mask));
+	mask[cpu / (8 * sizeof(unsigned long))] |= 1UL << (cpu % (8 * sizeof(unsigned long)));
+	syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask); // Best effort, the loop works unpinned too.
+}
 
+static void eventLoopAccept(EventLoopWorker* w, pid_t tid) {
+	int k;
 
-	printf("servIP: %s\n", servIP);
-	
+	for (k = 0; k < EVENTLOOPACCEPTBATCH; k++) {
+		struct sockaddr_in clntAddr;
+		socklen_t clntLen = sizeof(clntAddr);
+		int sock;
+		if (Paras.accept4) {
+			sock = (int) syscall(SYS_accept4, EventLoop.listenSock, (struct sockaddr*) &clntAddr, &clntLen, SOCK_NONBLOCK);
+		}
+		else {
+			sock = accept(EventLoop.listenSock, (struct sockaddr*) &clntAddr, &clntLen);
+		}
+		if (sock < 0) {
+			if (errno == ECONNABORTED) {
+				w->resets++; // Reset while still in the accept queue.
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				return; // Taken by another loop, or no more pending.
+			}
+			dieWithError("eventLoopServer accept() failed");
+		}
+		if (!Paras.accept4) {
+			setNonBlocking(sock);
+		}
 
-	// Create a reliable, stream socket using TCP.
-	if ((sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
-		dieWithError("L1 client socket() failed");
+		EventConn* c = (EventConn*) malloc(sizeof(EventConn));
+		if (c == NULL) {
+			dieWithError("eventLoopServer malloc() failed");
+		}
+		c->sock = sock;
+		c->cs = connStatsOpen("server", sock, -1, tid, &clntAddr);
+		recvPathInit(&c->rp);
+		c->totalRecvMsgSize = 0;
+		c->recvCalls = 0;
+		c->t1 = timingNowNs();
+		c->peerAddress = clntAddr;
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+			dieWithError("eventLoopServer epoll_ctl() failed");
+		}
+		__atomic_add_fetch(&w->connections, 1, __ATOMIC_RELAXED);
+		w->accepted++;
+		int open = __atomic_add_fetch(&EventLoop.connections, 1, __ATOMIC_RELAXED);
+		int most = __atomic_load_n(&EventLoop.mostConnections, __ATOMIC_RELAXED);
+		while (open > most && !__atomic_compare_exchange_n(&EventLoop.mostConnections, &most, open, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		}
 	}
+}
 
-	// Construct the server address structure.
-	memset(&servAddr, 0, sizeof(servAddr)); // Zero out structure.
-	servAddr.sin_family = AF_INET; // Internet address family.
-	servAddr.sin_addr.s_addr = inet_addr(servIP); // Server IP address.
-	servAddr.sin_port = htons(servPort); // Server port.
+static void eventLoopClose(EventLoopWorker* w, EventConn* c) {
+	char prefix[64];
+	char ip[INET_ADDRSTRLEN];
+	double timeSpan = timingSince(c->t1);
+
+	// One line per connection, a summary each would drown tens of thousands of them.
+	inet_ntop(AF_INET, &c->peerAddress.sin_addr, ip, sizeof(ip));
+	snprintf(prefix, sizeof(prefix), "loop %d %s:%d ", w->id, ip, ntohs(c->peerAddress.sin_port));
+	printf("%sclosed: %llu Bytes in %lf s, %lf Mb/s, %llu recv calls\n", prefix, c->totalRecvMsgSize, timeSpan, timeSpan > 0 ? c->totalRecvMsgSize * 8 / (timeSpan * 1000 * 1000) : 0.0, c->recvCalls);
+	recvPathFinish(&c->rp, timeSpan, prefix);
+
+	connStatsClose(c->cs);
+	close(c->sock); // Also removes it from the epoll set.
+	free(c);
+	__atomic_sub_fetch(&w->connections, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&EventLoop.connections, 1, __ATOMIC_RELAXED);
+}
 
-	// Establish the connection to the echo server.
-	if (connect(sock, (struct sockaddr*) &servAddr, sizeof(servAddr)) < 0) {
-		dieWithError("L1 client connect() failed");
-	}
+void* threadEventLoop(void* arg) {
+	EventLoopWorker* w = (EventLoopWorker*) arg;
+	struct epoll_event events[EVENTLOOPMAXEVENTS];
+	pid_t tid = gettid();
+	int i;
 
-	// [Test
-	package = (char*) malloc(pkgSize * sizeof(char));
-	int i = 0;
-	package[0] = 's';
-	for (i = 1; i <= pkgSize-3; i++) {
-		package[i] = 'd';
-	}
-	package[pkgSize-2] = 'e';
-	//package[pkgSize-1] = '\0';
-	package[pkgSize-1] = 'e';
-	printf("package size: %d\n", pkgSize);
+	pinToCPU(w->id % (int) sysconf(_SC_NPROCESSORS_ONLN));
+	w->buffer = bufPoolNodeGet(); // After pinning, so it comes from this core's node.
 
-	// CPU calculating.
-	ProcStat ps1, ps2;
-	ProcPidStat pps1, pps2;	
-	pid_t pid = getpid();
-	getWholeCPUStatus(&ps1);
-	getProcessCPUStatus(&pps1, pid);
-	
-	// Time calculating.
-	struct timeval t1, t2; // "struct" required when use gcc.
-	gettimeofday(&t1, NULL);
-	double timeSpan = 0.0;
-	unsigned int sendTimes = 0;
 	while (1) {
-		if (send(sock, package, pkgSize, 0) != pkgSize) {
-			dieWithError("L1 client send() send a different number of bytes than expected");
+		int n = epoll_wait(w->epfd, events, EVENTLOOPMAXEVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			dieWithError("eventLoopServer epoll_wait() failed");
 		}
-		sendTimes++;
-		
-		
-		gettimeofday(&t2, NULL);
-		timeSpan = (double) (t2.tv_sec-t1.tv_sec) + (double) t2.tv_usec*1e-6 - (double) t1.tv_usec*1e-6;
-		if (timeSpan >= interval) {
-			break;
+		for (i = 0; i < n; i++) {
+			EventConn* c = (EventConn*) events[i].data.ptr;
+			if (c == NULL) {
+				eventLoopAccept(w, tid);
+				continue;
+			}
+
+			int recvMsgSize = connStatsTimedRecv(c->cs, c->sock, w->buffer, RCVBUFSIZE, 0);
+			if (recvMsgSize > 0) {
+				if (c->totalRecvMsgSize == 0) {
+					latencyAdd(&w->firstByte, timingNowNs() - c->t1);
+				}
+				c->totalRecvMsgSize += recvMsgSize;
+				c->recvCalls++;
+				connStatsRecv(c->cs, recvMsgSize);
+				recvPathFeed(&c->rp, w->buffer, recvMsgSize);
+			}
+			else if (recvMsgSize == 0 || errno == ECONNRESET) {
+				if (recvMsgSize < 0) {
+					w->resets++;
+				}
+				eventLoopClose(w, c);
+			}
+			else if (!connStatsNoProgress(recvMsgSize)) {
+				dieWithError("eventLoopServer recv() failed");
+			}
 		}
 	}
 
-	getWholeCPUStatus(&ps2);
-	getProcessCPUStatus(&pps2, pid);
-	float CPUUse = calWholeCPUUse(&ps1, &ps2);
-	float processCPUUse = calProcessCPUUse(&ps1, &pps1, &ps2, &pps2);
-	printf("CPUUse: %f, processCPUUse: %f\n", CPUUse, processCPUUse);
+	return ((void*) 0);
+}
 
-	printf("send times: %d\n", sendTimes);
-	unsigned long long int totalSendMsgSize = (unsigned long long int) sendTimes * pkgSize;
-	printf("totalSendMsgSize: %lld Bytes\n", totalSendMsgSize);
-	printf("time span: %lf s\n", timeSpan);
-	double sendSpeed = ((double) sendTimes * pkgSize * 8) / (timeSpan * 1000 * 1000);
-	printf("send speed: %lf Mb/s\n\n", sendSpeed);
-	// Test]
+// Resident memory of the process in Bytes.
+static unsigned long long int eventLoopRss() {
+	unsigned long long int size = 0, resident = 0;
+	FILE* fd = fopen("/proc/self/statm", "r");
+	if (fd != NULL) {
+		if (fscanf(fd, "%llu %llu", &size, &resident) != 2) {
+			resident = 0;
+		}
+		fclose(fd);
+	}
+	return resident * sysconf(_SC_PAGESIZE);
+}
 
-	sleep(3);
+// Memory of all TCP sockets of the host in Bytes, the "mem" pages of /proc/net/sockstat.
+static unsigned long long int eventLoopKernelTcpMem() {
+	char line[256];
+	unsigned long long int pages = 0;
+	FILE* fd = fopen("/proc/net/sockstat", "r");
+	if (fd != NULL) {
+		while (fgets(line, sizeof(line), fd) != NULL) {
+			char* mem = strstr(line, " mem ");
+			if (strncmp(line, "TCP:", 4) == 0 && mem != NULL) {
+				pages = strtoull(mem + 5, NULL, 10);
+			}
+		}
+		fclose(fd);
+	}
+	return pages * sysconf(_SC_PAGESIZE);
+}
 
-	close(sock);
+void eventLoopServer() {
+	printf("eventLoopServer\n");
+	int cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	int workers = Paras.workers > 0 ? Paras.workers : cpus;
+	int i;
 
-}
+	workers = workers < EVENTLOOPMAXWORKERS ? workers : EVENTLOOPMAXWORKERS;
+	EventLoop.workerAmount = workers;
+	// Connection bursts of many front-ends need more than MAXPENDING.
+	EventLoop.listenSock = listenOn(Paras.servPort, SOMAXCONN, "eventLoopServer listen failed");
+	setNonBlocking(EventLoop.listenSock); // Every loop wakes up for it, only one gets each connection.
+	printf("servPort: %d, event loops: %d, connection table: %d\n", Paras.servPort, workers, connStatsMax);
+
+	unsigned long long int rss0 = eventLoopRss();
+	unsigned long long int kernel0 = eventLoopKernelTcpMem();
+	unsigned long long int overflows0 = procNetCounter("/proc/net/netstat", "TcpExt:", "ListenOverflows"); // Accept queue full, the SYN or ACK was dropped.
+	unsigned long long int drops0 = procNetCounter("/proc/net/netstat", "TcpExt:", "ListenDrops");
+
+	for (i = 0; i < workers; i++) {
+		EventLoopWorker* w = &EventLoop.worker[i];
+		w->id = i;
+		latencyInit(&w->firstByte, i);
+		if ((w->epfd = epoll_create1(0)) < 0) {
+			dieWithError("eventLoopServer epoll_create1() failed");
+		}
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLEXCLUSIVE; // Wake one loop per new connection, not all of them.
+		ev.data.ptr = NULL;
+		if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, EventLoop.listenSock, &ev) < 0) {
+			dieWithError("eventLoopServer epoll_ctl() failed");
+		}
+		if (pthread_create(&w->ntid, NULL, threadEventLoop, w) != 0) {
+			dieWithError("eventLoopServer pthread_create() failed");
+		}
+		pthread_detach(w->ntid);
+	}
+
+	// Status once a second: the largest number of open connections, the aggregate rate they were served at, and what
+	// each of them costs.
+	ConnStatsTotals totals;
+	unsigned long long int lastBytes = 0, lastNs = timingNowNs();
+	unsigned long long int accepted = 0, lastAccepted = 0;
+	double peakAcceptRate = 0.0;
+	unsigned int acceptSeconds = 0; // Seconds in which connections were accepted.
+	int peak = 0;
+	double peakRate = 0.0;
+	unsigned long long int peakRss = rss0, peakKernel = kernel0;
+	int idle = 0;
+	int stopped = 0;
+	unsigned int tick = 0;
+
+	while (1) {
+		sleep(1);
+		int connections = 0;
+		accepted = 0;
+		for (i = 0; i < workers; i++) {
+			connections += __atomic_load_n(&EventLoop.worker[i].connections, __ATOMIC_RELAXED);
+			accepted += EventLoop.worker[i].accepted;
+		}
+		connStatsSnapshot(NULL, &totals);
+		unsigned long long int now = timingNowNs();
+		double rate = (totals.recvBytes - lastBytes) * 8 / ((now - lastNs) * 1e-3);
+		double acceptRate = (accepted - lastAccepted) / ((now - lastNs) * 1e-9);
+		acceptSeconds += accepted > lastAccepted;
+		peakAcceptRate = acceptRate > peakAcceptRate ? acceptRate : peakAcceptRate;
+		lastAccepted = accepted;
+		lastBytes = totals.recvBytes;
+		lastNs = now;
+
+		if (connections > peak) {
+			peak = connections;
+			peakRate = rate;
+			peakRss = rss0;
+			peakKernel = kernel0;
+		}
+		if (connections == peak && peak > 0) {
+			// Socket queues fill and drain, keep the most seen at the peak.
+			unsigned long long int rss = eventLoopRss();
+			unsigned long long int kernel = eventLoopKernelTcpMem();
+			peakRate = rate > peakRate ? rate : peakRate;
+			peakRss = rss > peakRss ? rss : peakRss;
+			peakKernel = kernel > peakKernel ? kernel : peakKernel;
+		}
+		if (++tick % 10 == 0) {
+			printf("event loops: %d connections, %llu accepted, recv %.1f Mb/s\n", connections, accepted, rate);
+			fflush(stdout);
+		}
+
+		// Stop accepting after SIGTERM and end when the open connections are done.
+		if (reportStopping() && !stopped) {
+			for (i = 0; i < workers; i++) {
+				epoll_ctl(EventLoop.worker[i].epfd, EPOLL_CTL_DEL, EventLoop.listenSock, NULL);
+			}
+			close(EventLoop.listenSock);
+			stopped = 1;
+		}
+		idle = connections == 0 ? idle + 1 : 0;
+		if (stopped && connections == 0) {
+			break;
+		}
+		if (!Paras.continuous && idle >= 30) {
+			printf("timeout\n");
+			break;
+		}
+	}
+
+	Latency firstByte;
+	unsigned long long int resets = 0;
+	latencyInit(&firstByte, 0);
+	for (i = 0; i < workers; i++) {
+		resets += EventLoop.worker[i].resets;
+		latencyMerge(&firstByte, &EventLoop.worker[i].firstByte);
+	}
+	printf("accepted: %llu, reset: %llu, listen overflows: %llu, listen drops: %llu (host wide)\n", accepted, resets, procNetCounter("/proc/net/netstat", "TcpExt:", "ListenOverflows") - overflows0, procNetCounter("/proc/net/netstat", "TcpExt:", "ListenDrops") - drops0);
+	printf("accept rate: peak %.0f /s, mean %.0f /s over %u s with accepts\n", peakAcceptRate, acceptSeconds > 0 ? (double) accepted / acceptSeconds : 0.0, acceptSeconds);
+	latencyPrint(&firstByte, "", "accept to first byte");
+	printf("most connections open at once: %d\n", __atomic_load_n(&EventLoop.mostConnections, __ATOMIC_RELAXED));
+	printf("peak connections (sampled each second): %d at aggregate recv %lf Mb/s (%lf kb/s each)\n", peak, peakRate, peak > 0 ? peakRate * 1000 / peak : 0.0);
+	if (peak > 0) {
+		printf("memory per connection: %zu Bytes user state, %llu Bytes RSS, %llu Bytes kernel TCP (host wide)\n", sizeof(EventConn) + sizeof(ConnStats), peakRss > rss0 ? (peakRss - rss0) / peak : 0, peakKernel > kernel0 ? (peakKernel - kernel0) / peak : 0);
+	}
+	if (Paras.continuous) {
+		reportDrain(NULL);
+	}
+
+	exit(0);
+}
+// ]
+
+// [ DatagramServer
+// Raw UDP front-ends. udpServer reads through the socket layer, one recv() per datagram on a SO_REUSEPORT socket per thread.
+// packetServer skips the socket layer: every thread maps a TPACKET_V3 ring on "-iface" and all rings share one fanout group.
+// Both stop after 10 s without datagrams, "-continuous" keeps them until SIGTERM. Every thread has a ConnStats slot, so the
+// reports and "-m" see the datagrams like the bytes of a connection.
+#define DGRAMMAXTHREADS 64
+#define DGRAMIDLESECONDS 10
+
+typedef struct dgramThread {
+	int index;
+	pthread_t ntid;
+	int sock; // udpServer.
+	PacketRing* ring; // packetServer.
+	unsigned long long int datagrams;
+	unsigned long long int totalRecvMsgSize;
+	unsigned long long int firstNs; // First and last datagram.
+	unsigned long long int lastNs;
+	unsigned int ringPackets; // Kernel counters of the ring.
+	unsigned int ringDrops;
+	float threadCPUUse;
+} DgramThread;
+
+struct {
+	int threadAmount;
+	DgramThread thread[DGRAMMAXTHREADS];
+} Dgram;
+
+static int dgramIdle(DgramThread* dt, unsigned long long int startNs) {
+	if (Paras.continuous) {
+		return reportStopping();
+	}
+	unsigned long long int last = dt->lastNs > 0 ? dt->lastNs : startNs;
+	return timingNowNs() - last > DGRAMIDLESECONDS * 1000000000ULL;
+}
+
+static void dgramReceived(DgramThread* dt, unsigned long long int before) {
+	if (dt->datagrams != before) {
+		dt->lastNs = timingNowNs();
+		if (dt->firstNs == 0) {
+			dt->firstNs = dt->lastNs;
+		}
+	}
+}
+
+void* threadUdpRecv(void* arg) {
+	DgramThread* dt = (DgramThread*) arg;
+	char* buffer = bufPoolNodeGet();
+	ProcStat ps1, ps2;
+	ProcPidStat pps1, pps2;
+	pid_t pid = getpid();
+	pid_t tid = gettid();
+	getWholeCPUStatus(&ps1);
+	getThreadCPUStatus(&pps1, pid, tid);
+	ConnStats* cs = connStatsOpen("udpserver", dt->sock, -1, tid, NULL);
+
+	unsigned long long int t1 = timingNowNs();
+	while (!dgramIdle(dt, t1)) {
+		ssize_t recvMsgSize = connStatsTimedRecv(cs, dt->sock, buffer, RCVBUFSIZE, 0);
+		if (recvMsgSize < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				continue; // SO_RCVTIMEO, check for idle.
+			}
+			dieWithError("udpServer recv() failed");
+		}
+		unsigned long long int before = dt->datagrams;
+		dt->datagrams++;
+		dt->totalRecvMsgSize += recvMsgSize;
+		connStatsRecv(cs, recvMsgSize);
+		dgramReceived(dt, before);
+	}
+	connStatsClose(cs);
+
+	getWholeCPUStatus(&ps2);
+	getThreadCPUStatus(&pps2, pid, tid);
+	dt->threadCPUUse = calThreadCPUUse(&ps1, &pps1, &ps2, &pps2);
+	bufPoolNodePut(buffer);
+	return ((void*) 0);
+}
+
+void* threadPacketRecv(void* arg) {
+	DgramThread* dt = (DgramThread*) arg;
+	ProcStat ps1, ps2;
+	ProcPidStat pps1, pps2;
+	pid_t pid = getpid();
+	pid_t tid = gettid();
+	getWholeCPUStatus(&ps1);
+	getThreadCPUStatus(&pps1, pid, tid);
+	ConnStats* cs = connStatsOpen("packetserver", -1, -1, tid, NULL); // No socket queue to sample, the ring is the queue.
+
+	unsigned long long int t1 = timingNowNs();
+	while (!dgramIdle(dt, t1)) {
+		unsigned long long int before = dt->datagrams;
+		unsigned long long int beforeBytes = dt->totalRecvMsgSize;
+		packetRingRead(dt->ring, 1000, &dt->datagrams, &dt->totalRecvMsgSize);
+		connStatsRecvBatch(cs, dt->totalRecvMsgSize - beforeBytes, dt->datagrams - before);
+		dgramReceived(dt, before);
+	}
+	connStatsClose(cs);
+
+	getWholeCPUStatus(&ps2);
+	getThreadCPUStatus(&pps2, pid, tid);
+	dt->threadCPUUse = calThreadCPUUse(&ps1, &pps1, &ps2, &pps2);
+	packetRingStats(dt->ring, &dt->ringPackets, &dt->ringDrops);
+	return ((void*) 0);
+}
+
+// A UDP socket bound to "port" that other threads may bind as well, the kernel spreads datagrams over them by flow hash.
+static int udpSocket(unsigned short port) {
+	int sock;
+	struct sockaddr_in addr;
+	int on = 1;
+	int rcvBuf = 64 * 1024 * 1024;
+	struct timeval timeout;
+
+	if ((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+		dieWithError("udpServer socket() failed");
+	}
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(int)) < 0) {
+		dieWithError("udpServer setsockopt() SO_REUSEPORT failed");
+	}
+	// SO_RCVBUFFORCE passes net.core.rmem_max for root, others get what rmem_max allows.
+	if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &rcvBuf, sizeof(int)) < 0) {
+		setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvBuf, sizeof(int));
+	}
+	timeout.tv_sec = 1;
+	timeout.tv_usec = 0;
+	if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+		dieWithError("udpServer setsockopt() SO_RCVTIMEO failed");
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+		dieWithError("udpServer bind() failed");
+	}
+
+	return sock;
+}
+
+// Start the threads, wait for them and print per thread and total rate and CPU. "ring" selects packetServer.
+static void dgramServer(int ring) {
+	int cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	int threadAmount = Paras.workers > 0 ? Paras.workers : cpus;
+	int fanoutMode = PACKET_FANOUT_LB;
+	int i;
+
+	if (threadAmount > DGRAMMAXTHREADS) {
+		threadAmount = DGRAMMAXTHREADS;
+	}
+	if (Paras.distType == DistHash) {
+		fanoutMode = PACKET_FANOUT_HASH; // Every flow stays on one ring, in order.
+	}
+	else if (Paras.distType == DistLeastQueued) {
+		fanoutMode = PACKET_FANOUT_ROLLOVER; // Fill one ring, move on once it is full.
+	}
+	Dgram.threadAmount = threadAmount;
+	if (ring) {
+		printf("packetServer, iface: %s, port: %d, threads: %d, fanout: %d\n", Paras.iface, Paras.servPort, threadAmount, fanoutMode);
+	}
+	else {
+		printf("udpServer, port: %d, threads: %d\n", Paras.servPort, threadAmount);
+	}
+
+	ProcStat ps1, ps2;
+	ProcPidStat pps1, pps2;
+	pid_t pid = getpid();
+	getWholeCPUStatus(&ps1);
+	getProcessCPUStatus(&pps1, pid);
+	unsigned long long int rcvbufErrors0 = procNetCounter("/proc/net/snmp", "Udp:", "RcvbufErrors");
+
+	for (i = 0; i < threadAmount; i++) {
+		DgramThread* dt = &Dgram.thread[i];
+		memset(dt, 0, sizeof(DgramThread));
+		dt->index = i;
+		if (ring) {
+			// The fanout group id only has to be unique on the host while the rings are open.
+			dt->ring = packetRingOpen(Paras.iface, Paras.servPort, threadAmount > 1 ? (pid & 0xffff) : 0, fanoutMode);
+			if (dt->ring == NULL) {
+				dieWithError("packetServer packetRingOpen() failed");
+			}
+		}
+		else {
+			dt->sock = udpSocket(Paras.servPort);
+		}
+	}
+	// Threads start once every ring has joined the group, so no ring sees the whole traffic on its own.
+	for (i = 0; i < threadAmount; i++) {
+		if (pthread_create(&Dgram.thread[i].ntid, NULL, ring ? threadPacketRecv : threadUdpRecv, &Dgram.thread[i]) != 0) {
+			dieWithError("dgramServer pthread_create() failed");
+		}
+	}
+
+	unsigned long long int datagrams = 0;
+	unsigned long long int totalRecvMsgSize = 0;
+	unsigned long long int firstNs = 0;
+	unsigned long long int lastNs = 0;
+	unsigned long long int drops = 0;
+	for (i = 0; i < threadAmount; i++) {
+		DgramThread* dt = &Dgram.thread[i];
+		pthread_join(dt->ntid, NULL);
+		double span = dt->lastNs > dt->firstNs ? (dt->lastNs - dt->firstNs) * 1e-9 : 0.0;
+		printf("thread %d: datagrams: %llu, totalRecvMsgSize: %llu, recv speed: %lf Mb/s, threadCPUUse: %f\n", i, dt->datagrams, dt->totalRecvMsgSize, span > 0 ? dt->totalRecvMsgSize * 8 / (span * 1000 * 1000) : 0.0, dt->threadCPUUse);
+		datagrams += dt->datagrams;
+		totalRecvMsgSize += dt->totalRecvMsgSize;
+		if (dt->firstNs > 0 && (firstNs == 0 || dt->firstNs < firstNs)) {
+			firstNs = dt->firstNs;
+		}
+		if (dt->lastNs > lastNs) {
+			lastNs = dt->lastNs;
+		}
+		if (ring) {
+			drops += dt->ringDrops;
+			packetRingRelease(dt->ring);
+		}
+		else {
+			close(dt->sock);
+		}
+	}
+	getWholeCPUStatus(&ps2);
+	getProcessCPUStatus(&pps2, pid);
+	float CPUUse = calWholeCPUUse(&ps1, &ps2);
+	float processCPUUse = calProcessCPUUse(&ps1, &pps1, &ps2, &pps2);
+	if (!ring) {
+		drops = procNetCounter("/proc/net/snmp", "Udp:", "RcvbufErrors") - rcvbufErrors0; // Host wide.
+	}
+
+	double timeSpan = lastNs > firstNs ? (lastNs - firstNs) * 1e-9 : 0.0;
+	printf("CPUUse: %f, processCPUUse: %f\n", CPUUse, processCPUUse);
+	printf("datagrams: %llu, totalRecvMsgSize: %llu, %s: %llu\n", datagrams, totalRecvMsgSize, ring ? "ring drops" : "rcvbuf errors (host wide)", drops);
+	printf("time span: %lf\n", timeSpan);
+	if (timeSpan > 0) {
+		printf("recv speed: %lf Mb/s, %lf kdatagrams/s\n", totalRecvMsgSize * 8 / (timeSpan * 1000 * 1000), datagrams / (timeSpan * 1000));
+	}
+	// CPU time of the whole process per datagram, comparable across the receivers whatever the thread count.
+	if (datagrams > 0) {
+		double cpuNs = (double) ((pps2.utime + pps2.stimev) - (pps1.utime + pps1.stimev)) / sysconf(_SC_CLK_TCK) * 1e9;
+		printf("CPU per datagram: %.0lf ns\n", cpuNs / datagrams);
+	}
+	printMemoryStatus("", &pps1, &pps2, totalRecvMsgSize);
+	if (Paras.continuous) {
+		reportDrain(NULL);
+	}
+
+	exit(0);
+}
+
+void udpServer() {
+	dgramServer(0);
+}
+
+void packetServer() {
+	dgramServer(1);
+}
+// ]
+
+// [ ForkServer
+// Pre-forked receiver: one worker process per core instead of one thread per connection, to compare process against thread
+// scaling. Every worker has its own address space and heap and serves one connection at a time. By default each worker
+// listens on its own SO_REUSEPORT socket and the kernel hashes connections over them; with "-sharedlisten" the parent listens
+// and the workers take turns in accept() on the inherited socket, so an idle worker always takes the next connection.
+// Workers publish their counters in a ShmStats slot, the parent aggregates them into the interval and final reports.
+#define FORKMAXWORKERS 64
+#define FORKIDLESECONDS 30 // Like the accept timeout of multiConnMultiThreadServer.
+#define FORKCPUCALLS 64 // A worker publishes its CPU time every 64 recv() calls.
+
+// Listening socket of one worker, other workers bind the same port.
+static int forkListen(unsigned short port) {
+	int sock;
+	struct sockaddr_in addr;
+	int on = 1;
+
+	if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		dieWithError("forkServer socket() failed");
+	}
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int)) < 0 || setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(int)) < 0) {
+		dieWithError("forkServer setsockopt() failed");
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+		dieWithError("forkServer bind() failed");
+	}
+	if (listenSocket(sock, MAXPENDING) < 0) {
+		dieWithError("forkServer listen() failed");
+	}
+
+	return sock;
+}
+
+// Body of worker "index", never returns. "servSock" is the inherited listening socket, -1 to listen on its own.
+static void forkWorker(ShmStats* ss, int index, int servSock) {
+	ShmStatsSlot* slot = &ss->slot[index];
+	ShmStatsSlot mine;
+	memset(&mine, 0, sizeof(mine));
+	mine.pid = getpid();
+	shmStatsPublish(slot, &mine);
+
+	if (servSock < 0) {
+		servSock = forkListen(Paras.servPort);
+	}
+	setNonBlocking(servSock); // Workers sharing the socket all wake up, the ones that lose the race get EAGAIN.
+	char* buffer = (char*) malloc(RCVBUFSIZE); // From the worker's own heap, no pool shared with other workers.
+	if (buffer == NULL) {
+		dieWithError("forkServer malloc() failed");
+	}
+
+	unsigned long long int idleSince = timingNowNs();
+	while (!__atomic_load_n(&ss->stop, __ATOMIC_RELAXED)) {
+		struct pollfd pfd;
+		pfd.fd = servSock;
+		pfd.events = POLLIN;
+		int ret = poll(&pfd, 1, 1000);
+		if (ret < 0 && errno != EINTR) {
+			dieWithError("forkServer poll() failed");
+		}
+		if (ret <= 0) {
+			if (!Paras.continuous && timingNowNs() - idleSince > FORKIDLESECONDS * 1000000000ULL) {
+				break;
+			}
+			continue;
+		}
+
+		struct sockaddr_in clntAddr;
+		socklen_t clntLen = sizeof(clntAddr);
+		int clntSock = accept(servSock, (struct sockaddr*) &clntAddr, &clntLen);
+		if (clntSock < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED) {
+				continue;
+			}
+			dieWithError("forkServer accept() failed");
+		}
+		mine.connections++;
+		mine.active = 1;
+		mine.cpuNs = threadCPUNs(); // Only this thread lives on in the worker, its CPU is the worker's.
+		shmStatsPublish(slot, &mine);
+
+		RecvPath rp;
+		recvPathInit(&rp);
+		unsigned long long int totalRecvMsgSize = 0;
+		unsigned long long int t1 = timingNowNs();
+		int recvMsgSize;
+		while ((recvMsgSize = recv(clntSock, buffer, RCVBUFSIZE, 0)) > 0) {
+			totalRecvMsgSize += recvMsgSize;
+			recvPathFeed(&rp, buffer, recvMsgSize);
+			mine.totalRecvMsgSize += recvMsgSize;
+			mine.recvCalls++;
+			mine.lastNs = timingNowNs();
+			if (mine.firstNs == 0) {
+				mine.firstNs = mine.lastNs;
+			}
+			if (mine.recvCalls % FORKCPUCALLS == 0) {
+				mine.cpuNs = threadCPUNs();
+			}
+			shmStatsPublish(slot, &mine);
+		}
+		if (recvMsgSize < 0) {
+			dieWithError("forkServer recv() failed");
+		}
+		double timeSpan = timingSince(t1);
+		close(clntSock);
+		mine.active = 0;
+		mine.cpuNs = threadCPUNs();
+		shmStatsPublish(slot, &mine);
+
+		char prefix[32];
+		snprintf(prefix, sizeof(prefix), "worker %d-%d ", index, mine.pid);
+		printf("%sconnection from %s:%d, totalRecvMsgSize: %llu Bytes, time span: %lf, receive speed: %lf Mb/s\n", prefix, inet_ntoa(clntAddr.sin_addr), ntohs(clntAddr.sin_port), totalRecvMsgSize, timeSpan, ((double) totalRecvMsgSize * 8) / (timeSpan * 1000 * 1000));
+		recvPathFinish(&rp, timeSpan, prefix);
+		fflush(stdout); // Workers leave with _exit().
+		idleSince = timingNowNs();
+	}
+
+	free(buffer);
+	close(servSock);
+	_exit(0);
+}
+
+static ShmStats* forkStats; // For forkServerTotals().
+
+// Sum of every slot.
+static void forkServerTotal(ShmStats* ss, ShmStatsSlot* total) {
+	int i;
+	memset(total, 0, sizeof(ShmStatsSlot));
+	for (i = 0; i < ss->slotAmount; i++) {
+		ShmStatsSlot s;
+		shmStatsRead(&ss->slot[i], &s);
+		total->connections += s.connections;
+		total->active += s.active;
+		total->totalRecvMsgSize += s.totalRecvMsgSize;
+		total->recvCalls += s.recvCalls;
+		total->cpuNs += s.cpuNs;
+		if (s.firstNs > 0 && (total->firstNs == 0 || s.firstNs < total->firstNs)) {
+			total->firstNs = s.firstNs;
+		}
+		if (s.lastNs > total->lastNs) {
+			total->lastNs = s.lastNs;
+		}
+	}
+}
+
+// The workers' counters and CPU time in the totals of the parent, for "-m" and the "-continuous" windows. Only the parent has a thread
+// reading them, the workers keep nothing in ConnStats.
+static void forkServerTotals(ConnStatsTotals* totals) {
+	ShmStatsSlot total;
+	forkServerTotal(forkStats, &total);
+	totals->activeConnections += total.active;
+	totals->closedConnections += total.connections - total.active;
+	totals->recvBytes += total.totalRecvMsgSize;
+	totals->recvCalls += total.recvCalls;
+	totals->cpuNs += total.cpuNs;
+}
+
+void forkServer() {
+	int cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	int workerAmount = Paras.workers > 0 ? Paras.workers : cpus;
+	pid_t pids[FORKMAXWORKERS];
+	struct rusage usage[FORKMAXWORKERS];
+	int servSock = -1;
+	int i;
+
+	if (workerAmount > FORKMAXWORKERS) {
+		workerAmount = FORKMAXWORKERS;
+	}
+	printf("forkServer, port: %d, workers: %d, %s\n", Paras.servPort, workerAmount, Paras.sharedListen ? "shared listening socket" : "SO_REUSEPORT socket per worker");
+	ShmStats* ss = shmStatsAlloc(workerAmount);
+	if (ss == NULL) {
+		dieWithError("forkServer shmStatsAlloc() failed");
+	}
+	forkStats = ss;
+	connStatsTotalsHook(forkServerTotals);
+	if (Paras.sharedListen) {
+		servSock = listenOn(Paras.servPort, MAXPENDING, "forkServer listenOn() failed");
+	}
+
+	ProcStat ps1, ps2;
+	getWholeCPUStatus(&ps1);
+	pid_t parent = getpid();
+	fflush(stdout); // Or the workers print it again.
+	for (i = 0; i < workerAmount; i++) {
+		if ((pids[i] = fork()) < 0) {
+			dieWithError("forkServer fork() failed");
+		}
+		else if (pids[i] == 0) {
+			// Only this thread lives on in the worker. "-continuous" blocked SIGTERM for the signal thread of the parent, the
+			// worker takes the default action again and dies with the parent.
+			sigset_t none;
+			sigemptyset(&none);
+			pthread_sigmask(SIG_SETMASK, &none, NULL);
+			prctl(PR_SET_PDEATHSIG, SIGTERM);
+			if (getppid() != parent) {
+				_exit(1);
+			}
+			forkWorker(ss, i, servSock);
+		}
+		memset(&usage[i], 0, sizeof(struct rusage));
+	}
+	if (servSock >= 0) {
+		close(servSock);
+	}
+
+	// Reap the workers, report every "-i" seconds, pass SIGTERM on as the stop flag.
+	int alive = workerAmount;
+	unsigned int seconds = 0;
+	ShmStatsSlot prev;
+	memset(&prev, 0, sizeof(prev));
+	while (alive > 0) {
+		sleep(1);
+		seconds++;
+		if (reportStopping()) {
+			__atomic_store_n(&ss->stop, 1, __ATOMIC_RELAXED);
+		}
+		for (i = 0; i < workerAmount; i++) {
+			int status;
+			if (pids[i] > 0 && wait4(pids[i], &status, WNOHANG, &usage[i]) == pids[i]) {
+				if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+					printf("worker %d-%d failed\n", i, pids[i]);
+				}
+				pids[i] = 0;
+				alive--;
+			}
+		}
+		if (Paras.reportInterval > 0 && seconds % Paras.reportInterval == 0) {
+			ShmStatsSlot total;
+			forkServerTotal(ss, &total);
+			printf("workers alive: %d, connections: %llu, active: %llu, recv speed: %lf Mb/s\n", alive, total.connections, total.active, ((double) (total.totalRecvMsgSize - prev.totalRecvMsgSize) * 8) / (Paras.reportInterval * 1000 * 1000));
+			prev = total;
+		}
+	}
+	getWholeCPUStatus(&ps2);
+
+	// Worker CPU comes from wait4(), it covers the whole process whatever ran in it.
+	double workerCPU = 0.0;
+	for (i = 0; i < workerAmount; i++) {
+		ShmStatsSlot s;
+		shmStatsRead(&ss->slot[i], &s);
+		double cpu = usage[i].ru_utime.tv_sec + usage[i].ru_utime.tv_usec * 1e-6 + usage[i].ru_stime.tv_sec + usage[i].ru_stime.tv_usec * 1e-6;
+		workerCPU += cpu;
+		char perGB[64] = ""; // Only a worker that received something has faults per GB.
+		if (s.totalRecvMsgSize > 0) {
+			double gb = s.totalRecvMsgSize / 1e9;
+			snprintf(perGB, sizeof(perGB), ", per GB: minor %.1f, major %.1f", usage[i].ru_minflt / gb, usage[i].ru_majflt / gb);
+		}
+		printf("worker %d-%d: connections: %llu, totalRecvMsgSize: %llu Bytes, recv calls: %llu, CPU: %lf s, max RSS: %ld KB, page faults: minor %ld, major %ld%s, context switches: voluntary %ld, involuntary %ld\n", i, s.pid, s.connections, s.totalRecvMsgSize, s.recvCalls, cpu, usage[i].ru_maxrss, usage[i].ru_minflt, usage[i].ru_majflt, perGB, usage[i].ru_nvcsw, usage[i].ru_nivcsw);
+	}
+	ShmStatsSlot total;
+	forkServerTotal(ss, &total);
+	double timeSpan = total.lastNs > total.firstNs ? (total.lastNs - total.firstNs) * 1e-9 : 0.0;
+	printf("CPUUse: %f, workers CPU: %lf s\n", calWholeCPUUse(&ps1, &ps2), workerCPU);
+	printf("connections: %llu, totalRecvMsgSize: %llu Bytes, recv calls: %llu\n", total.connections, total.totalRecvMsgSize, total.recvCalls);
+	printf("time span: %lf\n", timeSpan);
+	if (timeSpan > 0) {
+		printf("receive speed: %lf Mb/s, workers CPU use: %lf cores\n", ((double) total.totalRecvMsgSize * 8) / (timeSpan * 1000 * 1000), workerCPU / timeSpan);
+	}
+	if (Paras.continuous) {
+		reportDrain(&alive); // The workers are gone, only the rolling windows are left to print.
+	}
+	// No shmStatsRelease(): the metrics thread may be reading the slots through the hook, the mapping goes with exit().
+
+	exit(0);
+}
+// ]
+
+// [ ClientStream
+// The L1 client sends "-streams N" streams, one connection and one thread each. Stream i uses generator i of the "-gen" list
+// (the list repeats) and source id "-id" + i.
+#define CLIENTMAXSTREAMS 64
+
+typedef struct clientStream {
+	int index;
+	GenType genType;
+	uint16_t srcId;
+	pthread_t ntid;
+} ClientStream;
+
+void* threadClientStream(void* arg) {
+	ClientStream* stream = (ClientStream*) arg;
+	int sock; // Socket descriptor.
+	struct sockaddr_in servAddr; // Server address.
+	char* package;
+
+	unsigned short servPort = Paras.servPort;
+	char* servIP = Paras.servIP;
+	unsigned int pkgSize = Paras.pkgSize;	
+	unsigned int interval = Paras.interval;
+	char prefix[32] = "";
+	if (Paras.streams > 1) {
+		snprintf(prefix, sizeof(prefix), "stream %d ", stream->index);
+	}
+
+
+	printf("%sservIP: %s\n", prefix, servIP);
+
+	// Every stream replays its own seeded data, generated before connecting so the receiver does not time it.
+	GenRing* ring = genRingAlloc(stream->genType, pkgSize, Paras.seed + stream->index, Paras.adcBits);
+	if (ring == NULL) {
+		dieWithError("L1 client genRingAlloc() failed");
+	}
+	
+
+	// Create a reliable, stream socket using TCP.
+	if ((sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+		dieWithError("L1 client socket() failed");
+	}
+
+	// Construct the server address structure.
+	memset(&servAddr, 0, sizeof(servAddr)); // Zero out structure.
+	servAddr.sin_family = AF_INET; // Internet address family.
+	servAddr.sin_addr.s_addr = inet_addr(servIP); // Server IP address.
+	servAddr.sin_port = htons(servPort); // Server port.
+
+	// Establish the connection to the echo server.
+	if (connect(sock, (struct sockaddr*) &servAddr, sizeof(servAddr)) < 0) {
+		dieWithError("L1 client connect() failed");
+	}
+	ConnStats* cs = connStatsOpen("l1client", -1, sock, gettid(), &servAddr);
+
+	// [Test
+	printf("%spackage size: %d\n", prefix, pkgSize);
+	printf("%sgenerator: %s, seed: %llu, ring: %d packages, %llu Bytes (%s), generated in %lf s\n", prefix, genTypeName(ring->type), Paras.seed + stream->index, ring->amount, (unsigned long long int) ring->amount * pkgSize, ring->backing, ring->genNs * 1e-9);
+	if (Paras.framed) {
+		if (pkgSize <= FRAMEHEADERSIZE + (Paras.crc ? CRC32CSIZE : 0)) {
+			dieWithError("L1 client package size must be larger than the frame header");
+		}
+		printf("%sframed, source id: %d\n", prefix, stream->srcId);
+	}
+	if (Paras.crc) {
+		printf("%scrc32c: %s\n", prefix, crc32cImplName());
+	}
+
+	// CPU calculating.
+	ProcStat ps1, ps2;
+	ProcPidStat pps1, pps2;	
+	pid_t pid = getpid();
+	pid_t tid = gettid();
+	getWholeCPUStatus(&ps1);
+	getThreadCPUStatus(&pps1, pid, tid);
+	PerfCount perf;
+	perfCountStart(&perf);
+	
+	// Time calculating.
+	Deadline deadline; // The send loop only tests a flag, no clock read per package.
+	deadlineStart(&deadline, interval);
+	unsigned long long int t1 = timingNowNs();
+	double timeSpan = 0.0;
+	unsigned int sendTimes = 0;
+	while (!deadlinePassed(&deadline)) {
+		package = genRingNext(ring);
+		if (Paras.framed) {
+			frameHeaderWrite(package, stream->srcId, Paras.crc ? FRAMEFLAGCRC : 0, sendTimes, pkgSize - FRAMEHEADERSIZE);
+			if (Paras.crc) {
+				crc32cFrameSeal(package, pkgSize);
+			}
+		}
+		if (connStatsTimedSend(cs, sock, package, pkgSize, 0) != pkgSize) {
+			dieWithError("L1 client send() send a different number of bytes than expected");
+		}
+		sendTimes++;
+		connStatsSend(cs, pkgSize);
+	}
+	timeSpan = timingSince(t1);
+
+	getWholeCPUStatus(&ps2);
+	getThreadCPUStatus(&pps2, pid, tid);
+	perfCountStop(&perf);
+	float CPUUse = calWholeCPUUse(&ps1, &ps2);
+	float threadCPUUse = calProcessCPUUse(&ps1, &pps1, &ps2, &pps2);
+	printf("%sCPUUse: %f, threadCPUUse: %f\n", prefix, CPUUse, threadCPUUse);
+
+	printf("%ssend times: %d\n", prefix, sendTimes);
+	unsigned long long int totalSendMsgSize = (unsigned long long int) sendTimes * pkgSize;
+	printf("%stotalSendMsgSize: %lld Bytes\n", prefix, totalSendMsgSize);
+	printf("%stime span: %lf s\n", prefix, timeSpan);
+	double sendSpeed = ((double) sendTimes * pkgSize * 8) / (timeSpan * 1000 * 1000);
+	printf("%ssend speed: %lf Mb/s\n", prefix, sendSpeed);
+	connStatsPrintStall(cs, prefix);
+	printMemoryStatus(prefix, &pps1, &pps2, totalSendMsgSize);
+	perfCountPrint(&perf, prefix, totalSendMsgSize, sendTimes);
+	printf("\n");
+	// Test]
+
+	sleep(3);
+
+	genRingRelease(ring);
+	connStatsClose(cs);
+	close(sock);
+
+	return ((void*) 0);
+}
+
+void client() {
+	ClientStream streams[CLIENTMAXSTREAMS];
+	int streamAmount = Paras.streams < CLIENTMAXSTREAMS ? Paras.streams : CLIENTMAXSTREAMS;
+	int i;
+
+	for (i = 0; i < streamAmount; i++) {
+		streams[i].index = i;
+		streams[i].genType = Paras.genTypeAmount > 0 ? Paras.genTypes[i % Paras.genTypeAmount] : GenPattern;
+		streams[i].srcId = Paras.srcId + i;
+		if (pthread_create(&streams[i].ntid, NULL, threadClientStream, &streams[i]) != 0) {
+			dieWithError("L1 client pthread_create() failed");
+		}
+	}
+	for (i = 0; i < streamAmount; i++) {
+		pthread_join(streams[i].ntid, NULL);
+	}
+}
+// ]
+
+// [ StormClient
+// Connection storm, like every front-end reconnecting at once after a DAQ restart: "-streams" threads open connections at
+// "-storm" connections per second in total, send "-stormsize" Bytes on each and close it again.
+typedef struct stormThread {
+	int index;
+	int threadAmount;
+	pthread_t ntid;
+	Deadline* deadline;
+	Latency connectLatency; // connect() call to established.
+	unsigned long long int attempts;
+	unsigned long long int connected;
+	unsigned long long int refused;
+	unsigned long long int resets;
+	unsigned long long int timeouts;
+	unsigned long long int others;
+	int firstError; // errno of the first other failure.
+	unsigned long long int totalSendMsgSize;
+} StormThread;
+
+static void stormFailed(StormThread* st, int error) {
+	if (error == ECONNREFUSED) {
+		st->refused++;
+	}
+	else if (error == ECONNRESET || error == EPIPE) {
+		st->resets++;
+	}
+	else if (error == ETIMEDOUT) {
+		st->timeouts++;
+	}
+	else {
+		if (st->others++ == 0) {
+			st->firstError = error;
+		}
+	}
+}
+
+void* threadStorm(void* arg) {
+	StormThread* st = (StormThread*) arg;
+	struct sockaddr_in servAddr;
+	char* payload = NULL;
+
+	memset(&servAddr, 0, sizeof(servAddr));
+	servAddr.sin_family = AF_INET;
+	servAddr.sin_addr.s_addr = inet_addr(Paras.servIP);
+	servAddr.sin_port = htons(Paras.servPort);
+	if (Paras.stormSize > 0) {
+		payload = (char*) malloc(Paras.stormSize);
+		if (payload == NULL) {
+			dieWithError("stormClient malloc() failed");
+		}
+		memset(payload, 'a', Paras.stormSize);
+	}
+
+	// Open loop: connections are due on a fixed schedule, a slow connect() does not push the next ones back.
+	unsigned long long int intervalNs = (unsigned long long int) (1e9 * st->threadAmount / Paras.stormRate);
+	unsigned long long int next = timingNowNs() + intervalNs * st->index / st->threadAmount; // Threads take turns.
+
+	while (!deadlinePassed(st->deadline)) {
+		unsigned long long int now = timingNowNs();
+		if (now < next) {
+			struct timespec ts;
+			ts.tv_sec = (next - now) / 1000000000ULL;
+			ts.tv_nsec = (next - now) % 1000000000ULL;
+			nanosleep(&ts, NULL);
+			continue;
+		}
+		next = now - next > 1000000000ULL ? now + intervalNs : next + intervalNs; // More than 1 s behind: drop the backlog.
+
+		st->attempts++;
+		int sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (sock < 0) {
+			dieWithError("stormClient socket() failed");
+		}
+		unsigned long long int t = timingNowNs();
+		if (connect(sock, (struct sockaddr*) &servAddr, sizeof(servAddr)) < 0) {
+			stormFailed(st, errno);
+			close(sock);
+			continue;
+		}
+		latencyAdd(&st->connectLatency, timingNowNs() - t);
+		st->connected++;
+
+		size_t sent = 0;
+		while (sent < Paras.stormSize) {
+			ssize_t ret = send(sock, payload + sent, Paras.stormSize - sent, MSG_NOSIGNAL);
+			if (ret < 0) {
+				stormFailed(st, errno);
+				break;
+			}
+			sent += ret;
+		}
+		st->totalSendMsgSize += sent;
+		close(sock);
+	}
+
+	free(payload);
+	return ((void*) 0);
+}
+
+void stormClient() {
+	printf("stormClient\n");
+	StormThread threads[CLIENTMAXSTREAMS];
+	int threadAmount = Paras.streams < CLIENTMAXSTREAMS ? Paras.streams : CLIENTMAXSTREAMS;
+	Deadline deadline;
+	Latency all;
+	int i;
+
+	printf("target: %lf connections/s from %d threads, %zu Bytes each, %u s\n", Paras.stormRate, threadAmount, Paras.stormSize, Paras.interval);
+	unsigned long long int t1 = timingNowNs();
+	deadlineStart(&deadline, Paras.interval);
+	for (i = 0; i < threadAmount; i++) {
+		memset(&threads[i], 0, sizeof(StormThread));
+		threads[i].index = i;
+		threads[i].threadAmount = threadAmount;
+		threads[i].deadline = &deadline;
+		latencyInit(&threads[i].connectLatency, Paras.seed + i);
+		if (pthread_create(&threads[i].ntid, NULL, threadStorm, &threads[i]) != 0) {
+			dieWithError("stormClient pthread_create() failed");
+		}
+	}
+
+	StormThread sum;
+	memset(&sum, 0, sizeof(StormThread));
+	latencyInit(&all, Paras.seed);
+	for (i = 0; i < threadAmount; i++) {
+		StormThread* st = &threads[i];
+		pthread_join(st->ntid, NULL);
+		sum.attempts += st->attempts;
+		sum.connected += st->connected;
+		sum.refused += st->refused;
+		sum.resets += st->resets;
+		sum.timeouts += st->timeouts;
+		if (st->others > 0 && sum.others == 0) {
+			sum.firstError = st->firstError;
+		}
+		sum.others += st->others;
+		sum.totalSendMsgSize += st->totalSendMsgSize;
+		latencyMerge(&all, &st->connectLatency);
+		latencyRelease(&st->connectLatency);
+	}
+	double timeSpan = timingSince(t1);
+
+	printf("attempts: %llu, connected: %llu, refused: %llu, reset: %llu, timeout: %llu, other: %llu\n", sum.attempts, sum.connected, sum.refused, sum.resets, sum.timeouts, sum.others);
+	if (sum.others > 0) {
+		printf("first other error: %s\n", strerror(sum.firstError));
+	}
+	printf("totalSendMsgSize: %llu Bytes\n", sum.totalSendMsgSize);
+	printf("time span: %lf s\n", timeSpan);
+	printf("connect rate: %lf /s\n", sum.connected / timeSpan);
+	latencyPrint(&all, "", "connect latency");
+	latencyRelease(&all);
+
+	exit(0);
+}
+// ]
+
+// [ UdpClient
+// Raw UDP front-end: "-streams" threads send "-size" Byte datagrams to the server as fast as the socket takes them, for the
+// udpServer and packetServer receivers. Every thread counts its datagrams in a ConnStats slot.
+#define UDPMAXPAYLOAD 65507
+
+typedef struct udpThread {
+	pthread_t ntid;
+	Deadline* deadline;
+	unsigned long long int datagrams;
+	unsigned long long int totalSendMsgSize;
+	unsigned long long int dropped; // ENOBUFS or EAGAIN, the datagram never left.
+} UdpThread;
+
+void* threadUdpSend(void* arg) {
+	UdpThread* ut = (UdpThread*) arg;
+	struct sockaddr_in servAddr;
+	size_t size = Paras.pkgSize > 0 && Paras.pkgSize < UDPMAXPAYLOAD ? Paras.pkgSize : UDPMAXPAYLOAD;
+	int sock;
+
+	if ((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+		dieWithError("udpClient socket() failed");
+	}
+	memset(&servAddr, 0, sizeof(servAddr));
+	servAddr.sin_family = AF_INET;
+	servAddr.sin_addr.s_addr = inet_addr(Paras.servIP);
+	servAddr.sin_port = htons(Paras.servPort);
+	char* payload = (char*) malloc(size);
+	if (payload == NULL) {
+		dieWithError("udpClient malloc() failed");
+	}
+	memset(payload, 'a', size);
+	ConnStats* cs = connStatsOpen("udpclient", -1, sock, gettid(), &servAddr);
+
+	while (!deadlinePassed(ut->deadline)) {
+		// Not connected: an ICMP port unreachable from a packetServer host, which has no UDP socket on the port, is ignored.
+		if (sendto(sock, payload, size, 0, (struct sockaddr*) &servAddr, sizeof(servAddr)) < 0) {
+			if (errno == ENOBUFS || errno == EAGAIN) {
+				ut->dropped++;
+				continue;
+			}
+			dieWithError("udpClient sendto() failed");
+		}
+		ut->datagrams++;
+		ut->totalSendMsgSize += size;
+		connStatsSend(cs, size);
+	}
+	connStatsClose(cs);
+
+	free(payload);
+	close(sock);
+	return ((void*) 0);
+}
+
+void udpClient() {
+	printf("udpClient\n");
+	UdpThread threads[CLIENTMAXSTREAMS];
+	int threadAmount = Paras.streams < CLIENTMAXSTREAMS ? Paras.streams : CLIENTMAXSTREAMS;
+	Deadline deadline;
+	int i;
+
+	ProcStat ps1, ps2;
+	ProcPidStat pps1, pps2;
+	pid_t pid = getpid();
+	getWholeCPUStatus(&ps1);
+	getProcessCPUStatus(&pps1, pid);
+	unsigned long long int t1 = timingNowNs();
+	deadlineStart(&deadline, Paras.interval);
+	for (i = 0; i < threadAmount; i++) {
+		memset(&threads[i], 0, sizeof(UdpThread));
+		threads[i].deadline = &deadline;
+		if (pthread_create(&threads[i].ntid, NULL, threadUdpSend, &threads[i]) != 0) {
+			dieWithError("udpClient pthread_create() failed");
+		}
+	}
+
+	UdpThread sum;
+	memset(&sum, 0, sizeof(UdpThread));
+	for (i = 0; i < threadAmount; i++) {
+		pthread_join(threads[i].ntid, NULL);
+		sum.datagrams += threads[i].datagrams;
+		sum.totalSendMsgSize += threads[i].totalSendMsgSize;
+		sum.dropped += threads[i].dropped;
+	}
+	double timeSpan = timingSince(t1);
+	getWholeCPUStatus(&ps2);
+	getProcessCPUStatus(&pps2, pid);
+	float CPUUse = calWholeCPUUse(&ps1, &ps2);
+	float processCPUUse = calProcessCPUUse(&ps1, &pps1, &ps2, &pps2);
+
+	printf("CPUUse: %f, processCPUUse: %f\n", CPUUse, processCPUUse);
+	printf("datagrams: %llu, totalSendMsgSize: %llu, dropped by the sender: %llu\n", sum.datagrams, sum.totalSendMsgSize, sum.dropped);
+	printf("time span: %lf\n", timeSpan);
+	printf("send speed: %lf Mb/s, %lf kdatagrams/s\n", sum.totalSendMsgSize * 8 / (timeSpan * 1000 * 1000), sum.datagrams / (timeSpan * 1000));
+
+	exit(0);
+}
+// ]
 
 void l2Client() {
 	printf("l2client\n");
@@ -779,12 +2511,11 @@ void l2Client() {
 	}
 
 	// Mark the socket so it will listen for incoming connections.
-	if (listen(localSock, MAXPENDING) < 0) {
+	if (listenSocket(localSock, MAXPENDING) < 0) {
 		dieWithError("L2 client listen() failed");
 	}
 	
-	char buffer[RCVBUFSIZE];
-	bzero(buffer, RCVBUFSIZE);
+	char* buffer = bufPoolNodeGet();
 	int recvMsgSize;
 	clntLen = sizeof(preAddr);
 	if ((preSock = accept(localSock, (struct sockaddr*) &preAddr, &clntLen)) < 0) {
@@ -812,6 +2543,7 @@ void l2Client() {
 	// ]
 
 	printf("Handling data from L1 client: %s\n", inet_ntoa(preAddr.sin_addr));
+	ConnStats* cs = connStatsOpen("l2client", preSock, nextSock, gettid(), &preAddr);
 	unsigned long long int totalRecvMsgSize = 0;
 	unsigned long long int totalSendMsgSize = 0;
 	
@@ -821,54 +2553,92 @@ void l2Client() {
 	pid_t pid = getpid();
 	getWholeCPUStatus(&ps1);
 	getProcessCPUStatus(&pps1, pid);
+	PerfCount perf;
+	perfCountStartInherit(&perf); // The process role, so the codec and link threads started below count too.
 
 	// Time calculating.
-	struct timeval t1, t2;
-	gettimeofday(&t1, NULL);
+	unsigned long long int t1 = timingNowNs();
 	double timeSpan = 0.0;
 
-	while (1) {
-		// Receive data from L1 client to L2 client.
-		if ((recvMsgSize = recv(preSock, buffer, RCVBUFSIZE, 0)) < 0) {
-			dieWithError("L2 client recv() failed");
-		}
-		else if (recvMsgSize > 0) {
-			totalRecvMsgSize += recvMsgSize;
-			//printf("recvMsgSize %d\n", recvMsgSize);
-			//printf("totalRecvMsgSize: %lld\n", totalRecvMsgSize);
-			//printf("%s\n", buffer);
-
-			// Send data from L2 client to server.
-			//int sendMsgSize = strlen(buffer);
-			int sendMsgSize = recvMsgSize;
-			if (send(nextSock, buffer, sendMsgSize, 0) != sendMsgSize) {
-				dieWithError("L2 client send() send a different number of bytes than expected");
+	CodecStage stage;
+	LinkEmu* le = NULL;
+	TriggerFilter* tf = NULL;
+	if (Paras.compress) {
+		totalRecvMsgSize = compressForward(cs, preSock, nextSock, 0, &stage);
+		totalSendMsgSize = stage.wireBytes;
+	}
+	else if (Paras.trigger) {
+		tf = filterForward(cs, preSock, nextSock, buffer);
+		totalRecvMsgSize = cs->recvBytes;
+		totalSendMsgSize = tf->outBytes;
+	}
+	else if (Paras.linkEmu) {
+		le = linkForward(cs, preSock, nextSock, Paras.seed, NULL);
+		totalRecvMsgSize = le->recvBytes;
+		totalSendMsgSize = le->sentBytes;
+	}
+	else {
+		while (1) {
+			// Receive data from L1 client to L2 client.
+			if ((recvMsgSize = connStatsTimedRecv(cs, preSock, buffer, RCVBUFSIZE, 0)) < 0) {
+				dieWithError("L2 client recv() failed");
 			}
-			totalSendMsgSize += sendMsgSize;
-			//printf("sendMsgSize: %d\n", sendMsgSize);
-			//printf("totalSendMsgSize: %lld\n", totalSendMsgSize);
+			else if (recvMsgSize > 0) {
+				totalRecvMsgSize += recvMsgSize;
+				connStatsRecv(cs, recvMsgSize);
+				//printf("recvMsgSize %d\n", recvMsgSize);
+				//printf("totalRecvMsgSize: %lld\n", totalRecvMsgSize);
+				//printf("%s\n", buffer);
 
-		}
-		else { // recvMsgSize == 0
-			break;
-		}
+				// Send data from L2 client to server.
+				//int sendMsgSize = strlen(buffer);
+				int sendMsgSize = recvMsgSize;
+				if (connStatsTimedSend(cs, nextSock, buffer, sendMsgSize, 0) != sendMsgSize) {
+					dieWithError("L2 client send() send a different number of bytes than expected");
+				}
+				totalSendMsgSize += sendMsgSize;
+				connStatsSend(cs, sendMsgSize);
+				//printf("sendMsgSize: %d\n", sendMsgSize);
+				//printf("totalSendMsgSize: %lld\n", totalSendMsgSize);
+
+			}
+			else { // recvMsgSize == 0
+				break;
+			}
 		
+		}
 	}
 
 	getWholeCPUStatus(&ps2);
 	getProcessCPUStatus(&pps2, pid);
+	perfCountStop(&perf);
 	float CPUUse = calWholeCPUUse(&ps1, &ps2);
 	float processCPUUse = calProcessCPUUse(&ps1, &pps1, &ps2, &pps2);
 	printf("CPUUse: %f, processCPUUse: %f\n", CPUUse, processCPUUse);
 
-	gettimeofday(&t2, NULL);
-	timeSpan = (double) (t2.tv_sec-t1.tv_sec) + (double) t2.tv_usec*1e-6 - (double) t1.tv_usec*1e-6;
+	timeSpan = timingSince(t1);
 	double sendSpeed = ((double) totalSendMsgSize * 8) / (timeSpan * 1000 * 1000);
 	printf("totalRecvMsgSize: %lld\n", totalRecvMsgSize);
 	printf("totalSendMsgSize: %lld\n", totalSendMsgSize);
 	printf("time span: %lf\n", timeSpan);
 	printf("send speed(after receive): %lf Mb/s\n", sendSpeed);
+	connStatsPrintStall(cs, "");
+	printMemoryStatus("", &pps1, &pps2, totalRecvMsgSize);
+	perfCountPrint(&perf, "", totalRecvMsgSize, cs->recvCalls + cs->sendCalls);
+	if (Paras.compress) {
+		compressReport(&stage, timeSpan, "");
+	}
+	if (le != NULL) {
+		linkEmuPrint(le, "", timeSpan);
+		linkEmuRelease(le);
+	}
+	if (tf != NULL) {
+		triggerFilterPrint(tf, "", timeSpan);
+		triggerFilterRelease(tf);
+	}
 
+	bufPoolNodePut(buffer);
+	connStatsClose(cs);
 	close(preSock);
 	close(nextSock);
 
@@ -877,6 +2647,39 @@ void l2Client() {
 	
 }
 
+// [ OutQueue
+// Bounded output queue of one upstream connection in multiConnSingleThreadL2Client. Data is received straight into the ring
+// and sent straight out of it. Only the event loop thread touches it, so there is no lock.
+#define OUTQUEUESIZE (4*1024*1024) // Output queue size of each upstream connection.
+#define OUTQUEUEMINFREE (64*1024) // Reading pauses when less space than this is left.
+#define FORWARDCHUNK (256*1024) // Bytes of one queue sent before the next queue gets its turn.
+
+typedef struct outQueue {
+	char* data;
+	size_t head; // Read position.
+	size_t size; // Bytes queued.
+	size_t peak; // Largest "size" seen.
+	size_t chunkLeft; // Bytes left of the chunk being sent, the chunk goes out before other queues are served.
+} OutQueue;
+
+// Contiguous free space at the tail.
+size_t outQueueTail(OutQueue* oq, char** tail) {
+	size_t pos = (oq->head + oq->size) % OUTQUEUESIZE;
+	size_t free = OUTQUEUESIZE - oq->size;
+	*tail = oq->data + pos;
+	return OUTQUEUESIZE - pos < free ? OUTQUEUESIZE - pos : free;
+}
+
+// Contiguous queued bytes at the head.
+size_t outQueueHead(OutQueue* oq, char** head) {
+	*head = oq->data + oq->head;
+	return OUTQUEUESIZE - oq->head < oq->size ? OUTQUEUESIZE - oq->head : oq->size;
+}
+// ]
+
+// Nonblocking event loop: every upstream connection has a bounded OutQueue, nextSock is written only when select() reports it writable,
+// and an upstream connection is not read while its queue is full. A slow receiver therefore only pauses the upstream connections
+// whose queues are full, instead of blocking the whole loop in send().
 void multiConnSingleThreadL2Client() {
 	printf("multiConnSingleThreadL2Client\n");
 	unsigned short prePort = Paras.prePort;
@@ -889,7 +2692,6 @@ void multiConnSingleThreadL2Client() {
 	struct sockaddr_in preAddr; // connector's address info.
 	socklen_t sinSize; 
 	int on = 1;
-	char buffer[RCVBUFSIZE];
 	int ret;
 	int i;
 
@@ -917,7 +2719,7 @@ void multiConnSingleThreadL2Client() {
 		dieWithError("multiConnSingleThreadL2Client bind() failed");
 	}
 
-	if (listen(localSock, MAXPENDING) < 0) {
+	if (listenSocket(localSock, MAXPENDING) < 0) {
 		dieWithError("multiConnSingleThreadL2Client listen() failed");
 	}
 	printf("prePort: %d\n", prePort);
@@ -936,15 +2738,15 @@ void multiConnSingleThreadL2Client() {
 	if (connect(nextSock, (struct sockaddr*) &nextAddr, sizeof(nextAddr)) < 0) {
 		dieWithError("multiConnSingleThreadL2Client connect() failed");
 	}
+	setNonBlocking(nextSock);
 	// ]
 
-	fd_set fds;
+	fd_set rfds, wfds;
 	int maxsock;
 	struct timeval timeout;
 
 	connAmount = 0;
 	sinSize = sizeof(preAddr);
-	maxsock = localSock;
 
 	unsigned long long int totalRecvMsgSize[MAXPENDING] = {0};
 	unsigned long long int totalSendMsgSize[MAXPENDING] = {0};
@@ -952,116 +2754,248 @@ void multiConnSingleThreadL2Client() {
 	float CPUUse[MAXPENDING] = {0.0};
 	float processCPUUse[MAXPENDING] = {0.0};
 	double sendSpeed[MAXPENDING] = {0.0};
+	double pausedTime[MAXPENDING] = {0.0}; // Time reading was paused because the queue was full.
 	
 	ProcStat ps1[MAXPENDING], ps2[MAXPENDING];
 	ProcPidStat pps1[MAXPENDING], pps2[MAXPENDING];
 	pid_t pid = getpid();
 
-	struct timeval t1[MAXPENDING], t2[MAXPENDING];
+	// Counters count the thread, so all connections share one PerfCount and it is reported as a thread total.
+	PerfCount perf;
+	unsigned long long int perfBytes = 0;
+	unsigned long long int perfCalls = 0;
+	perfCountStart(&perf);
+
+	unsigned long long int t1[MAXPENDING];
+	unsigned long long int pauseStart[MAXPENDING];
+	int paused[MAXPENDING] = {0};
+	ConnStats* cs[MAXPENDING] = {NULL}; // Open until the queue of a closed client is forwarded.
+	pid_t tid = gettid();
+
+	OutQueue oq[MAXPENDING];
+	BufPool* oqPool = bufPoolAllocOnNode(OUTQUEUESIZE, MAXPENDING, currentNumaNode());
+	if (oqPool == NULL) {
+		dieWithError("multiConnSingleThreadL2Client bufPoolAllocOnNode() failed");
+	}
+	printf("output queues: %d x %d Bytes, %s\n", MAXPENDING, OUTQUEUESIZE, oqPool->backing);
+	for (i = 0; i < MAXPENDING; i++) {
+		memset(&oq[i], 0, sizeof(OutQueue));
+		oq[i].data = bufPoolGet(oqPool);
+	}
+	size_t queued = 0; // Bytes in all queues.
+	size_t peakQueued = 0;
+	int current = 0; // Queue being sent.
+
+	// Stall: data is queued but nextSock can not take more.
+	double stallTime = 0.0;
+	unsigned long long int stalls = 0;
+	unsigned long long int stallStart = 0;
+	int stalled = 0;
 
 
 	while (1) {
+		// After SIGTERM accept no more connections and end when the open ones are done and forwarded.
+		int stopping = reportStopping();
+		if (stopping && connAmount == 0 && queued == 0) {
+			break;
+		}
+
 		// Init file descriptor set.
-		FD_ZERO(&fds);
-		FD_SET(localSock, &fds);
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		if (!stopping) {
+			FD_SET(localSock, &rfds);
+		}
+		maxsock = localSock > nextSock ? localSock : nextSock;
 
 		// Timeout setting.
-		timeout.tv_sec = 10;
+		timeout.tv_sec = Paras.continuous ? 1 : 10;
 		timeout.tv_usec = 0;
 
-		// Add active connection to fd set.
+		// Add active connections with queue space to the read set, pause the others.
 		for (i = 0; i < MAXPENDING; i++) {
 			if (fdArr[i] != 0) {
-				FD_SET(fdArr[i], &fds);
+				if (OUTQUEUESIZE - oq[i].size >= OUTQUEUEMINFREE) {
+					if (paused[i]) {
+						pausedTime[i] += timingSince(pauseStart[i]);
+						paused[i] = 0;
+					}
+					FD_SET(fdArr[i], &rfds);
+					if (fdArr[i] > maxsock) {
+						maxsock = fdArr[i];
+					}
+				}
+				else if (!paused[i]) {
+					pauseStart[i] = timingNowNs();
+					paused[i] = 1;
+				}
 			}	
 		}
+		if (queued > 0) {
+			FD_SET(nextSock, &wfds);
+		}
 
-		ret = select(maxsock+1, &fds, NULL, NULL, &timeout);
+		unsigned long long int selectNs = timingNowNs();
+		ret = select(maxsock+1, &rfds, &wfds, NULL, &timeout);
+		selectNs = timingNowNs() - selectNs;
+		for (i = 0; i < MAXPENDING; i++) {
+			if (cs[i] != NULL) {
+				// Connections with queued data wait for the receiver, the others for their L1 client.
+				if (oq[i].size > 0 && queued > 0) {
+					connStatsSendBlock(cs[i], selectNs);
+				}
+				else {
+					connStatsRecvWait(cs[i], selectNs);
+				}
+			}
+		}
 		if (ret < 0) {
 			dieWithError("multiConnSingleThreadL2Client select() failed");
 		}
 		else if (ret == 0) {
+			if (queued > 0 || Paras.continuous) {
+				continue; // Never drop queued data, wait for the receiver.
+			}
 			printf("timeout\n");
 			break; // When timeout, jump out the loop and end the server.
 			//continue; // When timeout, just continue to waiting for new connetions.
 		}
 
+		// Forward queued data while nextSock takes it.
+		if (FD_ISSET(nextSock, &wfds)) {
+			if (stalled) {
+				stallTime += timingSince(stallStart);
+				stalled = 0;
+			}
+			while (queued > 0) {
+				// Serve the queues in turn, one chunk each.
+				if (oq[current].chunkLeft == 0) {
+					int k;
+					for (k = 1; k <= MAXPENDING; k++) {
+						int j = (current + k) % MAXPENDING;
+						if (oq[j].size > 0) {
+							current = j;
+							break;
+						}
+					}
+					oq[current].chunkLeft = oq[current].size < FORWARDCHUNK ? oq[current].size : FORWARDCHUNK;
+				}
+
+				char* head;
+				size_t len = outQueueHead(&oq[current], &head);
+				len = len < oq[current].chunkLeft ? len : oq[current].chunkLeft;
+				ret = send(nextSock, head, len, 0);
+				if (ret < 0) {
+					if (errno == EAGAIN || errno == EWOULDBLOCK) {
+						connStatsSendZero(cs[current]);
+						stallStart = timingNowNs();
+						stalled = 1;
+						stalls++;
+						break;
+					}
+					dieWithError("multiConnSingleThreadL2Client L2 client send() failed");
+				}
+				oq[current].head = (oq[current].head + ret) % OUTQUEUESIZE;
+				oq[current].size -= ret;
+				oq[current].chunkLeft -= ret;
+				queued -= ret;
+				totalSendMsgSize[current] += ret;
+				connStatsSend(cs[current], ret);
+			}
+		}
+
 		// Check every fd in the set.
 		for (i = 0; i < MAXPENDING; i++) {
-			if (FD_ISSET(fdArr[i], &fds)) {
-				ret = recv(fdArr[i], buffer, RCVBUFSIZE, 0);
+			if (fdArr[i] != 0 && FD_ISSET(fdArr[i], &rfds)) {
+				char* tail;
+				size_t len = outQueueTail(&oq[i], &tail);
+				ret = recv(fdArr[i], tail, len < RCVBUFSIZE ? len : RCVBUFSIZE, 0);
 				if (ret < 0) {
+					if (errno == EAGAIN || errno == EWOULDBLOCK) {
+						connStatsRecvZero(cs[i]);
+						continue;
+					}
 					dieWithError("multiConnSingleThreadL2Client L2 client recv() failed");	
 				}
 				else if (ret > 0) {
 					totalRecvMsgSize[i] += ret;
-
-					// Receive data.
-					//int sendMsgSize = strlen(buffer);
-					int sendMsgSize = ret;
-					if (send(nextSock, buffer, sendMsgSize, 0) != sendMsgSize) {
-						dieWithError("multiConnSingleThreadL2Client L2 client send() send a different number of bytes that expected");
+					connStatsRecv(cs[i], ret);
+					oq[i].size += ret;
+					if (oq[i].size > oq[i].peak) {
+						oq[i].peak = oq[i].size;
+					}
+					queued += ret;
+					if (queued > peakQueued) {
+						peakQueued = queued;
 					}
-					totalSendMsgSize[i] += sendMsgSize;
-
-					//
-					//if (ret < RCVBUFSIZE) {
-					//	memset(&buffer[ret], '\0', 1);
-					//}
-					//
-					//printf("client[%d] send: %c...\n", i, buffer[0]);
 				}
 				else { // ret == 0
-					// Close client.
+					// Close client. Its queue is still forwarded, the slot is reused once the queue is empty.
 					printf("client[%d] close\n", i);
-					close(fdArr[i]);
+					connStatsCloseSock(cs[i], fdArr[i]);
 					connAmount--;
-					FD_CLR(fdArr[i], &fds);
 					fdArr[i] = 0;
-
-					// time and CPU.
-					gettimeofday(&t2[i], NULL);
-					getWholeCPUStatus(&ps2[i]);
-					getProcessCPUStatus(&pps2[i], pid);
-					
-					timeSpan[i] = (double) (t2[i].tv_sec-t1[i].tv_sec) + (double) t2[i].tv_usec*1e-6 - (double) t1[i].tv_usec*1e-6;
-					sendSpeed[i] = ((double) totalRecvMsgSize[i] * 8) / (timeSpan[i] * 1000 *1000);
-					CPUUse[i] = calWholeCPUUse(&ps1[i], &ps2[i]);
-					processCPUUse[i] = calProcessCPUUse(&ps1[i], &pps1[i], &ps2[i], &pps2[i]);
-
-
+					if (paused[i]) {
+						pausedTime[i] += timingSince(pauseStart[i]);
+						paused[i] = 0;
+					}
 				}
 			}
 		}
 
+		// Closed clients whose queue is forwarded now: their ConnStats may go, nothing is sent for them any more.
+		for (i = 0; i < MAXPENDING; i++) {
+			if (fdArr[i] == 0 && cs[i] != NULL && oq[i].size == 0) {
+				char prefix[32];
+				snprintf(prefix, sizeof(prefix), "client[%d] ", i);
+				connStatsPrintStall(cs[i], prefix);
+
+				// time and CPU.
+				getWholeCPUStatus(&ps2[i]);
+				getProcessCPUStatus(&pps2[i], pid);
+
+				timeSpan[i] = timingSince(t1[i]);
+				sendSpeed[i] = ((double) totalSendMsgSize[i] * 8) / (timeSpan[i] * 1000 *1000);
+				CPUUse[i] = calWholeCPUUse(&ps1[i], &ps2[i]);
+				processCPUUse[i] = calProcessCPUUse(&ps1[i], &pps1[i], &ps2[i], &pps2[i]);
+				printMemoryStatus(prefix, &pps1[i], &pps2[i], totalRecvMsgSize[i]);
+				perfBytes += totalRecvMsgSize[i];
+				perfCalls += cs[i]->recvCalls + cs[i]->sendCalls;
+				connStatsClose(cs[i]);
+				cs[i] = NULL;
+			}
+		}
+
 		// Check whether a new connection comes.
-		if (FD_ISSET(localSock, &fds)) {
+		if (FD_ISSET(localSock, &rfds)) {
 			preSock = accept(localSock, (struct sockaddr*) &preAddr, &sinSize);
 			if (preSock <= 0) {
 				dieWithError("multiConnSingleThreadL2Client accept() failed");
 			}
 
 			// Add to fd queue.
-			if (connAmount < MAXPENDING) {
-				for (i = 0; i < MAXPENDING; i++) {
-					if (fdArr[i] == 0) {
-						fdArr[i] = preSock;
-						connAmount++;
-
-						// time and CPU.
-						gettimeofday(&t1[i], NULL);
-						getWholeCPUStatus(&ps1[i]);
-						getProcessCPUStatus(&pps1[i], pid);
-
-						printf("new connection client[%d] %s:%d\n", i, inet_ntoa(preAddr.sin_addr), ntohs(preAddr.sin_port));
-						break;
-					}
-				}
-
-				if (preSock > maxsock) {
-					maxsock = preSock;
+			for (i = 0; i < MAXPENDING; i++) {
+				if (fdArr[i] == 0 && cs[i] == NULL) {
+					break;
 				}
 			}
+			if (i < MAXPENDING) {
+				setNonBlocking(preSock);
+				fdArr[i] = preSock;
+				connAmount++;
+				cs[i] = connStatsOpen("l2client", preSock, nextSock, tid, &preAddr);
+				totalRecvMsgSize[i] = 0;
+				totalSendMsgSize[i] = 0;
+				pausedTime[i] = 0.0;
+				oq[i].peak = 0;
+
+				// time and CPU.
+				t1[i] = timingNowNs();
+				getWholeCPUStatus(&ps1[i]);
+				getProcessCPUStatus(&pps1[i], pid);
+
+				printf("new connection client[%d] %s:%d\n", i, inet_ntoa(preAddr.sin_addr), ntohs(preAddr.sin_port));
+			}
 			else {
 				printf("connections limits\n");
 				//send(preSock, "bye", 4, 0);
@@ -1085,14 +3019,28 @@ void multiConnSingleThreadL2Client() {
 
 	// Close other connections.
 	for (i = 0; i < MAXPENDING; i++) {
+		if (cs[i] != NULL) {
+			perfBytes += totalRecvMsgSize[i];
+			perfCalls += cs[i]->recvCalls + cs[i]->sendCalls;
+			connStatsClose(cs[i]);
+		}
 		if (fdArr[i] != 0) {
 			close(fdArr[i]);
 			connAmount--;
 		}
+		bufPoolPut(oqPool, oq[i].data);
 	} 
+	bufPoolRelease(oqPool);
+	close(nextSock);
 
 	for (i = 0; i < MAXPENDING; i++) {
-		printf("connection %d \nCPUUse: %f, processCPUUse: %f\ntotalRecvMsgSize: %llu Bytes\ntimeSpan: %lf\nsendSpeed(after receive): %lf Mb/s\n\n", i, CPUUse[i], processCPUUse[i], totalRecvMsgSize[i], timeSpan[i], sendSpeed[i]);
+		printf("connection %d \nCPUUse: %f, processCPUUse: %f\ntotalRecvMsgSize: %llu Bytes\ntotalSendMsgSize: %llu Bytes\ntimeSpan: %lf\nsendSpeed(after receive): %lf Mb/s\npeakQueue: %zu Bytes\npausedTime: %lf s\n\n", i, CPUUse[i], processCPUUse[i], totalRecvMsgSize[i], totalSendMsgSize[i], timeSpan[i], sendSpeed[i], oq[i].peak, pausedTime[i]);
+	}
+	printf("peak queued: %zu Bytes\nstall time: %lf s\nstalls: %llu\n", peakQueued, stallTime, stalls);
+	perfCountStop(&perf);
+	perfCountPrint(&perf, "thread total ", perfBytes, perfCalls);
+	if (Paras.continuous) {
+		reportDrain(NULL);
 	}
 
 	exit(0);
@@ -1100,183 +3048,756 @@ void multiConnSingleThreadL2Client() {
 
 }
 
-unsigned long long int threadRSTag = 0;
-pthread_mutex_t threadRSTagLock;
-void* threadReceiveAndSend(void* arg) { // Deprecated.
-	printf("threadReceiveAndSend\n");
-	ClntSockPool* cspool = (ClntSockPool*) arg;
-	int preSock = -1;
-	while (1) {
-		preSock = cspool->pool[cspool->poolTop-1];
-		if (preSock != -1) {
-			pthread_mutex_lock(&cspool->poolLock);
-			cspool->poolTop--;
-			pthread_mutex_unlock(&cspool->poolLock);
-			break;
+unsigned long long int threadRSTag = 0;
+pthread_mutex_t threadRSTagLock;
+void* threadReceiveAndSend(void* arg) { // Deprecated.
+	printf("threadReceiveAndSend\n");
+	ClntSockPool* cspool = (ClntSockPool*) arg;
+	int preSock = -1;
+	while (1) {
+		preSock = cspool->pool[cspool->poolTop-1];
+		if (preSock != -1) {
+			pthread_mutex_lock(&cspool->poolLock);
+			cspool->poolTop--;
+			pthread_mutex_unlock(&cspool->poolLock);
+			break;
+		}
+	}
+
+
+	// Get process id and thread id.
+	pid_t pid = getpid();
+	//pthread_t tid = pthread_self(); // Get tid, different from "syscall(SYS_gettid)".
+	pid_t tid = gettid();
+	printf("thread preSock: %d, pid: %u, tid: %u\n", preSock, (unsigned int) pid, (unsigned int) tid);
+
+
+	// [Connect L2 client to server.
+	int nextSock;
+	struct sockaddr_in nextAddr;
+	unsigned short nextPort = Paras.servPort;
+	char* nextIP = Paras.servIP;
+
+	if ((nextSock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+		dieWithError("threadReceiveAndSend socket() failed");
+	}
+	
+	memset(&nextAddr, 0, sizeof(nextAddr));
+	nextAddr.sin_family = AF_INET;
+	nextAddr.sin_addr.s_addr = inet_addr(nextIP);
+	nextAddr.sin_port = htons(nextPort);
+
+	if (connect(nextSock, (struct sockaddr*) &nextAddr, sizeof(nextAddr)) < 0) {
+		dieWithError("threadReceiveAndSend connect() failed");
+	}
+	// ]
+
+	char* buffer = bufPoolNodeGet();
+
+	int recvMsgSize;
+	unsigned long long int totalRecvMsgSize = 0;
+	unsigned long long int totalSendMsgSize = 0;
+
+	// CPU calculating.
+	ProcStat ps1, ps2;
+	ProcPidStat pps1, pps2;
+	getWholeCPUStatus(&ps1);
+	getThreadCPUStatus(&pps1, pid, tid); // accurate?
+
+	// Time calculating.
+	unsigned long long int t1 = timingNowNs();
+	double timeSpan = 0.0;
+
+	while (1) {
+		if ((recvMsgSize = recv(preSock, buffer, RCVBUFSIZE, 0)) < 0) {
+			dieWithError("threadReceiveAndSend recv() failed");
+		}
+		else if (recvMsgSize > 0) {
+			totalRecvMsgSize += recvMsgSize;
+			//printf("thread %u recvMsgSize: %d\n", (unsigned int) tid, recvMsgSize);
+            //printf("thread %u totalRecvMsgSize: %lld\n", (unsigned int) tid, totalRecvMsgSize);
+
+			// Send data from L2 client to server.
+			//int sendMsgSize = strlen(buffer);
+			int sendMsgSize = recvMsgSize;
+			if (send(nextSock, buffer, sendMsgSize, 0) != sendMsgSize) {
+				dieWithError("threadReceiveAndSend send() a different number of bytes than expected");
+			}
+			totalSendMsgSize += sendMsgSize;
+		}
+		else {
+			break;
+		}
+	}
+
+	getWholeCPUStatus(&ps2);
+	getThreadCPUStatus(&pps2, pid, tid);
+	float CPUUse = calWholeCPUUse(&ps1, &ps2);
+	float threadCPUUse = calProcessCPUUse(&ps1, &pps1, &ps2, &pps2);
+
+	timeSpan = timingSince(t1);
+	double sendSpeed = ((double) totalSendMsgSize * 8) / (timeSpan * 1000 *1000);
+
+	pthread_mutex_lock(&threadRSTagLock);
+	threadRSTag++;
+	printf("Tag: %llu\n", threadRSTag);
+    pthread_mutex_unlock(&threadRSTagLock);
+	printf("thread %d-%d CPUUse: %f, threadCPUUse: %f\n", pid, tid, CPUUse, threadCPUUse);
+	printf("thread %d-%d totalRecvMsgSize: %llu Bytes\n", pid, tid, totalRecvMsgSize);
+	printf("thread %d-%d totalSendMsgSize: %llu Bytes\n", pid, tid, totalSendMsgSize);
+	printf("thread %d-%d time span: %lf\n", pid, tid, timeSpan);
+	printf("thread %d-%d send speed(after receive): %lf Mb/s\n\n", pid, tid, sendSpeed);
+
+	bufPoolNodePut(buffer);
+	close(preSock);
+	close(nextSock);
+	pthread_exit((void*) 0);
+
+	return ((void*) 0);
+}
+
+LinkShare* multiLinkShare; // The link of every connection with "-link*", NULL without.
+void* threadReceiveConnectionAndSend(void* arg) { 
+	printf("threadReceiveAndSend\n");
+	Connection* conn = (Connection*) arg;
+	int preSock = conn->socketfd;
+
+
+	// Get process id and thread id.
+	pid_t pid = getpid();
+	//pthread_t tid = pthread_self(); // Get tid, different from "syscall(SYS_gettid)".
+	pid_t tid = gettid();
+	printf("thread preSock: %d, pid: %u, tid: %u\n", preSock, (unsigned int) pid, (unsigned int) tid);
+
+
+	// [Connect L2 client to server.
+	int nextSock;
+	struct sockaddr_in nextAddr;
+	unsigned short nextPort = Paras.servPort;
+	char* nextIP = Paras.servIP;
+
+	if ((nextSock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+		dieWithError("threadReceiveAndSend socket() failed");
+	}
+	
+	memset(&nextAddr, 0, sizeof(nextAddr));
+	nextAddr.sin_family = AF_INET;
+	nextAddr.sin_addr.s_addr = inet_addr(nextIP);
+	nextAddr.sin_port = htons(nextPort);
+
+	if (connect(nextSock, (struct sockaddr*) &nextAddr, sizeof(nextAddr)) < 0) {
+		dieWithError("threadReceiveAndSend connect() failed");
+	}
+	ConnStats* cs = connStatsOpen("l2client", preSock, nextSock, tid, &conn->clientAddress);
+	// ]
+
+	char* buffer = bufPoolNodeGet();
+
+	int recvMsgSize;
+	unsigned long long int totalRecvMsgSize = 0;
+	unsigned long long int totalSendMsgSize = 0;
+
+	// CPU calculating.
+	ProcStat ps1, ps2;
+	ProcPidStat pps1, pps2;
+	getWholeCPUStatus(&ps1);
+	getThreadCPUStatus(&pps1, pid, tid); // accurate?
+	PerfCount perf;
+	perfCountStart(&perf);
+
+	// Time calculating.
+	unsigned long long int t1 = timingNowNs();
+	double timeSpan = 0.0;
+
+	CodecStage stage;
+	LinkEmu* le = NULL;
+	TriggerFilter* tf = NULL;
+	if (Paras.compress) {
+		totalRecvMsgSize = compressForward(cs, preSock, nextSock, (uint16_t) conn->id, &stage);
+		totalSendMsgSize = stage.wireBytes;
+	}
+	else if (Paras.trigger) {
+		tf = filterForward(cs, preSock, nextSock, buffer);
+		totalRecvMsgSize = cs->recvBytes;
+		totalSendMsgSize = tf->outBytes;
+	}
+	else if (Paras.linkEmu) {
+		le = linkForward(cs, preSock, nextSock, Paras.seed + conn->id, multiLinkShare);
+		totalRecvMsgSize = le->recvBytes;
+		totalSendMsgSize = le->sentBytes;
+	}
+	else {
+		while (1) {
+			if ((recvMsgSize = connStatsTimedRecv(cs, preSock, buffer, RCVBUFSIZE, 0)) < 0) {
+				dieWithError("threadReceiveAndSend recv() failed");
+			}
+			else if (recvMsgSize > 0) {
+				totalRecvMsgSize += recvMsgSize;
+				connStatsRecv(cs, recvMsgSize);
+				//printf("thread %u recvMsgSize: %d\n", (unsigned int) tid, recvMsgSize);
+	            //printf("thread %u totalRecvMsgSize: %lld\n", (unsigned int) tid, totalRecvMsgSize);
+
+				// Send data from L2 client to server.
+				//int sendMsgSize = strlen(buffer);
+				int sendMsgSize = recvMsgSize;
+				if (connStatsTimedSend(cs, nextSock, buffer, sendMsgSize, 0) != sendMsgSize) {
+					dieWithError("threadReceiveAndSend send() a different number of bytes than expected");
+				}
+				totalSendMsgSize += sendMsgSize;
+				connStatsSend(cs, sendMsgSize);
+			}
+			else {
+				break;
+			}
+		}
+	}
+
+	getWholeCPUStatus(&ps2);
+	getThreadCPUStatus(&pps2, pid, tid);
+	perfCountStop(&perf);
+	float CPUUse = calWholeCPUUse(&ps1, &ps2);
+	float threadCPUUse = calProcessCPUUse(&ps1, &pps1, &ps2, &pps2);
+
+	timeSpan = timingSince(t1);
+	double sendSpeed = ((double) totalSendMsgSize * 8) / (timeSpan * 1000 *1000);
+
+	pthread_mutex_lock(&threadRSTagLock);
+	threadRSTag++;
+	printf("Tag: %llu\n", threadRSTag);
+	pthread_mutex_unlock(&threadRSTagLock);
+	printf("thread %d-%d CPUUse: %f, threadCPUUse: %f\n", pid, tid, CPUUse, threadCPUUse);
+	printf("thread %d-%d totalRecvMsgSize: %llu Bytes\n", pid, tid, totalRecvMsgSize);
+	printf("thread %d-%d totalSendMsgSize: %llu Bytes\n", pid, tid, totalSendMsgSize);
+	printf("thread %d-%d time span: %lf\n", pid, tid, timeSpan);
+	printf("thread %d-%d send speed(after receive): %lf Mb/s\n", pid, tid, sendSpeed);
+	char prefix[32];
+	snprintf(prefix, sizeof(prefix), "thread %d-%d ", pid, tid);
+	connStatsPrintStall(cs, prefix);
+	printMemoryStatus(prefix, &pps1, &pps2, totalRecvMsgSize);
+	perfCountPrint(&perf, prefix, totalRecvMsgSize, cs->recvCalls + cs->sendCalls);
+	if (Paras.compress) {
+		compressReport(&stage, timeSpan, prefix);
+	}
+	if (le != NULL) {
+		linkEmuPrint(le, prefix, timeSpan);
+		linkEmuRelease(le);
+	}
+	if (tf != NULL) {
+		triggerFilterPrint(tf, prefix, timeSpan);
+		triggerFilterRelease(tf);
+	}
+	printf("\n");
+
+	bufPoolNodePut(buffer);
+	connStatsClose(cs);
+	close(preSock);
+	close(nextSock);
+	free(conn);
+	pthread_exit((void*) 0);
+
+	return ((void*) 0);
+}
+
+// [ Aggregate
+// Aggregating mode of the multithread L2 client ("-agg N"): upstream streams are multiplexed onto N downstream connections.
+// Receive threads recv() straight into blocks of a shared BufPool behind a MuxHeader, and the sender thread of each link
+// coalesces all queued blocks into one writev().
+#define AGGMAX 16 // Maximum downstream connections.
+#define AGGBLOCKSIZE (256*1024) // Block size of the shared pool.
+#define AGGBLOCKAMOUNT 256 // Blocks in the shared pool.
+#define AGGIOVMAX 64 // Blocks sent by one writev().
+
+typedef struct aggLink {
+	int sock;
+	BlockQueue* queue; // Blocks waiting to be sent, large enough for the whole pool.
+	unsigned long long int records;
+	unsigned long long int writevCalls;
+	unsigned long long int totalSendMsgSize;
+	pthread_t ntid;
+} AggLink;
+
+struct AGGREGATE {
+	AggLink link[AGGMAX];
+	int linkAmount;
+	BufPool* pool;
+	int activeUpstreams;
+	pthread_mutex_t lock;
+} Aggregate;
+
+void* threadAggregateSend(void* arg) {
+	AggLink* link = (AggLink*) arg;
+	ConnStats* cs = connStatsOpen("aggregate", -1, link->sock, gettid(), NULL);
+	struct iovec iov[AGGIOVMAX];
+	char* blocks[AGGIOVMAX];
+	size_t sizes[AGGIOVMAX];
+	int n, i;
+
+	// Take every queued block, up to AGGIOVMAX.
+	while ((n = blockQueuePop(link->queue, blocks, sizes, AGGIOVMAX)) > 0) {
+		for (i = 0; i < n; i++) {
+			iov[i].iov_base = blocks[i];
+			iov[i].iov_len = sizes[i];
+		}
+
+		// Send them, resuming after partial writes.
+		struct iovec* next = iov;
+		int left = n;
+		while (left > 0) {
+			unsigned long long int sendNs = timingNowNs();
+			ssize_t ret = writev(link->sock, next, left);
+			connStatsSendBlock(cs, timingNowNs() - sendNs);
+			if (ret < 0) {
+				dieWithError("threadAggregateSend writev() failed");
+			}
+			link->writevCalls++;
+			link->totalSendMsgSize += ret;
+			connStatsSend(cs, ret);
+			while (left > 0 && (size_t) ret >= next->iov_len) {
+				ret -= next->iov_len;
+				next++;
+				left--;
+			}
+			if (left > 0) {
+				next->iov_base = (char*) next->iov_base + ret;
+				next->iov_len -= ret;
+			}
+		}
+		link->records += n;
+		for (i = 0; i < n; i++) {
+			bufPoolPut(Aggregate.pool, blocks[i]);
 		}
 	}
 
+	char prefix[32];
+	snprintf(prefix, sizeof(prefix), "link %d ", (int) (link - Aggregate.link));
+	connStatsPrintStall(cs, prefix);
+	connStatsClose(cs);
+	close(link->sock);
+	return ((void*) 0);
+}
+
+void* threadReceiveConnectionAndAggregate(void* arg) {
+	Connection* conn = (Connection*) arg;
+	int preSock = conn->socketfd;
+	uint32_t streamId = (uint32_t) conn->id;
+	AggLink* link = &Aggregate.link[conn->id % Aggregate.linkAmount]; // One stream always uses one link, so its records stay in order.
 
-	// Get process id and thread id.
 	pid_t pid = getpid();
-	//pthread_t tid = pthread_self(); // Get tid, different from "syscall(SYS_gettid)".
 	pid_t tid = gettid();
-	printf("thread preSock: %d, pid: %u, tid: %u\n", preSock, (unsigned int) pid, (unsigned int) tid);
-
-
-	// [Connect L2 client to server.
-	int nextSock;
-	struct sockaddr_in nextAddr;
-	unsigned short nextPort = Paras.servPort;
-	char* nextIP = Paras.servIP;
-
-	if ((nextSock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
-		dieWithError("threadReceiveAndSend socket() failed");
-	}
-	
-	memset(&nextAddr, 0, sizeof(nextAddr));
-	nextAddr.sin_family = AF_INET;
-	nextAddr.sin_addr.s_addr = inet_addr(nextIP);
-	nextAddr.sin_port = htons(nextPort);
-
-	if (connect(nextSock, (struct sockaddr*) &nextAddr, sizeof(nextAddr)) < 0) {
-		dieWithError("threadReceiveAndSend connect() failed");
-	}
-	// ]
-
-	char buffer[RCVBUFSIZE];
-	bzero(buffer, RCVBUFSIZE);
+	printf("threadReceiveConnectionAndAggregate preSock: %d, stream: %u, pid: %u, tid: %u\n", preSock, streamId, (unsigned int) pid, (unsigned int) tid);
+	ConnStats* cs = connStatsOpen("l2client", preSock, link->sock, tid, &conn->clientAddress);
 
 	int recvMsgSize;
 	unsigned long long int totalRecvMsgSize = 0;
-	unsigned long long int totalSendMsgSize = 0;
 
 	// CPU calculating.
 	ProcStat ps1, ps2;
 	ProcPidStat pps1, pps2;
 	getWholeCPUStatus(&ps1);
-	getThreadCPUStatus(&pps1, pid, tid); // accurate?
+	getThreadCPUStatus(&pps1, pid, tid);
+	PerfCount perf;
+	perfCountStart(&perf);
 
 	// Time calculating.
-	struct timeval t1, t2;
-	gettimeofday(&t1, NULL);
+	unsigned long long int t1 = timingNowNs();
 	double timeSpan = 0.0;
 
 	while (1) {
-		if ((recvMsgSize = recv(preSock, buffer, RCVBUFSIZE, 0)) < 0) {
-			dieWithError("threadReceiveAndSend recv() failed");
+		// Take a block only once data is there, so idle upstreams hold no block and the pool is left to the active ones.
+		struct pollfd pfd = {preSock, POLLIN, 0};
+		unsigned long long int waitNs = timingNowNs();
+		if (poll(&pfd, 1, -1) < 0) {
+			dieWithError("threadReceiveConnectionAndAggregate poll() failed");
 		}
-		else if (recvMsgSize > 0) {
-			totalRecvMsgSize += recvMsgSize;
-			//printf("thread %u recvMsgSize: %d\n", (unsigned int) tid, recvMsgSize);
-            //printf("thread %u totalRecvMsgSize: %lld\n", (unsigned int) tid, totalRecvMsgSize);
-
-			// Send data from L2 client to server.
-			//int sendMsgSize = strlen(buffer);
-			int sendMsgSize = recvMsgSize;
-			if (send(nextSock, buffer, sendMsgSize, 0) != sendMsgSize) {
-				dieWithError("threadReceiveAndSend send() a different number of bytes than expected");
-			}
-			totalSendMsgSize += sendMsgSize;
+		connStatsRecvWait(cs, timingNowNs() - waitNs);
+		unsigned long long int getNs = timingNowNs();
+		char* block = bufPoolGet(Aggregate.pool);
+		connStatsSendBlock(cs, timingNowNs() - getNs); // An empty pool means the links are behind.
+		if ((recvMsgSize = connStatsTimedRecv(cs, preSock, block + MUXHEADERSIZE, AGGBLOCKSIZE - MUXHEADERSIZE, 0)) < 0) {
+			dieWithError("threadReceiveConnectionAndAggregate recv() failed");
 		}
-		else {
+		muxHeaderWrite(block, streamId, recvMsgSize); // Length 0 ends the stream.
+		blockQueuePush(link->queue, block, MUXHEADERSIZE + recvMsgSize);
+		if (recvMsgSize == 0) {
 			break;
 		}
+		totalRecvMsgSize += recvMsgSize;
+		connStatsRecv(cs, recvMsgSize);
 	}
 
 	getWholeCPUStatus(&ps2);
 	getThreadCPUStatus(&pps2, pid, tid);
+	perfCountStop(&perf);
 	float CPUUse = calWholeCPUUse(&ps1, &ps2);
 	float threadCPUUse = calProcessCPUUse(&ps1, &pps1, &ps2, &pps2);
 
-	gettimeofday(&t2, NULL);
-	timeSpan = (double) (t2.tv_sec-t1.tv_sec) + (double) t2.tv_usec*1e-6 - (double) t1.tv_usec*1e-6;
-	double sendSpeed = ((double) totalSendMsgSize * 8) / (timeSpan * 1000 *1000);
+	timeSpan = timingSince(t1);
+	double recvSpeed = ((double) totalRecvMsgSize * 8) / (timeSpan * 1000 *1000);
 
 	pthread_mutex_lock(&threadRSTagLock);
 	threadRSTag++;
 	printf("Tag: %llu\n", threadRSTag);
-    pthread_mutex_unlock(&threadRSTagLock);
+	pthread_mutex_unlock(&threadRSTagLock);
 	printf("thread %d-%d CPUUse: %f, threadCPUUse: %f\n", pid, tid, CPUUse, threadCPUUse);
-	printf("thread %d-%d totalRecvMsgSize: %llu Bytes\n", pid, tid, totalRecvMsgSize);
-	printf("thread %d-%d totalSendMsgSize: %llu Bytes\n", pid, tid, totalSendMsgSize);
+	printf("thread %d-%d stream %u totalRecvMsgSize: %llu Bytes\n", pid, tid, streamId, totalRecvMsgSize);
 	printf("thread %d-%d time span: %lf\n", pid, tid, timeSpan);
-	printf("thread %d-%d send speed(after receive): %lf Mb/s\n\n", pid, tid, sendSpeed);
-
+	printf("thread %d-%d receive speed: %lf Mb/s\n", pid, tid, recvSpeed);
+	char prefix[32];
+	snprintf(prefix, sizeof(prefix), "thread %d-%d ", pid, tid);
+	connStatsPrintStall(cs, prefix);
+	printMemoryStatus(prefix, &pps1, &pps2, totalRecvMsgSize);
+	perfCountPrint(&perf, prefix, totalRecvMsgSize, cs->recvCalls);
+	printf("\n");
+
+	connStatsClose(cs);
 	close(preSock);
-	close(nextSock);
-	pthread_exit((void*) 0);
+	free(conn);
+
+	pthread_mutex_lock(&Aggregate.lock);
+	Aggregate.activeUpstreams--;
+	pthread_mutex_unlock(&Aggregate.lock);
 
 	return ((void*) 0);
 }
 
-void* threadReceiveConnectionAndSend(void* arg) { 
-	printf("threadReceiveAndSend\n");
-	Connection* conn = (Connection*) arg;
-	int preSock = conn->socketfd;
+// Open the downstream links and start their senders.
+void aggregateStart() {
+	int i;
 
+	Aggregate.linkAmount = Paras.aggregate < AGGMAX ? Paras.aggregate : AGGMAX;
+	if ((Aggregate.pool = bufPoolAllocOnNode(AGGBLOCKSIZE, AGGBLOCKAMOUNT, currentNumaNode())) == NULL) {
+		dieWithError("aggregateStart bufPoolAlloc() failed");
+	}
+	pthread_mutex_init(&Aggregate.lock, NULL);
 
-	// Get process id and thread id.
-	pid_t pid = getpid();
-	//pthread_t tid = pthread_self(); // Get tid, different from "syscall(SYS_gettid)".
-	pid_t tid = gettid();
-	printf("thread preSock: %d, pid: %u, tid: %u\n", preSock, (unsigned int) pid, (unsigned int) tid);
+	for (i = 0; i < Aggregate.linkAmount; i++) {
+		AggLink* link = &Aggregate.link[i];
+		link->sock = connectToServer(Paras.servIP, Paras.servPort, "aggregateStart connect() failed");
+		if ((link->queue = blockQueueAlloc(AGGBLOCKAMOUNT)) == NULL) {
+			dieWithError("aggregateStart blockQueueAlloc() failed");
+		}
+		if (pthread_create(&link->ntid, NULL, threadAggregateSend, link) != 0) {
+			dieWithError("aggregateStart pthread_create() failed");
+		}
+	}
+	printf("aggregate: %d downstream connections\n", Aggregate.linkAmount);
+}
 
+// Wait for the upstream streams, drain the links and report.
+void aggregateFinish() {
+	int i;
 
-	// [Connect L2 client to server.
-	int nextSock;
-	struct sockaddr_in nextAddr;
-	unsigned short nextPort = Paras.servPort;
-	char* nextIP = Paras.servIP;
+	while (1) {
+		pthread_mutex_lock(&Aggregate.lock);
+		int active = Aggregate.activeUpstreams;
+		pthread_mutex_unlock(&Aggregate.lock);
+		if (active == 0) {
+			break;
+		}
+		sleep(1);
+	}
 
-	if ((nextSock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
-		dieWithError("threadReceiveAndSend socket() failed");
+	for (i = 0; i < Aggregate.linkAmount; i++) {
+		AggLink* link = &Aggregate.link[i];
+		blockQueueClose(link->queue);
+		pthread_join(link->ntid, NULL);
+		blockQueueRelease(link->queue);
+
+		double perWritev = link->writevCalls > 0 ? (double) link->totalSendMsgSize / link->writevCalls : 0.0;
+		printf("link %d\nrecords: %llu\nwritev calls: %llu\ntotalSendMsgSize: %llu Bytes\nbytes per writev: %lf\nrecords per writev: %lf\n\n", i, link->records, link->writevCalls, link->totalSendMsgSize, perWritev, link->writevCalls > 0 ? (double) link->records / link->writevCalls : 0.0);
 	}
+	printf("pool waits: %llu\n", Aggregate.pool->waits);
+	bufPoolRelease(Aggregate.pool);
+}
+// ]
+
+void multiConnMultiThreadL2Client() {
+	printf("multiConnMultiThreadL2Client\n");
+	unsigned short prePort = Paras.prePort;
+
+	int localSock, preSock; // Listen on localSock, new connection on preSock.
+	struct sockaddr_in localAddr; // local address info.
+	struct sockaddr_in preAddr; // connector's address info.
+	socklen_t sinSize; 
+	int on = 1;
 	
-	memset(&nextAddr, 0, sizeof(nextAddr));
-	nextAddr.sin_family = AF_INET;
-	nextAddr.sin_addr.s_addr = inet_addr(nextIP);
-	nextAddr.sin_port = htons(nextPort);
+	pthread_mutex_init(&threadRSTagLock, NULL);
+	if (Paras.aggregate > 0) {
+		aggregateStart();
+	}
+	if (Paras.linkEmu && (multiLinkShare = linkShareAlloc(Paras.linkBuffer)) == NULL) {
+		dieWithError("multiConnMultiThreadL2Client linkShareAlloc() failed");
+	}
+	int connId = 0;
+	// Pre client socket pool.
+	//ClntSockPool* cspool = clntSockPoolAlloc(); // Deprecated.
 
-	if (connect(nextSock, (struct sockaddr*) &nextAddr, sizeof(nextAddr)) < 0) {
-		dieWithError("threadReceiveAndSend connect() failed");
+	if ((localSock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		dieWithError("multiConnMultiThreadL2Client socket() failed");
 	}
-	// ]
 
-	char buffer[RCVBUFSIZE];
-	bzero(buffer, RCVBUFSIZE);
+	if (setsockopt(localSock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int)) < 0) {
+		dieWithError("multiConnMultiThreadL2Client setsockopt() failed");
+	}
+
+	// Construct local address structure.
+	localAddr.sin_family = AF_INET; // Host byte order.
+	localAddr.sin_port = htons(prePort);
+	localAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	memset(localAddr.sin_zero, '\0', sizeof(localAddr.sin_zero));
+
+	if (bind(localSock, (struct sockaddr*) &localAddr, sizeof(localAddr)) < 0) {
+		dieWithError("multiConnMultiThreadL2Client bind() failed");
+	}
+
+	if (listenSocket(localSock, MAXPENDING) < 0) {
+		dieWithError("multiConnMultiThreadL2Client listen() failed");
+	}
+	printf("prePort: %d\n", prePort);
+
+	fd_set fds;
+	int maxsock = localSock;
+	struct timeval timeout;
+
+	sinSize = sizeof(preAddr);
+
+
+	while (!reportStopping()) {
+		FD_ZERO(&fds);
+		FD_SET(localSock, &fds);
+		timeout.tv_sec = Paras.continuous ? 1 : 30;
+		timeout.tv_usec = 0;
+		int ret = 0;
+		if ((ret = select(maxsock+1, &fds, NULL, NULL, &timeout)) < 0) {
+			dieWithError("multiConnMultiThreadL2Client select() failed");
+		}
+		else if (ret == 0) {
+			if (Paras.continuous) {
+				continue;
+			}
+			printf("timeout\n");
+			break;
+		}
+
+		if ((preSock = accept(localSock, (struct sockaddr*) &preAddr, &sinSize)) < 0) {
+			dieWithError("multiConnMultiThreadL2Client accept() failed");
+		}
+		//pthread_mutex_lock(&cspool->poolLock);
+		//cspool->pool[cspool->poolTop++] = preSock;
+		//pthread_mutex_unlock(&cspool->poolLock);
+		
+		Connection* conn = (Connection*) malloc(sizeof(Connection));
+		conn->socketfd = preSock;
+		conn->id = connId++;
+		conn->serverAddress = localAddr;
+		conn->clientAddress = preAddr;
+		pthread_t ntid;
+		if (Paras.aggregate > 0) {
+			pthread_mutex_lock(&Aggregate.lock);
+			Aggregate.activeUpstreams++;
+			pthread_mutex_unlock(&Aggregate.lock);
+			if (pthread_create(&ntid, NULL, threadReceiveConnectionAndAggregate, conn) < 0) {
+				dieWithError("multiConnMultiThreadL2Client pthread_create() failed");
+			}
+		}
+		else if (pthread_create(&ntid, NULL, threadReceiveConnectionAndSend, conn) < 0) {
+			dieWithError("multiConnMultiThreadL2Client pthread_create() failed");
+		}
+		pthread_detach(ntid);
+		//pthread_join(ntid, NULL);
+
+
+	}
+	
+	//clntSockPoolRelease(cspool);
+	close(localSock);
+
+	if (Paras.aggregate > 0) {
+		aggregateFinish(); // Waits for the upstreams itself.
+	}
+	if (Paras.continuous) {
+		reportDrain(Paras.aggregate > 0 ? &Aggregate.activeUpstreams : NULL);
+	}
+
+	exit(0);
+
+}
+
+// [ FanOut
+// Fan-out L2 client: every upstream connection has a receive thread, which distributes byte chunks (or whole frames with "-frame")
+// over the downstream receivers. Each downstream has its own sender thread fed through a bounded ByteQueue.
+#define FANOUTMAX 16 // Maximum downstream receivers.
+#define FANOUTQUEUESIZE (8*1024*1024) // Queue size of each downstream.
+#define FANOUTBATCHSIZE (256*1024) // Frames for one downstream are batched up to this size before queueing.
+
+typedef struct downstream {
+	char ip[INET_ADDRSTRLEN];
+	unsigned short port;
+	int sock;
+	ByteQueue* queue;
+	unsigned long long int units; // Chunks or frames queued.
+	unsigned long long int totalSendMsgSize;
+	unsigned long long int lastSend; // End of the last send(), ends the time span.
+	pthread_t ntid;
+} Downstream;
+
+struct FANOUT {
+	Downstream down[FANOUTMAX];
+	int downAmount;
+	unsigned int rrNext;
+	int activeUpstreams;
+	pthread_mutex_t lock;
+} FanOut;
+
+// Choose the downstream for one chunk or frame.
+int fanOutPick(unsigned int srcId) {
+	int i;
+	int pick = 0;
+
+	if (Paras.distType == DistLeastQueued) {
+		size_t least = byteQueueSize(FanOut.down[0].queue);
+		for (i = 1; i < FanOut.downAmount; i++) {
+			size_t size = byteQueueSize(FanOut.down[i].queue);
+			if (size < least) {
+				least = size;
+				pick = i;
+			}
+		}
+	}
+	else if (Paras.distType == DistHash) {
+		pick = (int) (((srcId + 1) * 2654435761u) % FanOut.downAmount); // Knuth multiplicative hash, keeps one source on one downstream.
+	}
+	else { // DistRoundRobin
+		pick = (int) (__atomic_fetch_add(&FanOut.rrNext, 1, __ATOMIC_RELAXED) % FanOut.downAmount);
+	}
+
+	return pick;
+}
+
+// Upstream receive thread of the running fan-out, its queue waits count as blocked sending.
+__thread ConnStats* fanOutUpstreamStats;
+
+void fanOutQueue(int pick, const char* data, size_t len, unsigned long long int units) {
+	Downstream* d = &FanOut.down[pick];
+	unsigned long long int pushNs = timingNowNs();
+	byteQueuePush(d->queue, data, len);
+	connStatsSendBlock(fanOutUpstreamStats, timingNowNs() - pushNs);
+	__atomic_fetch_add(&d->units, units, __ATOMIC_RELAXED);
+}
+
+// Frames of one upstream connection are batched per downstream, then queued once per recv().
+typedef struct fanOutBatch {
+	char* data[FANOUTMAX];
+	size_t size[FANOUTMAX];
+	unsigned long long int units[FANOUTMAX];
+} FanOutBatch;
+
+void fanOutBatchFlush(FanOutBatch* batch, int pick) {
+	if (batch->size[pick] > 0) {
+		fanOutQueue(pick, batch->data[pick], batch->size[pick], batch->units[pick]);
+		batch->size[pick] = 0;
+		batch->units[pick] = 0;
+	}
+}
+
+void fanOutFrame(void* ctx, const char* frame, size_t frameSize, const FrameHeader* hdr) {
+	FanOutBatch* batch = (FanOutBatch*) ctx;
+	int pick = fanOutPick(hdr->srcId);
+
+	if (frameSize > FANOUTBATCHSIZE) {
+		fanOutBatchFlush(batch, pick);
+		fanOutQueue(pick, frame, frameSize, 1);
+		return;
+	}
+	if (batch->size[pick] + frameSize > FANOUTBATCHSIZE) {
+		fanOutBatchFlush(batch, pick);
+	}
+	memcpy(batch->data[pick] + batch->size[pick], frame, frameSize);
+	batch->size[pick] += frameSize;
+	batch->units[pick]++;
+}
+
+void* threadFanOutSend(void* arg) {
+	Downstream* d = (Downstream*) arg;
+	ConnStats* cs = connStatsOpen("fanout", -1, d->sock, gettid(), NULL);
+	char* data;
+	size_t len;
+
+	while ((len = byteQueuePeek(d->queue, &data)) > 0) {
+		int sendMsgSize = (int) (len < RCVBUFSIZE ? len : RCVBUFSIZE);
+		if (connStatsTimedSend(cs, d->sock, data, sendMsgSize, 0) != sendMsgSize) {
+			dieWithError("threadFanOutSend send() a different number of bytes than expected");
+		}
+		byteQueuePop(d->queue, sendMsgSize);
+		d->lastSend = timingNowNs();
+		d->totalSendMsgSize += sendMsgSize;
+		connStatsSend(cs, sendMsgSize);
+	}
+
+	char prefix[32];
+	snprintf(prefix, sizeof(prefix), "downstream[%d] ", (int) (d - FanOut.down));
+	connStatsPrintStall(cs, prefix);
+	connStatsClose(cs);
+	close(d->sock);
+	return ((void*) 0);
+}
+
+void* threadReceiveConnectionAndFanOut(void* arg) {
+	Connection* conn = (Connection*) arg;
+	int preSock = conn->socketfd;
+	pid_t pid = getpid();
+	pid_t tid = gettid();
+	printf("threadReceiveConnectionAndFanOut preSock: %d, pid: %u, tid: %u\n", preSock, (unsigned int) pid, (unsigned int) tid);
+	ConnStats* cs = connStatsOpen("l2client", preSock, -1, tid, &conn->clientAddress);
+	fanOutUpstreamStats = cs;
+
+	char* buffer = bufPoolNodeGet();
+	FrameReader* fr = NULL;
+	FanOutBatch batch;
+	int i;
+	if (Paras.framed) {
+		memset(&batch, 0, sizeof(batch));
+		for (i = 0; i < FanOut.downAmount; i++) {
+			if ((batch.data[i] = (char*) malloc(FANOUTBATCHSIZE)) == NULL) {
+				dieWithError("threadReceiveConnectionAndFanOut malloc() failed");
+			}
+		}
+		if ((fr = frameReaderAlloc()) == NULL) {
+			dieWithError("threadReceiveConnectionAndFanOut frameReaderAlloc() failed");
+		}
+	}
 
 	int recvMsgSize;
 	unsigned long long int totalRecvMsgSize = 0;
-	unsigned long long int totalSendMsgSize = 0;
 
 	// CPU calculating.
 	ProcStat ps1, ps2;
 	ProcPidStat pps1, pps2;
 	getWholeCPUStatus(&ps1);
-	getThreadCPUStatus(&pps1, pid, tid); // accurate?
+	getThreadCPUStatus(&pps1, pid, tid);
+	PerfCount perf;
+	perfCountStart(&perf);
 
 	// Time calculating.
-	struct timeval t1, t2;
-	gettimeofday(&t1, NULL);
+	unsigned long long int t1 = timingNowNs();
 	double timeSpan = 0.0;
 
 	while (1) {
-		if ((recvMsgSize = recv(preSock, buffer, RCVBUFSIZE, 0)) < 0) {
-			dieWithError("threadReceiveAndSend recv() failed");
+		if ((recvMsgSize = connStatsTimedRecv(cs, preSock, buffer, RCVBUFSIZE, 0)) < 0) {
+			dieWithError("threadReceiveConnectionAndFanOut recv() failed");
 		}
 		else if (recvMsgSize > 0) {
 			totalRecvMsgSize += recvMsgSize;
-			//printf("thread %u recvMsgSize: %d\n", (unsigned int) tid, recvMsgSize);
-            //printf("thread %u totalRecvMsgSize: %lld\n", (unsigned int) tid, totalRecvMsgSize);
-
-			// Send data from L2 client to server.
-			//int sendMsgSize = strlen(buffer);
-			int sendMsgSize = recvMsgSize;
-			if (send(nextSock, buffer, sendMsgSize, 0) != sendMsgSize) {
-				dieWithError("threadReceiveAndSend send() a different number of bytes than expected");
+			connStatsRecv(cs, recvMsgSize);
+			if (Paras.framed) {
+				frameReaderFeed(fr, buffer, recvMsgSize, fanOutFrame, &batch);
+				for (i = 0; i < FanOut.downAmount; i++) {
+					fanOutBatchFlush(&batch, i);
+				}
+			}
+			else {
+				fanOutQueue(fanOutPick(conn->id), buffer, recvMsgSize, 1);
 			}
-			totalSendMsgSize += sendMsgSize;
 		}
 		else {
 			break;
@@ -1285,117 +3806,244 @@ void* threadReceiveConnectionAndSend(void* arg) {
 
 	getWholeCPUStatus(&ps2);
 	getThreadCPUStatus(&pps2, pid, tid);
+	perfCountStop(&perf);
 	float CPUUse = calWholeCPUUse(&ps1, &ps2);
 	float threadCPUUse = calProcessCPUUse(&ps1, &pps1, &ps2, &pps2);
 
-	gettimeofday(&t2, NULL);
-	timeSpan = (double) (t2.tv_sec-t1.tv_sec) + (double) t2.tv_usec*1e-6 - (double) t1.tv_usec*1e-6;
-	double sendSpeed = ((double) totalSendMsgSize * 8) / (timeSpan * 1000 *1000);
+	timeSpan = timingSince(t1);
+	double recvSpeed = ((double) totalRecvMsgSize * 8) / (timeSpan * 1000 *1000);
 
-	pthread_mutex_lock(&threadRSTagLock);
-	threadRSTag++;
-	printf("Tag: %llu\n", threadRSTag);
-	pthread_mutex_unlock(&threadRSTagLock);
 	printf("thread %d-%d CPUUse: %f, threadCPUUse: %f\n", pid, tid, CPUUse, threadCPUUse);
 	printf("thread %d-%d totalRecvMsgSize: %llu Bytes\n", pid, tid, totalRecvMsgSize);
-	printf("thread %d-%d totalSendMsgSize: %llu Bytes\n", pid, tid, totalSendMsgSize);
+	if (Paras.framed) {
+		printf("thread %d-%d frames: %llu, skippedBytes: %llu\n", pid, tid, fr->frames, fr->skippedBytes);
+		for (i = 0; i < FanOut.downAmount; i++) {
+			free(batch.data[i]);
+		}
+		frameReaderRelease(fr);
+	}
 	printf("thread %d-%d time span: %lf\n", pid, tid, timeSpan);
-	printf("thread %d-%d send speed(after receive): %lf Mb/s\n\n", pid, tid, sendSpeed);
-
+	printf("thread %d-%d receive speed: %lf Mb/s\n", pid, tid, recvSpeed);
+	char prefix[32];
+	snprintf(prefix, sizeof(prefix), "thread %d-%d ", pid, tid);
+	connStatsPrintStall(cs, prefix);
+	printMemoryStatus(prefix, &pps1, &pps2, totalRecvMsgSize);
+	perfCountPrint(&perf, prefix, totalRecvMsgSize, cs->recvCalls);
+	printf("\n");
+
+	connStatsClose(cs);
 	close(preSock);
-	close(nextSock);
+	bufPoolNodePut(buffer);
 	free(conn);
-	pthread_exit((void*) 0);
+
+	pthread_mutex_lock(&FanOut.lock);
+	FanOut.activeUpstreams--;
+	pthread_mutex_unlock(&FanOut.lock);
 
 	return ((void*) 0);
 }
 
-void multiConnMultiThreadL2Client() {
-	printf("multiConnMultiThreadL2Client\n");
-	unsigned short prePort = Paras.prePort;
-
-	int localSock, preSock; // Listen on localSock, new connection on preSock.
-	struct sockaddr_in localAddr; // local address info.
-	struct sockaddr_in preAddr; // connector's address info.
-	socklen_t sinSize; 
-	int on = 1;
-	
-	pthread_mutex_init(&threadRSTagLock, NULL);
-	// Pre client socket pool.
-	//ClntSockPool* cspool = clntSockPoolAlloc(); // Deprecated.
-
-	if ((localSock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-		dieWithError("multiConnMultiThreadL2Client socket() failed");
+// Parse "ip:port,ip:port,..." into FanOut.down.
+void fanOutParse(const char* list) {
+	char* copy = strdup(list);
+	char* save = NULL;
+	char* item;
+
+	FanOut.downAmount = 0;
+	for (item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+		char* colon = strchr(item, ':');
+		if (colon == NULL || FanOut.downAmount == FANOUTMAX) {
+			dieWithError("fanOutParse bad -fanout list, expect at most 16 of ip:port");
+		}
+		*colon = '\0';
+		Downstream* d = &FanOut.down[FanOut.downAmount++];
+		snprintf(d->ip, sizeof(d->ip), "%s", item);
+		d->port = atoi(colon + 1);
 	}
+	free(copy);
 
-	if (setsockopt(localSock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int)) < 0) {
-		dieWithError("multiConnMultiThreadL2Client setsockopt() failed");
+	if (FanOut.downAmount == 0) {
+		dieWithError("fanOutParse empty -fanout list");
 	}
+}
 
-	// Construct local address structure.
-	localAddr.sin_family = AF_INET; // Host byte order.
-	localAddr.sin_port = htons(prePort);
-	localAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-	memset(localAddr.sin_zero, '\0', sizeof(localAddr.sin_zero));
+void fanOutL2Client() {
+	printf("fanOutL2Client\n");
+	unsigned short prePort = Paras.prePort;
+	int i;
 
-	if (bind(localSock, (struct sockaddr*) &localAddr, sizeof(localAddr)) < 0) {
-		dieWithError("multiConnMultiThreadL2Client bind() failed");
+	if (Paras.fanOut == NULL) {
+		// Without a list, fan out to the single "-a -p" receiver.
+		char single[64];
+		snprintf(single, sizeof(single), "%s:%d", Paras.servIP, Paras.servPort);
+		fanOutParse(single);
 	}
-
-	if (listen(localSock, MAXPENDING) < 0) {
-		dieWithError("multiConnMultiThreadL2Client listen() failed");
+	else {
+		fanOutParse(Paras.fanOut);
 	}
-	printf("prePort: %d\n", prePort);
+	pthread_mutex_init(&FanOut.lock, NULL);
+
+	// [Connect to every downstream and start its sender.
+	for (i = 0; i < FanOut.downAmount; i++) {
+		Downstream* d = &FanOut.down[i];
+		d->sock = connectToServer(d->ip, d->port, "fanOutL2Client connect() failed");
+		if ((d->queue = byteQueueAlloc(FANOUTQUEUESIZE)) == NULL) {
+			dieWithError("fanOutL2Client byteQueueAlloc() failed");
+		}
+		if (pthread_create(&d->ntid, NULL, threadFanOutSend, d) != 0) {
+			dieWithError("fanOutL2Client pthread_create() failed");
+		}
+		printf("downstream[%d] %s:%d\n", i, d->ip, d->port);
+	}
+	// ]
+
+	int localSock = listenOn(prePort, MAXPENDING, "fanOutL2Client listen failed");
+	printf("prePort: %d, downstreams: %d, dist: %d, framed: %d\n", prePort, FanOut.downAmount, Paras.distType, Paras.framed);
 
 	fd_set fds;
-	int maxsock = localSock;
 	struct timeval timeout;
+	struct sockaddr_in preAddr;
+	socklen_t sinSize = sizeof(preAddr);
+	int preSock;
+	int connId = 0;
 
-	sinSize = sizeof(preAddr);
-
+	unsigned long long int t1 = 0, t2;
+	int started = 0;
 
 	while (1) {
+		if (reportStopping()) {
+			reportDrain(&FanOut.activeUpstreams); // Then drain the queues below.
+			break;
+		}
 		FD_ZERO(&fds);
 		FD_SET(localSock, &fds);
-		timeout.tv_sec = 30;
+		timeout.tv_sec = Paras.continuous ? 1 : 30;
 		timeout.tv_usec = 0;
 		int ret = 0;
-		if ((ret = select(maxsock+1, &fds, NULL, NULL, &timeout)) < 0) {
-			dieWithError("multiConnMultiThreadL2Client select() failed");
+		if ((ret = select(localSock+1, &fds, NULL, NULL, &timeout)) < 0) {
+			dieWithError("fanOutL2Client select() failed");
 		}
 		else if (ret == 0) {
-			printf("timeout\n");
-			break;
+			pthread_mutex_lock(&FanOut.lock);
+			int active = FanOut.activeUpstreams;
+			pthread_mutex_unlock(&FanOut.lock);
+			if (active == 0 && !Paras.continuous) {
+				printf("timeout\n");
+				break;
+			}
+			continue; // Wait for running upstreams before reporting.
 		}
 
 		if ((preSock = accept(localSock, (struct sockaddr*) &preAddr, &sinSize)) < 0) {
-			dieWithError("multiConnMultiThreadL2Client accept() failed");
+			dieWithError("fanOutL2Client accept() failed");
 		}
-		//pthread_mutex_lock(&cspool->poolLock);
-		//cspool->pool[cspool->poolTop++] = preSock;
-		//pthread_mutex_unlock(&cspool->poolLock);
-		
+		if (!started) {
+			t1 = timingNowNs();
+			started = 1;
+		}
+
 		Connection* conn = (Connection*) malloc(sizeof(Connection));
 		conn->socketfd = preSock;
-		conn->serverAddress = localAddr;
+		conn->id = connId++;
 		conn->clientAddress = preAddr;
+		pthread_mutex_lock(&FanOut.lock);
+		FanOut.activeUpstreams++;
+		pthread_mutex_unlock(&FanOut.lock);
 		pthread_t ntid;
-		if (pthread_create(&ntid, NULL, threadReceiveConnectionAndSend, conn) < 0) {
-			dieWithError("multiConnMultiThreadL2Client pthread_create() failed");
+		if (pthread_create(&ntid, NULL, threadReceiveConnectionAndFanOut, conn) != 0) {
+			dieWithError("fanOutL2Client pthread_create() failed");
 		}
-		//pthread_join(ntid, NULL);
-
+		pthread_detach(ntid);
+	}
 
+	// Drain the queues and report.
+	for (i = 0; i < FanOut.downAmount; i++) {
+		byteQueueClose(FanOut.down[i].queue);
+		pthread_join(FanOut.down[i].ntid, NULL);
 	}
-	
-	//clntSockPoolRelease(cspool);
+	t2 = t1;
+	for (i = 0; i < FanOut.downAmount; i++) {
+		if (FanOut.down[i].lastSend > t2) {
+			t2 = FanOut.down[i].lastSend;
+		}
+	}
+	double timeSpan = started ? (t2 - t1) * 1e-9 : 0.0; // From first accept to last send, idle timeout excluded.
+
+	unsigned long long int total = 0, most = 0, least = ~0ULL;
+	for (i = 0; i < FanOut.downAmount; i++) {
+		Downstream* d = &FanOut.down[i];
+		double sendSpeed = timeSpan > 0 ? ((double) d->totalSendMsgSize * 8) / (timeSpan * 1000 * 1000) : 0.0;
+		printf("downstream[%d] %s:%d\nunits: %llu\ntotalSendMsgSize: %llu Bytes\npeakQueue: %zu Bytes\nqueueWait: %lf s\nsendSpeed: %lf Mb/s\n\n", i, d->ip, d->port, d->units, d->totalSendMsgSize, d->queue->peak, d->queue->pushWaitUs * 1e-6, sendSpeed);
+		total += d->totalSendMsgSize;
+		most = d->totalSendMsgSize > most ? d->totalSendMsgSize : most;
+		least = d->totalSendMsgSize < least ? d->totalSendMsgSize : least;
+		byteQueueRelease(d->queue);
+	}
+	double mean = (double) total / FanOut.downAmount;
+	printf("time span: %lf\n", timeSpan);
+	printf("total send speed: %lf Mb/s\n", timeSpan > 0 ? ((double) total * 8) / (timeSpan * 1000 * 1000) : 0.0);
+	printf("imbalance: max/mean %lf, (max-min)/mean %lf\n", mean > 0 ? most / mean : 0.0, mean > 0 ? (most - least) / mean : 0.0);
+
 	close(localSock);
 
 	exit(0);
+}
+// ]
+
+// [ Paras
+// Options that take no value.
+static const char* parasSwitches[] = {"-frame", "-demux", "-compress", "-decompress", "-sharedlisten", "-accept4", "-continuous", "-perf", "-crc", "--help", NULL};
+
+int parasSwitch(const char* option) {
+	int i;
+	for (i = 0; parasSwitches[i] != NULL; i++) {
+		if (strcmp(option, parasSwitches[i]) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
 
+// Port "value" of "option", -1 after printing why it is not one. A typo must not quietly end up as another port.
+int parasPort(const char* option, const char* value, int min) {
+	char* end;
+	long port = strtol(value, &end, 10);
+	if (end == value || *end != '\0' || port < min || port > 65535) {
+		printf("option %s takes a port, not %s\n", option, value);
+		return -1;
+	}
+	return port;
 }
 
-int main(int argc, char* argv[]) {
+// Integer "value" of "option" from "min" (at least 0) to "max", -1 after printing why it is not one. atoi() would
+// turn "x1" into 0 and "-1" into a huge unsigned count.
+long parasInt(const char* option, const char* value, long min, long max) {
+	char* end;
+	long n = strtol(value, &end, 10);
+	if (end == value || *end != '\0' || n < min || n > max) {
+		printf("option %s takes an integer from %ld to %ld, not %s\n", option, min, max, value);
+		return -1;
+	}
+	return n;
+}
+
+// Number "value" of "option" from "min" (at least 0) up to but not including "limit", -1 after printing why it is not one.
+double parasReal(const char* option, const char* value, double min, double limit) {
+	char* end;
+	double x = strtod(value, &end);
+	if (end == value || *end != '\0' || !(x >= min && x < limit)) {
+		if (limit == HUGE_VAL) {
+			printf("option %s takes a number from %g up, not %s\n", option, min, value);
+		}
+		else {
+			printf("option %s takes a number from %g to below %g, not %s\n", option, min, limit, value);
+		}
+		return -1;
+	}
+	return x;
+}
+
+void parasInit() {
 	Paras.servPort = 5555;
 	Paras.isServer = 1;
 	Paras.servIP = (char*) "127.0.0.1"; 
@@ -1403,47 +4051,517 @@ int main(int argc, char* argv[]) {
 	Paras.prePort = 6666;
 	Paras.serverType = 3;
 	Paras.clientType = 4;
+	Paras.metricsPort = 0;
+	Paras.reportInterval = 0;
+	Paras.fanOut = NULL;
+	Paras.distType = DistRoundRobin;
+	Paras.framed = 0;
+	Paras.srcId = 0;
+	Paras.aggregate = 0;
+	Paras.demux = 0;
+	Paras.compress = 0;
+	Paras.monitor = 0;
+	Paras.monitorFile = (char*) "idaq-monitor.txt";
+	Paras.trigger = 0;
+	Paras.triggerThreshold = 0;
+	Paras.triggerChannels = 1;
+	Paras.prescale = 0;
+	Paras.linkEmu = 0;
+	Paras.linkRate = 0;
+	Paras.linkDelay = 0;
+	Paras.linkJitter = 0;
+	Paras.linkLoss = 0;
+	Paras.linkBuffer = 4 * 1024 * 1024;
+	Paras.decompress = 0;
+	Paras.crc = 0;
+	Paras.streams = 1;
+	Paras.genTypeAmount = 0;
+	Paras.seed = 1;
+	Paras.adcBits = 12;
+	Paras.perf = 0;
+	Paras.tcpInfoFile = NULL;
+	Paras.continuous = 0;
+	Paras.workers = 0;
+	Paras.iface = (char*) "lo";
+	Paras.sharedListen = 0;
+	Paras.maxConns = 0;
+	Paras.backlog = 0;
+	Paras.deferAccept = 0;
+	Paras.accept4 = 0;
+	Paras.stormRate = 1000;
+	Paras.stormSize = 0;
+	Paras.topologyFile = NULL;
+	Paras.topologyHost = NULL;
+	Paras.benchRepeats = 0;
+	Paras.benchWarmup = 2;
+	Paras.benchBaseline = NULL;
+	Paras.benchSave = NULL;
+}
+
+// 0 when the command line is fine, 1 for "--help", -1 after printing what is wrong with it.
+// Options that are valid alone but not together, an option a mode would ignore is an error too.
+int parasConflicts() {
+	if (Paras.aggregate > 0 && (Paras.isServer || Paras.clientType != MultiConnMultiThreadL2Client)) {
+		printf("option -agg needs -c 4\n");
+		return -1;
+	}
+	if (Paras.compress && Paras.aggregate > 0) {
+		printf("option -compress does not work with -agg\n");
+		return -1;
+	}
+	if (Paras.compress && (Paras.isServer || (Paras.clientType != L2Client && Paras.clientType != MultiConnMultiThreadL2Client))) {
+		printf("option -compress needs -c 2 or -c 4\n");
+		return -1;
+	}
+	// Only the forwarders of -c 2 and -c 4 filter, the aggregating one multiplexes without parsing frames.
+	if (Paras.trigger && (Paras.isServer || (Paras.clientType != L2Client && Paras.clientType != MultiConnMultiThreadL2Client))) {
+		printf("option -trigger needs -c 2 or -c 4\n");
+		return -1;
+	}
+	if (Paras.trigger && Paras.aggregate > 0) {
+		printf("option -trigger does not work with -agg\n");
+		return -1;
+	}
+	if (Paras.linkEmu && (Paras.isServer || (Paras.clientType != L2Client && Paras.clientType != MultiConnMultiThreadL2Client))) {
+		printf("options -link* need -c 2 or -c 4\n");
+		return -1;
+	}
+	if (Paras.linkEmu && Paras.aggregate > 0) {
+		printf("options -link* do not work with -agg\n");
+		return -1;
+	}
+	if (!Paras.trigger && (Paras.triggerChannels != 1 || Paras.prescale != 0)) {
+		printf("options -trigchannels and -prescale need -trigger\n");
+		return -1;
+	}
+	// An L2 client forwards through one stage, the others would be dropped without a word.
+	if (Paras.compress + Paras.trigger + Paras.linkEmu > 1) {
+		printf("options -compress, -trigger and -link* do not work together\n");
+		return -1;
+	}
+	return 0;
+}
 
+int parasParse(int argc, char* argv[]) {
+	int port;
+	long n;
 	int i = 1;
 	for (i = 1; i < argc; i++) {
+		if (i == argc - 1 && !parasSwitch(argv[i])) {
+			printf("option %s is unknown or needs a value\n", argv[i]);
+			return -1;
+		}
+		// Every -c and -s value has a handler in main(), another one would run nothing.
 		if (strcmp(argv[i], "-c") == 0) {
+			if ((n = parasInt(argv[i], argv[i + 1], L1Client, UdpClient)) < 0) {
+				return -1;
+			}
 			Paras.isServer = 0;
+			Paras.clientType = n;
 			i++;
-			Paras.clientType = atoi(argv[i]);
 		}
 		else if (strcmp(argv[i], "-s") == 0) {
+			if ((n = parasInt(argv[i], argv[i + 1], DefaultServer, ForkServer)) < 0) {
+				return -1;
+			}
 			Paras.isServer = 1;
+			Paras.serverType = n;
 			i++;
-			Paras.serverType = atoi(argv[i]);
 		}
 		else if (strcmp(argv[i], "-a") == 0) {
 			i++;
 			Paras.servIP = argv[i];
 		}
 		else if (strcmp(argv[i], "-p") == 0) {
+			if ((port = parasPort(argv[i], argv[i + 1], 1)) < 0) {
+				return -1;
+			}
+			Paras.servPort = port;
 			i++;
-			Paras.servPort = atoi(argv[i]);
 		}
 		else if (strcmp(argv[i], "-P") == 0) {
+			if ((port = parasPort(argv[i], argv[i + 1], 1)) < 0) {
+				return -1;
+			}
+			Paras.prePort = port;
+			i++;
+		}
+		else if (strcmp(argv[i], "-m") == 0) {
+			if ((port = parasPort(argv[i], argv[i + 1], 0)) < 0) {
+				return -1;
+			}
+			Paras.metricsPort = port;
 			i++;
-			Paras.prePort = atoi(argv[i]);
 		}
 		else if (strcmp(argv[i], "-size") == 0) {
+			if ((n = parasInt(argv[i], argv[i + 1], 1, INT_MAX)) < 0) {
+				return -1;
+			}
+			Paras.pkgSize = n;
 			i++;
-			Paras.pkgSize = atoi(argv[i]);
 		}
 		else if (strcmp(argv[i], "-t") == 0) {
+			if ((n = parasInt(argv[i], argv[i + 1], 1, INT_MAX)) < 0) {
+				return -1;
+			}
+			Paras.interval = n;
+			i++;
+		}
+		else if (strcmp(argv[i], "-i") == 0) {
+			if ((n = parasInt(argv[i], argv[i + 1], 0, INT_MAX)) < 0) {
+				return -1;
+			}
+			Paras.reportInterval = n;
+			i++;
+		}
+		else if (strcmp(argv[i], "-frame") == 0) {
+			Paras.framed = 1;
+		}
+		else if (strcmp(argv[i], "-id") == 0) {
+			if ((n = parasInt(argv[i], argv[i + 1], 0, 65535)) < 0) {
+				return -1;
+			}
+			Paras.srcId = n;
+			i++;
+		}
+		else if (strcmp(argv[i], "-fanout") == 0) {
+			i++;
+			Paras.fanOut = argv[i];
+		}
+		else if (strcmp(argv[i], "-dist") == 0) {
+			i++;
+			if (strcmp(argv[i], "lq") == 0) {
+				Paras.distType = DistLeastQueued;
+			}
+			else if (strcmp(argv[i], "hash") == 0) {
+				Paras.distType = DistHash;
+			}
+			else if (strcmp(argv[i], "rr") == 0) {
+				Paras.distType = DistRoundRobin;
+			}
+			else {
+				printf("option -dist takes rr, lq or hash, not %s\n", argv[i]);
+				return -1;
+			}
+		}
+		else if (strcmp(argv[i], "-agg") == 0) {
+			if ((n = parasInt(argv[i], argv[i + 1], 1, AGGMAX)) < 0) {
+				return -1;
+			}
+			Paras.aggregate = n;
+			i++;
+		}
+		else if (strcmp(argv[i], "-demux") == 0) {
+			Paras.demux = 1;
+		}
+		else if (strcmp(argv[i], "-compress") == 0) {
+			Paras.compress = 1;
+		}
+		else if (strcmp(argv[i], "-monitor") == 0) {
+			if ((n = parasInt(argv[i], argv[i + 1], 0, INT_MAX)) < 0) {
+				return -1;
+			}
+			Paras.monitor = n;
+			i++;
+		}
+		else if (strcmp(argv[i], "-monitorfile") == 0) {
+			Paras.monitorFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "-trigger") == 0) {
+			char* end;
+			long threshold = strtol(argv[++i], &end, 10);
+			if (end == argv[i] || *end != '\0' || threshold < 0 || threshold > 65535) {
+				printf("option -trigger takes a threshold from 0 to 65535, not %s\n", argv[i]);
+				return -1;
+			}
+			Paras.triggerThreshold = threshold;
+			Paras.trigger = 1;
+			Paras.framed = 1; // Events are frames.
+		}
+		else if (strcmp(argv[i], "-trigchannels") == 0) {
+			if ((n = parasInt(argv[i], argv[i + 1], 1, INT_MAX)) < 0) {
+				return -1;
+			}
+			Paras.triggerChannels = n;
+			i++;
+		}
+		else if (strcmp(argv[i], "-prescale") == 0) {
+			if ((n = parasInt(argv[i], argv[i + 1], 0, INT_MAX)) < 0) {
+				return -1;
+			}
+			Paras.prescale = n;
+			i++;
+		}
+		else if (strcmp(argv[i], "-linkrate") == 0) {
+			if ((Paras.linkRate = parasReal(argv[i], argv[i + 1], 0, HUGE_VAL)) < 0) {
+				return -1;
+			}
+			Paras.linkEmu = 1;
+			i++;
+		}
+		else if (strcmp(argv[i], "-linkdelay") == 0) {
+			if ((Paras.linkDelay = parasReal(argv[i], argv[i + 1], 0, HUGE_VAL)) < 0) {
+				return -1;
+			}
+			Paras.linkEmu = 1;
+			i++;
+		}
+		else if (strcmp(argv[i], "-linkjitter") == 0) {
+			if ((Paras.linkJitter = parasReal(argv[i], argv[i + 1], 0, HUGE_VAL)) < 0) {
+				return -1;
+			}
+			Paras.linkEmu = 1;
+			i++;
+		}
+		else if (strcmp(argv[i], "-linkloss") == 0) {
+			// A loss of 1 would retransmit every block forever.
+			if ((Paras.linkLoss = parasReal(argv[i], argv[i + 1], 0, 1)) < 0) {
+				return -1;
+			}
+			Paras.linkEmu = 1;
+			i++;
+		}
+		else if (strcmp(argv[i], "-linkbuf") == 0) {
+			if ((n = parasInt(argv[i], argv[i + 1], 1, INT_MAX)) < 0) {
+				return -1;
+			}
+			Paras.linkBuffer = n;
+			Paras.linkEmu = 1;
+			i++;
+		}
+		else if (strcmp(argv[i], "-decompress") == 0) {
+			Paras.decompress = 1;
+		}
+		else if (strcmp(argv[i], "-streams") == 0) {
+			if ((n = parasInt(argv[i], argv[i + 1], 1, CLIENTMAXSTREAMS)) < 0) {
+				return -1;
+			}
+			Paras.streams = n;
+			i++;
+		}
+		else if (strcmp(argv[i], "-gen") == 0) {
+			i++;
+			char* name = strtok(argv[i], ",");
+			Paras.genTypeAmount = 0;
+			while (name != NULL && Paras.genTypeAmount < (int) sizeof(Paras.genTypes)) {
+				int type = genTypeParse(name);
+				if (type < 0) {
+					printf("option -gen takes pattern, random, adc, sparse or seq, not %s\n", name);
+					return -1;
+				}
+				Paras.genTypes[Paras.genTypeAmount++] = type;
+				name = strtok(NULL, ",");
+			}
+		}
+		else if (strcmp(argv[i], "-seed") == 0) {
+			i++;
+			char* end;
+			Paras.seed = strtoull(argv[i], &end, 10);
+			// strtoull() takes "-1" as the largest seed.
+			if (end == argv[i] || *end != '\0' || argv[i][0] == '-') {
+				printf("option -seed takes an unsigned integer, not %s\n", argv[i]);
+				return -1;
+			}
+		}
+		else if (strcmp(argv[i], "-adcbits") == 0) {
+			i++;
+			if (strcmp(argv[i], "12") != 0 && strcmp(argv[i], "14") != 0) {
+				printf("option -adcbits takes 12 or 14, not %s\n", argv[i]);
+				return -1;
+			}
+			Paras.adcBits = atoi(argv[i]);
+		}
+		else if (strcmp(argv[i], "-workers") == 0) {
+			if ((n = parasInt(argv[i], argv[i + 1], 0, FORKMAXWORKERS)) < 0) {
+				return -1;
+			}
+			Paras.workers = n;
 			i++;
-			Paras.interval = atoi(argv[i]);
+		}
+		else if (strcmp(argv[i], "-iface") == 0) {
+			Paras.iface = argv[++i];
+		}
+		else if (strcmp(argv[i], "-sharedlisten") == 0) {
+			Paras.sharedListen = 1;
+		}
+		else if (strcmp(argv[i], "-maxconns") == 0) {
+			if ((n = parasInt(argv[i], argv[i + 1], 0, INT_MAX)) < 0) {
+				return -1;
+			}
+			Paras.maxConns = n;
+			i++;
+		}
+		else if (strcmp(argv[i], "-backlog") == 0) {
+			if ((n = parasInt(argv[i], argv[i + 1], 0, INT_MAX)) < 0) {
+				return -1;
+			}
+			Paras.backlog = n;
+			i++;
+		}
+		else if (strcmp(argv[i], "-deferaccept") == 0) {
+			if ((n = parasInt(argv[i], argv[i + 1], 0, INT_MAX)) < 0) {
+				return -1;
+			}
+			Paras.deferAccept = n;
+			i++;
+		}
+		else if (strcmp(argv[i], "-accept4") == 0) {
+			Paras.accept4 = 1;
+		}
+		else if (strcmp(argv[i], "-storm") == 0) {
+			i++;
+			char* end;
+			Paras.stormRate = strtod(argv[i], &end);
+			if (*end != '\0' || !(Paras.stormRate > 0)) {
+				printf("option -storm takes connections per second above 0, not %s\n", argv[i]);
+				return -1;
+			}
+		}
+		else if (strcmp(argv[i], "-stormsize") == 0) {
+			if ((n = parasInt(argv[i], argv[i + 1], 0, INT_MAX)) < 0) {
+				return -1;
+			}
+			Paras.stormSize = n;
+			i++;
+		}
+		else if (strcmp(argv[i], "-continuous") == 0) {
+			Paras.continuous = 1;
+		}
+		else if (strcmp(argv[i], "-tcpinfo") == 0) {
+			Paras.tcpInfoFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "-perf") == 0) {
+			Paras.perf = 1;
+		}
+		else if (strcmp(argv[i], "-topology") == 0) {
+			Paras.topologyFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "-host") == 0) {
+			Paras.topologyHost = argv[++i];
+		}
+		else if (strcmp(argv[i], "-repeat") == 0) {
+			if ((n = parasInt(argv[i], argv[i + 1], 0, BENCHMAXREPEATS)) < 0) {
+				return -1;
+			}
+			Paras.benchRepeats = n;
+			i++;
+		}
+		else if (strcmp(argv[i], "-warmup") == 0) {
+			i++;
+			char* end;
+			Paras.benchWarmup = strtod(argv[i], &end);
+			if (end == argv[i] || *end != '\0' || !(Paras.benchWarmup >= 0)) {
+				printf("option -warmup takes seconds from 0 up, not %s\n", argv[i]);
+				return -1;
+			}
+		}
+		else if (strcmp(argv[i], "-baseline") == 0) {
+			Paras.benchBaseline = argv[++i];
+		}
+		else if (strcmp(argv[i], "-savebaseline") == 0) {
+			Paras.benchSave = argv[++i];
+		}
+		else if (strcmp(argv[i], "-crc") == 0) {
+			Paras.crc = 1;
+			Paras.framed = 1; // The CRC is a frame trailer.
 		}
 		else if (strcmp(argv[i], "--help") == 0) {
-			printUsage();
-			return 0;
+			return 1;
 		}
 		else {
+			printf("unknown option %s\n", argv[i]);
+			return -1;
+		}
+	}
+	return parasConflicts();
+}
+
+// ConnStats slots without -maxconns. The event loop server may hold as many connections as it may open fds, so it
+// tracks that many, up to CONNSTATSMAXAUTO; the thread and select modes stay far below MAXCONNSTATS.
+int connStatsSlots() {
+	struct rlimit rl;
+	int slots = MAXCONNSTATS;
+
+	if (Paras.isServer && Paras.serverType == EventLoopServer && getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur > (rlim_t) slots) {
+		slots = rl.rlim_cur < CONNSTATSMAXAUTO ? (int) rl.rlim_cur : CONNSTATSMAXAUTO;
+	}
+	return slots;
+}
+
+// Parse a stage command line of the topology launcher without keeping any of it.
+int parasCheck(int argc, char* argv[]) {
+	struct PARAS saved = Paras;
+	parasInit();
+	int ret = parasParse(argc, argv);
+	Paras = saved;
+	return ret != 0;
+}
 
+// Load the -topology file, start its stages of this host and report them all, "-repeat" times for a benchmark.
+int topologyLaunch() {
+	char host[256];
+	if (Paras.topologyHost == NULL) {
+		if (gethostname(host, sizeof(host)) < 0) {
+			dieWithError("topologyLaunch gethostname() failed");
 		}
+		host[sizeof(host) - 1] = '\0';
+		Paras.topologyHost = host;
+	}
+	Topology* topo = topologyLoad(Paras.topologyFile, Paras.topologyHost, parasCheck);
+	if (topo == NULL) {
+		return 1;
+	}
+	printf("host: %s\n", Paras.topologyHost);
+	topologyPrint(topo);
+	int failed;
+	if (Paras.benchRepeats > 0) {
+		// Regressions against the baseline fail the benchmark like failed stages fail a launch.
+		failed = benchRun(topo, Paras.benchRepeats, Paras.benchWarmup, Paras.benchBaseline, Paras.benchSave) != 0;
+	}
+	else {
+		failed = topologyRun(topo);
+	}
+	topologyRelease(topo);
+	return failed > 0 ? 1 : 0;
+}
+// ]
+
+int main(int argc, char* argv[]) {
+	timingInit();
+	parasInit();
+	int ret = parasParse(argc, argv);
+	if (ret != 0) {
+		printUsage();
+		return ret < 0 ? 1 : 0;
+	}
+	if (Paras.topologyFile != NULL) {
+		return topologyLaunch();
+	}
+
+	connStatsInit(Paras.maxConns > 0 ? Paras.maxConns : connStatsSlots());
+	printf("clock: %s", timingClockName());
+	if (timingClock.useTsc) {
+		printf(" (%.1lf MHz)", timingClock.tscHz * 1e-6);
+	}
+	printf("\n");
+	if (Paras.perf) {
+		perfCountEnable();
+	}
+	if (Paras.tcpInfoFile != NULL) {
+		tcpInfoDumpOpen(Paras.tcpInfoFile);
+	}
+	// The fork server has no connections of its own, it builds the interval report from the ShmStats of its workers.
+	// Sampling the sockets costs syscalls and /proc reads every 100 ms, done only when something reads the samples.
+	int sample = Paras.reportInterval > 0 || Paras.metricsPort > 0 || Paras.continuous || Paras.tcpInfoFile != NULL;
+	reportStart(Paras.isServer && Paras.serverType == ForkServer ? 0 : Paras.reportInterval, Paras.continuous, sample);
+	// After reportStart(), the metrics thread must leave SIGTERM to the signal thread of "-continuous" too.
+	if (Paras.metricsPort != 0) {
+		metricsStart(Paras.metricsPort);
 	}
+	if (Paras.isServer && Paras.monitor > 0) {
+		monitorStart(Paras.monitor, Paras.monitorFile, Paras.reportInterval > 0 ? Paras.reportInterval : 10, Paras.adcBits);
+	}
+	bufPoolNodeInit(RCVBUFSIZE, RCVPOOLAMOUNT);
 
 	if (Paras.isServer) {
 		if (Paras.serverType == DefaultServer) {
@@ -1455,6 +4573,18 @@ int main(int argc, char* argv[]) {
 		else if (Paras.serverType == MultiConnMultiThreadServer) {
 			multiConnMultiThreadServer();
 		}
+		else if (Paras.serverType == EventLoopServer) {
+			eventLoopServer();
+		}
+		else if (Paras.serverType == UdpServer) {
+			udpServer();
+		}
+		else if (Paras.serverType == PacketServer) {
+			packetServer();
+		}
+		else if (Paras.serverType == ForkServer) {
+			forkServer();
+		}
 	}
 	else {
 		if (Paras.clientType == L1Client) {
@@ -1469,6 +4599,15 @@ int main(int argc, char* argv[]) {
 		else if (Paras.clientType == MultiConnMultiThreadL2Client) {
 			multiConnMultiThreadL2Client();
 		}
+		else if (Paras.clientType == FanOutL2Client) {
+			fanOutL2Client();
+		}
+		else if (Paras.clientType == StormClient) {
+			stormClient();
+		}
+		else if (Paras.clientType == UdpClient) {
+			udpClient();
+		}
 	}
 
 	return 0;
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "latency.h"
+#include "dieWithError.h"
+
+void latencyInit(Latency* lat, unsigned long long int seed) {
+	memset(lat, 0, sizeof(Latency));
+	lat->samples = (unsigned long long int*) malloc(LATENCYSAMPLES * sizeof(unsigned long long int));
+	if (lat->samples == NULL) {
+		dieWithError("latencyInit malloc() failed");
+	}
+	lat->rng = seed * 0x9e3779b97f4a7c15ULL + 1;
+}
+
+void latencyRelease(Latency* lat) {
+	free(lat->samples);
+	lat->samples = NULL;
+}
+
+static unsigned long long int latencyRandom(Latency* lat) {
+	lat->rng ^= lat->rng >> 12;
+	lat->rng ^= lat->rng << 25;
+	lat->rng ^= lat->rng >> 27;
+	return lat->rng * 0x2545f4914f6cdd1dULL;
+}
+
+void latencyAdd(Latency* lat, unsigned long long int ns) {
+	lat->count++;
+	lat->sum += ns;
+	lat->max = ns > lat->max ? ns : lat->max;
+	if (lat->kept < LATENCYSAMPLES) {
+		lat->samples[lat->kept++] = ns;
+		return;
+	}
+	unsigned long long int slot = latencyRandom(lat) % lat->count;
+	if (slot < LATENCYSAMPLES) {
+		lat->samples[slot] = ns;
+	}
+}
+
+void latencyMerge(Latency* into, Latency* from) {
+	int i;
+
+	// Keep each sample of "from" with the share it stands for, so a busy thread weighs more than an idle one.
+	unsigned long long int total = into->count + from->count;
+	for (i = 0; i < from->kept; i++) {
+		if (into->kept < LATENCYSAMPLES) {
+			into->samples[into->kept++] = from->samples[i];
+		}
+		else if (latencyRandom(into) % total < from->count) {
+			into->samples[latencyRandom(into) % LATENCYSAMPLES] = from->samples[i];
+		}
+	}
+	into->count = total;
+	into->sum += from->sum;
+	into->max = from->max > into->max ? from->max : into->max;
+}
+
+static int latencyCompare(const void* a, const void* b) {
+	unsigned long long int x = *(const unsigned long long int*) a;
+	unsigned long long int y = *(const unsigned long long int*) b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+void latencyPrint(Latency* lat, const char* prefix, const char* name) {
+	static const double ranks[] = {0.5, 0.9, 0.99, 0.999};
+	static const char* rankNames[] = {"p50", "p90", "p99", "p99.9"};
+	int i;
+
+	if (lat->kept == 0) {
+		printf("%s%s: none\n", prefix, name);
+		return;
+	}
+	qsort(lat->samples, lat->kept, sizeof(unsigned long long int), latencyCompare);
+	printf("%s%s: %llu, mean %.3f ms", prefix, name, lat->count, lat->sum * 1e-6 / lat->count);
+	for (i = 0; i < 4; i++) {
+		int k = (int) (ranks[i] * (lat->kept - 1) + 0.5);
+		printf(", %s %.3f ms", rankNames[i], lat->samples[k] * 1e-6);
+	}
+	printf(", max %.3f ms\n", lat->max * 1e-6);
+}
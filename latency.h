@@ -0,0 +1,25 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#define LATENCYSAMPLES 65536 // Samples kept per recorder, later ones replace kept ones at random (reservoir sampling).
+
+// [ Latency
+// Bounded recorder of durations for percentiles. One recorder per thread, merged for the report.
+typedef struct latency {
+	unsigned long long int* samples; // ns.
+	int kept;
+	unsigned long long int count; // Durations recorded, kept or not.
+	unsigned long long int max;
+	unsigned long long int sum;
+	unsigned long long int rng;
+} Latency;
+
+void latencyInit(Latency* lat, unsigned long long int seed);
+void latencyRelease(Latency* lat);
+void latencyAdd(Latency* lat, unsigned long long int ns);
+void latencyMerge(Latency* into, Latency* from); // "from" is left unchanged.
+// One line: count, mean, p50, p90, p99, p99.9 and max in ms.
+void latencyPrint(Latency* lat, const char* prefix, const char* name);
+// ]
+
+#endif // LATENCY_H
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/socket.h>
+#include "linkEmu.h"
+
+static double linkEmuRandom(LinkEmu* le) {
+	// xorshift64*, uniform in [0, 1).
+	le->rng ^= le->rng >> 12;
+	le->rng ^= le->rng << 25;
+	le->rng ^= le->rng >> 27;
+	return ((le->rng * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+LinkEmu* linkEmuAlloc(double rateMbps, double delayMs, double jitterMs, double loss, size_t bufferBytes, unsigned long long int seed) {
+	LinkEmu* le = (LinkEmu*) calloc(1, sizeof(LinkEmu));
+	if (le == NULL) {
+		return NULL;
+	}
+	le->rate = rateMbps * 1e6;
+	le->delayNs = (unsigned long long int) (delayMs * 1e6);
+	le->jitterNs = (unsigned long long int) (jitterMs * 1e6);
+	le->loss = loss;
+	le->chunk = LINKEMUBLOCKSIZE;
+	if (le->rate > 0 && le->rate / 8 / 1000 < LINKEMUBLOCKSIZE) {
+		le->chunk = le->rate / 8 / 1000 > LINKEMUSEGMENT ? (size_t) (le->rate / 8 / 1000) : LINKEMUSEGMENT;
+	}
+	le->blockAmount = bufferBytes / le->chunk > 2 ? bufferBytes / le->chunk : 2;
+	le->rng = seed * 0x9e3779b97f4a7c15ULL + 1;
+
+	le->data = (char*) malloc((size_t) le->blockAmount * le->chunk);
+	le->block = (LinkEmuBlock*) calloc(le->blockAmount, sizeof(LinkEmuBlock));
+	le->slotHead = (int*) malloc(LINKEMUSLOTS * sizeof(int));
+	le->slotTail = (int*) malloc(LINKEMUSLOTS * sizeof(int));
+	le->slotUsed = (unsigned long long int*) calloc(LINKEMUSLOTS / 64, sizeof(unsigned long long int));
+	le->pending = (int*) malloc(le->blockAmount * sizeof(int));
+	if (le->data == NULL || le->block == NULL || le->slotHead == NULL || le->slotTail == NULL || le->slotUsed == NULL || le->pending == NULL) {
+		linkEmuRelease(le);
+		return NULL;
+	}
+	int i;
+	for (i = 0; i < LINKEMUSLOTS; i++) {
+		le->slotHead[i] = -1;
+		le->slotTail[i] = -1;
+	}
+	for (i = 0; i < le->blockAmount; i++) {
+		le->block[i].next = i + 1 < le->blockAmount ? i + 1 : -1;
+	}
+	le->freeHead = 0;
+	le->readyHead = -1;
+	le->readyTail = -1;
+	return le;
+}
+
+LinkShare* linkShareAlloc(size_t bufferBytes) {
+	LinkShare* ls = (LinkShare*) calloc(1, sizeof(LinkShare));
+	if (ls != NULL) {
+		pthread_mutex_init(&ls->lock, NULL);
+		ls->budget = bufferBytes;
+	}
+	return ls;
+}
+
+void linkEmuShare(LinkEmu* le, LinkShare* ls) {
+	le->share = ls;
+}
+
+void linkEmuRelease(LinkEmu* le) {
+	free(le->data);
+	free(le->block);
+	free(le->slotHead);
+	free(le->slotTail);
+	free(le->slotUsed);
+	free(le->pending);
+	free(le);
+}
+
+char* linkEmuRecvBuffer(LinkEmu* le, size_t* room) {
+	le->heldByShare = 0;
+	if (le->share != NULL) {
+		pthread_mutex_lock(&le->share->lock);
+		// An empty link always takes a block, even one larger than the whole buffer.
+		le->heldByShare = le->share->buffered > 0 && le->share->buffered + le->chunk > le->share->budget;
+		pthread_mutex_unlock(&le->share->lock);
+	}
+	if (le->freeHead < 0 || le->heldByShare) {
+		le->fullWaits++;
+		return NULL;
+	}
+	*room = le->chunk;
+	return le->data + (size_t) le->freeHead * le->chunk;
+}
+
+void linkEmuPush(LinkEmu* le, size_t len, unsigned long long int now) {
+	int b = le->freeHead;
+	LinkEmuBlock* block = &le->block[b];
+	le->freeHead = block->next;
+
+	// Serialization at the capped rate, then propagation.
+	if (le->share != NULL) {
+		pthread_mutex_lock(&le->share->lock);
+		le->linkFree = le->share->linkFree;
+	}
+	unsigned long long int start = le->linkFree > now ? le->linkFree : now;
+	le->linkFree = start + (le->rate > 0 ? (unsigned long long int) (len * 8 * 1e9 / le->rate) : 0);
+	if (le->share != NULL) {
+		le->share->linkFree = le->linkFree;
+		le->share->buffered += len;
+		if (le->share->buffered > le->share->peakBuffered) {
+			le->share->peakBuffered = le->share->buffered;
+		}
+		pthread_mutex_unlock(&le->share->lock);
+	}
+	long long int delay = (long long int) le->delayNs;
+	if (le->jitterNs > 0) {
+		delay += (long long int) ((linkEmuRandom(le) * 2 - 1) * le->jitterNs);
+		if (delay < 0) {
+			delay = 0;
+		}
+	}
+	unsigned long long int due = le->linkFree + delay;
+	if (le->loss > 0) {
+		unsigned long long int segments = (len + LINKEMUSEGMENT - 1) / LINKEMUSEGMENT;
+		le->segments += segments;
+		// One draw per block: the chance that any of its segments is lost.
+		if (linkEmuRandom(le) < 1 - pow(1 - le->loss, segments)) {
+			le->lost++;
+			due += 2 * le->delayNs > 1000000ULL ? 2 * le->delayNs : 1000000ULL;
+		}
+	}
+	if (due < le->lastDue) {
+		due = le->lastDue; // In order.
+	}
+	le->lastDue = due;
+
+	block->due = due;
+	block->len = len;
+	block->sent = 0;
+	block->next = -1;
+	unsigned long long int tick = due / LINKEMUTICKNS;
+	if (le->timers == 0 && le->readyHead < 0) {
+		le->tick = now / LINKEMUTICKNS; // Nothing pending, the wheel catches up at once.
+	}
+	if (tick < le->tick) {
+		tick = le->tick;
+	}
+	int slot = tick % LINKEMUSLOTS;
+	if (le->slotTail[slot] < 0) {
+		le->slotHead[slot] = b;
+		le->slotUsed[slot / 64] |= 1ULL << (slot % 64);
+	}
+	else {
+		le->block[le->slotTail[slot]].next = b;
+	}
+	le->slotTail[slot] = b;
+	le->pending[(le->pendingHead + le->timers) % le->blockAmount] = b;
+	le->timers++;
+
+	le->blocks++;
+	le->recvBytes += len;
+	le->buffered += len;
+	if (le->buffered > le->peakBuffered) {
+		le->peakBuffered = le->buffered;
+	}
+}
+
+// Next non-empty slot at or after "slot", -1 if none until the end of the wheel.
+static int linkEmuNextSlot(LinkEmu* le, int slot) {
+	int word = slot / 64;
+	unsigned long long int bits = le->slotUsed[word] & (~0ULL << (slot % 64));
+	while (bits == 0) {
+		if (++word == LINKEMUSLOTS / 64) {
+			return -1;
+		}
+		bits = le->slotUsed[word];
+	}
+	return word * 64 + __builtin_ctzll(bits);
+}
+
+// Move the blocks due by "now" from the wheel to the ready list.
+static void linkEmuExpire(LinkEmu* le, unsigned long long int now) {
+	unsigned long long int nowTick = now / LINKEMUTICKNS;
+	while (le->timers > 0 && le->tick <= nowTick) {
+		// Jump over empty slots, at most to the end of this turn.
+		int slot = le->tick % LINKEMUSLOTS;
+		int next = linkEmuNextSlot(le, slot);
+		if (next < 0) {
+			le->tick += LINKEMUSLOTS - slot;
+			continue;
+		}
+		le->tick += next - slot;
+		if (le->tick > nowTick) {
+			break;
+		}
+		slot = next;
+
+		// Blocks of later turns stay, blocks of this tick may not be due yet.
+		int prev = -1;
+		int b = le->slotHead[slot];
+		while (b >= 0) {
+			int after = le->block[b].next;
+			if (le->block[b].due <= now) {
+				if (prev < 0) {
+					le->slotHead[slot] = after;
+				}
+				else {
+					le->block[prev].next = after;
+				}
+				if (le->slotTail[slot] == b) {
+					le->slotTail[slot] = prev;
+				}
+				le->block[b].next = -1;
+				if (le->readyTail < 0) {
+					le->readyHead = b;
+				}
+				else {
+					le->block[le->readyTail].next = b;
+				}
+				le->readyTail = b;
+				le->timers--;
+				le->pendingHead = (le->pendingHead + 1) % le->blockAmount; // Due blocks leave in push order.
+			}
+			else {
+				prev = b;
+			}
+			b = after;
+		}
+		if (le->slotHead[slot] < 0) {
+			le->slotUsed[slot / 64] &= ~(1ULL << (slot % 64));
+		}
+		if (le->tick == nowTick) {
+			break; // Later blocks of this tick expire on the next call.
+		}
+		le->tick++;
+	}
+}
+
+long long int linkEmuWaitNs(LinkEmu* le, unsigned long long int now) {
+	linkEmuExpire(le, now);
+	if (le->readyHead >= 0) {
+		return 0;
+	}
+	if (le->timers == 0) {
+		return -1;
+	}
+	// The next non-empty slot may hold only blocks of a later turn when the buffer spans more than one turn, so the
+	// oldest block pushed is what is due first.
+	unsigned long long int due = le->block[le->pending[le->pendingHead]].due;
+	return due > now ? (long long int) (due - now) : 0;
+}
+
+ssize_t linkEmuSend(LinkEmu* le, int sock) {
+	ssize_t total = 0;
+	size_t freed = 0;
+	while (le->readyHead >= 0) {
+		int b = le->readyHead;
+		LinkEmuBlock* block = &le->block[b];
+		ssize_t ret = send(sock, le->data + (size_t) b * le->chunk + block->sent, block->len - block->sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			return -1;
+		}
+		total += ret;
+		block->sent += ret;
+		if (block->sent < block->len) {
+			break;
+		}
+		le->readyHead = block->next;
+		if (le->readyHead < 0) {
+			le->readyTail = -1;
+		}
+		block->next = le->freeHead;
+		le->freeHead = b;
+		le->buffered -= block->len;
+		freed += block->len;
+	}
+	if (le->share != NULL && freed > 0) {
+		pthread_mutex_lock(&le->share->lock);
+		le->share->buffered -= freed;
+		pthread_mutex_unlock(&le->share->lock);
+	}
+	le->sentBytes += total;
+	return total;
+}
+
+int linkEmuEmpty(LinkEmu* le) {
+	return le->timers == 0 && le->readyHead < 0;
+}
+
+void linkEmuPrint(LinkEmu* le, const char* prefix, double timeSpan) {
+	printf("%slink: rate %.1lf Mb/s, delay %.3lf ms, jitter %.3lf ms, loss %g, buffer %d x %zu Bytes\n", prefix, le->rate * 1e-6, le->delayNs * 1e-6, le->jitterNs * 1e-6, le->loss, le->blockAmount, le->chunk);
+	if (le->share != NULL) {
+		printf("%slink: shared, buffer %zu Bytes, peak buffered %zu Bytes\n", prefix, le->share->budget, le->share->peakBuffered);
+	}
+	printf("%slink: %llu Bytes in %llu blocks, %lf Mb/s, lost blocks %llu of %llu segments, peak buffered %zu Bytes, reads held back %llu\n", prefix, le->sentBytes, le->blocks, timeSpan > 0 ? le->sentBytes * 8 / (timeSpan * 1e6) : 0.0, le->lost, le->segments, le->peakBuffered, le->fullWaits);
+}
@@ -0,0 +1,99 @@
+#ifndef LINKEMU_H
+#define LINKEMU_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#define LINKEMUBLOCKSIZE (64*1024) // Data moves through the link in blocks of at most this size.
+#define LINKEMUTICKNS 10000 // Timer wheel resolution, 10 us.
+#define LINKEMUSLOTS 65536 // One turn of the wheel is 655 ms, later timers wait for their turn.
+#define LINKEMUSEGMENT 1448 // Loss is drawn per TCP segment of this size.
+#define LINKEMUSHAREPOLLNS 1000000 // A LinkEmu held back by its LinkShare tries again after this long.
+
+// [ LinkShare
+// One link under the LinkEmus of several connections: their blocks are serialized one after the other on one clock and
+// queue in one buffer, so N connections together get the rate and buffer of the link, not N times them. A LinkEmu checks
+// the buffer before it reads and fills it after, so the buffer may overshoot by one block per connection.
+typedef struct linkShare {
+	pthread_mutex_t lock;
+	unsigned long long int linkFree; // The link serializes earlier blocks of every LinkEmu until then.
+	size_t budget;
+	size_t buffered;
+	size_t peakBuffered;
+} LinkShare;
+
+LinkShare* linkShareAlloc(size_t bufferBytes); // NULL on failure.
+// ]
+
+// [ LinkEmu
+// Emulated link between two stages of one direction of a TCP stream: a bandwidth cap, a one-way delay with jitter and segment
+// loss. A block is serialized at the capped rate, then delivered after the delay. A stream cannot lose bytes, so a lost
+// segment costs what a fast retransmit costs, one more round trip (2 x delay, at least 1 ms), and every later block waits
+// behind it. Blocks are delivered in order, jitter never reorders them. The buffer is preallocated; when every block is in
+// flight the sender is not read any more, so "bufferBytes" is the bottleneck queue plus the bytes on the wire.
+typedef struct linkEmuBlock {
+	unsigned long long int due; // timingNowNs() of delivery.
+	size_t len;
+	size_t sent;
+	int next; // In the wheel slot, the ready list or the free list.
+} LinkEmuBlock;
+
+typedef struct linkEmu {
+	double rate; // Bits per second, 0 means no cap.
+	unsigned long long int delayNs;
+	unsigned long long int jitterNs;
+	double loss; // Probability per segment.
+	size_t chunk; // Bytes read per block, about 1 ms at the capped rate.
+
+	char* data;
+	LinkEmuBlock* block;
+	int blockAmount;
+	int freeHead;
+
+	int* slotHead;
+	int* slotTail;
+	unsigned long long int* slotUsed; // One bit per non-empty slot, to find the next timer without walking empty slots.
+	unsigned long long int tick; // Next tick to expire.
+	int timers; // Blocks in the wheel.
+	int* pending; // Ring of the blocks in the wheel in push order, which is due order, so the head is due first.
+	int pendingHead;
+	int readyHead; // Due blocks in order, the head may be partly sent.
+	int readyTail;
+
+	unsigned long long int linkFree; // The link serializes earlier blocks until then.
+	LinkShare* share; // NULL when the link is this LinkEmu's alone.
+	int heldByShare; // The last linkEmuRecvBuffer() found the shared buffer full.
+	unsigned long long int lastDue;
+	unsigned long long int rng;
+
+	unsigned long long int blocks;
+	unsigned long long int recvBytes;
+	unsigned long long int sentBytes;
+	unsigned long long int segments;
+	unsigned long long int lost;
+	unsigned long long int fullWaits; // Reads refused because every block was in flight.
+	size_t buffered;
+	size_t peakBuffered;
+} LinkEmu;
+
+// "rateMbps" 0 means no cap. NULL on failure.
+LinkEmu* linkEmuAlloc(double rateMbps, double delayMs, double jitterMs, double loss, size_t bufferBytes, unsigned long long int seed);
+void linkEmuRelease(LinkEmu* le);
+// Put "le" on the link of "ls" before the first linkEmuPush().
+void linkEmuShare(LinkEmu* le, LinkShare* ls);
+
+// Free block to read at most "*room" Bytes into, NULL when the buffer is full.
+char* linkEmuRecvBuffer(LinkEmu* le, size_t* room);
+// Schedule the "len" Bytes just read into the block of linkEmuRecvBuffer().
+void linkEmuPush(LinkEmu* le, size_t len, unsigned long long int now);
+// ns until the next block is due, 0 if data is ready to send, -1 if the link is empty.
+long long int linkEmuWaitNs(LinkEmu* le, unsigned long long int now);
+// Send ready data without blocking. Returns the Bytes sent, -1 on error other than EAGAIN.
+ssize_t linkEmuSend(LinkEmu* le, int sock);
+int linkEmuEmpty(LinkEmu* le);
+
+void linkEmuPrint(LinkEmu* le, const char* prefix, double timeSpan);
+// ]
+
+#endif // LINKEMU_H
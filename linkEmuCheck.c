@@ -0,0 +1,69 @@
+#include <stdio.h> // for printf().
+#include <stdlib.h> // for exit().
+#include <unistd.h> // for read().
+#include <sys/socket.h> // for socketpair().
+#include "linkEmu.h"
+
+// [ LinkEmuCheck
+// Drives a LinkEmu on a simulated clock, as linkForward() of idaq.c does on the real one: refill every free block, sleep
+// until linkEmuWaitNs(), send what is due. With a buffer that spans more than one wheel turn the wait must still be the
+// one of the oldest block, and the link must deliver its capped rate. "make check" runs it, it exits 1 on a failure.
+#define CHECKSECONDS 5
+
+static int checkLink(double rateMbps, size_t bufferBytes) {
+	LinkEmu* le = linkEmuAlloc(rateMbps, 0, 0, 0, bufferBytes, 1);
+	int sv[2];
+	char drain[64 * 1024];
+	unsigned long long int now = 0;
+	unsigned long long int endNs = CHECKSECONDS * 1000000000ULL;
+	unsigned long long int serializeNs;
+	long long int worstWait = 0;
+	int failures = 0;
+
+	if (le == NULL || socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		printf("linkEmuCheck setup failed\n");
+		exit(1);
+	}
+	serializeNs = (unsigned long long int) (le->chunk * 8 * 1e9 / le->rate);
+	while (now < endNs) {
+		size_t room;
+		while (linkEmuRecvBuffer(le, &room) != NULL) {
+			linkEmuPush(le, room, now);
+		}
+		long long int wait = linkEmuWaitNs(le, now);
+		// A full link sends a block every serializeNs, the wheel adds at most one tick.
+		if (wait < 0 || wait > (long long int) (serializeNs + LINKEMUTICKNS)) {
+			failures++;
+		}
+		worstWait = wait > worstWait ? wait : worstWait;
+		now += wait > 0 ? wait : 0;
+		if (linkEmuWaitNs(le, now) != 0) {
+			failures++;
+			now += serializeNs; // Go on, the rate check reports the loss.
+		}
+		if (linkEmuSend(le, sv[0]) < 0) {
+			printf("linkEmuCheck send() failed\n");
+			exit(1);
+		}
+		while (recv(sv[1], drain, sizeof(drain), MSG_DONTWAIT) > 0) {
+		}
+	}
+
+	double rate = le->sentBytes * 8 / (now * 1e-9) * 1e-6;
+	int ok = failures == 0 && rate >= rateMbps * 0.99;
+	printf("linkemu %.1lf Mb/s, buffer %zu Bytes (%.2lf wheel turns): %.3lf Mb/s, worst wait %.3lf ms, bad waits %d: %s\n", rateMbps, bufferBytes, bufferBytes * 8 / (rateMbps * 1e6) / (LINKEMUSLOTS * LINKEMUTICKNS * 1e-9), rate, worstWait * 1e-6, failures, ok ? "ok" : "FAILED");
+	linkEmuRelease(le);
+	close(sv[0]);
+	close(sv[1]);
+	return ok ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+	int failed = 0;
+
+	failed += checkLink(1000, 4 * 1024 * 1024); // Less than one turn.
+	failed += checkLink(10, 4 * 1024 * 1024); // About 5 turns.
+	failed += checkLink(1, 1024 * 1024); // About 13 turns.
+	return failed > 0 ? 1 : 0;
+}
+// ]
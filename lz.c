@@ -0,0 +1,275 @@
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "lz.h"
+#include "cpuUsage.h"
+
+#define LZHASHLOG 12
+#define LZMINMATCH 4
+#define LZLASTLITERALS 5 // The last 5 bytes are always literals.
+#define LZMFLIMIT 12 // No match starts in the last 12 bytes.
+#define LZMAXOFFSET 65535
+
+static inline uint32_t lzRead32(const char* p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline uint32_t lzHash(uint32_t v) {
+	return (v * 2654435761u) >> (32 - LZHASHLOG);
+}
+
+// Extended length bytes: 255, 255, ..., rest.
+static inline char* lzWriteLength(char* op, size_t len) {
+	while (len >= 255) {
+		*op++ = (char) 255;
+		len -= 255;
+	}
+	*op++ = (char) len;
+	return op;
+}
+
+int lzCompressBound(int srcSize) {
+	return srcSize + srcSize / 255 + 16;
+}
+
+int lzCompress(const char* src, int srcSize, char* dst, int dstCap) {
+	uint32_t table[1 << LZHASHLOG];
+	const char* ip = src;
+	const char* anchor = src;
+	const char* iend = src + srcSize;
+	const char* mflimit = iend - LZMFLIMIT;
+	const char* matchlimit = iend - LZLASTLITERALS;
+	char* op = dst;
+	char* oend = dst + dstCap;
+
+	memset(table, 0, sizeof(table));
+	if (srcSize >= LZMFLIMIT) {
+		ip++;
+		while (ip < mflimit) {
+			uint32_t seq = lzRead32(ip);
+			uint32_t h = lzHash(seq);
+			const char* ref = src + table[h];
+			table[h] = (uint32_t) (ip - src);
+
+			if (ref >= ip || ip - ref > LZMAXOFFSET || lzRead32(ref) != seq) {
+				ip += 1 + ((ip - anchor) >> 6); // Skip faster through data that does not compress.
+				continue;
+			}
+
+			// Extend the match backwards into the pending literals, then forwards.
+			while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+				ip--;
+				ref--;
+			}
+			const char* mp = ip + LZMINMATCH;
+			const char* rp = ref + LZMINMATCH;
+			while (mp < matchlimit && *mp == *rp) {
+				mp++;
+				rp++;
+			}
+
+			size_t litLen = ip - anchor;
+			size_t matchLen = mp - ip - LZMINMATCH;
+			if (op + 1 + litLen + litLen / 255 + 1 + 2 + matchLen / 255 + 1 > oend) {
+				return 0;
+			}
+
+			// Sequence: token, literals, offset, match length.
+			char* token = op++;
+			if (litLen >= 15) {
+				*token = (char) (15 << 4);
+				op = lzWriteLength(op, litLen - 15);
+			}
+			else {
+				*token = (char) (litLen << 4);
+			}
+			memcpy(op, anchor, litLen);
+			op += litLen;
+			size_t offset = ip - ref;
+			*op++ = (char) (offset & 0xff);
+			*op++ = (char) (offset >> 8);
+			if (matchLen >= 15) {
+				*token |= 15;
+				op = lzWriteLength(op, matchLen - 15);
+			}
+			else {
+				*token |= (char) matchLen;
+			}
+
+			ip = mp;
+			anchor = ip;
+			table[lzHash(lzRead32(ip - 2))] = (uint32_t) (ip - 2 - src);
+		}
+	}
+
+	// Last literals.
+	size_t litLen = iend - anchor;
+	if (op + 1 + litLen + litLen / 255 + 1 > oend) {
+		return 0;
+	}
+	char* token = op++;
+	if (litLen >= 15) {
+		*token = (char) (15 << 4);
+		op = lzWriteLength(op, litLen - 15);
+	}
+	else {
+		*token = (char) (litLen << 4);
+	}
+	memcpy(op, anchor, litLen);
+	op += litLen;
+
+	return (int) (op - dst);
+}
+
+int lzDecompress(const char* src, int srcSize, char* dst, int dstCap) {
+	const unsigned char* ip = (const unsigned char*) src;
+	const unsigned char* iend = ip + srcSize;
+	char* op = dst;
+	char* oend = dst + dstCap;
+	unsigned int b;
+
+	while (ip < iend) {
+		unsigned int token = *ip++;
+
+		size_t litLen = token >> 4;
+		if (litLen == 15) {
+			do {
+				if (ip >= iend) {
+					return -1;
+				}
+				b = *ip++;
+				litLen += b;
+			} while (b == 255);
+		}
+		if (litLen > (size_t) (iend - ip) || litLen > (size_t) (oend - op)) {
+			return -1;
+		}
+		memcpy(op, ip, litLen);
+		op += litLen;
+		ip += litLen;
+		if (ip >= iend) {
+			break; // The last sequence has literals only.
+		}
+
+		if (iend - ip < 2) {
+			return -1;
+		}
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t) (op - dst)) {
+			return -1;
+		}
+		size_t matchLen = token & 15;
+		if (matchLen == 15) {
+			do {
+				if (ip >= iend) {
+					return -1;
+				}
+				b = *ip++;
+				matchLen += b;
+			} while (b == 255);
+		}
+		matchLen += LZMINMATCH;
+		if (matchLen > (size_t) (oend - op)) {
+			return -1;
+		}
+
+		const char* ref = op - offset;
+		if (offset >= matchLen) {
+			memcpy(op, ref, matchLen);
+			op += matchLen;
+		}
+		else {
+			// Overlapping match repeats the last "offset" bytes.
+			while (matchLen-- > 0) {
+				*op++ = *ref++;
+			}
+		}
+	}
+
+	return (int) (op - dst);
+}
+
+size_t lzEncodeFrame(const char* raw, size_t rawSize, char* frame, uint16_t srcId, uint32_t seq) {
+	char* payload = frame + FRAMEHEADERSIZE;
+	int compSize = lzCompress(raw, (int) rawSize, payload + 4, (int) rawSize); // Only worth it if it shrinks.
+
+	if (compSize <= 0) {
+		memcpy(payload, raw, rawSize);
+		frameHeaderWrite(frame, srcId, FRAMEFLAGSTORED, seq, (uint32_t) rawSize);
+		return FRAMEHEADERSIZE + rawSize;
+	}
+	uint32_t rawSizeN = htonl((uint32_t) rawSize);
+	memcpy(payload, &rawSizeN, 4);
+	frameHeaderWrite(frame, srcId, FRAMEFLAGLZ, seq, (uint32_t) (4 + compSize));
+	return FRAMEHEADERSIZE + 4 + compSize;
+}
+
+static void lzDecodeFrame(void* ctx, const char* frame, size_t frameSize, const FrameHeader* hdr) {
+	LzDecoder* ld = (LzDecoder*) ctx;
+	const char* payload = frame + FRAMEHEADERSIZE;
+
+	ld->blocks++;
+	ld->wireBytes += frameSize;
+	if (!(hdr->flags & FRAMEFLAGLZ)) {
+		// Stored blocks and plain frames pass through as they are.
+		if (hdr->flags & FRAMEFLAGSTORED) {
+			ld->storedBlocks++;
+		}
+		else {
+			ld->plainFrames++;
+		}
+		ld->rawBytes += hdr->length;
+		if (ld->onRaw != NULL) {
+			ld->onRaw(ld->ctx, payload, hdr->length);
+		}
+		return;
+	}
+
+	uint32_t rawSize;
+	memcpy(&rawSize, payload, 4);
+	rawSize = ntohl(rawSize);
+	unsigned long long int t = threadCPUNs();
+	int n = (hdr->length >= 4 && rawSize <= LZBLOCKSIZE) ? lzDecompress(payload + 4, hdr->length - 4, ld->out, LZBLOCKSIZE) : -1;
+	ld->codecNs += threadCPUNs() - t;
+	if (n != (int) rawSize) {
+		ld->badBlocks++;
+		return;
+	}
+	ld->rawBytes += n;
+	if (ld->onRaw != NULL) {
+		ld->onRaw(ld->ctx, ld->out, n);
+	}
+}
+
+LzDecoder* lzDecoderAlloc(LzRawHandler onRaw, void* ctx) {
+	LzDecoder* ld;
+	if ((ld = (LzDecoder*) calloc(1, sizeof(LzDecoder))) != NULL) {
+		ld->fr = frameReaderAlloc();
+		ld->out = (char*) malloc(LZBLOCKSIZE);
+		if (ld->fr == NULL || ld->out == NULL) {
+			if (ld->fr != NULL) {
+				frameReaderRelease(ld->fr);
+			}
+			free(ld->out);
+			free(ld);
+			return NULL;
+		}
+		ld->onRaw = onRaw;
+		ld->ctx = ctx;
+	}
+
+	return ld;
+}
+
+void lzDecoderRelease(LzDecoder* ld) {
+	frameReaderRelease(ld->fr);
+	free(ld->out);
+	free(ld);
+}
+
+void lzDecoderFeed(LzDecoder* ld, const char* buf, size_t len) {
+	frameReaderFeed(ld->fr, buf, len, lzDecodeFrame, ld);
+}
@@ -0,0 +1,46 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "frame.h"
+
+// [ LZ block codec
+// Greedy LZ77 in the LZ4 block format: 4-byte hashed matches, 64 KiB window, no entropy stage. Fast enough to run at link speed.
+#define LZBLOCKSIZE (64*1024) // Raw bytes compressed as one block.
+
+int lzCompressBound(int srcSize);
+int lzCompress(const char* src, int srcSize, char* dst, int dstCap); // Return compressed size, 0 if it does not fit in dstCap.
+int lzDecompress(const char* src, int srcSize, char* dst, int dstCap); // Return raw size, -1 on malformed input.
+// ]
+
+// [ Compressed frames
+// Compressed blocks travel as frames: FrameHeader with FRAMEFLAGLZ, payload = raw size (4 bytes, network order) + LZ data.
+// A block that does not shrink goes out with FRAMEFLAGSTORED and its raw bytes as payload.
+#define LZFRAMEMAX (FRAMEHEADERSIZE + 4 + LZBLOCKSIZE + LZBLOCKSIZE / 255 + 16) // Largest frame lzEncodeFrame() writes.
+
+size_t lzEncodeFrame(const char* raw, size_t rawSize, char* frame, uint16_t srcId, uint32_t seq); // rawSize <= LZBLOCKSIZE.
+
+// Handler for the raw bytes coming out of an LzDecoder.
+typedef void (*LzRawHandler)(void* ctx, const char* data, size_t len);
+
+typedef struct lzDecoder {
+	FrameReader* fr;
+	char* out;
+	unsigned long long int blocks;
+	unsigned long long int storedBlocks;
+	unsigned long long int plainFrames; // Frames without FRAMEFLAGLZ or FRAMEFLAGSTORED, not from a compressing stage.
+	unsigned long long int badBlocks;
+	unsigned long long int wireBytes; // Frame bytes received.
+	unsigned long long int rawBytes; // Bytes after decompression.
+	unsigned long long int codecNs; // Thread CPU time spent decompressing.
+	LzRawHandler onRaw; // May be NULL.
+	void* ctx;
+} LzDecoder;
+
+LzDecoder* lzDecoderAlloc(LzRawHandler onRaw, void* ctx);
+void lzDecoderRelease(LzDecoder* ld);
+void lzDecoderFeed(LzDecoder* ld, const char* buf, size_t len);
+// ]
+
+#endif // LZ_H
@@ -0,0 +1,225 @@
+#include <stdio.h> // for printf().
+#include <stdlib.h> // for exit().
+#include <string.h> // for memcmp().
+#include <arpa/inet.h> // for htonl().
+#include "lz.h"
+#include "gen.h"
+
+// [ LzCheck
+// Round trips of the "-compress" codec on the data of every "-gen" generator, on empty, tiny and whole blocks, directly
+// and as frames fed to an LzDecoder in small pieces. Then malformed input: truncated and corrupted blocks and hand-made
+// bad sequences must come back as -1 or a short block, never as a write past the output buffer. "make check" runs it,
+// it exits 1 on a failure.
+#define CHECKGUARD 64 // Bytes after the output buffer that decompression must not touch.
+#define CHECKCORRUPTIONS 20000
+
+static char checkRaw[LZBLOCKSIZE];
+static char checkComp[LZBLOCKSIZE + LZBLOCKSIZE / 255 + 16];
+static char checkOut[LZBLOCKSIZE + CHECKGUARD];
+
+static int checkGuardIntact(int cap) {
+	int i;
+	for (i = cap; i < cap + CHECKGUARD; i++) {
+		if (checkOut[i] != 'g') {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Decompress "comp" into a buffer of "cap" Bytes followed by guard Bytes.
+static int checkDecompress(const char* comp, int compSize, int cap) {
+	memset(checkOut, 'g', cap + CHECKGUARD);
+	int n = lzDecompress(comp, compSize, checkOut, cap);
+	if (!checkGuardIntact(cap) || n < -1 || n > cap) {
+		return -2; // Wrote or claimed past the buffer.
+	}
+	return n;
+}
+
+// Compress and decompress "size" Bytes of checkRaw, with room to spare and with the exact room lzEncodeFrame() gives.
+static int checkRoundTrip(const char* name, int size) {
+	int compSize = lzCompress(checkRaw, size, checkComp, lzCompressBound(size));
+	if (compSize <= 0 || checkDecompress(checkComp, compSize, size) != size || memcmp(checkOut, checkRaw, size) != 0) {
+		printf("lz %s, %d Bytes: round trip failed, compressed to %d Bytes\n", name, size, compSize);
+		return 1;
+	}
+	// One Byte short of the output it needs.
+	if (size > 0 && checkDecompress(checkComp, compSize, size - 1) != -1) {
+		printf("lz %s, %d Bytes: decompressed into %d Bytes of room\n", name, size, size - 1);
+		return 1;
+	}
+	// A block that does not shrink may be refused, one that is accepted must still decode.
+	int tight = lzCompress(checkRaw, size, checkComp, size);
+	if (tight > 0 && (checkDecompress(checkComp, tight, size) != size || memcmp(checkOut, checkRaw, size) != 0)) {
+		printf("lz %s, %d Bytes: round trip failed without spare room\n", name, size);
+		return 1;
+	}
+	return 0;
+}
+
+static void checkFill(GenType type, int size, unsigned long long int seed, int adcBits) {
+	GenRing* gr = genRingAlloc(type, size, seed, adcBits);
+	if (gr == NULL) {
+		printf("lzCheck genRingAlloc() failed\n");
+		exit(1);
+	}
+	memcpy(checkRaw, gr->region, size);
+	genRingRelease(gr);
+}
+
+static int checkGenerators() {
+	static const int sizes[] = {1, 4, 5, 11, 12, 13, 16, 100, 255, 270, 4096, 65535, LZBLOCKSIZE};
+	static const GenType types[] = {GenPattern, GenRandom, GenAdc, GenSparse, GenSeq};
+	int failures = 0;
+	int cases = 0;
+	int t, s;
+
+	for (t = 0; t < (int) (sizeof(types) / sizeof(types[0])); t++) {
+		for (s = 0; s < (int) (sizeof(sizes) / sizeof(sizes[0])); s++) {
+			checkFill(types[t], sizes[s], 7 + s, 12);
+			failures += checkRoundTrip(genTypeName(types[t]), sizes[s]);
+			cases++;
+		}
+	}
+	checkFill(GenAdc, LZBLOCKSIZE, 3, 14);
+	failures += checkRoundTrip("adc 14 bit", LZBLOCKSIZE);
+	memset(checkRaw, 0, LZBLOCKSIZE); // One match as long as the block, many extra length Bytes.
+	failures += checkRoundTrip("zeros", LZBLOCKSIZE);
+	failures += checkRoundTrip("empty", 0);
+	cases += 3;
+	printf("lz round trips: %d cases, failures %d: %s\n", cases, failures, failures == 0 ? "ok" : "FAILED");
+	return failures > 0 ? 1 : 0;
+}
+
+typedef struct checkStream {
+	char* data;
+	size_t len;
+} CheckStream;
+
+static void checkCollect(void* ctx, const char* data, size_t len) {
+	CheckStream* cs = (CheckStream*) ctx;
+	memcpy(cs->data + cs->len, data, len);
+	cs->len += len;
+}
+
+// adc, random and empty blocks as lzEncodeFrame() frames, fed to an LzDecoder 7 Bytes at a time, then a frame whose raw
+// size is larger than a block.
+static int checkFrames() {
+	static const GenType types[] = {GenAdc, GenRandom, GenSparse};
+	static char wire[4 * LZFRAMEMAX];
+	static char raw[4 * LZBLOCKSIZE];
+	static char got[4 * LZBLOCKSIZE];
+	CheckStream cs = {got, 0};
+	size_t wireLen = 0;
+	size_t rawLen = 0;
+	size_t i;
+	int t;
+	int failures = 0;
+
+	for (t = 0; t < (int) (sizeof(types) / sizeof(types[0])); t++) {
+		checkFill(types[t], LZBLOCKSIZE, 11 + t, 12);
+		memcpy(raw + rawLen, checkRaw, LZBLOCKSIZE);
+		rawLen += LZBLOCKSIZE;
+		wireLen += lzEncodeFrame(checkRaw, LZBLOCKSIZE, wire + wireLen, 1, t);
+	}
+	wireLen += lzEncodeFrame(checkRaw, 0, wire + wireLen, 1, t);
+
+	LzDecoder* ld = lzDecoderAlloc(checkCollect, &cs);
+	if (ld == NULL) {
+		printf("lzCheck lzDecoderAlloc() failed\n");
+		exit(1);
+	}
+	for (i = 0; i < wireLen; i += 7) {
+		lzDecoderFeed(ld, wire + i, wireLen - i < 7 ? wireLen - i : 7);
+	}
+	if (cs.len != rawLen || memcmp(got, raw, rawLen) != 0 || ld->badBlocks != 0 || ld->storedBlocks < 1 || ld->blocks != 4) {
+		printf("lz frames: %zu of %zu Bytes, %llu blocks, %llu stored, %llu bad\n", cs.len, rawLen, ld->blocks, ld->storedBlocks, ld->badBlocks);
+		failures++;
+	}
+
+	// The raw size field claims more than LZBLOCKSIZE.
+	size_t frameLen = lzEncodeFrame(raw, LZBLOCKSIZE, wire, 1, 0);
+	uint32_t huge = htonl(LZBLOCKSIZE + 1);
+	memcpy(wire + FRAMEHEADERSIZE, &huge, 4);
+	size_t before = cs.len;
+	lzDecoderFeed(ld, wire, frameLen);
+	if (ld->badBlocks != 1 || cs.len != before) {
+		printf("lz frames: a block larger than LZBLOCKSIZE was not rejected\n");
+		failures++;
+	}
+	lzDecoderRelease(ld);
+	printf("lz frames: %zu Bytes in 7 Byte pieces, oversized block: %s\n", wireLen, failures == 0 ? "ok" : "FAILED");
+	return failures > 0 ? 1 : 0;
+}
+
+static int checkMalformed() {
+	// Sequences the compressor never writes. Each must be refused.
+	static const struct {
+		const char* name;
+		const char* data;
+		int len;
+		int cap;
+	} bad[] = {
+		{"offset 0", "\x40" "abcd" "\x00\x00", 7, LZBLOCKSIZE},
+		{"offset before the output", "\x40" "abcd" "\x05\x00", 7, LZBLOCKSIZE},
+		{"offset Byte missing", "\x40" "abcd" "\x01", 6, LZBLOCKSIZE},
+		{"literals past the input", "\x50" "abc", 4, LZBLOCKSIZE},
+		{"literals past the output", "\x40" "abcd", 5, 3},
+		{"literal length Bytes missing", "\xf0", 1, LZBLOCKSIZE},
+		{"literal length run past the input", "\xf0\xff\xff", 3, LZBLOCKSIZE},
+		{"match length Bytes missing", "\x1f" "a" "\x01\x00", 4, LZBLOCKSIZE},
+		{"match past the output", "\x1f" "a" "\x01\x00\xff\x00", 6, 100},
+	};
+	int failures = 0;
+	int i;
+
+	for (i = 0; i < (int) (sizeof(bad) / sizeof(bad[0])); i++) {
+		int n = checkDecompress(bad[i].data, bad[i].len, bad[i].cap);
+		if (n != -1) {
+			printf("lz malformed, %s: returned %d\n", bad[i].name, n);
+			failures++;
+		}
+	}
+
+	// Truncated and corrupted adc blocks may decode to something short, but never past the buffer.
+	checkFill(GenAdc, LZBLOCKSIZE, 5, 12);
+	int compSize = lzCompress(checkRaw, LZBLOCKSIZE, checkComp, sizeof(checkComp));
+	int truncated = 0;
+	for (i = 1; i < compSize; i++) {
+		int n = checkDecompress(checkComp, i, LZBLOCKSIZE);
+		if (n == -2 || n == LZBLOCKSIZE) {
+			truncated++;
+		}
+	}
+	int corrupted = 0;
+	unsigned long long int x = 88172645463325252ULL;
+	for (i = 0; i < CHECKCORRUPTIONS; i++) {
+		static char copy[sizeof(checkComp)];
+		memcpy(copy, checkComp, compSize);
+		int k;
+		for (k = 0; k < 1 + i % 4; k++) {
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			copy[x % compSize] ^= (char) (1 + (x >> 32) % 255);
+		}
+		// Half of them into a block much smaller than the data.
+		if (checkDecompress(copy, compSize, i % 2 ? LZBLOCKSIZE : 1000) == -2) {
+			corrupted++;
+		}
+	}
+	failures += truncated + corrupted;
+	printf("lz malformed: %d bad sequences, %d truncations (%d wrong), %d corruptions (%d past the buffer): %s\n", (int) (sizeof(bad) / sizeof(bad[0])), compSize - 1, truncated, CHECKCORRUPTIONS, corrupted, failures == 0 ? "ok" : "FAILED");
+	return failures > 0 ? 1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+	int failed = 0;
+
+	failed += checkGenerators();
+	failed += checkFrames();
+	failed += checkMalformed();
+	return failed > 0 ? 1 : 0;
+}
+// ]
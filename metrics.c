@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include "metrics.h"
+#include "connStats.h"
+#include "cpuUsage.h"
+#include "dieWithError.h"
+
+// [ MetricsBuf
+// Growing text buffer holding one HTTP response.
+typedef struct metricsBuf {
+	char* data;
+	size_t len;
+	size_t cap;
+} MetricsBuf;
+
+static void metricsPrintf(MetricsBuf* mb, const char* format, ...) {
+	va_list ap;
+	int n;
+
+	while (1) {
+		va_start(ap, format);
+		n = vsnprintf(mb->data + mb->len, mb->cap - mb->len, format, ap);
+		va_end(ap);
+		if (n < 0) {
+			return;
+		}
+		if (mb->len + n < mb->cap) {
+			mb->len += n;
+			return;
+		}
+		mb->cap = mb->cap * 2 + n;
+		if ((mb->data = (char*) realloc(mb->data, mb->cap)) == NULL) {
+			dieWithError("metrics realloc() failed");
+		}
+	}
+}
+// ]
+
+static void metricsHeader(MetricsBuf* mb, const char* name, const char* type, const char* help) {
+	metricsPrintf(mb, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void metricsRender(MetricsBuf* mb, ConnStats* snapshot, int n, ConnStatsTotals* totals) {
+	static char (*labels)[128] = NULL; // Too big for the stack with a large table, only this thread renders.
+	double ticks = (double) sysconf(_SC_CLK_TCK);
+	pid_t pid = getpid();
+	ProcPidStat pps;
+	int i;
+
+	if (labels == NULL) {
+		labels = malloc(connStatsMax * sizeof(*labels));
+		if (labels == NULL) {
+			dieWithError("metricsRender malloc() failed");
+		}
+	}
+
+	char ip[INET_ADDRSTRLEN];
+	for (i = 0; i < n; i++) {
+		inet_ntop(AF_INET, &snapshot[i].peerAddress.sin_addr, ip, sizeof(ip)); // inet_ntoa() is not thread safe.
+		snprintf(labels[i], sizeof(labels[i]), "role=\"%s\",conn=\"%d\",peer=\"%s:%d\",tid=\"%d\"", snapshot[i].role, snapshot[i].id, ip, ntohs(snapshot[i].peerAddress.sin_port), snapshot[i].tid);
+	}
+
+	metricsHeader(mb, "idaq_active_connections", "gauge", "Connections currently open.");
+	metricsPrintf(mb, "idaq_active_connections %d\n", totals->activeConnections);
+	metricsHeader(mb, "idaq_closed_connections_total", "counter", "Connections closed since start.");
+	metricsPrintf(mb, "idaq_closed_connections_total %llu\n", totals->closedConnections);
+	metricsHeader(mb, "idaq_received_bytes_total", "counter", "Bytes received by all connections.");
+	metricsPrintf(mb, "idaq_received_bytes_total %llu\n", totals->recvBytes);
+	metricsHeader(mb, "idaq_recv_calls_total", "counter", "recv() calls of all connections.");
+	metricsPrintf(mb, "idaq_recv_calls_total %llu\n", totals->recvCalls);
+	metricsHeader(mb, "idaq_sent_bytes_total", "counter", "Bytes sent by all connections.");
+	metricsPrintf(mb, "idaq_sent_bytes_total %llu\n", totals->sendBytes);
+	metricsHeader(mb, "idaq_send_calls_total", "counter", "send() calls of all connections.");
+	metricsPrintf(mb, "idaq_send_calls_total %llu\n", totals->sendCalls);
+
+	getProcessCPUStatus(&pps, pid);
+	metricsHeader(mb, "idaq_process_cpu_seconds_total", "counter", "CPU time of the idaq process.");
+	metricsPrintf(mb, "idaq_process_cpu_seconds_total %.2f\n", (double) (pps.utime + pps.stimev) / ticks + totals->cpuNs * 1e-9); // Fork workers included.
+
+	metricsHeader(mb, "idaq_connection_received_bytes_total", "counter", "Bytes received on the connection.");
+	for (i = 0; i < n; i++) {
+		metricsPrintf(mb, "idaq_connection_received_bytes_total{%s} %llu\n", labels[i], snapshot[i].recvBytes);
+	}
+	metricsHeader(mb, "idaq_connection_recv_calls_total", "counter", "recv() calls on the connection.");
+	for (i = 0; i < n; i++) {
+		metricsPrintf(mb, "idaq_connection_recv_calls_total{%s} %llu\n", labels[i], snapshot[i].recvCalls);
+	}
+	metricsHeader(mb, "idaq_connection_sent_bytes_total", "counter", "Bytes sent for the connection.");
+	for (i = 0; i < n; i++) {
+		metricsPrintf(mb, "idaq_connection_sent_bytes_total{%s} %llu\n", labels[i], snapshot[i].sendBytes);
+	}
+	metricsHeader(mb, "idaq_connection_send_calls_total", "counter", "send() calls for the connection.");
+	for (i = 0; i < n; i++) {
+		metricsPrintf(mb, "idaq_connection_send_calls_total{%s} %llu\n", labels[i], snapshot[i].sendCalls);
+	}
+	metricsHeader(mb, "idaq_connection_recv_wait_seconds_total", "counter", "Time spent in recv(), waiting for the previous hop.");
+	for (i = 0; i < n; i++) {
+		metricsPrintf(mb, "idaq_connection_recv_wait_seconds_total{%s} %.6f\n", labels[i], snapshot[i].recvWaitNs * 1e-9);
+	}
+	metricsHeader(mb, "idaq_connection_send_blocked_seconds_total", "counter", "Time spent in send(), blocked by the next hop.");
+	for (i = 0; i < n; i++) {
+		metricsPrintf(mb, "idaq_connection_send_blocked_seconds_total{%s} %.6f\n", labels[i], snapshot[i].sendBlockNs * 1e-9);
+	}
+	// The latest samples of the report thread, the sockets in "snapshot" may be closed by now.
+	metricsHeader(mb, "idaq_connection_socket_inq_bytes", "gauge", "Unread bytes in the receive queue (SIOCINQ).");
+	for (i = 0; i < n; i++) {
+		if (snapshot[i].recvSock >= 0) {
+			metricsPrintf(mb, "idaq_connection_socket_inq_bytes{%s} %d\n", labels[i], snapshot[i].inqLast);
+		}
+	}
+	metricsHeader(mb, "idaq_connection_socket_outq_bytes", "gauge", "Unsent bytes in the send queue (SIOCOUTQ).");
+	for (i = 0; i < n; i++) {
+		if (snapshot[i].sendSock >= 0) {
+			metricsPrintf(mb, "idaq_connection_socket_outq_bytes{%s} %d\n", labels[i], snapshot[i].outqLast);
+		}
+	}
+	metricsHeader(mb, "idaq_connection_thread_cpu_seconds_total", "counter", "CPU time of the thread handling the connection.");
+	for (i = 0; i < n; i++) {
+		if (tryGetThreadCPUStatus(&pps, pid, snapshot[i].tid) == 0) {
+			metricsPrintf(mb, "idaq_connection_thread_cpu_seconds_total{%s} %.2f\n", labels[i], (double) (pps.utime + pps.stimev) / ticks);
+		}
+	}
+}
+
+static void* threadMetrics(void* arg) {
+	int listenSock = *((int*) arg);
+	free(arg);
+
+	ConnStats* snapshot = (ConnStats*) malloc(connStatsMax * sizeof(ConnStats));
+	MetricsBuf body = {NULL, 0, 0};
+	MetricsBuf response = {NULL, 0, 0};
+	char request[2048];
+	struct timeval timeout;
+
+	if (snapshot == NULL) {
+		dieWithError("metrics malloc() failed");
+	}
+
+	while (1) {
+		int sock;
+		if ((sock = accept(listenSock, NULL, NULL)) < 0) {
+			continue;
+		}
+
+		// Do not let a stuck scraper hold the thread.
+		timeout.tv_sec = 1;
+		timeout.tv_usec = 0;
+		setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		recv(sock, request, sizeof(request), 0); // Any request gets the metrics.
+
+		ConnStatsTotals totals;
+		int n = connStatsSnapshot(snapshot, &totals);
+		body.len = 0;
+		metricsRender(&body, snapshot, n, &totals);
+
+		response.len = 0;
+		metricsPrintf(&response, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", body.len);
+		send(sock, response.data, response.len, MSG_NOSIGNAL);
+		size_t sent = 0;
+		while (sent < body.len) {
+			ssize_t ret = send(sock, body.data + sent, body.len - sent, MSG_NOSIGNAL);
+			if (ret <= 0) {
+				break;
+			}
+			sent += ret;
+		}
+		close(sock);
+	}
+
+	return ((void*) 0);
+}
+
+void metricsStart(unsigned short port) {
+	struct sockaddr_in addr;
+	int on = 1;
+	int* listenSock = (int*) malloc(sizeof(int));
+
+	if ((*listenSock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		dieWithError("metrics socket() failed");
+	}
+	if (setsockopt(*listenSock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int)) < 0) {
+		dieWithError("metrics setsockopt() failed");
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // Local scraping only.
+	addr.sin_port = htons(port);
+	if (bind(*listenSock, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+		dieWithError("metrics bind() failed");
+	}
+	if (listen(*listenSock, 4) < 0) {
+		dieWithError("metrics listen() failed");
+	}
+
+	pthread_t ntid;
+	if (pthread_create(&ntid, NULL, threadMetrics, listenSock) != 0) {
+		dieWithError("metrics pthread_create() failed");
+	}
+	pthread_detach(ntid);
+	printf("metrics on http://127.0.0.1:%d/metrics\n", port);
+}
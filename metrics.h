@@ -0,0 +1,8 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+// Start the metrics thread. It serves the live counters of "connStats.h" in Prometheus text format on "http://127.0.0.1:<port>/metrics".
+// The thread only reads the counters and the socket queues, it never touches the data path.
+void metricsStart(unsigned short port);
+
+#endif // METRICS_H
@@ -0,0 +1,418 @@
+#include <stdio.h> // for printf().
+#include <stdlib.h> // for atoi() and qsort().
+#include <string.h> // for memcpy() and strstr().
+#include <unistd.h> // for getpid() and sysconf().
+#include <sched.h> // for sched_yield().
+#include <pthread.h> // for pthread_create().
+#include <sys/time.h> // for gettimeofday().
+#include <sys/syscall.h> // for SYS_gettid and SYS_sched_setaffinity.
+#include "cpuUsage.h"
+#include "timing.h"
+#include "clntSockPool.h"
+#include "byteQueue.h"
+#include "bufPool.h"
+#include "blockQueue.h"
+#include "crc32c.h"
+#include "lz.h"
+#include "trigger.h"
+#include "gen.h"
+
+// [ MicroBench
+// ns/op and throughput of the building blocks of idaq, each one alone in a loop, without a network chain around it.
+// Every case is calibrated to run about "-ms" per repeat, then repeated "-repeat" times on a pinned CPU; the median
+// repeat is the result, min and max show how stable it was. "make bench" builds it with -O2 and runs every case, or
+// "./microBench.o [-cpu n] [-repeat n] [-ms n] [name ...]" runs the cases whose name contains one of the names.
+#define MICROBENCHMAXREPEATS 64
+#define MICROBENCHBUFSIZE (1024*1024) // As RCVBUFSIZE of idaq.c.
+#define MICROBENCHBLOCKSIZE (64*1024) // As LZBLOCKSIZE and the fan-out chunks.
+
+typedef struct microBenchCase {
+	const char* name;
+	size_t bytes; // Bytes one op handles, 0 for no throughput.
+	void (*run)(long long int n); // Do the op n times.
+} MicroBenchCase;
+
+static struct {
+	int cpu;
+	int cpu2; // Second thread of the handoff cases.
+	ProcStat ps;
+	ProcPidStat pps;
+	pid_t pid;
+	pid_t tid;
+	char* src;
+	char* dst;
+	char* adc; // MICROBENCHBLOCKSIZE of "adc" generator data.
+	char* lz; // "adc" compressed.
+	int lzSize;
+	ClntSockPool* cspool;
+	ByteQueue* bq;
+	BlockQueue* blq;
+	BufPool* bp;
+	volatile unsigned long long int sink; // Keeps results alive.
+} Micro;
+
+// A plain bit mask keeps this free of _GNU_SOURCE, as pinToCPU() of idaq.c.
+static void microPin(int cpu) {
+	unsigned long mask[16];
+
+	memset(mask, 0, sizeof(mask));
+	mask[cpu / (8 * sizeof(unsigned long))] |= 1UL << (cpu % (8 * sizeof(unsigned long)));
+	syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask);
+}
+
+// [ /proc parsers
+static void microProcStat(long long int n) {
+	long long int i;
+	for (i = 0; i < n; i++) {
+		getWholeCPUStatus(&Micro.ps);
+	}
+}
+
+static void microProcPidStat(long long int n) {
+	long long int i;
+	for (i = 0; i < n; i++) {
+		getProcessCPUStatus(&Micro.pps, Micro.pid);
+	}
+}
+
+static void microProcThreadStat(long long int n) {
+	long long int i;
+	for (i = 0; i < n; i++) {
+		getThreadCPUStatus(&Micro.pps, Micro.pid, Micro.tid);
+	}
+}
+
+static void microThreadCPUNs(long long int n) {
+	long long int i;
+	for (i = 0; i < n; i++) {
+		Micro.sink += threadCPUNs();
+	}
+}
+// ]
+
+// [ Clocks
+static void microTimingNow(long long int n) {
+	long long int i;
+	for (i = 0; i < n; i++) {
+		Micro.sink += timingNowNs();
+	}
+}
+
+static void microTimingRaw(long long int n) {
+	long long int i;
+	for (i = 0; i < n; i++) {
+		Micro.sink += timingRawNs();
+	}
+}
+
+// The time span of every role: a clock read, a subtraction and the scaling to seconds.
+static void microTimeSpan(long long int n) {
+	unsigned long long int t1 = timingNowNs();
+	double sum = 0;
+	long long int i;
+	for (i = 0; i < n; i++) {
+		sum += timingSince(t1);
+	}
+	Micro.sink += (unsigned long long int) sum;
+}
+
+// The same with gettimeofday() and timeval arithmetic, as idaq did before timing.h.
+static void microTimeSpanTimeval(long long int n) {
+	struct timeval t1;
+	struct timeval t2;
+	double sum = 0;
+	long long int i;
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < n; i++) {
+		gettimeofday(&t2, NULL);
+		sum += (t2.tv_sec - t1.tv_sec) + (t2.tv_usec - t1.tv_usec) / 1000000.0;
+	}
+	Micro.sink += (unsigned long long int) sum;
+}
+// ]
+
+// [ Connection handoff
+static void microSockPool(long long int n) {
+	long long int i;
+	for (i = 0; i < n; i++) {
+		clntSockPoolPush(Micro.cspool, (int) i);
+		Micro.sink += clntSockPoolPop(Micro.cspool);
+	}
+}
+
+static void* threadMicroSockPoolTake(void* arg) {
+	long long int n = *((long long int*) arg);
+	long long int i;
+	microPin(Micro.cpu2);
+	for (i = 0; i < n; i++) {
+		int sock;
+		while ((sock = clntSockPoolPop(Micro.cspool)) < 0) {
+			sched_yield();
+		}
+		Micro.sink += sock;
+	}
+	return ((void*) 0);
+}
+
+// Accepting thread to receiving thread through the pool, as the deprecated threadReceive().
+static void microSockPoolHandoff(long long int n) {
+	pthread_t ntid;
+	long long int i;
+	pthread_create(&ntid, NULL, threadMicroSockPoolTake, &n);
+	for (i = 0; i < n; i++) {
+		while (clntSockPoolPush(Micro.cspool, (int) i) < 0) {
+			sched_yield();
+		}
+	}
+	pthread_join(ntid, NULL);
+}
+
+static void* threadMicroConnection(void* arg) {
+	free(arg);
+	return ((void*) 0);
+}
+
+// A new thread per connection, as the multithread server and L2 client hand off every accepted socket.
+static void microThreadSpawn(long long int n) {
+	long long int i;
+	for (i = 0; i < n; i++) {
+		pthread_t ntid;
+		pthread_create(&ntid, NULL, threadMicroConnection, malloc(64));
+		pthread_join(ntid, NULL);
+	}
+}
+// ]
+
+// [ Buffer paths
+static void microMemcpy1M(long long int n) {
+	long long int i;
+	for (i = 0; i < n; i++) {
+		memcpy(Micro.dst, Micro.src, MICROBENCHBUFSIZE);
+		Micro.src[i & 4095]++;
+	}
+}
+
+static void microMemcpy64K(long long int n) {
+	long long int i;
+	for (i = 0; i < n; i++) {
+		memcpy(Micro.dst, Micro.src, MICROBENCHBLOCKSIZE);
+		Micro.src[i & 4095]++;
+	}
+}
+
+// One fan-out chunk in and out of a ByteQueue: the copy in, then the consumer's view of it.
+static void microByteQueue(long long int n) {
+	long long int i;
+	for (i = 0; i < n; i++) {
+		char* data;
+		size_t left = MICROBENCHBLOCKSIZE;
+		byteQueuePush(Micro.bq, Micro.src, MICROBENCHBLOCKSIZE);
+		while (left > 0) {
+			size_t len = byteQueuePeek(Micro.bq, &data);
+			Micro.sink += data[0];
+			byteQueuePop(Micro.bq, len);
+			left -= len;
+		}
+	}
+}
+
+static void microBlockQueue(long long int n) {
+	char* block;
+	size_t size;
+	long long int i;
+	for (i = 0; i < n; i++) {
+		blockQueuePush(Micro.blq, Micro.src, MICROBENCHBLOCKSIZE);
+		blockQueuePop(Micro.blq, &block, &size, 1);
+		Micro.sink += size;
+	}
+}
+
+static void microBufPool(long long int n) {
+	long long int i;
+	for (i = 0; i < n; i++) {
+		char* block = bufPoolGetCached(Micro.bp);
+		Micro.sink += (unsigned long long int) block;
+		bufPoolPutCached(Micro.bp, block);
+	}
+}
+// ]
+
+// [ Data kernels
+static void microCrc32c(long long int n) {
+	long long int i;
+	for (i = 0; i < n; i++) {
+		Micro.sink += crc32c(0, Micro.adc, MICROBENCHBLOCKSIZE);
+	}
+}
+
+// The samples of an 8 KiB frame.
+static void microTrigger(long long int n) {
+	long long int i;
+	for (i = 0; i < n; i++) {
+		Micro.sink += triggerCount(Micro.adc, 4088, 600);
+	}
+}
+
+static void microLzCompress(long long int n) {
+	long long int i;
+	for (i = 0; i < n; i++) {
+		Micro.sink += lzCompress(Micro.adc, MICROBENCHBLOCKSIZE, Micro.dst, MICROBENCHBUFSIZE);
+	}
+}
+
+static void microLzDecompress(long long int n) {
+	long long int i;
+	for (i = 0; i < n; i++) {
+		Micro.sink += lzDecompress(Micro.lz, Micro.lzSize, Micro.dst, MICROBENCHBUFSIZE);
+	}
+}
+// ]
+
+static MicroBenchCase microCases[] = {
+	{"procstat", 0, microProcStat},
+	{"procpidstat", 0, microProcPidStat},
+	{"procthreadstat", 0, microProcThreadStat},
+	{"threadcpuns", 0, microThreadCPUNs},
+	{"timingnow", 0, microTimingNow},
+	{"timingraw", 0, microTimingRaw},
+	{"timespan", 0, microTimeSpan},
+	{"timespantimeval", 0, microTimeSpanTimeval},
+	{"sockpool", 0, microSockPool},
+	{"sockpoolhandoff", 0, microSockPoolHandoff},
+	{"threadspawn", 0, microThreadSpawn},
+	{"memcpy1m", MICROBENCHBUFSIZE, microMemcpy1M},
+	{"memcpy64k", MICROBENCHBLOCKSIZE, microMemcpy64K},
+	{"bytequeue64k", MICROBENCHBLOCKSIZE, microByteQueue},
+	{"blockqueue", 0, microBlockQueue},
+	{"bufpool", 0, microBufPool},
+	{"crc32c64k", MICROBENCHBLOCKSIZE, microCrc32c},
+	{"trigger8k", 4088 * 2, microTrigger},
+	{"lzcompress64k", MICROBENCHBLOCKSIZE, microLzCompress},
+	{"lzdecompress64k", MICROBENCHBLOCKSIZE, microLzDecompress},
+	{NULL, 0, NULL}
+};
+
+static int microCompare(const void* a, const void* b) {
+	double x = *((const double*) a);
+	double y = *((const double*) b);
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static double microOnce(MicroBenchCase* mc, long long int n) {
+	unsigned long long int t1 = timingNowNs();
+	mc->run(n);
+	return (double) (timingNowNs() - t1);
+}
+
+static void microRun(MicroBenchCase* mc, int repeats, double targetNs) {
+	double nsPerOp[MICROBENCHMAXREPEATS];
+	long long int n = 1;
+	double ns;
+	int r;
+
+	// Double the ops until a run is long enough to scale from, this also warms caches and branch predictors.
+	while ((ns = microOnce(mc, n)) < targetNs / 10 && n < (1LL << 40)) {
+		n *= 2;
+	}
+	n = (long long int) (n * targetNs / (ns > 0 ? ns : 1));
+	n = n > 0 ? n : 1;
+	for (r = 0; r < repeats; r++) {
+		nsPerOp[r] = microOnce(mc, n) / n;
+	}
+	qsort(nsPerOp, repeats, sizeof(double), microCompare);
+	double median = repeats % 2 == 1 ? nsPerOp[repeats / 2] : (nsPerOp[repeats / 2 - 1] + nsPerOp[repeats / 2]) / 2;
+	printf("%-16s %12lld ops %12.1lf ns/op (min %.1lf, max %.1lf, spread %5.1lf%%)", mc->name, n, median, nsPerOp[0], nsPerOp[repeats - 1],
+			median > 0 ? (nsPerOp[repeats - 1] - nsPerOp[0]) * 100 / median : 0.0);
+	if (mc->bytes > 0) {
+		printf(" %10.1lf MB/s", mc->bytes * 1000.0 / median);
+	}
+	printf("\n");
+}
+
+int main(int argc, char* argv[]) {
+	int repeats = 7;
+	double ms = 100;
+	int named = 0;
+	int i;
+	int k;
+
+	timingInit();
+	Micro.cpu = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	Micro.cpu2 = -1;
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-cpu") == 0 && i + 1 < argc) {
+			Micro.cpu = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-cpu2") == 0 && i + 1 < argc) {
+			Micro.cpu2 = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-repeat") == 0 && i + 1 < argc) {
+			repeats = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-ms") == 0 && i + 1 < argc) {
+			ms = atof(argv[++i]);
+		}
+		else if (argv[i][0] == '-') {
+			printf("Usage: microBench.o [-cpu n] [-cpu2 n] [-repeat n] [-ms n] [name ...]\n");
+			return 1;
+		}
+		else {
+			named++;
+		}
+	}
+	repeats = repeats < 1 ? 1 : (repeats > MICROBENCHMAXREPEATS ? MICROBENCHMAXREPEATS : repeats);
+	if (Micro.cpu2 < 0) {
+		// Next to the first CPU, on a single CPU machine the handoff cases measure context switches.
+		Micro.cpu2 = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? (Micro.cpu == 0 ? 1 : Micro.cpu - 1) : Micro.cpu;
+	}
+	microPin(Micro.cpu);
+
+	// [Everything the cases touch is set up before any case runs.
+	Micro.pid = getpid();
+	Micro.tid = syscall(SYS_gettid);
+	Micro.src = (char*) malloc(MICROBENCHBUFSIZE);
+	Micro.dst = (char*) malloc(MICROBENCHBUFSIZE);
+	Micro.lz = (char*) malloc(lzCompressBound(MICROBENCHBLOCKSIZE));
+	memset(Micro.src, 's', MICROBENCHBUFSIZE);
+	memset(Micro.dst, 'd', MICROBENCHBUFSIZE);
+	GenRing* gr = genRingAlloc(GenAdc, MICROBENCHBLOCKSIZE, 1, 12);
+	Micro.adc = gr->region;
+	Micro.lzSize = lzCompress(Micro.adc, MICROBENCHBLOCKSIZE, Micro.lz, lzCompressBound(MICROBENCHBLOCKSIZE));
+	Micro.cspool = clntSockPoolAlloc();
+	Micro.bq = byteQueueAlloc(MICROBENCHBUFSIZE);
+	Micro.blq = blockQueueAlloc(32);
+	Micro.bp = bufPoolAlloc(MICROBENCHBUFSIZE, 8);
+	if (Micro.src == NULL || Micro.dst == NULL || Micro.lz == NULL || Micro.cspool == NULL || Micro.bq == NULL || Micro.blq == NULL || Micro.bp == NULL) {
+		printf("microBench: allocation failed\n");
+		return 1;
+	}
+	// ]
+
+	printf("microBench: cpu %d (handoff %d), %d repeats of %.0lf ms, clock %s, crc32c %s, trigger %s, adc compresses to %d of %d Bytes\n",
+			Micro.cpu, Micro.cpu2, repeats, ms, timingClockName(), crc32cImplName(), triggerKernelName(), Micro.lzSize, MICROBENCHBLOCKSIZE);
+	for (k = 0; microCases[k].name != NULL; k++) {
+		int run = named == 0;
+		for (i = 1; i < argc && !run; i++) {
+			if (argv[i][0] == '-') {
+				i++; // Skip the value.
+			}
+			else if (strstr(microCases[k].name, argv[i]) != NULL) {
+				run = 1;
+			}
+		}
+		if (run) {
+			microRun(&microCases[k], repeats, ms * 1e6);
+		}
+	}
+
+	genRingRelease(gr);
+	bufPoolRelease(Micro.bp);
+	blockQueueRelease(Micro.blq);
+	byteQueueRelease(Micro.bq);
+	clntSockPoolRelease(Micro.cspool);
+	free(Micro.lz);
+	free(Micro.dst);
+	free(Micro.src);
+	return 0;
+}
+// ]
@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <immintrin.h> // for _mm256_srli_epi16().
+#include "monitor.h"
+#include "timing.h"
+#include "cpuUsage.h"
+#include "dieWithError.h"
+
+#define MONITORSUBHISTS 4 // Consecutive samples go to different copies, so equal bins do not wait on each other's increments.
+#define MONITORSOURCES 65536
+
+typedef struct monitorState {
+	pthread_mutex_t lock; // Guards the ring list, taken only to add a ring and by the monitoring thread.
+	MonitorRing* rings;
+	pthread_key_t ringKey; // Marks the ring of a thread closed when the thread exits.
+	pid_t pid;
+	unsigned int every;
+	const char* path;
+	unsigned int dumpSeconds;
+	int shift; // Sample bits beyond the 12 of the amplitude bins.
+	uint16_t nextId;
+
+	unsigned long long int amp[MONITORSUBHISTS][MONITORAMPBINS];
+	unsigned long long int size[MONITORSIZEBINS];
+	unsigned long long int* source; // Sampled events per source.
+	unsigned long long int* prevSource; // At the last dump.
+	unsigned long long int sampled;
+	unsigned long long int samples;
+	unsigned long long int startNs;
+	unsigned long long int lastDumpNs;
+	unsigned long long int binNs; // Monitoring thread CPU time spent binning.
+} MonitorState;
+
+static MonitorState* monitorState = NULL;
+static __thread MonitorRing* monitorThreadRing = NULL;
+static void (*monitorBinImpl)(MonitorState* ms, const char* p, size_t n);
+
+// Ring Bytes of a slot holding "len" Bytes of event.
+static size_t monitorSlotStride(size_t len) {
+	return (sizeof(MonitorSlot) + len + MONITORSLOTALIGN - 1) / MONITORSLOTALIGN * MONITORSLOTALIGN;
+}
+
+static void monitorBinScalar(MonitorState* ms, const char* p, size_t n) {
+	size_t i;
+	for (i = 0; i < n; i++) {
+		uint16_t v;
+		memcpy(&v, p + 2 * i, 2);
+		v >>= ms->shift;
+		ms->amp[i % MONITORSUBHISTS][v < MONITORAMPBINS ? v : MONITORAMPBINS - 1]++;
+	}
+}
+
+// Bin indices of 16 samples at once, then one increment each spread over the sub-histograms.
+__attribute__((target("avx2")))
+static void monitorBinAvx2(MonitorState* ms, const char* p, size_t n) {
+	__m128i shift = _mm_cvtsi32_si128(ms->shift);
+	__m256i top = _mm256_set1_epi16(MONITORAMPBINS - 1);
+	uint16_t bins[16];
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) (p + 2 * i));
+		_mm256_storeu_si256((__m256i*) bins, _mm256_min_epu16(_mm256_srl_epi16(v, shift), top));
+		int j;
+		for (j = 0; j < 16; j += MONITORSUBHISTS) {
+			ms->amp[0][bins[j]]++;
+			ms->amp[1][bins[j + 1]]++;
+			ms->amp[2][bins[j + 2]]++;
+			ms->amp[3][bins[j + 3]]++;
+		}
+	}
+	monitorBinScalar(ms, p + 2 * i, n - i);
+}
+
+static void monitorEvent(MonitorState* ms, MonitorSlot* slot, const char* data) {
+	int bin = 0;
+	while (bin + 1 < MONITORSIZEBINS && (1ULL << (bin + 1)) <= slot->eventSize) {
+		bin++;
+	}
+	ms->size[bin]++;
+	ms->source[slot->srcId]++;
+	ms->sampled++;
+
+	const char* samples = data;
+	size_t len = slot->len;
+	if (slot->framed) {
+		FrameHeader hdr;
+		frameHeaderRead(data, &hdr);
+		if (hdr.flags & (FRAMEFLAGLZ | FRAMEFLAGSTORED)) {
+			return; // No samples to look at.
+		}
+		samples += FRAMEHEADERSIZE;
+		len -= FRAMEHEADERSIZE;
+	}
+	unsigned long long int t = threadCPUNs();
+	monitorBinImpl(ms, samples, len / 2);
+	ms->binNs += threadCPUNs() - t;
+	ms->samples += len / 2;
+}
+
+// Rewrite the dump file: a new file renamed over the old one, readers never see half a dump.
+static void monitorDump(MonitorState* ms) {
+	unsigned long long int now = timingNowNs();
+	double span = (now - ms->lastDumpNs) * 1e-9;
+	char tmp[4096];
+	int i;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", ms->path);
+	FILE* fd = fopen(tmp, "w");
+	if (fd == NULL) {
+		return;
+	}
+	fprintf(fd, "# idaq monitor, %.1lf s since start, 1 in %u events sampled, %llu sampled, %llu samples binned in %.3lf s (%.3lf ns/sample)\n", (now - ms->startNs) * 1e-9, ms->every, ms->sampled, ms->samples, ms->binNs * 1e-9, ms->samples > 0 ? (double) ms->binNs / ms->samples : 0.0);
+	fprintf(fd, "# amplitude: bin start, sampled samples\n");
+	for (i = 0; i < MONITORAMPBINS; i++) {
+		unsigned long long int count = ms->amp[0][i] + ms->amp[1][i] + ms->amp[2][i] + ms->amp[3][i];
+		if (count > 0) {
+			fprintf(fd, "amp %d %llu\n", i << ms->shift, count);
+		}
+	}
+	fprintf(fd, "# event size: Bytes from, sampled events\n");
+	for (i = 0; i < MONITORSIZEBINS; i++) {
+		if (ms->size[i] > 0) {
+			fprintf(fd, "size %llu %llu\n", 1ULL << i, ms->size[i]);
+		}
+	}
+	fprintf(fd, "# source: id, events, events/s since the last dump (sampled x %u)\n", ms->every);
+	for (i = 0; i < MONITORSOURCES; i++) {
+		if (ms->source[i] > 0) {
+			fprintf(fd, "source %d %llu %.1lf\n", i, ms->source[i] * ms->every, span > 0 ? (ms->source[i] - ms->prevSource[i]) * ms->every / span : 0.0);
+		}
+	}
+	fclose(fd);
+	rename(tmp, ms->path);
+	memcpy(ms->prevSource, ms->source, MONITORSOURCES * sizeof(unsigned long long int));
+	ms->lastDumpNs = now;
+}
+
+// Drain every ring, free the rings that are closed and empty, return the events drained. Called with the lock held.
+static unsigned int monitorDrain(MonitorState* ms) {
+	unsigned int events = 0;
+	MonitorRing** link = &ms->rings;
+	while (*link != NULL) {
+		MonitorRing* mr = *link;
+		int closed = __atomic_load_n(&mr->closed, __ATOMIC_ACQUIRE); // Before the last head.
+		unsigned long long int head = __atomic_load_n(&mr->head, __ATOMIC_ACQUIRE);
+		while (mr->tail != head) {
+			size_t pos = mr->tail % MONITORRINGSIZE;
+			MonitorSlot* slot = (MonitorSlot*) (mr->data + pos);
+			size_t stride = MONITORRINGSIZE - pos; // Padding up to the end of the ring.
+			if (slot->eventSize > 0) {
+				monitorEvent(ms, slot, mr->data + pos + sizeof(MonitorSlot));
+				stride = monitorSlotStride(slot->len);
+				events++;
+			}
+			__atomic_store_n(&mr->tail, mr->tail + stride, __ATOMIC_RELEASE);
+		}
+		if (closed) {
+			*link = mr->next;
+			free(mr->data);
+			free(mr);
+		}
+		else {
+			link = &mr->next;
+		}
+	}
+	return events;
+}
+
+// Thread exit: the monitoring thread frees the ring after its last samples.
+static void monitorRingClose(void* arg) {
+	MonitorRing* mr = (MonitorRing*) arg;
+	__atomic_store_n(&mr->closed, 1, __ATOMIC_RELEASE);
+}
+
+// Ring of the calling thread, made with its first sample.
+static MonitorRing* monitorRingOf(MonitorState* ms) {
+	if (monitorThreadRing == NULL) {
+		MonitorRing* mr = (MonitorRing*) calloc(1, sizeof(MonitorRing));
+		if (mr == NULL || (mr->data = (char*) malloc(MONITORRINGSIZE)) == NULL) {
+			dieWithError("monitorRingOf malloc() failed");
+		}
+		pthread_mutex_lock(&ms->lock);
+		mr->next = ms->rings;
+		ms->rings = mr;
+		pthread_mutex_unlock(&ms->lock);
+		pthread_setspecific(ms->ringKey, mr);
+		monitorThreadRing = mr;
+	}
+	return monitorThreadRing;
+}
+
+static void* threadMonitor(void* arg) {
+	MonitorState* ms = (MonitorState*) arg;
+	unsigned int events = 0;
+	while (1) {
+		if (events == 0) {
+			usleep(MONITORPOLLMS * 1000); // Rings that had samples are drained again at once.
+		}
+		pthread_mutex_lock(&ms->lock);
+		events = monitorDrain(ms);
+		if (timingNowNs() - ms->lastDumpNs >= ms->dumpSeconds * 1000000000ULL) {
+			monitorDump(ms);
+		}
+		pthread_mutex_unlock(&ms->lock);
+	}
+	return ((void*) 0);
+}
+
+// The last samples make it into the file however the process ends.
+static void monitorExit() {
+	if (monitorState != NULL && monitorState->pid == getpid()) {
+		pthread_mutex_lock(&monitorState->lock);
+		monitorDrain(monitorState);
+		monitorDump(monitorState);
+		pthread_mutex_unlock(&monitorState->lock);
+	}
+}
+
+void monitorStart(unsigned int every, const char* path, unsigned int dumpSeconds, int adcBits) {
+	MonitorState* ms = (MonitorState*) calloc(1, sizeof(MonitorState));
+	if (ms == NULL) {
+		dieWithError("monitorStart calloc() failed");
+	}
+	ms->source = (unsigned long long int*) calloc(MONITORSOURCES, sizeof(unsigned long long int));
+	ms->prevSource = (unsigned long long int*) calloc(MONITORSOURCES, sizeof(unsigned long long int));
+	if (ms->source == NULL || ms->prevSource == NULL || pthread_mutex_init(&ms->lock, NULL) != 0 || pthread_key_create(&ms->ringKey, monitorRingClose) != 0) {
+		dieWithError("monitorStart calloc() failed");
+	}
+	ms->pid = getpid();
+	ms->every = every > 0 ? every : 1;
+	ms->path = path;
+	ms->dumpSeconds = dumpSeconds > 0 ? dumpSeconds : 1;
+	ms->shift = adcBits > 12 ? adcBits - 12 : 0;
+	ms->startNs = timingNowNs();
+	ms->lastDumpNs = ms->startNs;
+	__builtin_cpu_init();
+	monitorBinImpl = __builtin_cpu_supports("avx2") ? monitorBinAvx2 : monitorBinScalar;
+	monitorState = ms;
+	atexit(monitorExit);
+
+	pthread_t ntid;
+	if (pthread_create(&ntid, NULL, threadMonitor, ms) != 0) {
+		dieWithError("monitorStart pthread_create() failed");
+	}
+	pthread_detach(ntid);
+}
+
+MonitorTap* monitorTapOpen(int framed) {
+	MonitorState* ms = monitorState;
+	if (ms == NULL || ms->pid != getpid()) {
+		return NULL; // Off, or a forked worker without the monitoring thread.
+	}
+	MonitorTap* mt = (MonitorTap*) calloc(1, sizeof(MonitorTap));
+	if (mt == NULL) {
+		dieWithError("monitorTapOpen calloc() failed");
+	}
+	if (framed && (mt->fr = frameReaderAlloc()) == NULL) {
+		dieWithError("monitorTapOpen frameReaderAlloc() failed");
+	}
+	mt->countdown = ms->every;
+
+	pthread_mutex_lock(&ms->lock);
+	mt->id = ms->nextId++;
+	pthread_mutex_unlock(&ms->lock);
+	return mt;
+}
+
+// Copy one event into the ring of the calling thread, or drop it if the ring is full.
+static void monitorTapSample(MonitorTap* mt, const char* event, size_t size, uint16_t srcId, int framed) {
+	MonitorRing* mr = monitorRingOf(monitorState);
+	size_t len = size < MONITORSLOTSIZE ? size : MONITORSLOTSIZE;
+	size_t stride = monitorSlotStride(len);
+	unsigned long long int head = mr->head;
+	size_t pos = head % MONITORRINGSIZE;
+	size_t pad = pos + stride > MONITORRINGSIZE ? MONITORRINGSIZE - pos : 0; // A slot never wraps around.
+	if (head + pad + stride - __atomic_load_n(&mr->tail, __ATOMIC_ACQUIRE) > MONITORRINGSIZE) {
+		mt->dropped++;
+		return;
+	}
+	if (pad > 0) {
+		((MonitorSlot*) (mr->data + pos))->eventSize = 0;
+		head += pad;
+		pos = 0;
+	}
+	MonitorSlot* slot = (MonitorSlot*) (mr->data + pos);
+	slot->len = len;
+	slot->eventSize = size;
+	slot->srcId = srcId;
+	slot->framed = framed;
+	memcpy(mr->data + pos + sizeof(MonitorSlot), event, len);
+	__atomic_store_n(&mr->head, head + stride, __ATOMIC_RELEASE);
+	mt->sampled++;
+}
+
+static void monitorTapFrame(void* ctx, const char* frame, size_t frameSize, const FrameHeader* hdr) {
+	MonitorTap* mt = (MonitorTap*) ctx;
+	mt->events++;
+	if (--mt->countdown == 0) {
+		mt->countdown = monitorState->every;
+		monitorTapSample(mt, frame, frameSize, hdr->srcId, 1);
+	}
+}
+
+void monitorTapFeed(MonitorTap* mt, const char* buf, size_t len) {
+	unsigned long long int t = timingNowNs();
+	if (mt->fr != NULL) {
+		frameReaderFeed(mt->fr, buf, len, monitorTapFrame, mt);
+	}
+	else {
+		mt->events++;
+		if (--mt->countdown == 0) {
+			mt->countdown = monitorState->every;
+			monitorTapSample(mt, buf, len, mt->id, 0);
+		}
+	}
+	mt->tapNs += timingNowNs() - t;
+}
+
+void monitorTapPrint(MonitorTap* mt, const char* prefix, double timeSpan) {
+	printf("%smonitor tap: events %llu, sampled %llu, dropped %llu (ring full), tap %.1lf ns/event, %.3lf%% of the time span\n", prefix, mt->events, mt->sampled, mt->dropped, mt->events > 0 ? (double) mt->tapNs / mt->events : 0.0, timeSpan > 0 ? mt->tapNs * 1e-7 / timeSpan : 0.0);
+}
+
+void monitorTapClose(MonitorTap* mt) {
+	if (mt->fr != NULL) {
+		frameReaderRelease(mt->fr);
+	}
+	free(mt); // Its samples are in the ring of the thread.
+}
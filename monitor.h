@@ -0,0 +1,56 @@
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "frame.h"
+
+#define MONITORRINGSIZE (4*1024*1024) // Bytes of sampled events waiting per receiving thread, more are dropped.
+#define MONITORSLOTSIZE (64*1024) // Sampled events are cut to this size (header included).
+#define MONITORSLOTALIGN 16 // Slots start at multiples of this in the ring.
+#define MONITORAMPBINS 4096 // Amplitude spectrum bins, 12 bit samples get one bin each.
+#define MONITORSIZEBINS 33 // Event size bins, log2.
+#define MONITORPOLLMS 10
+
+// [ Monitor
+// Online monitoring tap of the receivers. Every connection has a MonitorTap that copies 1 in N events into the
+// single producer single consumer ring of its receiving thread, never waiting: a full ring drops the sample. A slot
+// takes only the size of its event, so an event loop thread with thousands of connections still has one 4 MiB ring.
+// One monitoring thread drains every ring and fills the histograms (amplitude spectrum, event size, events per source)
+// and rewrites the dump file every "dumpSeconds". Events are frames when the stream is framed, recv() calls otherwise.
+typedef struct monitorSlot {
+	uint32_t len; // Bytes copied, the copy follows the slot.
+	uint32_t eventSize; // Bytes of the whole event, 0 for the padding up to the end of the ring.
+	uint16_t srcId;
+	uint16_t framed; // The copy starts with a FrameHeader.
+} MonitorSlot;
+
+typedef struct monitorRing {
+	unsigned long long int head __attribute__((aligned(64))); // Bytes written, by the receiving thread.
+	unsigned long long int tail __attribute__((aligned(64))); // Bytes read, by the monitoring thread.
+	char* data; // MONITORRINGSIZE Bytes of slots.
+	int closed; // The receiving thread is gone, the monitoring thread frees the ring once it is empty.
+	struct monitorRing* next;
+} MonitorRing;
+
+typedef struct monitorTap {
+	FrameReader* fr; // NULL for unframed streams.
+	uint16_t id; // Source id of unframed events.
+	unsigned int countdown;
+
+	unsigned long long int events;
+	unsigned long long int sampled;
+	unsigned long long int dropped;
+	unsigned long long int tapNs; // Time the receive thread spent in the tap.
+} MonitorTap;
+
+// Start the monitoring thread: sample 1 in "every" events, samples have "adcBits" significant bits.
+void monitorStart(unsigned int every, const char* path, unsigned int dumpSeconds, int adcBits);
+// NULL when monitoring is off in this process.
+MonitorTap* monitorTapOpen(int framed);
+void monitorTapFeed(MonitorTap* mt, const char* buf, size_t len);
+void monitorTapPrint(MonitorTap* mt, const char* prefix, double timeSpan);
+void monitorTapClose(MonitorTap* mt); // "mt" must not be used afterwards.
+// ]
+
+#endif // MONITOR_H
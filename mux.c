@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "mux.h"
+
+void muxHeaderWrite(char* dst, uint32_t streamId, uint32_t length) {
+	MuxHeader hdr;
+	hdr.streamId = htonl(streamId);
+	hdr.length = htonl(length);
+	memcpy(dst, &hdr, MUXHEADERSIZE);
+}
+
+MuxReader* muxReaderAlloc(MuxDataHandler onData, MuxEndHandler onEnd, void* ctx) {
+	MuxReader* mr;
+	if ((mr = (MuxReader*) calloc(1, sizeof(MuxReader))) != NULL) {
+		mr->onData = onData;
+		mr->onEnd = onEnd;
+		mr->ctx = ctx;
+	}
+
+	return mr;
+}
+
+void muxReaderRelease(MuxReader* mr) {
+	free(mr);
+}
+
+void muxReaderFeed(MuxReader* mr, const char* buf, size_t len) {
+	size_t n;
+
+	while (len > 0) {
+		if (mr->remaining == 0) {
+			// Collect the next header.
+			n = MUXHEADERSIZE - mr->headerSize;
+			n = n < len ? n : len;
+			memcpy(mr->header + mr->headerSize, buf, n);
+			mr->headerSize += n;
+			buf += n;
+			len -= n;
+			if (mr->headerSize < MUXHEADERSIZE) {
+				return;
+			}
+			mr->headerSize = 0;
+
+			MuxHeader hdr;
+			memcpy(&hdr, mr->header, MUXHEADERSIZE);
+			hdr.streamId = ntohl(hdr.streamId);
+			hdr.length = ntohl(hdr.length);
+
+			MuxStream* stream = &mr->streams[hdr.streamId % MUXMAXSTREAMS];
+			if (!stream->open || stream->streamId != hdr.streamId) {
+				memset(stream, 0, sizeof(MuxStream));
+				stream->open = 1;
+				stream->streamId = hdr.streamId;
+			}
+			mr->records++;
+			if (hdr.length == 0) {
+				mr->streamsEnded++;
+				if (mr->onEnd != NULL) {
+					mr->onEnd(mr->ctx, stream);
+				}
+				stream->open = 0;
+				continue;
+			}
+			stream->records++;
+			mr->current = stream;
+			mr->remaining = hdr.length;
+		}
+
+		n = mr->remaining < len ? mr->remaining : len;
+		mr->current->bytes += n;
+		if (mr->onData != NULL) {
+			mr->onData(mr->ctx, mr->current->streamId, buf, n);
+		}
+		mr->remaining -= n;
+		buf += n;
+		len -= n;
+	}
+}
@@ -0,0 +1,52 @@
+#ifndef MUX_H
+#define MUX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MUXHEADERSIZE 8 // sizeof(MuxHeader).
+#define MUXMAXSTREAMS 1024 // Streams a MuxReader tracks at the same time.
+
+// [ MuxHeader
+// The aggregating L2 client ("-agg") sends many upstream streams over one connection as records: MuxHeader then "length" bytes of the stream.
+// A record with length 0 ends the stream. Both fields are in network byte order on the wire.
+typedef struct muxHeader {
+	uint32_t streamId;
+	uint32_t length;
+} MuxHeader;
+
+void muxHeaderWrite(char* dst, uint32_t streamId, uint32_t length);
+// ]
+
+// [ MuxReader
+// Split a multiplexed connection back into streams and count each stream.
+typedef struct muxStream {
+	int open;
+	uint32_t streamId;
+	unsigned long long int records;
+	unsigned long long int bytes;
+} MuxStream;
+
+// "onData" gets the stream payload, possibly in several pieces per record. "onEnd" is called when a stream ends.
+typedef void (*MuxDataHandler)(void* ctx, uint32_t streamId, const char* data, size_t len);
+typedef void (*MuxEndHandler)(void* ctx, MuxStream* stream);
+
+typedef struct muxReader {
+	char header[MUXHEADERSIZE];
+	size_t headerSize; // Bytes of the next header received so far.
+	size_t remaining; // Payload bytes left in the current record.
+	MuxStream* current;
+	MuxStream streams[MUXMAXSTREAMS]; // Indexed by streamId % MUXMAXSTREAMS.
+	unsigned long long int records;
+	unsigned long long int streamsEnded;
+	MuxDataHandler onData; // May be NULL.
+	MuxEndHandler onEnd; // May be NULL.
+	void* ctx;
+} MuxReader;
+
+MuxReader* muxReaderAlloc(MuxDataHandler onData, MuxEndHandler onEnd, void* ctx);
+void muxReaderRelease(MuxReader* mr);
+void muxReaderFeed(MuxReader* mr, const char* buf, size_t len);
+// ]
+
+#endif // MUX_H
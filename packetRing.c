@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <net/if.h> // for if_nametoindex().
+#include <linux/if_ether.h> // for ETH_P_ALL.
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#include "packetRing.h"
+
+#ifndef PACKET_FANOUT_FLAG_IGNORE_OUTGOING
+#define PACKET_FANOUT_FLAG_IGNORE_OUTGOING 0x4000 // Linux 6.4.
+#endif
+
+// BPF program: IPv4, UDP, not a later fragment, destination port "port". The port is patched in by packetRingOpen().
+static const struct sock_filter packetRingFilter[] = {
+	{ 0x28, 0, 0, 12 }, // ldh [12], EtherType.
+	{ 0x15, 0, 8, ETH_P_IP }, // jeq IPv4, else drop.
+	{ 0x30, 0, 0, 23 }, // ldb [23], IP protocol.
+	{ 0x15, 0, 6, 17 }, // jeq UDP, else drop.
+	{ 0x28, 0, 0, 20 }, // ldh [20], flags and fragment offset.
+	{ 0x45, 4, 0, 0x1fff }, // jset fragment offset, drop.
+	{ 0xb1, 0, 0, 14 }, // ldxb 4*([14]&0xf), IP header length.
+	{ 0x48, 0, 0, 16 }, // ldh [x+16], UDP destination port.
+	{ 0x15, 0, 1, 0 }, // jeq port, else drop.
+	{ 0x06, 0, 0, 0x40000 }, // Accept.
+	{ 0x06, 0, 0, 0 } // Drop.
+};
+
+static int packetRingSetup(PacketRing* pr, const char* iface, unsigned short port, int fanoutGroup, int fanoutMode) {
+	int version = TPACKET_V3;
+	struct tpacket_req3 req;
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = PACKETRINGBLOCKSIZE;
+	req.tp_block_nr = PACKETRINGBLOCKAMOUNT;
+	req.tp_frame_size = PACKETRINGFRAMESIZE;
+	req.tp_frame_nr = PACKETRINGBLOCKSIZE / PACKETRINGFRAMESIZE * PACKETRINGBLOCKAMOUNT;
+	req.tp_retire_blk_tov = PACKETRINGRETIREMS;
+
+	struct sock_filter code[sizeof(packetRingFilter) / sizeof(packetRingFilter[0])];
+	struct sock_fprog prog;
+	memcpy(code, packetRingFilter, sizeof(code));
+	code[8].k = port;
+	prog.len = sizeof(code) / sizeof(code[0]);
+	prog.filter = code;
+
+	struct sockaddr_ll addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons(ETH_P_ALL);
+	addr.sll_ifindex = if_nametoindex(iface);
+	if (addr.sll_ifindex == 0) {
+		return -1;
+	}
+
+	int on = 1;
+	if (setsockopt(pr->sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0
+		|| setsockopt(pr->sock, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0
+		|| setsockopt(pr->sock, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		return -1;
+	}
+	// On loopback every datagram passes twice, leaving and arriving. Older kernels lack the option, packetRingRead() checks too.
+	setsockopt(pr->sock, SOL_PACKET, PACKET_IGNORE_OUTGOING, &on, sizeof(on));
+
+	pr->mapSize = (size_t) req.tp_block_size * req.tp_block_nr;
+	pr->map = (char*) mmap(NULL, pr->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, pr->sock, 0);
+	if (pr->map == MAP_FAILED) {
+		pr->map = (char*) mmap(NULL, pr->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, pr->sock, 0); // Over the memlock limit.
+	}
+	if (pr->map == MAP_FAILED) {
+		pr->map = NULL;
+		return -1;
+	}
+
+	// Bind after the ring is set up, so no packet arrives before there is room for it.
+	if (bind(pr->sock, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+		return -1;
+	}
+	if (fanoutGroup > 0) {
+		// The group demuxes before PACKET_IGNORE_OUTGOING of the members applies, so on loopback the group has to ignore them
+		// itself or "lb" hands every outgoing copy to one ring and every arriving one to the other. Older kernels refuse the flag.
+		int fanout = (fanoutGroup & 0xffff) | ((fanoutMode | PACKET_FANOUT_FLAG_IGNORE_OUTGOING) << 16);
+		if (setsockopt(pr->sock, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) < 0) {
+			fanout = (fanoutGroup & 0xffff) | (fanoutMode << 16);
+			if (setsockopt(pr->sock, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) < 0) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+PacketRing* packetRingOpen(const char* iface, unsigned short port, int fanoutGroup, int fanoutMode) {
+	PacketRing* pr = (PacketRing*) calloc(1, sizeof(PacketRing));
+	if (pr == NULL) {
+		return NULL;
+	}
+	if ((pr->sock = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) < 0) {
+		free(pr);
+		return NULL;
+	}
+	if (packetRingSetup(pr, iface, port, fanoutGroup, fanoutMode) < 0) {
+		int error = errno;
+		packetRingRelease(pr);
+		errno = error;
+		return NULL;
+	}
+	return pr;
+}
+
+void packetRingRelease(PacketRing* pr) {
+	if (pr->map != NULL) {
+		munmap(pr->map, pr->mapSize);
+	}
+	close(pr->sock);
+	free(pr);
+}
+
+int packetRingRead(PacketRing* pr, int timeoutMs, unsigned long long int* datagrams, unsigned long long int* bytes) {
+	int read = 0;
+	struct tpacket_block_desc* block = (struct tpacket_block_desc*) (pr->map + (size_t) pr->current * PACKETRINGBLOCKSIZE);
+
+	if ((block->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+		struct pollfd pfd;
+		pfd.fd = pr->sock;
+		pfd.events = POLLIN | POLLERR;
+		pfd.revents = 0;
+		poll(&pfd, 1, timeoutMs);
+	}
+
+	while (block->hdr.bh1.block_status & TP_STATUS_USER) {
+		unsigned int i;
+		struct tpacket3_hdr* frame = (struct tpacket3_hdr*) ((char*) block + block->hdr.bh1.offset_to_first_pkt);
+		for (i = 0; i < block->hdr.bh1.num_pkts; i++) {
+			struct sockaddr_ll* sll = (struct sockaddr_ll*) ((char*) frame + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+			if (sll->sll_pkttype != PACKET_OUTGOING) {
+				const unsigned char* ip = (const unsigned char*) frame + frame->tp_mac + 14; // The filter let only Ethernet IPv4 through.
+				const unsigned char* udp = ip + (ip[0] & 0xf) * 4;
+				unsigned int udpLen = (udp[4] << 8) | udp[5];
+				*bytes += udpLen >= 8 ? udpLen - 8 : 0;
+				(*datagrams)++;
+				read++;
+			}
+			frame = (struct tpacket3_hdr*) ((char*) frame + frame->tp_next_offset);
+		}
+
+		// Hand the block back and go on with the next one.
+		__atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		pr->current = (pr->current + 1) % PACKETRINGBLOCKAMOUNT;
+		block = (struct tpacket_block_desc*) (pr->map + (size_t) pr->current * PACKETRINGBLOCKSIZE);
+	}
+
+	return read;
+}
+
+void packetRingStats(PacketRing* pr, unsigned int* packets, unsigned int* drops) {
+	struct tpacket_stats_v3 stats;
+	socklen_t len = sizeof(stats);
+
+	memset(&stats, 0, sizeof(stats));
+	getsockopt(pr->sock, SOL_PACKET, PACKET_STATISTICS, &stats, &len); // Reading resets the counters.
+	*packets = stats.tp_packets;
+	*drops = stats.tp_drops;
+}
@@ -0,0 +1,33 @@
+#ifndef PACKETRING_H
+#define PACKETRING_H
+
+#include <stddef.h>
+
+#define PACKETRINGBLOCKSIZE (1024*1024) // One block is handed over to user space at a time.
+#define PACKETRINGBLOCKAMOUNT 64
+#define PACKETRINGFRAMESIZE 2048 // Only a hint for TPACKET_V3, which packs variable sized frames into a block.
+#define PACKETRINGRETIREMS 10 // A block not yet full is handed over after 10 ms.
+
+// [ PacketRing
+// TPACKET_V3 memory mapped receive ring of an AF_PACKET socket. The kernel fills whole blocks of frames and user space walks a
+// block at a time, so there is no syscall and no copy per datagram. A classic BPF filter keeps only IPv4 UDP datagrams to one port.
+typedef struct packetRing {
+	int sock;
+	char* map;
+	size_t mapSize;
+	unsigned int current; // Next block to read.
+} PacketRing;
+
+// Open a ring on "iface" for UDP destination port "port". With fanoutGroup > 0 the socket joins that fanout group, so the rings of
+// several threads share the traffic ("fanoutMode" is PACKET_FANOUT_HASH, PACKET_FANOUT_LB, ...). Returns NULL on failure with errno set.
+PacketRing* packetRingOpen(const char* iface, unsigned short port, int fanoutGroup, int fanoutMode);
+void packetRingRelease(PacketRing* pr);
+
+// Wait up to "timeoutMs" for a block, then walk every ready block. Adds the UDP payload bytes and datagrams read, returns the datagrams.
+int packetRingRead(PacketRing* pr, int timeoutMs, unsigned long long int* datagrams, unsigned long long int* bytes);
+
+// Packets the kernel passed to this socket and dropped because the ring was full, since the last call.
+void packetRingStats(PacketRing* pr, unsigned int* packets, unsigned int* drops);
+// ]
+
+#endif // PACKETRING_H
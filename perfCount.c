@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perfCount.h"
+
+enum {
+	PerfCycles = 0,
+	PerfInstructions,
+	PerfLlcMisses,
+	PerfBranchMisses,
+	PerfTaskClock,
+	PerfContextSwitches,
+	PerfPageFaults
+};
+
+typedef struct perfEvent {
+	const char* name;
+	unsigned int type;
+	unsigned long long int config;
+} PerfEvent;
+
+static const PerfEvent perfEvents[PERFCOUNTMAX] = {
+	{"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{"LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+	{"branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	{"task clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+	{"context switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+	{"page faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS}
+};
+
+static int perfCountEnabled = 0;
+
+void perfCountEnable() {
+	perfCountEnabled = 1;
+}
+
+static int perfEventOpen(const PerfEvent* ev, int inherit) {
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.inherit = inherit;
+	attr.size = sizeof(attr);
+	attr.type = ev->type;
+	attr.config = ev->config;
+	attr.disabled = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	// Hardware events count user space only, which perf_event_paranoid 2 allows
+	// without privileges. Context switches and faults happen in the kernel, so
+	// software events try to include it first.
+	if (ev->type == PERF_TYPE_SOFTWARE) {
+		int fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (fd >= 0) {
+			return fd;
+		}
+	}
+	attr.exclude_kernel = 1;
+	return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0); // This thread, any CPU.
+}
+
+static void perfCountOpen(PerfCount* pc, int inherit) {
+	int i;
+
+	memset(pc, 0, sizeof(PerfCount));
+	pc->active = perfCountEnabled;
+	for (i = 0; i < PERFCOUNTMAX; i++) {
+		pc->fds[i] = pc->active ? perfEventOpen(&perfEvents[i], inherit) : -1;
+	}
+	for (i = 0; i < PERFCOUNTMAX; i++) {
+		if (pc->fds[i] >= 0) {
+			ioctl(pc->fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(pc->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+}
+
+void perfCountStart(PerfCount* pc) {
+	perfCountOpen(pc, 0);
+}
+
+void perfCountStartInherit(PerfCount* pc) {
+	perfCountOpen(pc, 1);
+}
+
+void perfCountStop(PerfCount* pc) {
+	unsigned long long int buf[3]; // Value, time enabled, time running.
+	int i;
+
+	for (i = 0; i < PERFCOUNTMAX; i++) {
+		if (pc->fds[i] >= 0) {
+			ioctl(pc->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		}
+	}
+	for (i = 0; i < PERFCOUNTMAX; i++) {
+		if (pc->fds[i] < 0) {
+			continue;
+		}
+		if (read(pc->fds[i], buf, sizeof(buf)) == sizeof(buf)) {
+			pc->values[i] = (buf[2] > 0 && buf[2] < buf[1]) ? (unsigned long long int) ((double) buf[0] * buf[1] / buf[2]) : buf[0];
+		}
+		else {
+			close(pc->fds[i]);
+			pc->fds[i] = -1; // Shown as n/a.
+			continue;
+		}
+		close(pc->fds[i]);
+		pc->fds[i] = -2; // Closed, value valid.
+	}
+}
+
+static int perfCountHas(PerfCount* pc, int event) {
+	return pc->fds[event] == -2;
+}
+
+void perfCountPrint(PerfCount* pc, const char* prefix, unsigned long long int bytes, unsigned long long int calls) {
+	double perByte = bytes > 0 ? 1.0 / bytes : 0.0;
+	double perCall = calls > 0 ? 1.0 / calls : 0.0;
+
+	if (!pc->active) {
+		return;
+	}
+	if (perfCountHas(pc, PerfCycles) && perfCountHas(pc, PerfInstructions)) {
+		printf("%sperf cycles: %llu (%lf /Byte, %lf /call), instructions: %llu (%lf /Byte), IPC: %lf\n", prefix, pc->values[PerfCycles], pc->values[PerfCycles] * perByte, pc->values[PerfCycles] * perCall, pc->values[PerfInstructions], pc->values[PerfInstructions] * perByte, pc->values[PerfCycles] > 0 ? (double) pc->values[PerfInstructions] / pc->values[PerfCycles] : 0.0);
+	}
+	else {
+		printf("%sperf cycles, instructions: n/a (no hardware PMU access)\n", prefix);
+	}
+	if (perfCountHas(pc, PerfLlcMisses)) {
+		printf("%sperf LLC misses: %llu (%lf /KiB)\n", prefix, pc->values[PerfLlcMisses], pc->values[PerfLlcMisses] * perByte * 1024);
+	}
+	if (perfCountHas(pc, PerfBranchMisses)) {
+		printf("%sperf branch misses: %llu (%lf /call)\n", prefix, pc->values[PerfBranchMisses], pc->values[PerfBranchMisses] * perCall);
+	}
+	if (perfCountHas(pc, PerfTaskClock)) {
+		printf("%sperf task clock: %lf s (%lf ns/Byte)\n", prefix, pc->values[PerfTaskClock] * 1e-9, pc->values[PerfTaskClock] * perByte);
+	}
+	if (perfCountHas(pc, PerfContextSwitches) && perfCountHas(pc, PerfPageFaults)) {
+		printf("%sperf context switches: %llu (%lf /call), page faults: %llu (%lf /call)\n", prefix, pc->values[PerfContextSwitches], pc->values[PerfContextSwitches] * perCall, pc->values[PerfPageFaults], pc->values[PerfPageFaults] * perCall);
+	}
+	else {
+		printf("%sperf: n/a (perf_event_open() not permitted)\n", prefix);
+	}
+}
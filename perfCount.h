@@ -0,0 +1,24 @@
+#ifndef PERFCOUNT_H
+#define PERFCOUNT_H
+
+#define PERFCOUNTMAX 7 // Events of one PerfCount.
+
+// [ PerfCount
+// perf_event_open() counters of the calling thread, opened around the region a handler measures ("-perf").
+// Hardware events need a PMU the kernel lets us use; without one only the software events count.
+// Only user space is counted, which perf_event_paranoid 2 still allows.
+typedef struct perfCount {
+	int active;
+	int fds[PERFCOUNTMAX];
+	unsigned long long int values[PERFCOUNTMAX]; // Scaled by enabled/running time when the PMU was multiplexed.
+} PerfCount;
+
+void perfCountEnable(); // Without it Start and Print do nothing.
+void perfCountStart(PerfCount* pc);
+void perfCountStartInherit(PerfCount* pc); // Also counts the threads the calling thread creates after the start.
+void perfCountStop(PerfCount* pc);
+// Ratios next to throughput: per Byte for cycles, instructions and LLC misses, per call for the rest.
+void perfCountPrint(PerfCount* pc, const char* prefix, unsigned long long int bytes, unsigned long long int calls);
+// ]
+
+#endif // PERFCOUNT_H
@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include "report.h"
+#include "connStats.h"
+#include "cpuUsage.h"
+#include "dieWithError.h"
+
+// Cumulative totals at one moment, the rolling windows are differences of two of them.
+typedef struct rollSample {
+	unsigned long long int ns;
+	unsigned long long int recvBytes;
+	unsigned long long int sendBytes;
+	unsigned long long int cpuTicks; // utime + stime of the process.
+} RollSample;
+
+typedef struct reportState {
+	unsigned int interval;
+	int continuous;
+	int sample;
+	ConnStats* prev; // Snapshot of the last interval, indexed by slot id.
+	ConnStats* snapshot;
+	unsigned long long int lastNs;
+	ProcPidStat lastPps; // Process at the last interval, for the page faults in between.
+	unsigned long long int lastRecvBytes;
+	unsigned long long int lastSendBytes;
+
+	RollSample roll[REPORTROLLSLOTS]; // Ring, one sample a second.
+	unsigned long long int rollCount;
+} ReportState;
+
+static ReportState* reportState = NULL;
+static int reportStopRequested = 0;
+static int reportDumpRequested = 0;
+
+static void rollRecord(ReportState* rs) {
+	ConnStatsTotals totals;
+	ProcPidStat pps;
+	RollSample* r = &rs->roll[rs->rollCount % REPORTROLLSLOTS];
+
+	connStatsSnapshot(NULL, &totals);
+	r->ns = timingNowNs();
+	r->recvBytes = totals.recvBytes;
+	r->sendBytes = totals.sendBytes;
+	getProcessCPUStatus(&pps, getpid());
+	r->cpuTicks = pps.utime + pps.stimev + (unsigned long long int) (totals.cpuNs * 1e-9 * sysconf(_SC_CLK_TCK)); // Fork workers included.
+	rs->rollCount++;
+}
+
+static void rollPrint(ReportState* rs) {
+	static const int windows[] = {1, 10, 60};
+	double ticks = (double) sysconf(_SC_CLK_TCK);
+	int i;
+
+	if (rs->rollCount < 2) {
+		printf("rolling: less than 1 s recorded\n");
+		return;
+	}
+	RollSample* last = &rs->roll[(rs->rollCount - 1) % REPORTROLLSLOTS];
+	printf("rolling");
+	for (i = 0; i < 3; i++) {
+		unsigned long long int back = windows[i] < rs->rollCount - 1 ? windows[i] : rs->rollCount - 1; // Shorter while starting up.
+		RollSample* first = &rs->roll[(rs->rollCount - 1 - back) % REPORTROLLSLOTS];
+		double span = last->ns > first->ns ? (last->ns - first->ns) * 1e-9 : 1e-9;
+		printf("%s %ds: recv %.1f Mb/s, send %.1f Mb/s, CPU %.1f%%", i == 0 ? "" : " |", windows[i], (last->recvBytes - first->recvBytes) * 8e-6 / span, (last->sendBytes - first->sendBytes) * 8e-6 / span, (last->cpuTicks - first->cpuTicks) * 100.0 / ticks / span);
+	}
+	printf("\n");
+}
+
+static void reportInterval(ReportState* rs) {
+	ConnStatsTotals totals;
+	int n = connStatsSnapshot(rs->snapshot, &totals);
+	unsigned long long int now = timingNowNs();
+	double span = (now - rs->lastNs) * 1e-9;
+	double recvTotal = 0.0, sendTotal = 0.0;
+	char ip[INET_ADDRSTRLEN];
+	int i;
+
+	printf("==== interval %.1f s, active connections: %d ====\n", span, totals.activeConnections);
+	for (i = 0; i < n; i++) {
+		ConnStats* cur = &rs->snapshot[i];
+		ConnStats* prev = &rs->prev[cur->id];
+		ConnStats zero;
+		if (prev->openNs != cur->openNs) {
+			// New connection in this slot, count from its start.
+			memset(&zero, 0, sizeof(zero));
+			zero.openNs = cur->openNs;
+			prev = &zero;
+		}
+		unsigned long long int startNs = cur->openNs > rs->lastNs ? cur->openNs : rs->lastNs;
+		unsigned long long int elapsedNs = now > startNs ? now - startNs : 1;
+
+		// Interval deltas, fed to the same bottleneck rule as the summaries.
+		ConnStats delta = *cur;
+		delta.recvWaitNs -= prev->recvWaitNs;
+		delta.sendBlockNs -= prev->sendBlockNs;
+		delta.queueSamples -= prev->queueSamples;
+		delta.inqSum -= prev->inqSum;
+		delta.outqSum -= prev->outqSum;
+		delta.busySum -= prev->busySum;
+		delta.busySamples -= prev->busySamples;
+		double samples = delta.queueSamples > 0 ? (double) delta.queueSamples : 1.0;
+
+		double recvSpeed = (double) (cur->recvBytes - prev->recvBytes) * 8 / (elapsedNs * 1e-3);
+		double sendSpeed = (double) (cur->sendBytes - prev->sendBytes) * 8 / (elapsedNs * 1e-3);
+		recvTotal += recvSpeed;
+		sendTotal += sendSpeed;
+
+		// TCP state of the sending socket, where cwnd and retransmits mean something, else of the receiving one.
+		TcpInfoStats* tcp = cur->sendTcp.samples > 0 ? &cur->sendTcp : &cur->recvTcp;
+		TcpInfoStats* tcpPrev = cur->sendTcp.samples > 0 ? &prev->sendTcp : &prev->recvTcp;
+		unsigned int retrans = tcp->last.totalRetrans - (tcpPrev->samples > 0 ? tcpPrev->last.totalRetrans : tcp->first.totalRetrans);
+
+		inet_ntop(AF_INET, &cur->peerAddress.sin_addr, ip, sizeof(ip));
+		printf("conn %d %s %s:%d tid %d: recv %.1f Mb/s, send %.1f Mb/s, recv wait %.1f%%, send blocked %.1f%%, inq avg %.0f, outq avg %.0f, busy %.1f%%, bottleneck: %s", cur->id, cur->role, ip, ntohs(cur->peerAddress.sin_port), cur->tid, recvSpeed, sendSpeed, delta.recvWaitNs * 100.0 / elapsedNs, delta.sendBlockNs * 100.0 / elapsedNs, delta.inqSum / samples, delta.outqSum / samples, delta.busySamples > 0 ? delta.busySum * 100.0 / delta.busySamples : 0.0, connStatsBottleneck(&delta, elapsedNs));
+		if (tcp->samples > 0) {
+			printf(", rtt %.3f ms, cwnd %u, retrans %u, delivery %.1f Mb/s%s", tcp->last.rttUs * 1e-3, tcp->last.cwnd, retrans, tcp->last.deliveryRate * 8e-6, tcp->last.appLimited ? " (app-limited)" : "");
+		}
+		printf("\n");
+	}
+	printf("total: recv %.1f Mb/s, send %.1f Mb/s\n", recvTotal, sendTotal);
+	// Process wide, a growing thread count or rss between intervals is a leak.
+	ProcPidStat pps;
+	getProcessCPUStatus(&pps, getpid());
+	// Faults per GB received, per GB sent for senders that receive nothing.
+	unsigned long long int recvBytes = totals.recvBytes - rs->lastRecvBytes;
+	unsigned long long int sendBytes = totals.sendBytes - rs->lastSendBytes;
+	printMemoryStatus("process ", &rs->lastPps, &pps, recvBytes > 0 ? recvBytes : sendBytes);
+	rs->lastPps = pps;
+	rs->lastRecvBytes = totals.recvBytes;
+	rs->lastSendBytes = totals.sendBytes;
+	if (rs->continuous) {
+		rollPrint(rs);
+	}
+	printf("\n");
+	fflush(stdout);
+
+	memset(rs->prev, 0, connStatsMax * sizeof(ConnStats));
+	for (i = 0; i < n; i++) {
+		rs->prev[rs->snapshot[i].id] = rs->snapshot[i];
+	}
+	rs->lastNs = now;
+}
+
+static void* threadReport(void* arg) {
+	ReportState* rs = (ReportState*) arg;
+	unsigned long long int nextReport = timingNowNs() + rs->interval * 1000000000ULL;
+	unsigned long long int nextRoll = timingNowNs();
+
+	while (1) {
+		usleep(REPORTSAMPLEMS * 1000);
+		if (rs->sample) {
+			connStatsSampleQueues();
+		}
+		if (rs->continuous && timingNowNs() >= nextRoll) {
+			rollRecord(rs);
+			nextRoll += 1000000000ULL;
+		}
+		if (rs->interval > 0 && timingNowNs() >= nextReport) {
+			reportInterval(rs);
+			nextReport += rs->interval * 1000000000ULL;
+		}
+		if (__atomic_exchange_n(&reportDumpRequested, 0, __ATOMIC_RELAXED)) {
+			reportInterval(rs);
+		}
+	}
+
+	return ((void*) 0);
+}
+
+// Signals are blocked in every thread and taken here, so no recv() or select() ever sees EINTR.
+static void* threadSignal(void* arg) {
+	sigset_t* set = (sigset_t*) arg;
+	int sig;
+
+	while (1) {
+		if (sigwait(set, &sig) != 0) {
+			continue;
+		}
+		if (sig == SIGUSR1) {
+			__atomic_store_n(&reportDumpRequested, 1, __ATOMIC_RELAXED);
+		}
+		else if (sig == SIGTERM) {
+			if (__atomic_exchange_n(&reportStopRequested, 1, __ATOMIC_RELAXED)) {
+				printf("SIGTERM again, exit without draining\n");
+				exit(1);
+			}
+			printf("SIGTERM, draining\n");
+			fflush(stdout);
+		}
+	}
+
+	return ((void*) 0);
+}
+
+int reportStopping() {
+	return __atomic_load_n(&reportStopRequested, __ATOMIC_RELAXED);
+}
+
+void reportDrain(int* active) {
+	ConnStatsTotals totals;
+
+	while (1) {
+		int n;
+		if (active != NULL) {
+			n = __atomic_load_n(active, __ATOMIC_RELAXED);
+		}
+		else {
+			connStatsSnapshot(NULL, &totals);
+			n = totals.activeConnections;
+		}
+		if (n == 0) {
+			break;
+		}
+		usleep(REPORTSAMPLEMS * 1000);
+	}
+	if (reportState != NULL && reportState->continuous) {
+		rollRecord(reportState); // The report thread may not have run since the last connection closed.
+		rollPrint(reportState);
+	}
+}
+
+void reportStart(unsigned int interval, int continuous, int sample) {
+	ReportState* rs = (ReportState*) calloc(1, sizeof(ReportState));
+	if (rs == NULL) {
+		dieWithError("reportStart calloc() failed");
+	}
+	rs->interval = interval;
+	rs->continuous = continuous;
+	rs->sample = sample;
+	if (interval > 0 || continuous) {
+		rs->prev = (ConnStats*) calloc(connStatsMax, sizeof(ConnStats));
+		rs->snapshot = (ConnStats*) malloc(connStatsMax * sizeof(ConnStats));
+		if (rs->prev == NULL || rs->snapshot == NULL) {
+			dieWithError("reportStart calloc() failed");
+		}
+	}
+	rs->lastNs = timingNowNs();
+	getProcessCPUStatus(&rs->lastPps, getpid());
+	reportState = rs;
+
+	pthread_t ntid;
+	if (continuous) {
+		static sigset_t set;
+		sigemptyset(&set);
+		sigaddset(&set, SIGUSR1);
+		sigaddset(&set, SIGTERM);
+		if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0) {
+			dieWithError("reportStart pthread_sigmask() failed");
+		}
+		if (pthread_create(&ntid, NULL, threadSignal, &set) != 0) {
+			dieWithError("reportStart pthread_create() failed");
+		}
+		pthread_detach(ntid);
+	}
+	if (interval == 0 && !continuous && !sample) {
+		return; // Nothing for the report thread to do.
+	}
+	if (pthread_create(&ntid, NULL, threadReport, rs) != 0) {
+		dieWithError("reportStart pthread_create() failed");
+	}
+	pthread_detach(ntid);
+}
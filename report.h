@@ -0,0 +1,20 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#define REPORTSAMPLEMS 100 // Socket queues are sampled every 100 ms.
+#define REPORTROLLSLOTS 61 // Totals recorded once a second, enough for the 60 s window.
+
+// Start the report thread. With "sample" it samples the socket queues, TCP_INFO and thread CPU of every open connection,
+// which only the reports, the metrics and the TCP_INFO dump read. When "interval" is not 0 it prints an interval report
+// of every connection each "interval" seconds.
+// With "continuous" it also keeps rolling 1 s, 10 s and 60 s windows of throughput and CPU, prints a report on SIGUSR1
+// and starts a drain on SIGTERM. Call it before any other thread is created, so they all leave the signals to it.
+void reportStart(unsigned int interval, int continuous, int sample);
+
+// [ Continuous mode
+int reportStopping(); // SIGTERM was received: accept no more connections and drain. A second SIGTERM exits at once.
+// Wait until "*active" (open connections when NULL) drops to 0, then print the rolling windows.
+void reportDrain(int* active);
+// ]
+
+#endif // REPORT_H
@@ -0,0 +1,35 @@
+#include <stddef.h>
+#include <sys/mman.h>
+#include "shmStats.h"
+
+ShmStats* shmStatsAlloc(int slotAmount) {
+	size_t size = sizeof(ShmStats) + (size_t) slotAmount * sizeof(ShmStatsSlot);
+	ShmStats* ss = (ShmStats*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (ss == MAP_FAILED) {
+		return NULL;
+	}
+	ss->slotAmount = slotAmount; // The rest is zero already.
+	return ss;
+}
+
+void shmStatsRelease(ShmStats* ss) {
+	munmap(ss, sizeof(ShmStats) + (size_t) ss->slotAmount * sizeof(ShmStatsSlot));
+}
+
+void shmStatsRead(ShmStatsSlot* slot, ShmStatsSlot* copy) {
+	unsigned int seq1, seq2;
+	do {
+		seq1 = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		copy->pid = __atomic_load_n(&slot->pid, __ATOMIC_RELAXED);
+		copy->connections = __atomic_load_n(&slot->connections, __ATOMIC_RELAXED);
+		copy->active = __atomic_load_n(&slot->active, __ATOMIC_RELAXED);
+		copy->totalRecvMsgSize = __atomic_load_n(&slot->totalRecvMsgSize, __ATOMIC_RELAXED);
+		copy->recvCalls = __atomic_load_n(&slot->recvCalls, __ATOMIC_RELAXED);
+		copy->firstNs = __atomic_load_n(&slot->firstNs, __ATOMIC_RELAXED);
+		copy->lastNs = __atomic_load_n(&slot->lastNs, __ATOMIC_RELAXED);
+		copy->cpuNs = __atomic_load_n(&slot->cpuNs, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE); // The fields are read before seq is checked again.
+		seq2 = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+	} while ((seq1 & 1) != 0 || seq1 != seq2);
+	copy->seq = seq1;
+}
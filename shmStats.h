@@ -0,0 +1,49 @@
+#ifndef SHMSTATS_H
+#define SHMSTATS_H
+
+// [ ShmStats
+// Counters of worker processes in one shared memory segment, a 64 Byte slot per worker. Every slot is a seqlock: only its
+// worker writes it and never waits, readers retry while a write is in progress, so there is no lock shared between processes.
+typedef struct shmStatsSlot {
+	unsigned int seq; // Odd while the worker writes.
+	int pid;
+	unsigned long long int connections; // Accepted.
+	unsigned long long int active; // Open now.
+	unsigned long long int totalRecvMsgSize;
+	unsigned long long int recvCalls;
+	unsigned long long int firstNs; // First and last Byte received, timingNowNs().
+	unsigned long long int lastNs;
+	unsigned long long int cpuNs; // CPU time of the worker.
+} __attribute__((aligned(64))) ShmStatsSlot;
+
+typedef struct shmStats {
+	int slotAmount;
+	int stop; // Set by the parent: workers finish the connection at hand and exit.
+	ShmStatsSlot slot[];
+} ShmStats;
+
+// Anonymous shared mapping, made before fork() so every worker inherits it. NULL on failure.
+ShmStats* shmStatsAlloc(int slotAmount);
+void shmStatsRelease(ShmStats* ss);
+
+// Copy "values" (seq is ignored) into the slot of the calling worker.
+static inline void shmStatsPublish(ShmStatsSlot* slot, const ShmStatsSlot* values) {
+	unsigned int seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE); // The odd seq is visible before any field changes.
+	__atomic_store_n(&slot->pid, values->pid, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->connections, values->connections, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->active, values->active, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->totalRecvMsgSize, values->totalRecvMsgSize, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->recvCalls, values->recvCalls, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->firstNs, values->firstNs, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->lastNs, values->lastNs, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->cpuNs, values->cpuNs, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// A consistent copy of "slot", from any process.
+void shmStatsRead(ShmStatsSlot* slot, ShmStatsSlot* copy);
+// ]
+
+#endif // SHMSTATS_H
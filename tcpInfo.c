@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/tcp.h> // for struct tcp_info with the delivery and pacing rates.
+#include "tcpInfo.h"
+#include "dieWithError.h"
+
+static FILE* tcpInfoDumpFile = NULL;
+static pthread_mutex_t tcpInfoDumpLock = PTHREAD_MUTEX_INITIALIZER;
+
+int tcpInfoRead(int sock, unsigned int ms, TcpSample* s) {
+	struct tcp_info info;
+	socklen_t len = sizeof(info);
+
+	memset(&info, 0, sizeof(info));
+	if (sock < 0 || getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &len) < 0) {
+		return -1;
+	}
+	s->ms = ms;
+	s->rttUs = info.tcpi_rtt;
+	s->rttVarUs = info.tcpi_rttvar;
+	s->cwnd = info.tcpi_snd_cwnd;
+	s->totalRetrans = info.tcpi_total_retrans;
+	s->appLimited = info.tcpi_delivery_rate_app_limited;
+	s->deliveryRate = info.tcpi_delivery_rate; // Zero on kernels older than the field.
+	s->pacingRate = info.tcpi_pacing_rate;
+	return 0;
+}
+
+void tcpInfoAdd(TcpInfoStats* ts, const TcpSample* s) {
+	if (ts->samples == 0) {
+		ts->first = *s;
+		ts->rttMinUs = s->rttUs;
+		ts->rttMaxUs = s->rttUs;
+		ts->cwndMin = s->cwnd;
+		ts->cwndMax = s->cwnd;
+	}
+	ts->last = *s;
+	ts->samples++;
+	ts->rttSumUs += s->rttUs;
+	ts->rttMinUs = s->rttUs < ts->rttMinUs ? s->rttUs : ts->rttMinUs;
+	ts->rttMaxUs = s->rttUs > ts->rttMaxUs ? s->rttUs : ts->rttMaxUs;
+	ts->cwndMin = s->cwnd < ts->cwndMin ? s->cwnd : ts->cwndMin;
+	ts->cwndMax = s->cwnd > ts->cwndMax ? s->cwnd : ts->cwndMax;
+	ts->appLimitedSamples += s->appLimited;
+
+	TcpSeries* series = ts->series;
+	if (series == NULL) {
+		return;
+	}
+	if (series->readings++ % series->stride != 0) {
+		return;
+	}
+	if (series->count == TCPINFOSERIESMAX) {
+		int i;
+		for (i = 0; i < TCPINFOSERIESMAX / 2; i++) {
+			series->samples[i] = series->samples[i * 2];
+		}
+		series->count = TCPINFOSERIESMAX / 2;
+		series->stride *= 2;
+		if ((series->readings - 1) % series->stride != 0) {
+			return;
+		}
+	}
+	series->samples[series->count++] = *s;
+}
+
+void tcpInfoPrint(TcpInfoStats* ts, const char* prefix, const char* dir) {
+	if (ts->samples == 0) {
+		return;
+	}
+	printf("%stcp %s: rtt avg %.3f ms (min %.3f, max %.3f), rttvar %.3f ms, cwnd %u (min %u, max %u), retrans %u, delivery %.1f Mb/s, pacing %.1f Mb/s, app-limited %.1f%%\n",
+		prefix, dir, ts->rttSumUs * 1e-3 / ts->samples, ts->rttMinUs * 1e-3, ts->rttMaxUs * 1e-3, ts->last.rttVarUs * 1e-3,
+		ts->last.cwnd, ts->cwndMin, ts->cwndMax, ts->last.totalRetrans - ts->first.totalRetrans,
+		ts->last.deliveryRate * 8e-6, ts->last.pacingRate * 8e-6, ts->appLimitedSamples * 100.0 / ts->samples);
+}
+
+void tcpInfoDumpOpen(const char* path) {
+	tcpInfoDumpFile = fopen(path, "w");
+	if (tcpInfoDumpFile == NULL) {
+		dieWithError("tcpInfoDumpOpen fopen() failed");
+	}
+	fprintf(tcpInfoDumpFile, "conn,role,socket,ms,rtt_us,rttvar_us,cwnd,total_retrans,delivery_rate_Bps,pacing_rate_Bps,app_limited\n");
+	fflush(tcpInfoDumpFile);
+}
+
+TcpSeries* tcpInfoSeriesAlloc() {
+	if (tcpInfoDumpFile == NULL) {
+		return NULL;
+	}
+	TcpSeries* series = (TcpSeries*) malloc(sizeof(TcpSeries));
+	if (series == NULL) {
+		dieWithError("tcpInfoSeriesAlloc malloc() failed");
+	}
+	series->count = 0;
+	series->stride = 1;
+	series->readings = 0;
+	return series;
+}
+
+void tcpInfoSeriesDump(TcpSeries* series, int id, const char* role, const char* dir) {
+	int i;
+
+	if (series == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&tcpInfoDumpLock);
+	for (i = 0; i < series->count; i++) {
+		TcpSample* s = &series->samples[i];
+		fprintf(tcpInfoDumpFile, "%d,%s,%s,%u,%u,%u,%u,%u,%llu,%llu,%u\n", id, role, dir, s->ms, s->rttUs, s->rttVarUs, s->cwnd, s->totalRetrans, s->deliveryRate, s->pacingRate, s->appLimited);
+	}
+	fflush(tcpInfoDumpFile);
+	pthread_mutex_unlock(&tcpInfoDumpLock);
+	free(series);
+}
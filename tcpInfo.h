@@ -0,0 +1,53 @@
+#ifndef TCPINFO_H
+#define TCPINFO_H
+
+#include <stdio.h>
+
+#define TCPINFOSERIESMAX 1024 // Samples kept per socket. When full every other sample is dropped and the stride doubles.
+
+// [ TcpInfo
+// One getsockopt(TCP_INFO) reading of a socket.
+typedef struct tcpSample {
+	unsigned int ms; // Since the connection was opened.
+	unsigned int rttUs;
+	unsigned int rttVarUs;
+	unsigned int cwnd; // Segments.
+	unsigned int totalRetrans; // Retransmitted segments since the socket was created.
+	unsigned int appLimited; // The last delivery rate sample was limited by the application, not the network.
+	unsigned long long int deliveryRate; // Bytes/s.
+	unsigned long long int pacingRate; // Bytes/s.
+} TcpSample;
+
+// Bounded time series of one socket. Thinned by dropping every other sample, so it always covers the whole connection.
+typedef struct tcpSeries {
+	TcpSample samples[TCPINFOSERIESMAX];
+	int count;
+	unsigned int stride; // Keep every stride-th reading.
+	unsigned long long int readings;
+} TcpSeries;
+
+// Running TCP state of one socket of a connection, updated by the report thread.
+typedef struct tcpInfoStats {
+	unsigned long long int samples; // 0 until the first successful reading.
+	TcpSample last;
+	TcpSample first;
+	unsigned long long int rttSumUs;
+	unsigned int rttMinUs;
+	unsigned int rttMaxUs;
+	unsigned int cwndMin;
+	unsigned int cwndMax;
+	unsigned long long int appLimitedSamples;
+	TcpSeries* series; // NULL unless a dump file is set with tcpInfoDumpOpen().
+} TcpInfoStats;
+
+int tcpInfoRead(int sock, unsigned int ms, TcpSample* s); // 0 on success.
+void tcpInfoAdd(TcpInfoStats* ts, const TcpSample* s);
+void tcpInfoPrint(TcpInfoStats* ts, const char* prefix, const char* dir);
+
+// Every series is appended to "path" as CSV lines when its connection closes.
+void tcpInfoDumpOpen(const char* path);
+TcpSeries* tcpInfoSeriesAlloc(); // NULL when no dump file is set.
+void tcpInfoSeriesDump(TcpSeries* series, int id, const char* role, const char* dir); // Also releases the series.
+// ]
+
+#endif // TCPINFO_H
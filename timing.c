@@ -0,0 +1,75 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <cpuid.h> // for __get_cpuid().
+#endif
+#include "timing.h"
+#include "dieWithError.h"
+
+#define TIMINGCALIBRATEMS 20 // TSC calibration span.
+
+TimingClock timingClock;
+
+// The TSC is only a clock if it ticks at a constant rate in every C-state and P-state.
+static int timingInvariantTsc() {
+#if defined(__x86_64__)
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1 << 8))) {
+		return 1;
+	}
+#endif
+	return 0;
+}
+
+void timingInit() {
+	timingClock.useTsc = 0;
+	timingClock.tscHz = 0.0;
+#if defined(__x86_64__)
+	if (timingInvariantTsc()) {
+		uint64_t ns1 = timingRawNs();
+		uint64_t tsc1 = __rdtsc();
+		usleep(TIMINGCALIBRATEMS * 1000);
+		uint64_t ns2 = timingRawNs();
+		uint64_t tsc2 = __rdtsc();
+		if (tsc2 > tsc1 && ns2 > ns1) {
+			timingClock.mult = ((ns2 - ns1) << 32) / (tsc2 - tsc1);
+			timingClock.tscHz = (double) (tsc2 - tsc1) * 1e9 / (ns2 - ns1);
+			timingClock.tsc0 = tsc2;
+			timingClock.ns0 = ns2;
+			timingClock.useTsc = 1;
+		}
+	}
+#endif
+}
+
+const char* timingClockName() {
+	return timingClock.useTsc ? "tsc" : "monotonic_raw";
+}
+
+void* threadDeadline(void* arg) {
+	Deadline* d = (Deadline*) arg;
+	unsigned long long int now;
+
+	// nanosleep() can return early on a signal, sleep until the clock agrees.
+	while ((now = timingNowNs()) < d->endNs) {
+		unsigned long long int left = d->endNs - now;
+		struct timespec ts;
+		ts.tv_sec = left / 1000000000ULL;
+		ts.tv_nsec = left % 1000000000ULL;
+		nanosleep(&ts, NULL);
+	}
+	__atomic_store_n(&d->expired, 1, __ATOMIC_RELAXED);
+	return ((void*) 0);
+}
+
+void deadlineStart(Deadline* d, double seconds) {
+	pthread_t ntid;
+
+	d->expired = 0;
+	d->endNs = timingNowNs() + (unsigned long long int) (seconds * 1e9);
+	if (pthread_create(&ntid, NULL, threadDeadline, d) != 0) {
+		dieWithError("deadlineStart pthread_create() failed");
+	}
+	pthread_detach(ntid);
+}
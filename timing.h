@@ -0,0 +1,60 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // for __rdtsc().
+#endif
+
+// [ Timing
+// One monotonic clock for every role. With an invariant TSC the clock is the TSC scaled to ns (calibrated against
+// CLOCK_MONOTONIC_RAW once at start), otherwise CLOCK_MONOTONIC_RAW itself. Both are immune to wall clock steps.
+typedef struct timingClock {
+	int useTsc;
+	uint64_t tsc0;
+	uint64_t ns0;
+	uint64_t mult; // ns per tick, 32.32 fixed point.
+	double tscHz;
+} TimingClock;
+
+extern TimingClock timingClock;
+
+void timingInit(); // Call once before any other thread starts.
+const char* timingClockName(); // "tsc" or "monotonic_raw".
+
+static inline unsigned long long int timingRawNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (unsigned long long int) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline unsigned long long int timingNowNs() {
+#if defined(__x86_64__)
+	if (timingClock.useTsc) {
+		return timingClock.ns0 + (uint64_t) (((unsigned __int128) (__rdtsc() - timingClock.tsc0) * timingClock.mult) >> 32);
+	}
+#endif
+	return timingRawNs();
+}
+
+static inline double timingSince(unsigned long long int startNs) { // Seconds since startNs.
+	return (timingNowNs() - startNs) * 1e-9;
+}
+// ]
+
+// [ Deadline
+// "-t" style run limits. A timer thread sets the flag, so the hot loop checks one load instead of reading a clock.
+typedef struct deadline {
+	volatile int expired;
+	unsigned long long int endNs;
+} Deadline;
+
+void deadlineStart(Deadline* d, double seconds); // "d" must outlive the timer.
+
+static inline int deadlinePassed(Deadline* d) {
+	return __atomic_load_n(&d->expired, __ATOMIC_RELAXED);
+}
+// ]
+
+#endif // TIMING_H
@@ -0,0 +1,863 @@
+#include <stdio.h> // for printf().
+#include <stdlib.h> // for malloc() and free().
+#include <string.h> // for strcmp() and strtok_r().
+#include <unistd.h> // for fork() and execv().
+#include <fcntl.h> // for open().
+#include <signal.h> // for sigaction().
+#include <netdb.h> // for getaddrinfo().
+#include <ifaddrs.h> // for getifaddrs().
+#include <arpa/inet.h> // for inet_aton().
+#include <sys/stat.h> // for mkdir().
+#include <sys/wait.h> // for waitpid().
+#include <sys/prctl.h> // for prctl().
+#include "timing.h"
+#include "topology.h"
+
+static const char* topologyRoleNames[] = {"", "sender", "forwarder", "receiver"};
+
+static volatile sig_atomic_t topologySignals = 0;
+
+static void topologySignal(int sig) {
+	topologySignals++;
+}
+
+int topologyInterrupted() {
+	return topologySignals > 0;
+}
+
+static int topologyFind(Topology* topo, const char* name) {
+	int i;
+	for (i = 0; i < topo->stageAmount; i++) {
+		if (strcmp(topo->stage[i].name, name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Value of option "name" in the options of a stage, "def" if it is not there.
+static int topologyOpt(TopologyStage* ts, const char* name, int def) {
+	int i;
+	for (i = 0; i + 1 < ts->optAmount; i++) {
+		if (strcmp(ts->opts[i], name) == 0) {
+			return atoi(ts->opts[i + 1]);
+		}
+	}
+	return def;
+}
+
+static int topologyHasOpt(TopologyStage* ts, const char* name) {
+	int i;
+	for (i = 0; i < ts->optAmount; i++) {
+		if (strcmp(ts->opts[i], name) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// UDP and packet servers take datagrams, every other receiver takes TCP connections.
+static int topologyDatagram(TopologyStage* ts) {
+	return ts->role == TopologyReceiver && (ts->mode == 5 || ts->mode == 6);
+}
+
+static int topologyListens(TopologyStage* ts) {
+	return ts->role != TopologySender;
+}
+
+// Connections one instance of stage "ts" opens to each of its downstream stages, -1 if not known.
+static int topologyOutConnections(TopologyStage* ts) {
+	if (ts->role == TopologySender) {
+		if (ts->mode == 6) {
+			return -1; // A storm of short connections.
+		}
+		return ts->mode == 7 ? 0 : topologyOpt(ts, "-streams", 1);
+	}
+	if (ts->mode == 3 || ts->mode == 4) {
+		int agg = ts->mode == 4 ? topologyOpt(ts, "-agg", 0) : 0;
+		return agg > 0 ? agg : ts->fanIn;
+	}
+	return 1;
+}
+
+static int topologyAddrLocal(const char* addr) {
+	struct ifaddrs* ifs;
+	struct ifaddrs* ifa;
+	struct in_addr in;
+	int local = 0;
+
+	if (inet_aton(addr, &in) == 0 || getifaddrs(&ifs) < 0) {
+		return 0;
+	}
+	for (ifa = ifs; ifa != NULL; ifa = ifa->ifa_next) {
+		if (ifa->ifa_addr != NULL && ifa->ifa_addr->sa_family == AF_INET &&
+				((struct sockaddr_in*) ifa->ifa_addr)->sin_addr.s_addr == in.s_addr) {
+			local = 1;
+		}
+	}
+	freeifaddrs(ifs);
+	return local;
+}
+
+static int topologyResolve(TopologyStage* ts) {
+	struct in_addr in;
+	struct addrinfo hints;
+	struct addrinfo* res;
+
+	if (ts->addr[0] != '\0') {
+		return inet_aton(ts->addr, &in) != 0 ? 0 : -1;
+	}
+	if (strcmp(ts->host, "localhost") == 0) {
+		snprintf(ts->addr, sizeof(ts->addr), "127.0.0.1");
+		return 0;
+	}
+	if (inet_aton(ts->host, &in) != 0) {
+		snprintf(ts->addr, sizeof(ts->addr), "%s", ts->host);
+		return 0;
+	}
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(ts->host, NULL, &hints, &res) != 0) {
+		return -1;
+	}
+	snprintf(ts->addr, sizeof(ts->addr), "%s", inet_ntoa(((struct sockaddr_in*) res->ai_addr)->sin_addr));
+	freeaddrinfo(res);
+	return 0;
+}
+
+// Longest path from stage "s" to a receiver, -1 on a cycle.
+static int topologyLevel(Topology* topo, int s, char* state) {
+	TopologyStage* ts = &topo->stage[s];
+	int i;
+
+	if (state[s] == 1) {
+		return -1;
+	}
+	if (state[s] == 2) {
+		return ts->level;
+	}
+	state[s] = 1;
+	ts->level = 0;
+	for (i = 0; i < ts->toAmount; i++) {
+		int level = topologyLevel(topo, ts->to[i], state);
+		if (level < 0) {
+			return -1;
+		}
+		if (level + 1 > ts->level) {
+			ts->level = level + 1;
+		}
+	}
+	state[s] = 2;
+	return ts->level;
+}
+
+// Full command line of instance "index" of stage "s", every string malloc()ed. Returns argc, argv ends with NULL.
+static int topologyCommand(Topology* topo, int s, int index, char* argv[]) {
+	TopologyStage* ts = &topo->stage[s];
+	char value[1024];
+	int argc = 0;
+	int i;
+
+	argv[argc++] = strdup("idaq");
+	argv[argc++] = strdup(ts->role == TopologyReceiver ? "-s" : "-c");
+	snprintf(value, sizeof(value), "%d", ts->mode);
+	argv[argc++] = strdup(value);
+	if (topologyListens(ts)) {
+		argv[argc++] = strdup(ts->role == TopologyReceiver ? "-p" : "-P");
+		snprintf(value, sizeof(value), "%d", ts->port);
+		argv[argc++] = strdup(value);
+		// Forwarders and receivers end on the SIGTERM of the launcher and drain first.
+		argv[argc++] = strdup("-continuous");
+	}
+	if (ts->toAmount > 1) {
+		size_t len = 0;
+		for (i = 0; i < ts->toAmount; i++) {
+			TopologyStage* down = &topo->stage[ts->to[i]];
+			len += snprintf(value + len, sizeof(value) - len, "%s%s:%d", i > 0 ? "," : "", down->addr, down->port);
+		}
+		argv[argc++] = strdup("-fanout");
+		argv[argc++] = strdup(value);
+	}
+	else if (ts->toAmount == 1) {
+		TopologyStage* down = &topo->stage[ts->to[0]];
+		argv[argc++] = strdup("-a");
+		argv[argc++] = strdup(down->addr);
+		argv[argc++] = strdup("-p");
+		snprintf(value, sizeof(value), "%d", down->port);
+		argv[argc++] = strdup(value);
+	}
+	if (ts->role == TopologySender && !topologyHasOpt(ts, "-id")) {
+		// Every sender instance of the topology gets its own source id.
+		int id = index;
+		for (i = 0; i < s; i++) {
+			if (topo->stage[i].role == TopologySender) {
+				id += topo->stage[i].count;
+			}
+		}
+		argv[argc++] = strdup("-id");
+		snprintf(value, sizeof(value), "%d", id);
+		argv[argc++] = strdup(value);
+	}
+	for (i = 0; i < ts->optAmount; i++) {
+		argv[argc++] = strdup(ts->opts[i]);
+	}
+	argv[argc] = NULL;
+	return argc;
+}
+
+static void topologyCommandFree(char* argv[]) {
+	int i;
+	for (i = 0; argv[i] != NULL; i++) {
+		free(argv[i]);
+	}
+}
+
+static int topologyError(Topology* topo, TopologyStage* ts, const char* message, const char* detail) {
+	printf("topology %s:%d: stage %s %s%s\n", topo->path, ts->line, ts->name, message, detail);
+	return -1;
+}
+
+// Every rule a stage must follow, -1 after printing the first broken one.
+static int topologyCheckStage(Topology* topo, int s, int (*checkOpts)(int argc, char* argv[])) {
+	static const char* owned[] = {"-s", "-c", "-a", "-p", "-P", "-fanout", NULL};
+	TopologyStage* ts = &topo->stage[s];
+	char* argv[TOPOLOGYMAXOPTS + 16];
+	int i;
+	int j;
+
+	if (ts->role == TopologySender && ts->mode != 1 && ts->mode != 6 && ts->mode != 7) {
+		return topologyError(topo, ts, "has a bad mode, a sender is -c 1, 6 or 7", "");
+	}
+	if (ts->role == TopologyForwarder && (ts->mode < 2 || ts->mode > 5)) {
+		return topologyError(topo, ts, "has a bad mode, a forwarder is -c 2 to 5", "");
+	}
+	if (ts->role == TopologyReceiver && (ts->mode < 1 || ts->mode > 7)) {
+		return topologyError(topo, ts, "has a bad mode, a receiver is -s 1 to 7", "");
+	}
+	if (topologyListens(ts) && ts->port == 0) {
+		return topologyError(topo, ts, "needs port=", "");
+	}
+	if (topologyListens(ts) && ts->count != 1) {
+		return topologyError(topo, ts, "listens on a port, count= is for senders", "");
+	}
+	if (ts->role == TopologyReceiver && ts->toAmount > 0) {
+		return topologyError(topo, ts, "is a receiver, it sends nowhere", "");
+	}
+	if (ts->role != TopologyReceiver && ts->toAmount == 0) {
+		return topologyError(topo, ts, "needs to=", "");
+	}
+	if (ts->toAmount > 1 && !(ts->role == TopologyForwarder && ts->mode == 5)) {
+		return topologyError(topo, ts, "sends to several stages, only the fan-out forwarder (mode 5) does", "");
+	}
+	for (i = 0; i < ts->toAmount; i++) {
+		TopologyStage* down = &topo->stage[ts->to[i]];
+		if (down->role == TopologySender) {
+			return topologyError(topo, ts, "sends to a sender: ", down->name);
+		}
+		if (topologyDatagram(down) != (ts->role == TopologySender && ts->mode == 7)) {
+			return topologyError(topo, ts, "and its downstream disagree on UDP, only sender mode 7 feeds receiver mode 5 or 6: ", down->name);
+		}
+	}
+	for (i = 0; i < ts->optAmount; i++) {
+		for (j = 0; owned[j] != NULL; j++) {
+			if (strcmp(ts->opts[i], owned[j]) == 0) {
+				return topologyError(topo, ts, "sets an option the topology sets: ", owned[j]);
+			}
+		}
+	}
+	for (i = 0; i < s; i++) {
+		TopologyStage* other = &topo->stage[i];
+		if (topologyListens(ts) && topologyListens(other) && ts->port == other->port && strcmp(ts->addr, other->addr) == 0) {
+			return topologyError(topo, ts, "listens on the port of stage ", other->name);
+		}
+	}
+	if (checkOpts != NULL) {
+		int argc = topologyCommand(topo, s, 0, argv);
+		int bad = checkOpts(argc, argv);
+		topologyCommandFree(argv);
+		if (bad) {
+			return topologyError(topo, ts, "has options idaq does not take", "");
+		}
+	}
+	return 0;
+}
+
+// Fan-in from the sources down, then the modes that take a single connection.
+static int topologyCheckFanIn(Topology* topo) {
+	int level;
+	int maxLevel = 0;
+	int s;
+	int i;
+
+	for (s = 0; s < topo->stageAmount; s++) {
+		topo->stage[s].fanIn = 0;
+		if (topo->stage[s].level > maxLevel) {
+			maxLevel = topo->stage[s].level;
+		}
+	}
+	for (level = maxLevel; level >= 0; level--) {
+		for (s = 0; s < topo->stageAmount; s++) {
+			TopologyStage* ts = &topo->stage[s];
+			if (ts->level != level) {
+				continue;
+			}
+			if (topologyListens(ts) && ts->fanIn == 0) {
+				return topologyError(topo, ts, "has no upstream stage", "");
+			}
+			if ((ts->role == TopologyReceiver && ts->mode == 1) || (ts->role == TopologyForwarder && ts->mode == 2)) {
+				if (ts->fanIn != 1) {
+					return topologyError(topo, ts, "takes a single connection, its upstream stages open more", "");
+				}
+			}
+			int out = topologyOutConnections(ts);
+			for (i = 0; i < ts->toAmount; i++) {
+				TopologyStage* down = &topo->stage[ts->to[i]];
+				if (out < 0 || down->fanIn < 0) {
+					down->fanIn = -1;
+				}
+				else {
+					down->fanIn += ts->count * (out > 0 ? out : 1);
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+static int topologyParseLine(Topology* topo, char* line, int lineNo, char* toList) {
+	char* save = NULL;
+	char* name = strtok_r(line, " \t\r\n", &save);
+	char* token;
+
+	if (name == NULL) {
+		return 0;
+	}
+	if (strcmp(name, "set") == 0) {
+		while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+			if (strncmp(token, "logdir=", 7) == 0) {
+				snprintf(topo->logDir, sizeof(topo->logDir), "%s", token + 7);
+			}
+			else if (strncmp(token, "ready=", 6) == 0) {
+				topo->readySeconds = atof(token + 6);
+			}
+			else if (strncmp(token, "drain=", 6) == 0) {
+				topo->drainSeconds = atof(token + 6);
+			}
+			else {
+				printf("topology %s:%d: unknown setting %s\n", topo->path, lineNo, token);
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	if (topo->stageAmount == TOPOLOGYMAXSTAGES) {
+		printf("topology %s:%d: more than %d stages\n", topo->path, lineNo, TOPOLOGYMAXSTAGES);
+		return -1;
+	}
+	TopologyStage* ts = &topo->stage[topo->stageAmount];
+	memset(ts, 0, sizeof(TopologyStage));
+	ts->line = lineNo;
+	ts->count = 1;
+	ts->mode = -1;
+	snprintf(ts->name, sizeof(ts->name), "%s", name);
+	if (topologyFind(topo, ts->name) >= 0) {
+		printf("topology %s:%d: stage %s twice\n", topo->path, lineNo, ts->name);
+		return -1;
+	}
+	topo->stageAmount++;
+
+	token = strtok_r(NULL, " \t\r\n", &save);
+	for (ts->role = TopologySender; ts->role <= TopologyReceiver; ts->role++) {
+		if (token != NULL && strcmp(token, topologyRoleNames[ts->role]) == 0) {
+			break;
+		}
+	}
+	if (ts->role > TopologyReceiver) {
+		return topologyError(topo, ts, "needs a role, sender, forwarder or receiver", "");
+	}
+	while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL && strcmp(token, "--") != 0) {
+		char* end;
+		if (strncmp(token, "host=", 5) == 0) {
+			snprintf(ts->host, sizeof(ts->host), "%s", token + 5);
+		}
+		else if (strncmp(token, "addr=", 5) == 0) {
+			snprintf(ts->addr, sizeof(ts->addr), "%s", token + 5);
+		}
+		else if (strncmp(token, "port=", 5) == 0) {
+			long port = strtol(token + 5, &end, 10);
+			if (*end != '\0' || port <= 0 || port > 65535) {
+				return topologyError(topo, ts, "has a bad ", token);
+			}
+			ts->port = port;
+		}
+		else if (strncmp(token, "mode=", 5) == 0) {
+			ts->mode = strtol(token + 5, &end, 10);
+			if (*end != '\0') {
+				return topologyError(topo, ts, "has a bad ", token);
+			}
+		}
+		else if (strncmp(token, "count=", 6) == 0) {
+			ts->count = strtol(token + 6, &end, 10);
+			if (*end != '\0' || ts->count <= 0) {
+				return topologyError(topo, ts, "has a bad ", token);
+			}
+		}
+		else if (strncmp(token, "to=", 3) == 0) {
+			snprintf(toList, 256, "%s", token + 3);
+		}
+		else {
+			return topologyError(topo, ts, "has an unknown key ", token);
+		}
+	}
+	while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+		if (ts->optAmount == TOPOLOGYMAXOPTS) {
+			return topologyError(topo, ts, "has too many options", "");
+		}
+		ts->opts[ts->optAmount++] = strdup(token);
+	}
+	if (ts->host[0] == '\0') {
+		return topologyError(topo, ts, "needs host=", "");
+	}
+	if (ts->mode < 0) {
+		// The multithread modes by default, as in idaq.
+		ts->mode = ts->role == TopologySender ? 1 : (ts->role == TopologyForwarder ? 4 : 3);
+	}
+	if (topologyResolve(ts) < 0) {
+		return topologyError(topo, ts, "has an address that does not resolve: ", ts->addr[0] != '\0' ? ts->addr : ts->host);
+	}
+	return 0;
+}
+
+Topology* topologyLoad(const char* path, const char* localHost, int (*checkOpts)(int argc, char* argv[])) {
+	static char toLists[TOPOLOGYMAXSTAGES][256];
+	char line[1024];
+	char state[TOPOLOGYMAXSTAGES];
+	FILE* fp;
+	int lineNo = 0;
+	int s;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		printf("topology %s: cannot open\n", path);
+		return NULL;
+	}
+	Topology* topo = (Topology*) calloc(1, sizeof(Topology));
+	if (topo == NULL) {
+		fclose(fp);
+		return NULL;
+	}
+	topo->path = path;
+	snprintf(topo->logDir, sizeof(topo->logDir), "idaq-topology");
+	topo->readySeconds = 5;
+	topo->drainSeconds = 2;
+	memset(toLists, 0, sizeof(toLists));
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineNo++;
+		char* hash = strchr(line, '#');
+		if (hash != NULL) {
+			*hash = '\0';
+		}
+		if (topologyParseLine(topo, line, lineNo, toLists[topo->stageAmount]) < 0) {
+			fclose(fp);
+			topologyRelease(topo);
+			return NULL;
+		}
+	}
+	fclose(fp);
+	if (topo->stageAmount == 0) {
+		printf("topology %s: no stages\n", path);
+		topologyRelease(topo);
+		return NULL;
+	}
+
+	// [Resolve the names of the downstream stages.
+	for (s = 0; s < topo->stageAmount; s++) {
+		TopologyStage* ts = &topo->stage[s];
+		char* save = NULL;
+		char* name;
+		for (name = strtok_r(toLists[s], ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+			int to = topologyFind(topo, name);
+			if (to < 0 || to == s || ts->toAmount == TOPOLOGYMAXTO) {
+				topologyError(topo, ts, to < 0 ? "sends to an unknown stage " : "has a bad to= at ", name);
+				topologyRelease(topo);
+				return NULL;
+			}
+			ts->to[ts->toAmount++] = to;
+		}
+		ts->local = strcmp(ts->host, localHost) == 0 || strcmp(ts->host, "localhost") == 0 || topologyAddrLocal(ts->addr);
+	}
+	// ]
+
+	memset(state, 0, sizeof(state));
+	for (s = 0; s < topo->stageAmount; s++) {
+		if (topologyLevel(topo, s, state) < 0) {
+			topologyError(topo, &topo->stage[s], "is on a cycle", "");
+			topologyRelease(topo);
+			return NULL;
+		}
+	}
+	for (s = 0; s < topo->stageAmount; s++) {
+		if (topologyCheckStage(topo, s, checkOpts) < 0) {
+			topologyRelease(topo);
+			return NULL;
+		}
+	}
+	if (topologyCheckFanIn(topo) < 0) {
+		topologyRelease(topo);
+		return NULL;
+	}
+	return topo;
+}
+
+void topologyRelease(Topology* topo) {
+	int s;
+	int i;
+	if (topo == NULL) {
+		return;
+	}
+	for (s = 0; s < topo->stageAmount; s++) {
+		for (i = 0; i < topo->stage[s].optAmount; i++) {
+			free(topo->stage[s].opts[i]);
+		}
+	}
+	free(topo);
+}
+
+void topologyPrint(Topology* topo) {
+	char* argv[TOPOLOGYMAXOPTS + 16];
+	int s;
+	int i;
+
+	printf("topology %s: %d stages, logdir %s, ready %.1lf s, drain %.1lf s\n", topo->path, topo->stageAmount, topo->logDir, topo->readySeconds, topo->drainSeconds);
+	for (s = 0; s < topo->stageAmount; s++) {
+		TopologyStage* ts = &topo->stage[s];
+		printf("%-12s level %d %-9s mode %d x%d on %s (%s)%s", ts->name, ts->level, topologyRoleNames[ts->role], ts->mode, ts->count, ts->host, ts->addr, ts->local ? " local" : "");
+		if (topologyListens(ts)) {
+			if (ts->fanIn < 0) {
+				printf(", fan-in unknown");
+			}
+			else {
+				printf(", fan-in %d", ts->fanIn);
+			}
+		}
+		printf("\n   ");
+		topologyCommand(topo, s, 0, argv);
+		for (i = 0; argv[i] != NULL; i++) {
+			printf(" %s", argv[i]);
+		}
+		topologyCommandFree(argv);
+		printf("\n");
+	}
+}
+
+// Sockets of "/proc/net/tcp" or udp (v4 and v6) with local "port" in "state" (0A listen, 01 established, 07 UDP bound).
+static int topologySockets(unsigned short port, int udp, unsigned int state) {
+	const char* paths[2][2] = {{"/proc/net/tcp", "/proc/net/tcp6"}, {"/proc/net/udp", "/proc/net/udp6"}};
+	char line[512];
+	int amount = 0;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		FILE* fp = fopen(paths[udp][i], "r");
+		if (fp == NULL) {
+			continue;
+		}
+		while (fgets(line, sizeof(line), fp) != NULL) {
+			unsigned int localPort;
+			unsigned int st;
+			if (sscanf(line, " %*d: %*[0-9A-Fa-f]:%x %*[0-9A-Fa-f]:%*x %x", &localPort, &st) == 2 && localPort == port && st == state) {
+				amount++;
+			}
+		}
+		fclose(fp);
+	}
+	return amount;
+}
+
+static int topologyReady(TopologyStage* ts) {
+	if (ts->role == TopologyReceiver && ts->mode == 6) {
+		return 1;
+	}
+	return topologySockets(ts->port, topologyDatagram(ts), topologyDatagram(ts) ? 0x07 : 0x0A) > 0;
+}
+
+static int topologyReap(Topology* topo, pid_t pid, int status) {
+	int i;
+	for (i = 0; i < topo->instanceAmount; i++) {
+		TopologyInstance* ti = &topo->instance[i];
+		if (ti->pid == pid && !ti->done) {
+			ti->done = 1;
+			ti->status = status;
+			ti->endNs = timingNowNs();
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void topologyReapAll(Topology* topo) {
+	pid_t pid;
+	int status;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		topologyReap(topo, pid, status);
+	}
+}
+
+static int topologyStageDone(Topology* topo, int s) {
+	int i;
+	for (i = 0; i < topo->instanceAmount; i++) {
+		if (topo->instance[i].stage == s && !topo->instance[i].done) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void topologyTerminate(Topology* topo, int s) {
+	int i;
+	for (i = 0; i < topo->instanceAmount; i++) {
+		TopologyInstance* ti = &topo->instance[i];
+		if ((s < 0 || ti->stage == s) && !ti->done) {
+			kill(ti->pid, SIGTERM);
+		}
+	}
+}
+
+static int topologyStart(Topology* topo, int s, int index) {
+	TopologyStage* ts = &topo->stage[s];
+	char* argv[TOPOLOGYMAXOPTS + 16];
+
+	if (topo->instanceAmount == TOPOLOGYMAXINSTANCES) {
+		printf("topology: more than %d local instances\n", TOPOLOGYMAXINSTANCES);
+		return -1;
+	}
+	TopologyInstance* ti = &topo->instance[topo->instanceAmount];
+	memset(ti, 0, sizeof(TopologyInstance));
+	ti->stage = s;
+	ti->index = index;
+	snprintf(ti->log, sizeof(ti->log), "%s/%s.%d.log", topo->logDir, ts->name, index);
+	topologyCommand(topo, s, index, argv);
+	fflush(stdout);
+	ti->startNs = timingNowNs();
+	if ((ti->pid = fork()) < 0) {
+		topologyCommandFree(argv);
+		return -1;
+	}
+	if (ti->pid == 0) {
+		// A stage must not outlive the launcher.
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+		int fd = open(ti->log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			perror("topology open() failed");
+			_exit(127);
+		}
+		dup2(fd, 1);
+		dup2(fd, 2);
+		close(fd);
+		execv("/proc/self/exe", argv);
+		perror("topology execv() failed");
+		_exit(127);
+	}
+	topologyCommandFree(argv);
+	topo->instanceAmount++;
+	printf("topology: started %s.%d, pid %d\n", ts->name, index, ti->pid);
+	return 0;
+}
+
+// Wait until stage "s" listens, -1 if it ends or runs out of time first.
+static int topologyWaitReady(Topology* topo, int s) {
+	TopologyStage* ts = &topo->stage[s];
+	unsigned long long int deadline = timingNowNs() + (unsigned long long int) (topo->readySeconds * 1e9);
+
+	if (ts->role == TopologyReceiver && ts->mode == 6) {
+		usleep(500000); // A packet ring has no port, being alive a while is all there is.
+	}
+	while (timingNowNs() < deadline && topologySignals == 0) {
+		topologyReapAll(topo);
+		if (topologyStageDone(topo, s)) {
+			printf("topology: %s ended before it listened\n", ts->name);
+			return -1;
+		}
+		if (topologyReady(ts)) {
+			printf("topology: %s ready on %s:%d\n", ts->name, ts->addr, ts->port);
+			return 0;
+		}
+		usleep(10000);
+	}
+	printf("topology: %s not listening after %.1lf s\n", ts->name, topo->readySeconds);
+	return -1;
+}
+
+static void topologyReport(Topology* topo, int* order, int orderAmount) {
+	char line[1024];
+	int k;
+	int i;
+
+	printf("\ntopology results, logs in %s:\n", topo->logDir);
+	for (k = 0; k < orderAmount; k++) {
+		TopologyStage* ts = &topo->stage[order[k]];
+		for (i = 0; i < topo->instanceAmount; i++) {
+			TopologyInstance* ti = &topo->instance[i];
+			if (ti->stage != order[k]) {
+				continue;
+			}
+			printf("%s.%d (%s mode %d, pid %d): ", ts->name, ti->index, topologyRoleNames[ts->role], ts->mode, ti->pid);
+			if (WIFEXITED(ti->status)) {
+				printf("exit %d", WEXITSTATUS(ti->status));
+			}
+			else {
+				printf("signal %d", WTERMSIG(ti->status));
+			}
+			printf(", %.3lf s\n", (ti->endNs - ti->startNs) * 1e-9);
+			// The end results of every role have "speed" in them, interval reports do not.
+			FILE* fp = fopen(ti->log, "r");
+			if (fp == NULL) {
+				continue;
+			}
+			while (fgets(line, sizeof(line), fp) != NULL) {
+				if (strstr(line, "speed") != NULL || strstr(line, "Speed") != NULL) {
+					printf("    %s", line);
+				}
+			}
+			fclose(fp);
+		}
+	}
+}
+
+int topologyRun(Topology* topo) {
+	int order[TOPOLOGYMAXSTAGES];
+	int orderAmount = 0;
+	char stopped[TOPOLOGYMAXSTAGES];
+	char seen[TOPOLOGYMAXSTAGES];
+	unsigned long long int busyNs[TOPOLOGYMAXSTAGES];
+	struct sigaction sa;
+	int handled = 0;
+	int failed = 0;
+	int level;
+	int s;
+	int k;
+	int i;
+
+	topo->instanceAmount = 0;
+	memset(stopped, 0, sizeof(stopped));
+	memset(seen, 0, sizeof(seen));
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = topologySignal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	if (mkdir(topo->logDir, 0755) < 0 && access(topo->logDir, W_OK) < 0) {
+		printf("topology: cannot write logdir %s\n", topo->logDir);
+		return 1;
+	}
+
+	// [Start the local stages level by level from the receivers up.
+	for (level = 0; level < TOPOLOGYMAXSTAGES; level++) {
+		for (s = 0; s < topo->stageAmount; s++) {
+			if (topo->stage[s].local && topo->stage[s].level == level) {
+				order[orderAmount++] = s;
+			}
+		}
+	}
+	for (k = 0; k < orderAmount && !failed && topologySignals == 0; k++) {
+		TopologyStage* ts = &topo->stage[order[k]];
+		for (i = 0; i < ts->toAmount; i++) {
+			TopologyStage* down = &topo->stage[ts->to[i]];
+			if (!down->local) {
+				printf("topology: %s sends to %s on %s, which must already run there\n", ts->name, down->name, down->host);
+			}
+		}
+		if (topologyListens(ts) && !(ts->role == TopologyReceiver && ts->mode == 6) && topologyReady(ts)) {
+			printf("topology: port %d of %s is in use\n", ts->port, ts->name);
+			failed = 1;
+			break;
+		}
+		for (i = 0; i < ts->count && !failed; i++) {
+			failed = topologyStart(topo, order[k], i) < 0;
+		}
+		if (!failed && topologyListens(ts)) {
+			failed = topologyWaitReady(topo, order[k]) < 0;
+		}
+		busyNs[order[k]] = timingNowNs();
+	}
+	if (failed) {
+		topologyTerminate(topo, -1);
+	}
+	// ]
+
+	// [Stop every forwarder and receiver once its local upstream is done and it is idle.
+	while (1) {
+		topologyReapAll(topo);
+		if (topologySignals != handled) {
+			// Every SIGINT or SIGTERM goes on to the stages, a second one makes them exit without draining.
+			handled = topologySignals;
+			topologyTerminate(topo, -1);
+		}
+		int running = 0;
+		for (i = 0; i < topo->instanceAmount; i++) {
+			running += !topo->instance[i].done;
+		}
+		if (running == 0) {
+			break;
+		}
+		unsigned long long int now = timingNowNs();
+		for (k = 0; k < orderAmount; k++) {
+			s = order[k];
+			TopologyStage* ts = &topo->stage[s];
+			if (!topologyListens(ts) || stopped[s] || topologyStageDone(topo, s)) {
+				continue;
+			}
+			int upstreamDone = 1;
+			int remoteUpstream = 0;
+			int u;
+			for (u = 0; u < topo->stageAmount; u++) {
+				int t;
+				for (t = 0; t < topo->stage[u].toAmount; t++) {
+					if (topo->stage[u].to[t] != s) {
+						continue;
+					}
+					if (!topo->stage[u].local) {
+						remoteUpstream = 1;
+					}
+					else if (!topologyStageDone(topo, u)) {
+						upstreamDone = 0;
+					}
+				}
+			}
+			int connections = topologyDatagram(ts) ? 0 : topologySockets(ts->port, 0, 0x01);
+			if (connections > 0) {
+				seen[s] = 1;
+			}
+			if (!upstreamDone || connections > 0) {
+				busyNs[s] = now;
+			}
+			// A stage fed from another host stops only after it had connections, datagram receivers never do.
+			if ((!remoteUpstream || seen[s]) && now - busyNs[s] >= (unsigned long long int) (topo->drainSeconds * 1e9)) {
+				printf("topology: %s idle, SIGTERM\n", ts->name);
+				topologyTerminate(topo, s);
+				stopped[s] = 1;
+			}
+		}
+		usleep(100000);
+	}
+	// ]
+
+	topologyReport(topo, order, orderAmount);
+	int failedStages = 0;
+	for (k = 0; k < orderAmount; k++) {
+		int stageFailed = 0;
+		for (i = 0; i < topo->instanceAmount; i++) {
+			TopologyInstance* ti = &topo->instance[i];
+			if (ti->stage == order[k] && !(WIFEXITED(ti->status) && WEXITSTATUS(ti->status) == 0)) {
+				stageFailed = 1;
+			}
+		}
+		failedStages += stageFailed;
+	}
+	if (failed && failedStages == 0) {
+		failedStages = 1;
+	}
+	printf("topology: %d of %d local stages failed\n", failedStages, orderAmount);
+	return failedStages;
+}
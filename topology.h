@@ -0,0 +1,80 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <sys/types.h>
+
+#define TOPOLOGYMAXSTAGES 64
+#define TOPOLOGYMAXTO 16 // Downstream stages of one stage, the fan-out L2 client limit.
+#define TOPOLOGYMAXOPTS 64
+#define TOPOLOGYMAXINSTANCES 256
+
+// [ Topology
+// An N-level chain in one file, the same file on every host. One stage per line:
+//
+//   name role host=h [addr=ip] [port=n] [mode=n] [count=n] [to=name,name,...] [-- idaq options]
+//
+// role is sender (-c 1, 6 or 7), forwarder (-c 2 to 5) or receiver (-s 1 to 7), "mode" the number after -c or -s.
+// Stages refer to their downstream stages by name, the launcher writes -a, -p, -P and -fanout from the names, so every
+// port is written once. "set logdir=dir ready=s drain=s" lines change the launcher settings. "#" starts a comment.
+typedef enum TOPOLOGYROLE {
+	TopologySender = 1,
+	TopologyForwarder = 2,
+	TopologyReceiver = 3
+} TopologyRole;
+
+typedef struct topologyStage {
+	char name[32];
+	int role; // TopologyRole.
+	int mode;
+	char host[64];
+	char addr[64]; // Dotted quad the upstream stages connect to.
+	unsigned short port; // Listening port of forwarders and receivers.
+	int count; // Instances of a sender, each one a process with its own -id.
+	int toAmount;
+	int to[TOPOLOGYMAXTO];
+	int optAmount;
+	char* opts[TOPOLOGYMAXOPTS]; // Options after "--", passed on as they are.
+	int line;
+	int local; // Runs on this host.
+	int level; // Longest path to a receiver, stages start from level 0 up.
+	int fanIn; // Connections the upstream stages open to this one, -1 if not known (storm client).
+} TopologyStage;
+
+typedef struct topologyInstance {
+	int stage;
+	int index;
+	pid_t pid;
+	char log[320];
+	int status; // waitpid() status.
+	int done;
+	unsigned long long int startNs;
+	unsigned long long int endNs;
+} TopologyInstance;
+
+typedef struct topology {
+	const char* path;
+	int stageAmount;
+	TopologyStage stage[TOPOLOGYMAXSTAGES];
+	char logDir[256]; // Output of every local stage goes to logDir/name.index.log.
+	double readySeconds; // How long a forwarder or receiver may take to listen.
+	double drainSeconds; // How long a forwarder or receiver stays idle after its upstream is done before SIGTERM.
+	int instanceAmount;
+	TopologyInstance instance[TOPOLOGYMAXINSTANCES];
+} Topology;
+
+// Read and check "path": names, roles, modes, ports, fan-in and cycles. "localHost" selects the stages of this host,
+// stages with host "localhost" or an address of a local interface are local too. "checkOpts" gets the full idaq
+// command line of every stage (copies, argv[0] included) and returns non-zero to reject it. Errors are printed with
+// their line, NULL on any error.
+Topology* topologyLoad(const char* path, const char* localHost, int (*checkOpts)(int argc, char* argv[]));
+void topologyRelease(Topology* topo);
+void topologyPrint(Topology* topo);
+
+// Start the local stages from the receivers up, each forwarder and receiver only once it listens, stop every forwarder
+// and receiver with SIGTERM once its local upstream stages are done and it has been idle for drainSeconds, then print
+// the results of every stage. SIGINT or SIGTERM stop all stages early. Returns the number of stages that failed.
+int topologyRun(Topology* topo);
+int topologyInterrupted(); // A SIGINT or SIGTERM reached the launcher.
+// ]
+
+#endif
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <immintrin.h> // for _mm256_max_epu16().
+#include "trigger.h"
+#include "crc32c.h"
+#include "cpuUsage.h"
+
+static size_t (*triggerImpl)(const void* samples, size_t n, uint16_t threshold);
+static pthread_once_t triggerOnce = PTHREAD_ONCE_INIT;
+
+static size_t triggerCountScalar(const void* samples, size_t n, uint16_t threshold) {
+	const char* p = (const char*) samples;
+	size_t count = 0;
+	size_t i;
+	for (i = 0; i < n; i++) {
+		uint16_t v;
+		memcpy(&v, p + 2 * i, 2); // Frames start anywhere in the receive buffer.
+		count += v > threshold;
+	}
+	return count;
+}
+
+// There is no unsigned 16 bit compare, but x > t exactly when max(x, t + 1) == x.
+__attribute__((target("sse4.1")))
+static size_t triggerCountSse(const void* samples, size_t n, uint16_t threshold) {
+	if (threshold == 0xffff) {
+		return 0;
+	}
+	__m128i t = _mm_set1_epi16((short) (threshold + 1));
+	size_t count = 0;
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i*) ((const char*) samples + 2 * i));
+		__m128i b = _mm_loadu_si128((const __m128i*) ((const char*) samples + 2 * i + 16));
+		__m128i over = _mm_packs_epi16(_mm_cmpeq_epi16(_mm_max_epu16(a, t), a), _mm_cmpeq_epi16(_mm_max_epu16(b, t), b));
+		count += __builtin_popcount(_mm_movemask_epi8(over));
+	}
+	return count + triggerCountScalar((const char*) samples + 2 * i, n - i, threshold);
+}
+
+__attribute__((target("avx2")))
+static size_t triggerCountAvx2(const void* samples, size_t n, uint16_t threshold) {
+	if (threshold == 0xffff) {
+		return 0;
+	}
+	__m256i t = _mm256_set1_epi16((short) (threshold + 1));
+	size_t count = 0;
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i*) ((const char*) samples + 2 * i));
+		__m256i b = _mm256_loadu_si256((const __m256i*) ((const char*) samples + 2 * i + 32));
+		// packs works within each 128 bit lane, the order does not matter for a count.
+		__m256i over = _mm256_packs_epi16(_mm256_cmpeq_epi16(_mm256_max_epu16(a, t), a), _mm256_cmpeq_epi16(_mm256_max_epu16(b, t), b));
+		count += __builtin_popcount((unsigned int) _mm256_movemask_epi8(over));
+	}
+	return count + triggerCountSse((const char*) samples + 2 * i, n - i, threshold);
+}
+
+static void triggerInit() {
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		triggerImpl = triggerCountAvx2;
+	}
+	else if (__builtin_cpu_supports("sse4.1")) {
+		triggerImpl = triggerCountSse;
+	}
+	else {
+		triggerImpl = triggerCountScalar;
+	}
+}
+
+size_t triggerCount(const void* samples, size_t n, uint16_t threshold) {
+	pthread_once(&triggerOnce, triggerInit);
+	return triggerImpl(samples, n, threshold);
+}
+
+const char* triggerKernelName() {
+	pthread_once(&triggerOnce, triggerInit);
+	return triggerImpl == triggerCountAvx2 ? "avx2" : (triggerImpl == triggerCountSse ? "sse4.1" : "scalar");
+}
+
+TriggerKernel triggerKernel(const char* name) {
+	__builtin_cpu_init();
+	if (strcmp(name, "avx2") == 0) {
+		return __builtin_cpu_supports("avx2") ? triggerCountAvx2 : NULL;
+	}
+	if (strcmp(name, "sse4.1") == 0) {
+		return __builtin_cpu_supports("sse4.1") ? triggerCountSse : NULL;
+	}
+	return strcmp(name, "scalar") == 0 ? triggerCountScalar : NULL;
+}
+
+TriggerFilter* triggerFilterAlloc(int sock, uint16_t threshold, int minChannels, unsigned int prescale) {
+	TriggerFilter* tf;
+	if ((tf = (TriggerFilter*) calloc(1, sizeof(TriggerFilter))) != NULL) {
+		if ((tf->fr = frameReaderAlloc()) == NULL) {
+			free(tf);
+			return NULL;
+		}
+		tf->sock = sock;
+		tf->threshold = threshold;
+		tf->minChannels = minChannels > 0 ? minChannels : 1;
+		tf->prescale = prescale;
+	}
+	pthread_once(&triggerOnce, triggerInit);
+
+	return tf;
+}
+
+void triggerFilterRelease(TriggerFilter* tf) {
+	frameReaderRelease(tf->fr);
+	free(tf->spill);
+	free(tf);
+}
+
+static void triggerFlush(TriggerFilter* tf) {
+	int first = 0;
+	if (tf->iovAmount == 0) {
+		return;
+	}
+	unsigned long long int t = threadCPUNs();
+	while (first < tf->iovAmount && tf->failed == 0) {
+		ssize_t ret = writev(tf->sock, tf->iov + first, tf->iovAmount - first);
+		if (ret < 0) {
+			if (errno != EINTR) {
+				tf->failed = errno;
+			}
+			continue;
+		}
+		tf->outBytes += ret;
+		tf->sends++;
+		// Skip what went out, a partial write leaves the rest of one frame.
+		while (first < tf->iovAmount && (size_t) ret >= tf->iov[first].iov_len) {
+			ret -= tf->iov[first].iov_len;
+			first++;
+		}
+		if (first < tf->iovAmount) {
+			tf->iov[first].iov_base = (char*) tf->iov[first].iov_base + ret;
+			tf->iov[first].iov_len -= ret;
+		}
+	}
+	tf->sendNs += threadCPUNs() - t;
+	tf->iovAmount = 0;
+	tf->spillUsed = 0;
+}
+
+// Queue a frame for the next writev(). "inPlace" frames stay valid until the end of triggerFilterFeed().
+static void triggerForward(TriggerFilter* tf, const char* frame, size_t frameSize, int inPlace) {
+	if (tf->iovAmount == TRIGGERIOVMAX) {
+		triggerFlush(tf);
+	}
+	if (!inPlace) {
+		if (tf->spillUsed + frameSize > tf->spillSize) {
+			triggerFlush(tf); // Nothing points into spill any more, it may move.
+			if (frameSize > tf->spillSize) {
+				char* spill = (char*) realloc(tf->spill, frameSize);
+				if (spill == NULL) {
+					tf->failed = ENOMEM;
+					return;
+				}
+				tf->spill = spill;
+				tf->spillSize = frameSize;
+			}
+		}
+		memcpy(tf->spill + tf->spillUsed, frame, frameSize);
+		frame = tf->spill + tf->spillUsed;
+		tf->spillUsed += frameSize;
+	}
+	tf->iov[tf->iovAmount].iov_base = (void*) frame;
+	tf->iov[tf->iovAmount].iov_len = frameSize;
+	tf->iovAmount++;
+}
+
+typedef struct triggerFeed {
+	TriggerFilter* tf;
+	const char* buf;
+	size_t len;
+} TriggerFeed;
+
+static void triggerFrame(void* ctx, const char* frame, size_t frameSize, const FrameHeader* hdr) {
+	TriggerFeed* feed = (TriggerFeed*) ctx;
+	TriggerFilter* tf = feed->tf;
+	int inPlace = frame >= feed->buf && frame + frameSize <= feed->buf + feed->len;
+
+	tf->events++;
+	tf->inBytes += frameSize;
+	if (hdr->flags & (FRAMEFLAGLZ | FRAMEFLAGSTORED)) {
+		tf->unfiltered++;
+		triggerForward(tf, frame, frameSize, inPlace);
+		return;
+	}
+	size_t payload = hdr->length - ((hdr->flags & FRAMEFLAGCRC) && hdr->length >= CRC32CSIZE ? CRC32CSIZE : 0);
+	size_t n = payload / 2;
+	tf->samples += n;
+	if (triggerImpl(frame + FRAMEHEADERSIZE, n, tf->threshold) >= (size_t) tf->minChannels) {
+		tf->accepted++;
+		triggerForward(tf, frame, frameSize, inPlace);
+	}
+	else if (tf->prescale > 0 && tf->rejected++ % tf->prescale == 0) {
+		tf->prescaled++;
+		triggerForward(tf, frame, frameSize, inPlace);
+	}
+}
+
+int triggerFilterFeed(TriggerFilter* tf, const char* buf, size_t len) {
+	TriggerFeed feed;
+	feed.tf = tf;
+	feed.buf = buf;
+	feed.len = len;
+
+	unsigned long long int t = threadCPUNs();
+	unsigned long long int sendNs = tf->sendNs;
+	frameReaderFeed(tf->fr, buf, len, triggerFrame, &feed);
+	tf->filterNs += threadCPUNs() - t - (tf->sendNs - sendNs);
+	triggerFlush(tf); // The in place frames point into "buf".
+	if (tf->failed != 0) {
+		errno = tf->failed;
+		return -1;
+	}
+	return 0;
+}
+
+void triggerFilterPrint(TriggerFilter* tf, const char* prefix, double timeSpan) {
+	printf("%strigger: threshold %u, min channels %d, prescale %u, kernel %s\n", prefix, tf->threshold, tf->minChannels, tf->prescale, triggerKernelName());
+	printf("%strigger events: in %llu (%.0lf /s), accepted %llu, prescaled %llu, out %llu (%.0lf /s), unfiltered %llu, skipped %llu Bytes\n", prefix, tf->events, tf->events / timeSpan, tf->accepted, tf->prescaled, tf->accepted + tf->prescaled + tf->unfiltered, (tf->accepted + tf->prescaled + tf->unfiltered) / timeSpan, tf->unfiltered, tf->fr->skippedBytes);
+	printf("%strigger reduction: events %.2lf, Bytes %.2lf (in %llu, out %llu Bytes in %llu writev)\n", prefix, tf->accepted + tf->prescaled + tf->unfiltered > 0 ? (double) tf->events / (tf->accepted + tf->prescaled + tf->unfiltered) : 0.0, tf->outBytes > 0 ? (double) tf->inBytes / tf->outBytes : 0.0, tf->inBytes, tf->outBytes, tf->sends);
+	printf("%strigger CPU: filter %lf s, %.1lf ns/event, %.3lf ns/sample, send %lf s\n", prefix, tf->filterNs * 1e-9, tf->events > 0 ? (double) tf->filterNs / tf->events : 0.0, tf->samples > 0 ? (double) tf->filterNs / tf->samples : 0.0, tf->sendNs * 1e-9);
+}
@@ -0,0 +1,60 @@
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include "frame.h"
+
+#define TRIGGERIOVMAX 64 // Accepted frames sent with one writev().
+
+// [ Threshold scan
+// Over-threshold channels of an event: samples (uint16, host order, any alignment) strictly above "threshold". Uses AVX2 or
+// SSE4.1 when the CPU has them, plain C otherwise.
+size_t triggerCount(const void* samples, size_t n, uint16_t threshold);
+const char* triggerKernelName(); // "avx2", "sse4.1" or "scalar".
+// One kernel by name for checking it against "scalar", NULL if the name is unknown or the CPU lacks it.
+typedef size_t (*TriggerKernel)(const void* samples, size_t n, uint16_t threshold);
+TriggerKernel triggerKernel(const char* name);
+// ]
+
+// [ TriggerFilter
+// Software trigger of an L2 client. Parses the framed stream, accepts events with at least "minChannels" over-threshold
+// samples and forwards them unchanged. Rejected events are dropped, except every "prescale"-th one (0 drops all).
+// Frames that carry no samples (LZ compressed) pass untouched. Accepted frames are sent in place with writev(), only
+// frames the FrameReader assembled in its carry buffer are copied.
+typedef struct triggerFilter {
+	FrameReader* fr;
+	int sock;
+	uint16_t threshold;
+	int minChannels;
+	unsigned int prescale;
+
+	struct iovec iov[TRIGGERIOVMAX];
+	int iovAmount;
+	char* spill; // Copies of carry frames until they are sent.
+	size_t spillSize;
+	size_t spillUsed;
+	int failed; // errno of a failed writev(), 0 if none.
+
+	unsigned long long int events;
+	unsigned long long int accepted;
+	unsigned long long int prescaled; // Rejected but forwarded by the prescaler.
+	unsigned long long int rejected;
+	unsigned long long int unfiltered;
+	unsigned long long int samples;
+	unsigned long long int inBytes;
+	unsigned long long int outBytes;
+	unsigned long long int sends;
+	unsigned long long int filterNs; // Thread CPU time parsing and scanning.
+	unsigned long long int sendNs; // Thread CPU time in writev().
+} TriggerFilter;
+
+TriggerFilter* triggerFilterAlloc(int sock, uint16_t threshold, int minChannels, unsigned int prescale);
+void triggerFilterRelease(TriggerFilter* tf);
+// Filter "len" received Bytes and send what passes. Returns -1 if sending failed, with errno set.
+int triggerFilterFeed(TriggerFilter* tf, const char* buf, size_t len);
+void triggerFilterPrint(TriggerFilter* tf, const char* prefix, double timeSpan);
+// ]
+
+#endif // TRIGGER_H
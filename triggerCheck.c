@@ -0,0 +1,80 @@
+#include <stdio.h> // for printf().
+#include <stdlib.h> // for exit().
+#include <string.h> // for memcpy().
+#include "trigger.h"
+
+// [ TriggerCheck
+// Compares the AVX2 and SSE4.1 threshold scans with the scalar one on every start offset of a 32 Byte line, odd ones
+// included, every tail length of one and two vector loops, and thresholds at the ends of the uint16 range, where
+// "threshold + 1" wraps and the signed compare of the packs differs from an unsigned one. "make check" runs it, it exits
+// 1 on a failure and skips a kernel the CPU lacks.
+#define CHECKSAMPLES 4160
+#define CHECKOFFSETS 32
+
+static unsigned char checkBuf[CHECKSAMPLES * 2 + CHECKOFFSETS];
+
+static const uint16_t checkThresholds[] = {0, 1, 600, 0x7ffe, 0x7fff, 0x8000, 0xfffe, 0xffff};
+
+// Samples crowd the thresholds, both ends of the range and the sign bit.
+static void checkFill() {
+	static const uint16_t edges[] = {0, 1, 2, 600, 601, 0x7ffe, 0x7fff, 0x8000, 0x8001, 0xfffe, 0xffff};
+	unsigned long long int x = 88172645463325252ULL;
+	size_t i;
+	for (i = 0; i < sizeof(checkBuf) / 2; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		uint16_t v = (x >> 8) & 1 ? edges[(x >> 16) % (sizeof(edges) / sizeof(edges[0]))] : (uint16_t) (x >> 32);
+		memcpy(checkBuf + 2 * i, &v, 2);
+	}
+}
+
+static int checkKernel(const char* name) {
+	TriggerKernel kernel = triggerKernel(name);
+	TriggerKernel scalar = triggerKernel("scalar");
+	size_t lengths[CHECKSAMPLES];
+	size_t lengthAmount = 0;
+	size_t n;
+	int cases = 0;
+	int failures = 0;
+	int o, t, l;
+
+	if (kernel == NULL) {
+		printf("trigger %s: not supported by this CPU, skipped\n", name);
+		return 0;
+	}
+	// Every tail up to two loops of the widest kernel, then some whole events.
+	for (n = 0; n <= 130; n++) {
+		lengths[lengthAmount++] = n;
+	}
+	lengths[lengthAmount++] = 4088; // One "-gen adc" event of a 8 KiB package.
+	lengths[lengthAmount++] = 4095;
+	lengths[lengthAmount++] = CHECKSAMPLES;
+	for (o = 0; o < CHECKOFFSETS; o++) {
+		for (t = 0; t < (int) (sizeof(checkThresholds) / sizeof(checkThresholds[0])); t++) {
+			for (l = 0; l < (int) lengthAmount; l++) {
+				size_t want = scalar(checkBuf + o, lengths[l], checkThresholds[t]);
+				size_t got = kernel(checkBuf + o, lengths[l], checkThresholds[t]);
+				cases++;
+				if (got != want) {
+					if (failures < 5) {
+						printf("trigger %s: offset %d, %zu samples, threshold %u: %zu, scalar %zu\n", name, o, lengths[l], checkThresholds[t], got, want);
+					}
+					failures++;
+				}
+			}
+		}
+	}
+	printf("trigger %s: %d cases, mismatches %d: %s\n", name, cases, failures, failures == 0 ? "ok" : "FAILED");
+	return failures > 0 ? 1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+	int failed = 0;
+
+	checkFill();
+	failed += checkKernel("sse4.1");
+	failed += checkKernel("avx2");
+	return failed > 0 ? 1 : 0;
+}
+// ]